@@ -0,0 +1,656 @@
+/*  ADCHandler.cpp PWM synchronised DMA driven ADC sampling of current sense and system analogue channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "ADCHandler.h"
+#include "OutputHandler.h"
+#include "WireProtection.h"
+#include "ChannelGroups.h"
+#include "FaultCapture.h"
+
+// #define DEBUG
+
+ADC_HandleTypeDef hadc1;
+DMA_HandleTypeDef hdma_adc1;
+TIM_HandleTypeDef htim2;
+
+// Circular DMA buffer. Scan-major: ADC_SCAN_CHANNELS results per scan, ADC_SCAN_DEPTH scans. Word aligned for ADCAccumulate().
+static volatile uint16_t __attribute__((aligned(4))) adcBuffer[ADC_SCAN_DEPTH * ADC_SCAN_CHANNELS];
+
+// Running sums, filled from the DMA interrupt and emptied by ADCUpdate()
+static volatile uint32_t adcSums[ADC_SCAN_CHANNELS];
+static volatile uint32_t adcScanCount;
+static volatile uint32_t adcTempSum;
+static volatile uint32_t adcVbattSum;
+static volatile uint32_t adcVrefintSum;
+static volatile uint32_t adcInjectedCount;
+static volatile uint32_t adcOnSums[NUM_CHANNELS];
+static volatile uint32_t adcOnCounts[NUM_CHANNELS];
+
+// Output table phases for the next scan to be processed
+static PWMSamplePhase samplePhase[PWM_BANKS];
+
+// Timer clock cycles between scan triggers
+static uint32_t scanCycles;
+
+uint16_t ADCResults[ADC_RESULT_CHANNELS] = {0};
+uint16_t ADCOnResults[NUM_CHANNELS] = {0};
+uint16_t ADCTemperatureRaw = 0;
+uint32_t ADCSamplesAveraged = 0;
+uint32_t ADCOnSamplesAveraged[NUM_CHANNELS] = {0};
+uint16_t ADCSlotDivider = 1;
+volatile uint32_t VBattMillivolts = 0;
+volatile uint32_t VBattCompensation[VBATT_COMP_MODES] = {65536, 65536, 65536};
+volatile uint32_t ADCTripCount = 0;
+volatile uint32_t ADCTripLatency = 0;
+volatile uint32_t ADCTripLatencyMax = 0;
+volatile uint32_t ADCWatchdogRaises = 0;
+
+// Analog watchdog levels and the sample that tripped each channel
+static volatile uint16_t adcTripLevels[NUM_CHANNELS];
+static volatile uint16_t adcTripRaw[NUM_CHANNELS];
+
+// Lowest trip level. The watchdog is put back to it at the start of each block.
+static volatile uint16_t adcWatchdogLevel;
+
+// Filtered battery voltage (millivolts, Q16). Loaded from the first reading after starting.
+static int32_t vbattFiltered;
+static bool vbattFilterLoaded;
+
+// TIM2 counts TIM8 updates (ITR1) and triggers an ADC scan every ADCSlotDivider slots
+static void configureSampleTimer()
+{
+  __HAL_RCC_TIM2_CLK_ENABLE();
+
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 0;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = ADCSlotDivider - 1;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+
+  HAL_TIM_Base_Init(&htim2);
+
+  TIM_SlaveConfigTypeDef sSlaveConfig = {0};
+  sSlaveConfig.SlaveMode = TIM_SLAVEMODE_EXTERNAL1;
+  sSlaveConfig.InputTrigger = TIM_TS_ITR1; // TIM8 TRGO
+  HAL_TIM_SlaveConfigSynchro(&htim2, &sSlaveConfig);
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig);
+
+  // Counts nothing until TIM8 is running
+  HAL_TIM_Base_Start(&htim2);
+}
+
+void InitialiseADC()
+{
+  // All scanned pins in analogue mode
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    pinMode(channelCurrentSensePins[i], INPUT_ANALOG);
+  }
+  pinMode(VBATT_ANALOG_PIN, INPUT_ANALOG);
+
+  __HAL_RCC_ADC1_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  // DMA2 Stream 4, Channel 0 (ADC1). Peripheral -> memory, circular.
+  hdma_adc1.Instance = DMA2_Stream4;
+  hdma_adc1.Init.Channel = DMA_CHANNEL_0;
+  hdma_adc1.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdma_adc1.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_adc1.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_adc1.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma_adc1.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  hdma_adc1.Init.Mode = DMA_CIRCULAR;
+  hdma_adc1.Init.Priority = DMA_PRIORITY_MEDIUM; // Output BSRR streams keep the higher priority
+  hdma_adc1.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+  HAL_DMA_Init(&hdma_adc1);
+  __HAL_LINKDMA(&hadc1, DMA_Handle, hdma_adc1);
+
+  hadc1.Instance = ADC1;
+  hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4; // 84MHz / 4 = 21MHz
+  hadc1.Init.Resolution = ADC_RESOLUTION_12B;
+  hadc1.Init.ScanConvMode = ENABLE;
+  hadc1.Init.ContinuousConvMode = DISABLE;
+  hadc1.Init.DiscontinuousConvMode = DISABLE;
+  hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+  hadc1.Init.ExternalTrigConv = ADC_EXTERNALTRIGCONV_T2_TRGO; // One scan per sample timer update
+  hadc1.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+  hadc1.Init.NbrOfConversion = ADC_SCAN_CHANNELS;
+  hadc1.Init.DMAContinuousRequests = ENABLE;
+  hadc1.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+
+  HAL_ADC_Init(&hadc1);
+
+  // Current sense inputs. 28 + 12 cycles = 1.9µs per conversion
+  ADC_ChannelConfTypeDef sConfig = {0};
+  sConfig.SamplingTime = ADC_SAMPLETIME_28CYCLES;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    sConfig.Channel = currentSenseADCChannels[i];
+    sConfig.Rank = i + 1;
+    HAL_ADC_ConfigChannel(&hadc1, &sConfig);
+  }
+
+  // Temperature, battery voltage and the internal reference are converted by the injected group, automatically after each regular scan.
+  // This keeps them out of the analog watchdog. The temperature sensor and internal reference need at least 10µs sampling time.
+  const uint32_t injectedChannels[3] = {ADC_CHANNEL_TEMPSENSOR, VBATT_ADC_CHANNEL, ADC_CHANNEL_VREFINT};
+  const uint32_t injectedSampleTimes[3] = {ADC_SAMPLETIME_480CYCLES, ADC_SAMPLETIME_28CYCLES, ADC_SAMPLETIME_480CYCLES};
+  ADC_InjectionConfTypeDef sInjected = {0};
+  sInjected.InjectedNbrOfConversion = 3;
+  sInjected.InjectedOffset = 0;
+  sInjected.InjectedDiscontinuousConvMode = DISABLE;
+  sInjected.AutoInjectedConv = ENABLE;
+  sInjected.ExternalTrigInjecConv = ADC_INJECTED_SOFTWARE_START;
+  sInjected.ExternalTrigInjecConvEdge = ADC_EXTERNALTRIGINJECCONVEDGE_NONE;
+  for (int i = 0; i < 3; i++)
+  {
+    sInjected.InjectedChannel = injectedChannels[i];
+    sInjected.InjectedRank = ADC_INJECTED_RANK_1 + i;
+    sInjected.InjectedSamplingTime = injectedSampleTimes[i];
+    HAL_ADCEx_InjectedConfigChannel(&hadc1, &sInjected);
+  }
+
+  // Analog watchdog on every current sense input. Disabled until ADCSetTripLevels().
+  ADC_AnalogWDGConfTypeDef sWatchdog = {0};
+  sWatchdog.WatchdogMode = ADC_ANALOGWATCHDOG_ALL_REG;
+  sWatchdog.HighThreshold = ADCres;
+  sWatchdog.LowThreshold = 0;
+  sWatchdog.ITMode = ENABLE;
+  HAL_ADC_AnalogWDGConfig(&hadc1, &sWatchdog);
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    adcTripLevels[i] = ADCres;
+    adcTripRaw[i] = 0;
+  }
+  adcWatchdogLevel = ADCres;
+
+  HAL_NVIC_SetPriority(DMA2_Stream4_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream4_IRQn);
+
+  // Ahead of the output DMA. A trip has to reach BSRR as soon as possible.
+  HAL_NVIC_SetPriority(ADC_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(ADC_IRQn);
+
+  // Reset the running sums
+  for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+  {
+    adcSums[i] = 0;
+  }
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    adcOnSums[i] = 0;
+    adcOnCounts[i] = 0;
+  }
+  adcScanCount = 0;
+  adcTempSum = 0;
+  adcVbattSum = 0;
+  adcVrefintSum = 0;
+  adcInjectedCount = 0;
+  vbattFilterLoaded = false;
+
+  // Whole TIM8 slots per scan. Bank G's slot time is a whole fraction of the scan period (setPWMBankTiming()), so scans
+  // are ADC_SCAN_PERIOD apart whatever the PWM settings.
+  uint32_t slotCyclesG = PWMBanks[PWM_BANK_G].SlotCycles;
+  ADCSlotDivider = max((uint32_t)ADC_SCAN_PERIOD * (PWM_TIMER_CLOCK / 1000000) / slotCyclesG, (uint32_t)1);
+  scanCycles = ADCSlotDivider * slotCyclesG;
+
+  // The first scan is triggered by the ADCSlotDivider'th TIM8 update after the output timers start
+  for (int b = 0; b < PWM_BANKS; b++)
+  {
+    PWMSamplePhaseInit(&samplePhase[b], PWMBanks[b].SlotCycles, PWMBanks[b].Slots, scanCycles);
+  }
+
+#ifdef DEBUG
+  pinMode(ANALOG_READ_DEBUG_PIN, OUTPUT);
+#endif
+
+  HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adcBuffer, ADC_SCAN_DEPTH * ADC_SCAN_CHANNELS);
+
+  // The ADC interrupt is only for the watchdog
+  __HAL_ADC_DISABLE_IT(&hadc1, ADC_IT_OVR);
+
+  configureSampleTimer();
+}
+
+void SleepADC()
+{
+  HAL_TIM_Base_Stop(&htim2);
+  HAL_TIM_Base_DeInit(&htim2);
+  __HAL_RCC_TIM2_CLK_DISABLE();
+
+  HAL_ADC_Stop_DMA(&hadc1);
+  HAL_NVIC_DisableIRQ(DMA2_Stream4_IRQn);
+  HAL_NVIC_DisableIRQ(ADC_IRQn);
+  HAL_ADC_DeInit(&hadc1);
+  HAL_DMA_DeInit(&hdma_adc1);
+
+  __HAL_RCC_ADC1_CLK_SLEEP_DISABLE();
+  __HAL_RCC_ADC1_CLK_DISABLE();
+
+  // Results are stale after sleep
+  memset(ADCResults, 0, sizeof(ADCResults));
+  memset(ADCOnResults, 0, sizeof(ADCOnResults));
+  memset(ADCOnSamplesAveraged, 0, sizeof(ADCOnSamplesAveraged));
+  ADCTemperatureRaw = 0;
+  ADCSamplesAveraged = 0;
+}
+
+void ADCAccumulate(const volatile uint16_t *block, uint16_t scans, volatile uint32_t *sums, volatile uint32_t *count)
+{
+  // Restart the sums if they haven't been collected for a long time
+  if (*count >= ADC_ACCUMULATE_LIMIT)
+  {
+    for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+    {
+      sums[i] = 0;
+    }
+    *count = 0;
+  }
+
+  // Each scan is a whole number of 32 bit words, so two indexes can be summed at once with __UADD16
+  for (int first = 0; first < scans; first += ADC_PACKED_SCANS)
+  {
+    uint32_t packed[ADC_SCAN_CHANNELS / 2] = {0};
+    int last = min(first + ADC_PACKED_SCANS, (int)scans);
+
+    for (int scan = first; scan < last; scan++)
+    {
+      const volatile uint32_t *words = (const volatile uint32_t *)block;
+      for (int w = 0; w < ADC_SCAN_CHANNELS / 2; w++)
+      {
+        packed[w] = __UADD16(packed[w], words[w]);
+      }
+      block += ADC_SCAN_CHANNELS;
+    }
+
+    for (int w = 0; w < ADC_SCAN_CHANNELS / 2; w++)
+    {
+      sums[2 * w] += packed[w] & 0xFFFF;
+      sums[2 * w + 1] += packed[w] >> 16;
+    }
+  }
+
+  *count += scans;
+}
+
+void ADCUpdate()
+{
+  uint32_t sums[ADC_SCAN_CHANNELS];
+  uint32_t scans;
+  uint32_t tempSum;
+  uint32_t vbattSum;
+  uint32_t vrefintSum;
+  uint32_t injectedCount;
+  uint32_t onSums[NUM_CHANNELS];
+  uint32_t onCounts[NUM_CHANNELS];
+
+  // Collect and restart the running sums. Interrupts off so a DMA block can't be split across two updates.
+  noInterrupts();
+  for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+  {
+    sums[i] = adcSums[i];
+    adcSums[i] = 0;
+  }
+  scans = adcScanCount;
+  adcScanCount = 0;
+  tempSum = adcTempSum;
+  vbattSum = adcVbattSum;
+  vrefintSum = adcVrefintSum;
+  injectedCount = adcInjectedCount;
+  adcTempSum = 0;
+  adcVbattSum = 0;
+  adcVrefintSum = 0;
+  adcInjectedCount = 0;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    onSums[i] = adcOnSums[i];
+    onCounts[i] = adcOnCounts[i];
+    adcOnSums[i] = 0;
+    adcOnCounts[i] = 0;
+  }
+  interrupts();
+
+  // No new block since the last update. Keep the previous results.
+  if (scans > 0)
+  {
+    for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+    {
+      ADCResults[i] = (sums[i] + scans / 2) / scans;
+    }
+    ADCSamplesAveraged = scans;
+
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      ADCOnResults[i] = onCounts[i] > 0 ? (onSums[i] + onCounts[i] / 2) / onCounts[i] : 0;
+      ADCOnSamplesAveraged[i] = onCounts[i];
+    }
+  }
+
+  if (injectedCount > 0)
+  {
+    ADCTemperatureRaw = (tempSum + injectedCount / 2) / injectedCount;
+    ADCResults[ADC_VBATT_INDEX] = (vbattSum + injectedCount / 2) / injectedCount;
+    ADCResults[ADC_VREFINT_INDEX] = (vrefintSum + injectedCount / 2) / injectedCount;
+  }
+}
+
+uint32_t ADCBlockMicros()
+{
+  return scanCycles * (ADC_SCAN_DEPTH / 2) / (PWM_TIMER_CLOCK / 1000000);
+}
+
+int32_t ADCVrefMillivolts(uint16_t vrefRaw)
+{
+  if (vrefRaw == 0)
+  {
+    return ADC_VREF_DEFAULT_MV;
+  }
+  return __LL_ADC_CALC_VREFANALOG_VOLTAGE(vrefRaw, LL_ADC_RESOLUTION_12B);
+}
+
+float ADCToVolts(uint16_t raw, uint16_t vrefRaw)
+{
+  return (raw * (float)ADCVrefMillivolts(vrefRaw)) / (4095.0f * 1000.0f);
+}
+
+uint16_t PWMSampleDelaySlots(uint32_t slotCycles)
+{
+  uint32_t delayCycles = (uint32_t)ADC_SAMPLE_DELAY * (PWM_TIMER_CLOCK / 1000000);
+  return (delayCycles + slotCycles - 1) / slotCycles;
+}
+
+void PWMSamplePhaseInit(PWMSamplePhase *phase, uint32_t slotCycles, uint16_t slots, uint32_t firstScanCycles)
+{
+  phase->SlotCycles = slotCycles;
+  phase->Slots = slots;
+  phase->DelaySlots = PWMSampleDelaySlots(slotCycles);
+
+  // Update n writes table slot n - 1. Before the first update the outputs are still in their reset (off) state,
+  // which is treated as the last slot.
+  uint32_t updates = firstScanCycles / slotCycles;
+  phase->Slot = (updates + slots - 1) % slots;
+  phase->Updates = min(updates, (uint32_t)phase->DelaySlots + 1);
+  phase->Phase = firstScanCycles % slotCycles;
+}
+
+void PWMSamplePhaseAdvance(PWMSamplePhase *phase, uint32_t scanCycles)
+{
+  phase->Phase += scanCycles;
+  uint32_t updates = phase->Phase / phase->SlotCycles;
+  phase->Phase -= updates * phase->SlotCycles;
+  phase->Slot = (phase->Slot + updates) % phase->Slots;
+  phase->Updates = min(phase->Updates + updates, (uint32_t)phase->DelaySlots + 1);
+}
+
+uint32_t PWMSampleValidPins(const uint32_t *table, const PWMSamplePhase *phase)
+{
+  // The outputs were off before they started, whatever the end of the table says
+  if (phase->Updates <= phase->DelaySlots)
+  {
+    return 0;
+  }
+
+  // Set bits are in the lower half of each BSRR word
+  uint32_t pins = table[phase->Slot] & 0xFFFF;
+  uint16_t slot = phase->Slot;
+
+  // On for every slot back to the settling time
+  for (uint16_t i = 0; i < phase->DelaySlots && pins; i++)
+  {
+    slot = (slot == 0) ? phase->Slots - 1 : slot - 1;
+    pins &= table[slot];
+  }
+
+  return pins;
+}
+
+// Filter a battery voltage reading and work out the duty compensation for it
+static void updateVBatt(uint16_t vbattRaw, uint16_t vrefRaw)
+{
+  // The divider scaling assumes the nominal analogue supply. Correct it with the supply measured from VREFINT.
+  int32_t millivolts = ((uint64_t)vbattRaw * VBATT_MILLIVOLTS_Q16 * ADCVrefMillivolts(vrefRaw) / ADC_VREF_DEFAULT_MV + 0x8000) >> 16;
+
+  if (!vbattFilterLoaded)
+  {
+    vbattFiltered = millivolts << 16;
+    vbattFilterLoaded = true;
+  }
+  else
+  {
+    vbattFiltered += ((millivolts << 16) - vbattFiltered) >> VBATT_FILTER_SHIFT;
+  }
+
+  uint32_t filtered = (vbattFiltered + 0x8000) >> 16;
+  VBattMillivolts = filtered;
+
+  // One division per block. Outputs only multiply by these.
+  uint32_t ratio = filtered > 0 ? ((uint32_t)(VBATT_NOMINAL * 1000) << 16) / filtered : UINT32_MAX;
+  uint64_t squared = ((uint64_t)ratio * ratio) >> 16;
+
+  VBattCompensation[VBATT_COMP_POWER] = squared > UINT32_MAX ? UINT32_MAX : (uint32_t)squared;
+  VBattCompensation[VBATT_COMP_VOLTAGE] = ratio;
+  VBattCompensation[VBATT_COMP_NONE] = 65536;
+}
+
+static void adcBlockComplete(const volatile uint16_t *block)
+{
+#ifdef DEBUG
+  digitalWrite(ANALOG_READ_DEBUG_PIN, HIGH);
+#endif
+
+  // Restarted with the full sums if they haven't been collected for a long time
+  if (adcScanCount >= ADC_ACCUMULATE_LIMIT)
+  {
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      adcOnSums[i] = 0;
+      adcOnCounts[i] = 0;
+    }
+  }
+
+  ADCAccumulate(block, ADC_SCAN_DEPTH / 2, adcSums, &adcScanCount);
+  CaptureBlock(block, ADC_SCAN_DEPTH / 2);
+
+  for (int scan = 0; scan < ADC_SCAN_DEPTH / 2; scan++)
+  {
+    // Wire models take every sample, on or off
+    WireModelScan(block);
+
+    // On-state samples. Each scan is matched to the table slots that were driving the outputs when it was triggered.
+    for (int b = 0; b < PWM_BANKS; b++)
+    {
+      const PWMBank &bank = PWMBanks[b];
+      uint32_t pins = PWMSampleValidPins(PWMActiveTable(b), &samplePhase[b]);
+
+      for (int p = 0; p < bank.NumPins; p++)
+      {
+        if (pins & bank.Pins[p])
+        {
+          adcOnSums[bank.FirstChannel + p] += block[bank.FirstChannel + p];
+          adcOnCounts[bank.FirstChannel + p]++;
+        }
+      }
+
+      PWMSamplePhaseAdvance(&samplePhase[b], scanCycles);
+    }
+
+    block += ADC_SCAN_CHANNELS;
+  }
+
+  // Latest auto-injected conversions
+  uint16_t vbattRaw = hadc1.Instance->JDR2;
+  uint16_t vrefRaw = hadc1.Instance->JDR3;
+  adcTempSum += hadc1.Instance->JDR1;
+  adcVbattSum += vbattRaw;
+  adcVrefintSum += vrefRaw;
+  adcInjectedCount++;
+
+  updateVBatt(vbattRaw, vrefRaw);
+
+  // Back down to the lowest trip level if a channel below its own level raised the analog watchdog
+  noInterrupts();
+  hadc1.Instance->HTR = adcWatchdogLevel;
+  interrupts();
+
+#ifdef DEBUG
+  digitalWrite(ANALOG_READ_DEBUG_PIN, LOW);
+#endif
+}
+
+void ADCSetTripLevels(const uint16_t *levels)
+{
+  uint16_t lowest = ADCres;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    adcTripLevels[i] = levels[i];
+    lowest = min(lowest, levels[i]);
+  }
+
+  // Fires when any regular conversion is above the high threshold
+  noInterrupts();
+  adcWatchdogLevel = lowest;
+  hadc1.Instance->HTR = lowest;
+  interrupts();
+}
+
+void ADCArmTripLevel(uint8_t channel, uint16_t level)
+{
+  if (channel >= NUM_CHANNELS || level >= adcTripLevels[channel])
+    return;
+
+  noInterrupts();
+  adcTripLevels[channel] = level;
+  adcWatchdogLevel = min((uint16_t)adcWatchdogLevel, level);
+  if (level < hadc1.Instance->HTR)
+  {
+    hadc1.Instance->HTR = level;
+  }
+  interrupts();
+}
+
+uint16_t ADCCollectTrip(uint8_t channel)
+{
+  noInterrupts();
+  uint16_t raw = adcTripRaw[channel];
+  adcTripRaw[channel] = 0;
+  interrupts();
+  return raw;
+}
+
+// A current sense conversion went above the lowest trip level
+static void adcWatchdogTrip()
+{
+  // The conversion that crossed the threshold has just been written by the DMA. Check the latest sample of each channel.
+  const uint32_t length = ADC_SCAN_DEPTH * ADC_SCAN_CHANNELS;
+  uint32_t next = length - __HAL_DMA_GET_COUNTER(&hdma_adc1);
+  bool tripped = false;
+
+  // Highest sample above the watchdog level that didn't trip its channel
+  uint16_t below = 0;
+
+  for (uint32_t n = 1; n <= ADC_SCAN_CHANNELS; n++)
+  {
+    uint32_t index = (next + length - n) % length;
+    uint8_t channel = index % ADC_SCAN_CHANNELS;
+    uint16_t raw = adcBuffer[index];
+
+    // A fault on any member of a ganged group trips the whole group. The trip is counted against the leader.
+    uint8_t leader = GroupLeader[channel];
+    if (raw > adcTripLevels[channel] && adcTripRaw[leader] == 0)
+    {
+      ForceGroupOff(channel);
+      adcTripRaw[leader] = raw;
+      tripped = true;
+
+      // The scan is in the half of the buffer the DMA is filling, which the capture ring hasn't had yet
+      CaptureTrigger(channel, CAPTURE_WATCHDOG, raw, (index / ADC_SCAN_CHANNELS) % (ADC_SCAN_DEPTH / 2));
+    }
+    else if (raw > hadc1.Instance->HTR)
+    {
+      below = max(below, raw);
+    }
+  }
+
+  if (tripped)
+  {
+    // TIM2 counts TIM8 slots since it triggered the scan
+    const PWMBank &bank = PWMBanks[PWM_BANK_G];
+    uint32_t cycles = __HAL_TIM_GET_COUNTER(&htim2) * bank.SlotCycles + __HAL_TIM_GET_COUNTER(bank.htim) * (bank.Prescaler + 1);
+    ADCTripLatency = cycles * 1000 / (PWM_TIMER_CLOCK / 1000000);
+    ADCTripLatencyMax = max(ADCTripLatencyMax, ADCTripLatency);
+    ADCTripCount++;
+  }
+
+  if (below)
+  {
+    // Above the watchdog level but not the channel's own, or already tripped. Raised to the next trip level above it
+    // until the next block, so the channel doesn't fire again every scan. Every channel at or above the new level is
+    // still tripped straight away. Channels with lower levels wait for the next block.
+    uint16_t level = ADCres;
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      if (adcTripLevels[i] > below)
+      {
+        level = min(level, (uint16_t)adcTripLevels[i]);
+      }
+    }
+    hadc1.Instance->HTR = level;
+    ADCWatchdogRaises++;
+  }
+}
+
+extern "C" void ADC_IRQHandler(void)
+{
+  if (__HAL_ADC_GET_FLAG(&hadc1, ADC_FLAG_AWD) && __HAL_ADC_GET_IT_SOURCE(&hadc1, ADC_IT_AWD))
+  {
+    __HAL_ADC_CLEAR_FLAG(&hadc1, ADC_FLAG_AWD);
+    adcWatchdogTrip();
+  }
+}
+
+extern "C" void DMA2_Stream4_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_adc1);
+}
+
+extern "C" void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+  if (hadc->Instance == ADC1)
+  {
+    // First half of the buffer is complete. DMA is now filling the second half.
+    adcBlockComplete(&adcBuffer[0]);
+  }
+}
+
+extern "C" void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+  if (hadc->Instance == ADC1)
+  {
+    // Second half of the buffer is complete. DMA has wrapped to the first half.
+    adcBlockComplete(&adcBuffer[(ADC_SCAN_DEPTH / 2) * ADC_SCAN_CHANNELS]);
+  }
+}
@@ -0,0 +1,203 @@
+/*  ADCHandler.h PWM synchronised DMA driven ADC sampling of current sense and system analogue channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef ADCHandler_H
+#define ADCHandler_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Number of ADC1 regular conversions per scan. Only the current sense inputs, so the analog watchdog covers the whole regular group.
+#define ADC_SCAN_CHANNELS NUM_CHANNELS
+
+// Number of averaged results. Current sense inputs followed by the injected battery voltage and internal reference.
+#define ADC_RESULT_CHANNELS (NUM_CHANNELS + 2)
+
+#if (ADC_SCAN_CHANNELS % 2) != 0
+#error "ADCAccumulate() sums scan results in pairs. ADC_SCAN_CHANNELS must be even."
+#endif
+
+// Result index of the battery voltage input
+#define ADC_VBATT_INDEX NUM_CHANNELS
+
+// Result index of the internal voltage reference
+#define ADC_VREFINT_INDEX (NUM_CHANNELS + 1)
+
+// Fallback analog supply (millivolts) until the first VREFINT result is available
+#define ADC_VREF_DEFAULT_MV 3294
+
+// Number of complete scans held in the circular DMA buffer. Half and full transfer interrupts each process half of this.
+#define ADC_SCAN_DEPTH 64
+
+// Sense output settling time after the BTS50010 has turned on (microseconds)
+#define ADC_SAMPLE_DELAY (BTS_TURN_ON_TIME + ANALOG_DELAY)
+
+// Accumulated scans at which the running sums are restarted. Prevents overflow if the main loop stalls (65536 * 4095 < 2^32).
+#define ADC_ACCUMULATE_LIMIT 65536
+
+// Battery voltage divider scaling (volts per ADC count)
+#define VBATT_SCALE 0.0039787f
+
+// Battery voltage divider scaling (millivolts per ADC count, Q16)
+#define VBATT_MILLIVOLTS_Q16 ((uint32_t)(VBATT_SCALE * 1000.0f * 65536.0f + 0.5f))
+
+// Battery voltage filter. Each DMA block moves the filtered voltage 1 / 2^VBATT_FILTER_SHIFT of the way to its latest reading.
+// About a 13ms time constant with 32 scan blocks at 10kHz.
+#define VBATT_FILTER_SHIFT 2
+
+// Scans summed in 16 bit halfword pairs before widening to the 32 bit sums (16 x 4095 < 65536)
+#define ADC_PACKED_SCANS 16
+
+/// @brief ADC1 channel numbers for each current sense pin (see channelCurrentSensePins)
+const uint32_t currentSenseADCChannels[NUM_CHANNELS] = {ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_4, ADC_CHANNEL_5, ADC_CHANNEL_6,
+                                                        ADC_CHANNEL_9, ADC_CHANNEL_8, ADC_CHANNEL_7, ADC_CHANNEL_13, ADC_CHANNEL_12, ADC_CHANNEL_11, ADC_CHANNEL_10};
+
+/// @brief ADC1 channel for the battery voltage pin (PC4)
+#define VBATT_ADC_CHANNEL ADC_CHANNEL_14
+
+/// @brief Averaged raw ADC results for each result index, latched by ADCUpdate()
+extern uint16_t ADCResults[ADC_RESULT_CHANNELS];
+
+/// @brief Averaged raw current sense results using only samples taken while each output was on and settled, latched by ADCUpdate().
+/// 0 if the output was never on long enough to be sampled.
+extern uint16_t ADCOnResults[NUM_CHANNELS];
+
+/// @brief Averaged raw internal temperature sensor result, latched by ADCUpdate()
+extern uint16_t ADCTemperatureRaw;
+
+/// @brief Number of scans averaged into the last ADCUpdate() results
+extern uint32_t ADCSamplesAveraged;
+
+/// @brief Number of on samples averaged into each ADCOnResults. Tells a reading of 0 from an output that was never sampled.
+extern uint32_t ADCOnSamplesAveraged[NUM_CHANNELS];
+
+/// @brief Filtered battery voltage, corrected for the analogue supply with VREFINT (millivolts). Updated every DMA block.
+extern volatile uint32_t VBattMillivolts;
+
+/// @brief Duty scaling for each VBattCompensationMode (Q16), updated with VBattMillivolts
+extern volatile uint32_t VBattCompensation[VBATT_COMP_MODES];
+
+/// @brief Number of outputs turned off by the analog watchdog since start up
+extern volatile uint32_t ADCTripCount;
+
+/// @brief Time from the scan trigger to the output being off for the last watchdog trip (nanoseconds).
+/// The sample that crossed the threshold is converted during the scan, so this is an upper bound on the fault to off latency.
+extern volatile uint32_t ADCTripLatency;
+
+/// @brief Longest ADCTripLatency since start up (nanoseconds)
+extern volatile uint32_t ADCTripLatencyMax;
+
+/// @brief Times the analog watchdog has been raised above the lowest trip level since start up.
+/// Each raise lasts to the end of the DMA block. See ADCSetTripLevels().
+extern volatile uint32_t ADCWatchdogRaises;
+
+/// @brief TIM8 slots per ADC scan, so scans are ADC_SCAN_PERIOD apart. A scan (15 x 1.9µs + 2 x 23.4µs = 75µs, regular
+/// and injected) must complete before the next trigger. At 200Hz with 100 slots: 2 x 50µs slots. At 50Hz with 20 slots
+/// requested, bank G runs 200 slots of 100µs instead.
+extern uint16_t ADCSlotDivider;
+
+/// @brief Position of an output table relative to the ADC scans
+struct PWMSamplePhase
+{
+  uint32_t SlotCycles; // Timer clock cycles per table slot
+  uint16_t Slots;      // Table length
+  uint16_t DelaySlots; // Slots an output must have been on before its sense output is valid
+  uint16_t Slot;       // Table slot driving the outputs when the current scan was triggered
+  uint16_t Updates;    // Slots loaded since the outputs started, up to DelaySlots + 1
+  uint32_t Phase;      // Timer clock cycles since the start of that slot
+};
+
+/// @brief Configure ADC1, DMA2 and the TIM2 sample timer and arm conversions. Scans are triggered every ADCSlotDivider TIM8 updates.
+/// Call after InitialiseOutputs() and before StartOutputs() so the first scan lines up with the first table slot.
+void InitialiseADC();
+
+/// @brief Stop conversions and disable the ADC, DMA stream and sample timer
+void SleepADC();
+
+/// @brief Number of slots to skip after an output turns on before its current sense output is valid
+/// @param slotCycles Timer clock cycles per table slot
+/// @return Settling time rounded up to whole slots
+uint16_t PWMSampleDelaySlots(uint32_t slotCycles);
+
+/// @brief Initialise a table phase for the first scan
+/// @param phase Phase to initialise
+/// @param slotCycles Timer clock cycles per table slot
+/// @param slots Table length
+/// @param firstScanCycles Timer clock cycles from the timer start to the first scan trigger
+void PWMSamplePhaseInit(PWMSamplePhase *phase, uint32_t slotCycles, uint16_t slots, uint32_t firstScanCycles);
+
+/// @brief Advance a table phase by one scan
+/// @param phase Phase to advance
+/// @param scanCycles Timer clock cycles between scan triggers
+void PWMSamplePhaseAdvance(PWMSamplePhase *phase, uint32_t scanCycles);
+
+/// @brief Pins that are on in the current slot and have been on for at least DelaySlots slots
+/// @param table BSRR output table
+/// @param phase Current table phase
+/// @return GPIO pin mask of outputs with a valid on-state current sample
+uint32_t PWMSampleValidPins(const uint32_t *table, const PWMSamplePhase *phase);
+
+/// @brief Set the raw current sense level above which each output is turned off by the analog watchdog.
+/// The watchdog is programmed with the lowest level. Its interrupt checks the latest sample of each channel against its own level.
+/// A channel running above the watchdog level but below its own raises the watchdog to the next trip level above its sample
+/// until the end of the DMA block. Channels with levels at or above that still trip within a scan. Channels with lower
+/// levels are only tripped once the watchdog is lowered again, so their worst case latency is one block (ADCBlockMicros())
+/// plus a scan. Counted by ADCWatchdogRaises.
+/// @param levels Raw trip level for each channel. ADCres disables the trip.
+void ADCSetTripLevels(const uint16_t *levels);
+
+/// @brief Lower one channel's trip level between control updates, for an output turned on from an interrupt. Never raises it.
+/// @param channel Channel index
+/// @param level Raw trip level
+void ADCArmTripLevel(uint8_t channel, uint16_t level);
+
+/// @brief Collect an analog watchdog trip for the retry and lockout logic
+/// @param channel Channel index
+/// @return Raw sample that tripped the output, or 0 if it hasn't tripped since the last call
+uint16_t ADCCollectTrip(uint8_t channel);
+
+/// @brief Latch the averages of all samples accumulated since the last call into ADCResults
+void ADCUpdate();
+
+/// @brief Time to fill one half of the DMA buffer. Samples reach the running sums, and so ADCUpdate(), this long after they're taken at most.
+/// @return Block time (microseconds)
+uint32_t ADCBlockMicros();
+
+/// @brief Accumulate a block of complete scans into running sums
+/// @param block Pointer to the first sample of the block
+/// @param scans Number of complete scans in the block
+/// @param sums Running per-index sums
+/// @param count Running scan count
+void ADCAccumulate(const volatile uint16_t *block, uint16_t scans, volatile uint32_t *sums, volatile uint32_t *count);
+
+/// @brief Convert a raw ADC result to volts, corrected against the measured internal reference
+/// @param raw Raw ADC result
+/// @param vrefRaw Raw VREFINT result
+/// @return Voltage at the pin
+float ADCToVolts(uint16_t raw, uint16_t vrefRaw);
+
+/// @brief Analog supply voltage in millivolts calculated from the internal reference
+/// @param vrefRaw Raw VREFINT result
+/// @return VDDA in millivolts
+int32_t ADCVrefMillivolts(uint16_t vrefRaw);
+
+#endif
@@ -0,0 +1,371 @@
+/*  AnalogueControl.cpp Analogue input sampling and ANA / ANA_PWM channel control.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "AnalogueControl.h"
+#include "OutputHandler.h"
+#include "InputCapture.h"
+#include "ADCHandler.h"
+
+ADC_HandleTypeDef hadc3;
+DMA_HandleTypeDef hdma_adc3;
+
+// Circular DMA buffer. Scan-major: NUM_ANA_CHANNELS results per scan, ANA_SCAN_DEPTH scans.
+static volatile uint16_t anaBuffer[ANA_SCAN_DEPTH * NUM_ANA_CHANNELS];
+
+// Filter state and settings of each input. Only used in the DMA interrupt once the conversions start.
+static AnalogueFilterState anaFilters[NUM_ANA_CHANNELS];
+static uint8_t anaFilterMode[NUM_ANA_CHANNELS];
+static uint8_t anaMedianLength[NUM_ANA_CHANNELS];
+static uint32_t anaAlpha[NUM_ANA_CHANNELS];
+
+// Latest filtered sample of each input (decimated counts), and how many have been published
+static volatile uint16_t anaPublished[NUM_ANA_CHANNELS];
+static volatile uint32_t anaSampleCount;
+
+uint16_t AnalogueMillivolts[NUM_ANA_CHANNELS] = {0};
+bool AnalogueActive[NUM_ANA_CHANNELS] = {false};
+uint16_t AnalogueDuty[NUM_ANA_CHANNELS] = {0};
+
+// Decimate and filter one half of the DMA buffer. A fixed amount of work every ANA_SAMPLE_PERIOD.
+static void anaBlockComplete(const volatile uint16_t *block)
+{
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    uint16_t sample = AnalogueDecimate(block, i);
+    anaPublished[i] = AnalogueFilterSample(anaFilters[i], sample, anaFilterMode[i], anaMedianLength[i], anaAlpha[i]);
+  }
+  anaSampleCount++;
+}
+
+static void anaHalfComplete(DMA_HandleTypeDef *hdma)
+{
+  // First half of the buffer is complete. DMA is now filling the second half.
+  anaBlockComplete(&anaBuffer[0]);
+}
+
+static void anaComplete(DMA_HandleTypeDef *hdma)
+{
+  // Second half of the buffer is complete. DMA has wrapped to the first half.
+  anaBlockComplete(&anaBuffer[ANA_OVERSAMPLE * NUM_ANA_CHANNELS]);
+}
+
+void InitialiseAnalogueADC()
+{
+  __HAL_RCC_ADC3_CLK_ENABLE();
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  // DMA2 Stream 0, Channel 2 (ADC3). Peripheral -> memory, circular.
+  hdma_adc3.Instance = DMA2_Stream0;
+  hdma_adc3.Init.Channel = DMA_CHANNEL_2;
+  hdma_adc3.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdma_adc3.Init.PeriphInc = DMA_PINC_DISABLE;
+  hdma_adc3.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_adc3.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  hdma_adc3.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  hdma_adc3.Init.Mode = DMA_CIRCULAR;
+  hdma_adc3.Init.Priority = DMA_PRIORITY_LOW;
+  hdma_adc3.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+  HAL_DMA_Init(&hdma_adc3);
+  __HAL_LINKDMA(&hadc3, DMA_Handle, hdma_adc3);
+
+  // Free running. The inputs are slow, so there's no need to trigger scans from a timer.
+  hadc3.Instance = ADC3;
+  hadc3.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4; // Shared with ADC1. 84MHz / 4 = 21MHz
+  hadc3.Init.Resolution = ADC_RESOLUTION_12B;
+  hadc3.Init.ScanConvMode = ENABLE;
+  hadc3.Init.ContinuousConvMode = ENABLE;
+  hadc3.Init.DiscontinuousConvMode = DISABLE;
+  hadc3.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+  hadc3.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+  hadc3.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+  hadc3.Init.NbrOfConversion = NUM_ANA_CHANNELS;
+  hadc3.Init.DMAContinuousRequests = ENABLE;
+  hadc3.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+
+  HAL_ADC_Init(&hadc3);
+
+  // Longest sampling time for the high impedance input dividers. 480 + 12 cycles = 23.4µs per conversion.
+  ADC_ChannelConfTypeDef sConfig = {0};
+  sConfig.SamplingTime = ADC_SAMPLETIME_480CYCLES;
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    sConfig.Channel = analogueADCChannels[i];
+    sConfig.Rank = i + 1;
+    HAL_ADC_ConfigChannel(&hadc3, &sConfig);
+  }
+
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    AnalogueMillivolts[i] = 0;
+    AnalogueActive[i] = false;
+    AnalogueDuty[i] = 0;
+    memset(&anaFilters[i], 0, sizeof(anaFilters[i]));
+  }
+  anaSampleCount = 0;
+  ConfigureAnalogueFilters();
+
+  HAL_ADC_Start_DMA(&hadc3, (uint32_t *)anaBuffer, ANA_SCAN_DEPTH * NUM_ANA_CHANNELS);
+
+  // The first half completes a whole sample period after starting, so there's time to take over the DMA callbacks.
+  // The ADC's own handlers only track state that continuous conversions don't use.
+  hdma_adc3.XferHalfCpltCallback = anaHalfComplete;
+  hdma_adc3.XferCpltCallback = anaComplete;
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, ANA_IRQ_PRIO, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+  // ADC_IRQHandler only services ADC1, so keep ADC3 off the shared ADC interrupt.
+  __HAL_ADC_DISABLE_IT(&hadc3, ADC_IT_OVR);
+}
+
+void SleepAnalogueADC()
+{
+  HAL_NVIC_DisableIRQ(DMA2_Stream0_IRQn);
+  HAL_ADC_Stop_DMA(&hadc3);
+  HAL_ADC_DeInit(&hadc3);
+  HAL_DMA_DeInit(&hdma_adc3);
+
+  __HAL_RCC_ADC3_CLK_SLEEP_DISABLE();
+  __HAL_RCC_ADC3_CLK_DISABLE();
+
+  // Nothing is switched on by a stale input after wake
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    AnalogueMillivolts[i] = 0;
+    AnalogueActive[i] = false;
+    AnalogueDuty[i] = 0;
+  }
+  anaSampleCount = 0;
+}
+
+void ConfigureAnalogueFilters()
+{
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    const AnalogueInputs &input = AnalogueIns[i];
+    uint8_t mode = input.FilterMode < ANA_FILTER_MODES ? input.FilterMode : (uint8_t)ANA_FILTER_IIR;
+    uint8_t length = constrain(input.MedianLength, 1, ANA_MEDIAN_MAX) | 1;
+    uint32_t alpha = AnalogueFilterAlpha(input.FilterTime);
+
+    noInterrupts();
+    if (mode != anaFilterMode[i] || length != anaMedianLength[i])
+    {
+      // Start again from the next sample rather than mixing the old filter's state into the new one
+      anaFilters[i].Loaded = false;
+      anaFilters[i].Count = 0;
+      anaFilters[i].Next = 0;
+    }
+    anaFilterMode[i] = mode;
+    anaMedianLength[i] = length;
+    anaAlpha[i] = alpha;
+    interrupts();
+  }
+}
+
+uint32_t AnalogueSampleCount()
+{
+  return anaSampleCount;
+}
+
+int32_t AnalogueFilter(int32_t filtered, uint16_t input, uint32_t alpha)
+{
+  int32_t scaled = (int32_t)input << 16;
+
+  return filtered + (int32_t)(((int64_t)(scaled - filtered) * alpha) >> 16);
+}
+
+uint32_t AnalogueFilterAlpha(uint16_t filterTime)
+{
+  if (filterTime == 0)
+  {
+    return 65536;
+  }
+
+  uint32_t timeConstant = (uint32_t)filterTime * 1000;
+  return ((uint64_t)ANA_SAMPLE_PERIOD << 16) / (timeConstant + ANA_SAMPLE_PERIOD);
+}
+
+uint16_t AnalogueDecimate(const volatile uint16_t *scans, uint8_t input)
+{
+  uint32_t sum = 0;
+  for (int s = 0; s < ANA_OVERSAMPLE; s++)
+  {
+    sum += scans[s * NUM_ANA_CHANNELS + input];
+  }
+
+  return sum >> ANA_DECIMATE_SHIFT;
+}
+
+uint16_t AnalogueFilterSample(AnalogueFilterState &state, uint16_t sample, uint8_t mode, uint8_t length, uint32_t alpha)
+{
+  if (mode == ANA_FILTER_MEDIAN)
+  {
+    state.Window[state.Next] = sample;
+    state.Next = (state.Next + 1 < length) ? state.Next + 1 : 0;
+    state.Count = min((uint8_t)(state.Count + 1), length);
+
+    // The median is the sample with as many below it as above. Ties are ranked by position,
+    // so exactly one sample has each rank and there's no sort to take a varying time.
+    uint8_t middle = state.Count / 2;
+    uint16_t median = sample;
+    for (int j = 0; j < state.Count; j++)
+    {
+      uint8_t rank = 0;
+      for (int k = 0; k < state.Count; k++)
+      {
+        rank += (state.Window[k] < state.Window[j]) || (state.Window[k] == state.Window[j] && k < j);
+      }
+      median = (rank == middle) ? state.Window[j] : median;
+    }
+
+    // Keep the low pass state close, so switching to it later doesn't start from stale data
+    state.Filtered = (int32_t)median << 16;
+    state.Loaded = true;
+    return median;
+  }
+
+  state.Filtered = state.Loaded ? AnalogueFilter(state.Filtered, sample, alpha) : (int32_t)sample << 16;
+  state.Loaded = true;
+  return (state.Filtered + 0x8000) >> 16;
+}
+
+bool AnalogueSwitch(bool active, int32_t millivolts, int32_t onMillivolts, int32_t offMillivolts)
+{
+  if (onMillivolts >= offMillivolts)
+  {
+    // Active high
+    if (millivolts >= onMillivolts)
+    {
+      return true;
+    }
+    if (millivolts <= offMillivolts)
+    {
+      return false;
+    }
+  }
+  else
+  {
+    // Active low
+    if (millivolts <= onMillivolts)
+    {
+      return true;
+    }
+    if (millivolts >= offMillivolts)
+    {
+      return false;
+    }
+  }
+
+  return active;
+}
+
+// Thousandths of the input's unit in one step of its duty map
+static int32_t mapUnit(const AnalogueInputs &input)
+{
+  switch (input.CaptureMode)
+  {
+  case ANA_CAPTURE_DUTY:
+    return 100; // 0.1%
+  case ANA_CAPTURE_FREQUENCY:
+    return 1000; // 1Hz
+  default:
+    return 1; // 1mV
+  }
+}
+
+uint16_t AnalogueMapDuty(const AnalogueInputs &input, int32_t millivolts)
+{
+  uint8_t points = min(input.MapPoints, (uint8_t)ANA_MAP_POINTS);
+  int32_t unit = mapUnit(input);
+
+  if (points >= 2)
+  {
+    if (millivolts <= input.MapMillivolts[0] * unit)
+    {
+      return min((uint16_t)input.MapDuty[0], (uint16_t)100) * (PWM_DUTY_MAX / 100);
+    }
+
+    for (int k = 1; k < points; k++)
+    {
+      if (millivolts < input.MapMillivolts[k] * unit)
+      {
+        int32_t x0 = input.MapMillivolts[k - 1] * unit;
+        int32_t x1 = input.MapMillivolts[k] * unit;
+        int32_t y0 = min((int32_t)input.MapDuty[k - 1], (int32_t)100) * (PWM_DUTY_MAX / 100);
+        int32_t y1 = min((int32_t)input.MapDuty[k], (int32_t)100) * (PWM_DUTY_MAX / 100);
+
+        return y0 + (int64_t)(y1 - y0) * (millivolts - x0) / (x1 - x0);
+      }
+    }
+
+    return min((uint16_t)input.MapDuty[points - 1], (uint16_t)100) * (PWM_DUTY_MAX / 100);
+  }
+
+  // Linear scale. A maximum below the minimum gives a falling map.
+  float low = min((float)input.PWMMin, 100.0f) * (PWM_DUTY_MAX / 100);
+  float high = min((float)input.PWMMax, 100.0f) * (PWM_DUTY_MAX / 100);
+  float span = (input.ScaleMax - input.ScaleMin) * 1000.0f;
+  float x = span != 0.0f ? (millivolts - input.ScaleMin * 1000.0f) / span : (millivolts >= input.ScaleMax * 1000.0f);
+
+  x = constrain(x, 0.0f, 1.0f);
+
+  return (uint16_t)(low + (high - low) * x + 0.5f);
+}
+
+void UpdateAnalogueInputs()
+{
+  // Inputs read as off until the first sample is published
+  if (anaSampleCount == 0)
+  {
+    return;
+  }
+
+  // The ADC measures against the analogue supply. Correct for it with the supply measured from VREFINT, as for the battery voltage.
+  uint32_t vref = ADCVrefMillivolts(ADCResults[ADC_VREFINT_INDEX]);
+
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    const AnalogueInputs &input = AnalogueIns[i];
+    uint32_t millivolts = ((uint64_t)anaPublished[i] * ANA_MILLIVOLTS_Q16 * vref / ADC_VREF_DEFAULT_MV + 0x8000) >> 16;
+    AnalogueMillivolts[i] = min(millivolts, (uint32_t)UINT16_MAX);
+
+    // Capture inputs switch and scale on their measured duty or frequency, in thousandths of a percent or hertz
+    int32_t value = AnalogueMillivolts[i];
+    if (input.CaptureMode == ANA_CAPTURE_DUTY)
+    {
+      value = InputDutyCycle[NUM_DI_CHANNELS + i] * 100;
+    }
+    else if (input.CaptureMode == ANA_CAPTURE_FREQUENCY)
+    {
+      value = min(InputMillihertz[NUM_DI_CHANNELS + i], (uint32_t)INT32_MAX);
+    }
+
+    // Rounded, as thresholds like 0.251V are a hair under in float and would truncate a millivolt low
+    AnalogueActive[i] = AnalogueSwitch(AnalogueActive[i], value, lroundf(input.OnThreshold * 1000.0f), lroundf(input.OffThreshold * 1000.0f));
+    AnalogueDuty[i] = AnalogueMapDuty(input, value);
+  }
+}
+
+extern "C" void DMA2_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_adc3);
+}
@@ -0,0 +1,140 @@
+/*  AnalogueControl.h Analogue input sampling and ANA / ANA_PWM channel control.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef AnalogueControl_H
+#define AnalogueControl_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Scans summed into each decimated sample. 16x oversampling gains two bits, for a 14-bit result from the 12-bit ADC.
+#define ANA_OVERSAMPLE 16
+
+// Bits dropped from each sum of ANA_OVERSAMPLE samples
+#define ANA_DECIMATE_SHIFT 2
+
+// Complete scans of the analogue inputs held in the circular DMA buffer. Each half is one decimated sample of every input.
+#define ANA_SCAN_DEPTH (2 * ANA_OVERSAMPLE)
+
+// Time to convert one scan of the analogue inputs (microseconds). 8 x (480 + 12) cycles at 21MHz.
+#define ANA_SCAN_TIME 188
+
+// Time between decimated samples (microseconds). About 330Hz.
+#define ANA_SAMPLE_PERIOD (ANA_OVERSAMPLE * ANA_SCAN_TIME)
+
+// Decimated sample at ADC full scale
+#define ANA_DECIMATED_MAX ((ADCres * ANA_OVERSAMPLE) >> ANA_DECIMATE_SHIFT)
+
+// Longest median filter (samples)
+#define ANA_MEDIAN_MAX 7
+
+// Input voltage at ADC full scale (millivolts), with the nominal analogue supply. The 5V inputs are divided down to the 3.3V ADC range.
+#define ANA_FULL_SCALE_MV 5000
+
+// Input millivolts per decimated count (Q16)
+#define ANA_MILLIVOLTS_Q16 ((uint32_t)(ANA_FULL_SCALE_MV * 65536.0f / ANA_DECIMATED_MAX + 0.5f))
+
+// Analogue input DMA interrupt priority. Below the output, current sense and input edge interrupts.
+#define ANA_IRQ_PRIO 7
+
+/// @brief Filter state of one analogue input
+struct AnalogueFilterState
+{
+  int32_t Filtered;                // Low pass filter state (decimated counts, Q16)
+  uint16_t Window[ANA_MEDIAN_MAX]; // Latest samples for the median, oldest overwritten first
+  uint8_t Next;                    // Next slot in the window
+  uint8_t Count;                   // Samples in the window
+  bool Loaded;                     // Filter holds a value. The first sample is taken as it is
+};
+
+/// @brief ADC3 channel numbers for each analogue input pin (see ANAchannelInputPins)
+const uint32_t analogueADCChannels[NUM_ANA_CHANNELS] = {ADC_CHANNEL_9, ADC_CHANNEL_14, ADC_CHANNEL_15, ADC_CHANNEL_4,
+                                                        ADC_CHANNEL_5, ADC_CHANNEL_6, ADC_CHANNEL_7, ADC_CHANNEL_8};
+
+/// @brief Filtered voltage of each analogue input (millivolts), updated by UpdateAnalogueInputs()
+extern uint16_t AnalogueMillivolts[NUM_ANA_CHANNELS];
+
+/// @brief Hysteresis state of each analogue input, from its on and off thresholds
+extern bool AnalogueActive[NUM_ANA_CHANNELS];
+
+/// @brief Duty each analogue input maps to for ANA_PWM channels (0 - PWM_DUTY_MAX)
+extern uint16_t AnalogueDuty[NUM_ANA_CHANNELS];
+
+/// @brief Configure ADC3 to scan the analogue inputs continuously into a circular buffer with DMA2 Stream 0.
+/// Each half of the buffer is decimated and filtered in the DMA interrupt as it completes.
+void InitialiseAnalogueADC();
+
+/// @brief Stop the analogue input conversions and disable ADC3 and its DMA stream
+void SleepAnalogueADC();
+
+/// @brief Update each input's voltage, switch state and duty from the latest filtered samples. Doesn't wait on the ADC.
+void UpdateAnalogueInputs();
+
+/// @brief Load each input's filter settings. Call whenever the analogue input config changes
+void ConfigureAnalogueFilters();
+
+/// @brief Number of decimated samples published since the conversions started
+uint32_t AnalogueSampleCount();
+
+/// @brief One step of a first order low pass filter
+/// @param filtered Filter state (Q16)
+/// @param input New input
+/// @param alpha Update period / (time constant + update period) (Q16). 65536 passes the input straight through.
+/// @return New filter state (Q16)
+int32_t AnalogueFilter(int32_t filtered, uint16_t input, uint32_t alpha);
+
+/// @brief Low pass filter coefficient for a time constant at the decimated sample rate
+/// @param filterTime Time constant (milliseconds). 0 for no filtering
+/// @return Filter coefficient for AnalogueFilter() (Q16)
+uint32_t AnalogueFilterAlpha(uint16_t filterTime);
+
+/// @brief Sum ANA_OVERSAMPLE scans of an input and drop ANA_DECIMATE_SHIFT bits
+/// @param scans First of ANA_OVERSAMPLE complete scans, NUM_ANA_CHANNELS results each
+/// @param input Analogue input index
+/// @return Decimated sample (0 - ANA_DECIMATED_MAX)
+uint16_t AnalogueDecimate(const volatile uint16_t *scans, uint8_t input);
+
+/// @brief Filter one decimated sample. The cost doesn't depend on the samples, and is at most ANA_MEDIAN_MAX squared comparisons.
+/// @param state Input's filter state
+/// @param sample Decimated sample
+/// @param mode AnalogueFilterMode
+/// @param length Median length. Odd, 1 to ANA_MEDIAN_MAX
+/// @param alpha Low pass filter coefficient (Q16)
+/// @return Filtered sample (decimated counts)
+uint16_t AnalogueFilterSample(AnalogueFilterState &state, uint16_t sample, uint8_t mode, uint8_t length, uint32_t alpha);
+
+/// @brief Switch with hysteresis. An on threshold above the off threshold is active high, below it is active low.
+/// @param active Current state
+/// @param millivolts Input voltage (millivolts)
+/// @param onMillivolts Voltage at which the switch turns on
+/// @param offMillivolts Voltage at which the switch turns off
+/// @return New state. Unchanged between the thresholds.
+bool AnalogueSwitch(bool active, int32_t millivolts, int32_t onMillivolts, int32_t offMillivolts);
+
+/// @brief Map an input voltage to a duty. Uses the input's map table if it has two or more points,
+/// otherwise scales ScaleMin - ScaleMax linearly to PWMMin - PWMMax. Inputs beyond either end are clamped.
+/// @param input Analogue input config
+/// @param millivolts Input voltage (millivolts), or measured duty (0.001%) or frequency (mHz) for capture inputs
+/// @return Duty (0 - PWM_DUTY_MAX)
+uint16_t AnalogueMapDuty(const AnalogueInputs &input, int32_t millivolts);
+
+#endif
@@ -21,6 +21,8 @@
 */
 
 #include "CANComms.h"
+#include <InputHandler.h>
+#include <ControlLoop.h>
 
 // Use CAN1 with ALT_2 pin configuration (PD0/PD1)
 STM32_CAN Can(CAN1, ALT_2);
@@ -60,8 +62,14 @@ void ReadCANMessages()
     CAN_message_t msg;
     while (Can.read(msg))
     {
+        // Config changes are applied between control updates
+        HoldControlLoop();
+
         if (msg.id == SystemParams.ChannelDataCANID)
         {
+            ControlSnapshot snapshot;
+            ReadControlSnapshot(snapshot);
+
             // Channel status request. Reply on data CAN ID + 1 over 3 frames.
             for (int i = 0; i < NUM_CHANNELS; i++)
             {
@@ -74,7 +82,7 @@ void ReadCANMessages()
                     frame0.flags.remote = 0;
                     frame0.buf[0] = 0; // Frame index
                     frame0.buf[1] = (uint8_t)(Channels[i].ChanType);
-                    frame0.buf[2] = (ChannelRuntime[i].CurrentValue * 10);
+                    frame0.buf[2] = (snapshot.Channels[i].CurrentValue * 10);
                     frame0.buf[3] = Channels[i].Enabled;
                     uint16_t packedName = ((Channels[i].ChannelName[0] - 'A') << 10) | ((Channels[i].ChannelName[1] - 'A') << 5) | (Channels[i].ChannelName[2] - 'A');
                     frame0.buf[4] = (packedName >> 8) & 0xFF; // upper 8 bits
@@ -108,6 +116,7 @@ void ReadCANMessages()
                     frame2.buf[2] = Channels[i].RunOnTime >> 16 & 0xFF;
                     frame2.buf[3] = Channels[i].RunOnTime >> 8 & 0xFF;
                     frame2.buf[4] = Channels[i].RunOnTime & 0xFF; // LSB
+                    frame2.buf[5] = snapshot.Channels[i].ErrorFlags; // Includes off-state diagnostics
                     Can.write(frame2);
                 }
             }
@@ -398,15 +407,21 @@ void ReadCANMessages()
         if (pendingEEPROMSave)
         {
             pendingEEPROMSave = false;
+            CompileInputRouting();
             saveEEPROMOnTimeout = true;
             invalidateDisplay = true;
             EEPROMSaveTimout = millis() + EEPROM_WRITE_DELAY;
         }
+
+        ReleaseControlLoop();
     }
 }
 
 void BroadcastSystemStatus()
 {
+    ControlSnapshot snapshot;
+    ReadControlSnapshot(snapshot);
+
     // System status 1
     CAN_message_t systemStatusMsg1;
     systemStatusMsg1.id = SystemParams.SystemDataCANID;
@@ -415,13 +430,13 @@ void BroadcastSystemStatus()
     systemStatusMsg1.flags.remote = 0;
     systemStatusMsg1.buf[0] = aliveCounter++;
     systemStatusMsg1.buf[1] = SystemParams.SystemCurrentLimit;
-    systemStatusMsg1.buf[2] = (uint8_t)SystemRuntimeParams.SystemTemperature;
-    systemStatusMsg1.buf[3] = (uint8_t)(SystemRuntimeParams.VBatt * 10);
-    uint16_t scaledCurrent = (uint16_t)(SystemRuntimeParams.SystemCurrent * 10);
+    systemStatusMsg1.buf[2] = (uint8_t)snapshot.System.SystemTemperature;
+    systemStatusMsg1.buf[3] = (uint8_t)(snapshot.System.VBatt * 10);
+    uint16_t scaledCurrent = (uint16_t)(snapshot.System.SystemCurrent * 10);
     systemStatusMsg1.buf[4] = (scaledCurrent >> 8) & 0xFF;                             // MSB
     systemStatusMsg1.buf[5] = scaledCurrent & 0xFF;                                    // LSB
-    systemStatusMsg1.buf[6] = (uint8_t)((SystemRuntimeParams.ErrorFlags >> 8) & 0xFF); // MSB
-    systemStatusMsg1.buf[7] = (uint8_t)(SystemRuntimeParams.ErrorFlags & 0xFF);        // LSB
+    systemStatusMsg1.buf[6] = (uint8_t)((snapshot.System.ErrorFlags >> 8) & 0xFF); // MSB
+    systemStatusMsg1.buf[7] = (uint8_t)(snapshot.System.ErrorFlags & 0xFF);        // LSB
     Can.write(systemStatusMsg1);
 
     // System status 2
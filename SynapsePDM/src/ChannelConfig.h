@@ -36,6 +36,33 @@ enum ChannelType
   CAN_PWM      // CAN bus controlled PWM output
 };
 
+/// @brief Soft start / soft stop ramp profiles
+enum RampProfile
+{
+  RAMP_NONE,       // Switch straight to the new duty
+  RAMP_LINEAR,     // Constant rate
+  RAMP_SCURVE,     // Slow at both ends (smoothstep)
+  RAMP_EXPONENTIAL // Fast at the start, settling towards the new duty
+};
+
+/// @brief Battery voltage compensation of PWM duty. Only applies to PWM channel types.
+enum VBattCompensationMode
+{
+  VBATT_COMP_POWER,   // Constant average power into a resistive load. Duty scaled by (VBATT_NOMINAL / VBatt)^2
+  VBATT_COMP_VOLTAGE, // Constant average voltage. Duty scaled by VBATT_NOMINAL / VBatt
+  VBATT_COMP_NONE,    // Duty used as set
+  VBATT_COMP_MODES
+};
+
+/// @brief Diagnostics run while a channel is off
+enum OffDiagnosticMode
+{
+  OFF_DIAG_NONE,    // No off-state diagnostics
+  OFF_DIAG_PASSIVE, // Watch the sense output for the fault current (short to battery). Output stays off
+  OFF_DIAG_PROBE,   // Passive, plus brief low duty pulses to check the load is connected (open load)
+  OFF_DIAG_MODES
+};
+
 /// @brief Channel config structure
 struct __attribute__((packed)) ChannelConfig
 {
@@ -55,7 +82,18 @@ struct __attribute__((packed)) ChannelConfig
   uint8_t ActiveHigh;         // True if input is active high
   uint8_t RunOn;              // Run-on after ignition off flag
   uint32_t RunOnTime;         // Run on time (in milliseconds)    
-  uint8_t Reserved[32];       // Reserved for future use
+  uint8_t RampProfile;        // Soft start / soft stop profile (RampProfile)
+  uint16_t RampUpTime;        // Soft start time from 0 to 100% (in milliseconds)
+  uint16_t RampDownTime;      // Soft stop time from 100% to 0 (in milliseconds)
+  uint32_t CurrentGain;       // Current sense gain (mA per ADC count, Q16). 0 uses the nominal BTS50010 gain
+  int16_t CurrentOffset;      // Current sense offset (ADC counts)
+  uint16_t WireCrossSection;  // Output wire cross section (0.01 mm²). 0 with no rated current disables the wire model
+  uint16_t WireRatedCurrent;  // Output wire continuous current (0.1 A). 0 uses the rating for the cross section
+  uint16_t WireTimeConstant;  // Output wire thermal time constant (in milliseconds). 0 uses the value for the cross section
+  uint16_t RetryCooldown;     // Cooldown before the first retry (in milliseconds). Doubles with each retry. 0 uses the default
+  uint8_t Compensation;       // Battery voltage compensation of PWM duty (VBattCompensationMode)
+  uint8_t OffDiagnostics;     // Diagnostics while the channel is off (OffDiagnosticMode)
+  uint8_t Reserved[11];       // Reserved for future use
 };
 
 /// @brief Channel config runtime structure
@@ -63,8 +101,10 @@ struct __attribute__((packed)) ChannelConfigRuntime
 {
   volatile int AnalogRaw;     // Raw analog value. Used for calibration
   float CurrentValue;         // Active current value
+  uint32_t CurrentMilliamps;  // Active current value (mA)
   uint8_t ErrorFlags;         // Bitmask for channel error flags
   uint8_t Override;           // Override flag
+  uint16_t InputDuty;         // Duty from the analogue input for ANA_PWM channels (0 - PWM_DUTY_MAX)
 };
 
 #endif
\ No newline at end of file
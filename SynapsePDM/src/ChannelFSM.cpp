@@ -0,0 +1,170 @@
+/*  ChannelFSM.cpp Per-channel output state machine. Inrush, current monitoring, fault cooldown, retry and lockout.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "ChannelFSM.h"
+
+ChannelFSM ChannelStates;
+
+// Time since a micros() timestamp, correct across the 32 bit wrap
+static inline bool elapsed(uint32_t now, uint32_t since, uint32_t duration)
+{
+  return (uint32_t)(now - since) >= duration;
+}
+
+static void enterState(uint8_t channel, uint8_t state, uint32_t now)
+{
+  ChannelStates.State[channel] = state;
+  ChannelStates.Entered[channel] = now;
+  ChannelStates.WindowStart[channel] = now;
+  ChannelStates.Samples[channel] = 0;
+  ChannelStates.CurrentSum[channel] = 0;
+}
+
+// Output has faulted. Cool down and retry, or lock out once the retries are used up.
+static void fault(uint8_t channel, uint8_t flags, const ChannelFSMInputs &in, uint32_t now, uint8_t &errorFlags)
+{
+  uint8_t retries = ++ChannelStates.Retries[channel];
+  errorFlags = flags;
+
+  if (retries > in.RetryCount)
+  {
+    errorFlags |= RETRY_LOCKOUT;
+    enterState(channel, CHANNEL_LOCKED, now);
+    return;
+  }
+
+  // Exponential backoff
+  uint32_t cooldownMax = (uint32_t)RETRY_COOLDOWN_MAX * 1000;
+  uint32_t cooldown = in.CooldownTime;
+  for (int i = 1; i < retries && cooldown < cooldownMax; i++)
+  {
+    cooldown <<= 1;
+  }
+  ChannelStates.Cooldown[channel] = min(cooldown, cooldownMax);
+
+  enterState(channel, CHANNEL_FAULT_COOLDOWN, now);
+}
+
+void ResetChannelFSM()
+{
+  uint32_t now = micros();
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    enterState(i, CHANNEL_OFF, now);
+    ChannelStates.Retries[i] = 0;
+    ChannelStates.Cooldown[i] = 0;
+  }
+}
+
+uint8_t ChannelFSMStep(uint8_t channel, const ChannelFSMInputs &in, uint32_t now, uint8_t &errorFlags)
+{
+  uint8_t state = ChannelStates.State[channel];
+
+  // Disabling a channel always turns it off and clears its faults, including a lockout
+  if (!in.Enabled)
+  {
+    if (state != CHANNEL_OFF)
+    {
+      enterState(channel, CHANNEL_OFF, now);
+      ChannelStates.Retries[channel] = 0;
+      errorFlags = 0;
+    }
+    return CHANNEL_OFF;
+  }
+
+  switch (state)
+  {
+  case CHANNEL_OFF:
+    enterState(channel, CHANNEL_INRUSH, now);
+    break;
+
+  case CHANNEL_INRUSH:
+  case CHANNEL_RETRY:
+    if (in.Trip)
+    {
+      fault(channel, in.Trip, in, now, errorFlags);
+    }
+    else if (!in.Settling && elapsed(now, ChannelStates.Entered[channel], in.InrushTime))
+    {
+      enterState(channel, CHANNEL_MONITOR, now);
+    }
+    break;
+
+  case CHANNEL_MONITOR:
+    if (in.Trip)
+    {
+      fault(channel, in.Trip, in, now, errorFlags);
+    }
+    else if (in.Settling)
+    {
+      // Restart the average once the ramp has finished
+      ChannelStates.WindowStart[channel] = now;
+      ChannelStates.Samples[channel] = 0;
+      ChannelStates.CurrentSum[channel] = 0;
+    }
+    else
+    {
+      ChannelStates.CurrentSum[channel] += in.Milliamps;
+      ChannelStates.Samples[channel]++;
+
+      if (elapsed(now, ChannelStates.WindowStart[channel], CHANNEL_MONITOR_WINDOW))
+      {
+        uint32_t average = ChannelStates.CurrentSum[channel] / ChannelStates.Samples[channel];
+        ChannelStates.WindowStart[channel] = now;
+        ChannelStates.Samples[channel] = 0;
+        ChannelStates.CurrentSum[channel] = 0;
+
+        if (in.HighMilliamps > 0 && average > in.HighMilliamps)
+        {
+          fault(channel, CHN_OVERCURRENT, in, now, errorFlags);
+        }
+        else if (average < in.LowMilliamps)
+        {
+          fault(channel, CHN_UNDERCURRENT, in, now, errorFlags);
+        }
+        else
+        {
+          errorFlags = 0;
+        }
+      }
+    }
+    break;
+
+  case CHANNEL_FAULT_COOLDOWN:
+    if (!in.TripHeld && elapsed(now, ChannelStates.Entered[channel], ChannelStates.Cooldown[channel]))
+    {
+      enterState(channel, CHANNEL_RETRY, now);
+    }
+    break;
+
+  case CHANNEL_LOCKED:
+  default:
+    break;
+  }
+
+  return ChannelStates.State[channel];
+}
+
+bool ChannelMonitoring(uint8_t channel)
+{
+  return channelStateInfo[ChannelStates.State[channel]].Monitoring;
+}
@@ -0,0 +1,112 @@
+/*  ChannelFSM.h Per-channel output state machine. Inrush, current monitoring, fault cooldown, retry and lockout.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef ChannelFSM_H
+#define ChannelFSM_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Time the monitored current is averaged over before it's compared with the thresholds (microseconds)
+#define CHANNEL_MONITOR_WINDOW 150000
+
+// Cooldown before the first retry when a channel doesn't configure one (milliseconds)
+#define RETRY_COOLDOWN_DEFAULT 100
+
+// Longest cooldown, however many faults in a row (milliseconds)
+#define RETRY_COOLDOWN_MAX 30000
+
+/// @brief Output channel states
+enum ChannelState
+{
+  CHANNEL_OFF,            // Disabled. Output off
+  CHANNEL_INRUSH,         // Turned on. Current thresholds held off for the inrush delay and any soft start
+  CHANNEL_MONITOR,        // Running. Averaged current compared with the thresholds
+  CHANNEL_FAULT_COOLDOWN, // Faulted. Output off until the cooldown has passed
+  CHANNEL_RETRY,          // Turned back on after a cooldown. Current thresholds held off as for inrush
+  CHANNEL_LOCKED          // Out of retries. Output off until the channel is disabled
+};
+
+/// @brief What each state does with the output
+struct ChannelStateInfo
+{
+  uint8_t OutputOn;   // Output is driven
+  uint8_t Monitoring; // Current thresholds apply
+};
+
+/// @brief Indexed by ChannelState
+const ChannelStateInfo channelStateInfo[] = {
+    {false, false}, // CHANNEL_OFF
+    {true, false},  // CHANNEL_INRUSH
+    {true, true},   // CHANNEL_MONITOR
+    {false, false}, // CHANNEL_FAULT_COOLDOWN
+    {true, false},  // CHANNEL_RETRY
+    {false, false}  // CHANNEL_LOCKED
+};
+
+/// @brief Inputs to one step of a channel's state machine
+struct ChannelFSMInputs
+{
+  bool Enabled;           // Channel is requested on
+  bool Settling;          // Output is ramping. Its current isn't comparable with the thresholds
+  uint8_t Trip;           // Error flags of a fault seen outside the averaged thresholds (watchdog, IS fault, wire model). 0 if none
+  bool TripHeld;          // The fault is still present. The cooldown can't end
+  uint32_t Milliamps;     // Load current
+  uint32_t HighMilliamps; // Overcurrent threshold. 0 disables the check
+  uint32_t LowMilliamps;  // Undercurrent threshold
+  uint32_t InrushTime;    // Inrush allowance (microseconds)
+  uint32_t CooldownTime;  // Cooldown before the first retry (microseconds). Doubles with each further fault
+  uint8_t RetryCount;     // Retries before lockout
+};
+
+/// @brief State machine data for every channel. Struct of arrays so each pass walks contiguous memory.
+struct ChannelFSM
+{
+  uint8_t State[NUM_CHANNELS];         // ChannelState
+  uint8_t Retries[NUM_CHANNELS];       // Faults since the channel was enabled
+  uint16_t Samples[NUM_CHANNELS];      // Current samples in the monitor window
+  uint32_t Entered[NUM_CHANNELS];      // micros() when the state was entered
+  uint32_t Cooldown[NUM_CHANNELS];     // Cooldown for the latest fault (microseconds)
+  uint32_t WindowStart[NUM_CHANNELS];  // micros() at the start of the monitor window
+  uint32_t CurrentSum[NUM_CHANNELS];   // Current samples in the monitor window (mA)
+};
+
+/// @brief State machine data
+extern ChannelFSM ChannelStates;
+
+/// @brief Put every channel in CHANNEL_OFF with no retries used
+void ResetChannelFSM();
+
+/// @brief Step a channel's state machine. Times are wraparound safe, so steps can be as far apart as 71 minutes.
+/// @param channel Channel index
+/// @param in Inputs for this step
+/// @param now micros()
+/// @param errorFlags Channel error flags. Set on a fault and cleared by a healthy monitor window or disabling the channel.
+/// @return New state
+uint8_t ChannelFSMStep(uint8_t channel, const ChannelFSMInputs &in, uint32_t now, uint8_t &errorFlags);
+
+/// @brief Check if a channel's current thresholds apply
+/// @param channel Channel index
+/// @return True in CHANNEL_MONITOR
+bool ChannelMonitoring(uint8_t channel);
+
+#endif
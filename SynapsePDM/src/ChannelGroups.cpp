@@ -0,0 +1,149 @@
+/*  ChannelGroups.cpp Ganged outputs. Channels in a group switch together and are protected as one load.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "ChannelGroups.h"
+#include "OutputHandler.h"
+#include <ADCHandler.h>
+
+ChannelGroup Groups[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+volatile uint16_t GroupMembers[NUM_CHANNELS] = {0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040,
+                                                0x0080, 0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000};
+volatile uint16_t GroupRejects = 0;
+int8_t GroupImbalance[NUM_CHANNELS] = {0};
+
+// Check a channel can be driven by a group leader
+static bool groupCompatible(uint8_t leader, uint8_t channel)
+{
+  // The banks run their own tables at their own frequencies, so members on different banks wouldn't switch together
+  bool sameBank = (leader < NUM_PINS_G) == (channel < NUM_PINS_G);
+
+  return sameBank && Channels[channel].ChanType == Channels[leader].ChanType && Channels[channel].Enabled == Channels[leader].Enabled;
+}
+
+void ConfigureGroups()
+{
+  uint8_t leaders[NUM_CHANNELS];
+  uint16_t members[NUM_CHANNELS] = {0};
+  uint16_t rejects = 0;
+
+  // The lowest numbered channel in a group leads it
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    leaders[i] = i;
+    if (Channels[i].MultiChannel)
+    {
+      for (int j = 0; j < i; j++)
+      {
+        if (Channels[j].MultiChannel && Channels[j].GroupNumber == Channels[i].GroupNumber)
+        {
+          leaders[i] = j;
+          break;
+        }
+      }
+    }
+
+    // A member that doesn't match its leader runs on its own rather than being driven with the wrong bank or config
+    if (!groupCompatible(leaders[i], i))
+    {
+      leaders[i] = i;
+      rejects |= 1 << i;
+    }
+    members[leaders[i]] |= 1 << i;
+  }
+
+  // Swapped in together so the interrupts see a consistent group
+  noInterrupts();
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    GroupLeader[i] = leaders[i];
+    GroupMembers[i] = members[i];
+  }
+  GroupRejects = rejects;
+  interrupts();
+}
+
+void UpdateGroups()
+{
+  ChannelGroup groups[NUM_CHANNELS] = {};
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    ChannelGroup &group = groups[GroupLeader[i]];
+    uint16_t onRaw = ADCOnResults[i];
+    group.Count++;
+    group.Milliamps += senseToMilliamps(i, ADCResults[i]);
+    group.OnMilliamps += senseToMilliamps(i, onRaw);
+    group.MaxOnRaw = max(group.MaxOnRaw, onRaw);
+  }
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    Groups[i] = groups[i];
+  }
+
+  // Members of a balanced group each carry the mean current
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    const ChannelGroup &group = groups[GroupLeader[i]];
+    GroupImbalance[i] = 0;
+
+    if (group.Count > 1 && group.OnMilliamps > 0)
+    {
+      int32_t mean = group.OnMilliamps / group.Count;
+      int32_t imbalance = ((int32_t)senseToMilliamps(i, ADCOnResults[i]) - mean) * 100 / mean;
+      GroupImbalance[i] = constrain(imbalance, INT8_MIN, INT8_MAX);
+    }
+  }
+}
+
+bool GroupFollower(uint8_t channel)
+{
+  return GroupLeader[channel] != channel;
+}
+
+void updateGroupDutyCycle(uint8_t channel, uint16_t dutyCycle)
+{
+  uint16_t members = GroupMembers[GroupLeader[channel]];
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (members & (1 << i))
+    {
+      updatePWMDutyCycle(i, dutyCycle);
+    }
+  }
+}
+
+void ForceGroupOff(uint8_t channel)
+{
+  uint16_t members = GroupMembers[GroupLeader[channel]];
+
+  // The channel itself first. It may not be in the mask if the groups are being rebuilt.
+  forceOutputOff(channel);
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if ((members & (1 << i)) && i != channel)
+    {
+      forceOutputOff(i);
+    }
+  }
+}
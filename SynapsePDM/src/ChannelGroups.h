@@ -0,0 +1,77 @@
+/*  ChannelGroups.h Ganged outputs. Channels in a group switch together and are protected as one load.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef ChannelGroups_H
+#define ChannelGroups_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+/// @brief State of a group of ganged outputs, indexed by the group leader.
+/// A channel that isn't ganged is a group of one that leads itself.
+struct ChannelGroup
+{
+  uint8_t Count;        // Number of members
+  uint32_t Milliamps;   // Total current from the mean of all samples (mA)
+  uint32_t OnMilliamps; // Total on-state current (mA)
+  uint16_t MaxOnRaw;    // Highest on-state current sense reading of any member
+};
+
+/// @brief Group state for each leader, updated by UpdateGroups()
+extern ChannelGroup Groups[NUM_CHANNELS];
+
+/// @brief Channel mask of each group, indexed by the group leader. 0 if the channel isn't a leader.
+extern volatile uint16_t GroupMembers[NUM_CHANNELS];
+
+/// @brief Leader of each channel's group. The lowest numbered channel with MultiChannel set and the same GroupNumber.
+/// The leader's config drives the whole group.
+extern volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+/// @brief Channels ConfigureGroups() left out of the group they were configured for. Each runs on its own.
+extern volatile uint16_t GroupRejects;
+
+/// @brief On-state current of each member relative to the group mean (percent). 0 for channels that aren't ganged.
+extern int8_t GroupImbalance[NUM_CHANNELS];
+
+/// @brief Rebuild group membership from the channel config. Called by ConfigureOutputs() when the config changes.
+/// A member must be on the same PWM bank as its leader, so their tables switch together, and have the same channel type
+/// and enable. Any that isn't is left out of the group and flagged in GroupRejects.
+void ConfigureGroups();
+
+/// @brief Total the latest current sense results of each group. Call once per output update, after ADCUpdate().
+void UpdateGroups();
+
+/// @brief Check if a channel is driven by another channel's group
+/// @param channel Channel index
+/// @return True for ganged channels other than the leader
+bool GroupFollower(uint8_t channel);
+
+/// @brief Update the duty cycle of every output in a channel's group
+/// @param channel Channel index
+/// @param dutyCycle Duty cycle in tenths of a percent (0 - PWM_DUTY_MAX)
+void updateGroupDutyCycle(uint8_t channel, uint16_t dutyCycle);
+
+/// @brief Turn every output in a channel's group off immediately. Safe to call from interrupts.
+/// @param channel Channel index
+void ForceGroupOff(uint8_t channel);
+
+#endif
@@ -0,0 +1,217 @@
+/*  ControlLoop.cpp Fixed rate control loop on a timer interrupt.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "ControlLoop.h"
+#include <ADCHandler.h>
+#include <InputHandler.h>
+#include <OutputHandler.h>
+#include <RunOn.h>
+
+ControlLoopStatistics ControlLoopStats;
+
+HardwareTimer controlTimer(TIM7);
+static bool controlRunning = false;
+static uint32_t controlRate;
+static volatile uint8_t controlHolds;
+
+// Snapshots are written in turn. The latest is snapshots[snapshotTick & 1].
+static ControlSnapshot snapshots[2];
+static volatile uint32_t snapshotTick;
+
+// Timing, in cycles
+static uint32_t lastStart;
+static uint64_t totalNanos;
+
+static inline uint32_t cyclesToNanos(uint32_t cycles)
+{
+  return (uint64_t)cycles * 1000000000ULL / SystemCoreClock;
+}
+
+// Write the snapshot the main loop isn't reading, then make it the latest
+static void publish()
+{
+  uint32_t tick = snapshotTick + 1;
+  ControlSnapshot &snapshot = snapshots[tick & 1];
+
+  snapshot.Tick = tick;
+  memcpy(snapshot.Channels, ChannelRuntime, sizeof(snapshot.Channels));
+  snapshot.System = SystemRuntimeParams;
+
+  __DMB();
+  snapshotTick = tick;
+}
+
+static void setControlRate(uint32_t rate)
+{
+  if (rate != controlRate)
+  {
+    controlRate = rate;
+    controlTimer.setOverflow(rate, HERTZ_FORMAT);
+  }
+}
+
+static void controlTick()
+{
+  uint32_t start = DWT->CYCCNT;
+
+  switch (PowerState)
+  {
+  case RUN:
+    ADCUpdate();
+
+    // With the ignition off the inputs are held until the main loop has chosen between run-on and sleep, so the
+    // run-on sees the channels as they were. Inputs switched off with the ignition would otherwise beat it there.
+    if (digitalRead(IGN_INPUT) || !bootToSleep)
+    {
+      HandleInputs();
+    }
+    break;
+
+  case RUN_ON:
+    ADCUpdate();
+
+    // Run-on channels are held on in place of reading the inputs. Checked by handlePowerState() between updates.
+    UpdateRunOn();
+    break;
+
+  default:
+    // Outputs and ADCs are off or on their way up or down
+    return;
+  }
+
+  uint32_t inputs = DWT->CYCCNT;
+  UpdateOutputs();
+  UpdateSystem();
+  publish();
+  uint32_t end = DWT->CYCCNT;
+
+  uint32_t periodCycles = SystemCoreClock / controlRate;
+  if (ControlLoopStats.Ticks && start - lastStart > periodCycles + periodCycles / 2)
+  {
+    ControlLoopStats.Late++;
+  }
+  lastStart = start;
+
+  uint32_t nanos = cyclesToNanos(end - start);
+  ControlLoopStats.Ticks++;
+  ControlLoopStats.LastNanos = nanos;
+  totalNanos += nanos;
+  ControlLoopStats.MeanNanos = totalNanos / ControlLoopStats.Ticks;
+  ControlLoopStats.MaxNanos = max(ControlLoopStats.MaxNanos, nanos);
+  ControlLoopStats.MaxInputNanos = max(ControlLoopStats.MaxInputNanos, cyclesToNanos(inputs - start));
+  ControlLoopStats.MaxOutputNanos = max(ControlLoopStats.MaxOutputNanos, cyclesToNanos(end - inputs));
+
+  if (end - start > periodCycles)
+  {
+    ControlLoopStats.Overruns++;
+
+    // Seen by the main loop, PC and CAN from the next snapshot
+    SystemRuntimeParams.ErrorFlags |= CONTROL_OVERRUN;
+  }
+  if (nanos > CONTROL_BUDGET * 1000UL)
+  {
+    ControlLoopStats.OverBudget++;
+  }
+
+  // Taken up from the next update
+  setControlRate(PowerState == RUN_ON && RunOnSteady() ? CONTROL_RATE_RUN_ON : CONTROL_RATE);
+}
+
+void StartControlLoop()
+{
+  if (controlRunning)
+  {
+    return;
+  }
+
+  // Cycle counter for the timing
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  // Groups and wire models for the config and PWM timing the update will run with
+  ConfigureOutputs();
+
+  // Something to read before the first update
+  publish();
+
+  // Counted afresh after a sleep, so a late first update isn't blamed on the loop
+  lastStart = DWT->CYCCNT;
+
+  controlRate = CONTROL_RATE;
+  controlTimer.setOverflow(CONTROL_RATE, HERTZ_FORMAT);
+  controlTimer.attachInterrupt(controlTick);
+  controlTimer.setInterruptPriority(CONTROL_IRQ_PRIO, 0);
+  controlTimer.resume();
+  controlRunning = true;
+
+  if (controlHolds)
+  {
+    NVIC_DisableIRQ(TIM7_IRQn);
+  }
+}
+
+void StopControlLoop()
+{
+  controlTimer.pause();
+  controlRunning = false;
+}
+
+void HoldControlLoop()
+{
+  NVIC_DisableIRQ(TIM7_IRQn);
+  controlHolds++;
+
+  // No update starts once this returns
+  __DSB();
+  __ISB();
+}
+
+void ReleaseControlLoop()
+{
+  if (!controlHolds || --controlHolds)
+  {
+    return;
+  }
+
+  // Config is changed with the loop held. What's derived from it is rebuilt here, out of the update, before the next one.
+  ConfigureOutputs();
+
+  if (controlRunning)
+  {
+    // An update that fell due while held runs now
+    NVIC_EnableIRQ(TIM7_IRQn);
+  }
+}
+
+void ReadControlSnapshot(ControlSnapshot &snapshot)
+{
+  uint32_t tick;
+  do
+  {
+    tick = snapshotTick;
+    __DMB();
+    memcpy(&snapshot, &snapshots[tick & 1], sizeof(snapshot));
+    __DMB();
+
+    // Two updates since reading the tick means the second wrote over this copy
+  } while (snapshotTick - tick > 1);
+}
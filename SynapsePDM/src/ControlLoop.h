@@ -0,0 +1,100 @@
+/*  ControlLoop.h Fixed rate control loop on a timer interrupt.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef ControlLoop_H
+#define ControlLoop_H
+
+#include <Arduino.h>
+#include <Globals.h>
+#include <ChannelConfig.h>
+#include <System.h>
+
+// Control updates per second
+#define CONTROL_RATE 1000
+
+// Time between control updates (microseconds)
+#define CONTROL_PERIOD (1000000 / CONTROL_RATE)
+
+// Control updates per second while the run-on channels are only being held on (RunOnSteady()), so the MCU can sleep between
+// them. The ADC watchdog and wire model still see every sample. Only the averaged current thresholds and the run-on
+// deadlines are checked less often.
+#define CONTROL_RATE_RUN_ON 20
+
+// Longest a control update should take (microseconds). A quarter of the period, leaving the rest to the main loop.
+// The update has no waits and every loop in it is bounded by the channel and input counts, so its run time only varies
+// with the config: logic programs, ramps and ganged groups. Work that only changes with the config is done on
+// ReleaseControlLoop(), and PWM staggering runs from the main loop.
+// The worst case execution time has not been measured on the target, so this is a budget, not a bound. MaxNanos records
+// the longest update seen, and an update over the period sets CONTROL_OVERRUN in the system error flags.
+#define CONTROL_BUDGET 250
+
+// Control loop timer interrupt priority. Below the output, current sense, analogue and input edge interrupts, so they
+// still interrupt the control update as they interrupted it in the main loop. Above USB, CAN and the main loop.
+#define CONTROL_IRQ_PRIO 8
+
+/// @brief Control update timing since start up
+struct __attribute__((packed)) ControlLoopStatistics
+{
+  uint32_t Ticks;          // Control updates run
+  uint32_t Late;           // Updates started over half a period late, held off by a config change or a long interrupt
+  uint32_t Overruns;       // Updates that took longer than the period. The first sets CONTROL_OVERRUN
+  uint32_t OverBudget;     // Updates that took longer than CONTROL_BUDGET
+  uint32_t LastNanos;      // Latest update
+  uint32_t MeanNanos;      // Mean update
+  uint32_t MaxNanos;       // Longest update. The worst case execution time seen, interrupts included
+  uint32_t MaxInputNanos;  // Longest input stage: ADC results, inputs and logic, or the run-on hold
+  uint32_t MaxOutputNanos; // Longest output stage: state machines, PWM tables, system checks and the snapshot
+};
+
+/// @brief Channel and system runtime data as one control update left them
+struct ControlSnapshot
+{
+  uint32_t Tick;                               // Control update that published it
+  ChannelConfigRuntime Channels[NUM_CHANNELS]; // ChannelRuntime
+  SystemRuntime System;                        // SystemRuntimeParams
+};
+
+/// @brief Control loop timing
+extern ControlLoopStatistics ControlLoopStats;
+
+/// @brief Start the control updates. Each one runs the inputs, logic, channel state machines and output tables on the
+/// latest DMA samples in RUN, or holds the run-on channels in RUN_ON, then publishes a snapshot. Other power states are skipped.
+void StartControlLoop();
+
+/// @brief Stop the control updates. Call before the outputs and ADCs are put to sleep.
+void StopControlLoop();
+
+/// @brief Keep the control updates off while the main loop changes the config or the runtime data they use. An update
+/// that falls due waits until the matching ReleaseControlLoop(), so keep it short. Calls nest.
+void HoldControlLoop();
+
+/// @brief Let the control updates run again after HoldControlLoop(). The last release rebuilds the groups and wire models
+/// from the config with ConfigureOutputs().
+void ReleaseControlLoop();
+
+/// @brief Copy the latest snapshot. ChannelRuntime and SystemRuntimeParams belong to the control loop, so the main loop
+/// reads them through this. Lock free: the two snapshots are written in turn, and a copy is taken again if the control
+/// loop got round to overwriting it.
+/// @param snapshot Copy of the latest snapshot
+void ReadControlSnapshot(ControlSnapshot &snapshot);
+
+#endif
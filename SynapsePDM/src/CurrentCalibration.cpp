@@ -0,0 +1,136 @@
+/*  CurrentCalibration.cpp Per-channel multi-point current sense calibration.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "CurrentCalibration.h"
+#include "OutputHandler.h"
+
+CalibrationConfigUnion CalibrationConfigData;
+CalibrationCurve CalibrationCurves[NUM_CHANNELS][CAL_MODES];
+
+void InitialiseCalibrationData()
+{
+  memset(CalibrationConfigData.dataBytes, 0, sizeof(CalibrationConfigData.dataBytes));
+}
+
+void ApplyCalibration(uint8_t channel)
+{
+  for (int mode = 0; mode < CAL_MODES; mode++)
+  {
+    const CalibrationTable &table = CalibrationConfigData.data[channel][mode];
+    CalibrationCurve curve = {};
+    uint8_t count = min(table.Count, (uint8_t)CAL_POINTS);
+
+    // Insert each point in reading order
+    for (int p = 0; p < count; p++)
+    {
+      CalibrationPoint point = table.Points[p];
+      int k = curve.Count;
+      while (k > 0 && curve.Raw[k - 1] > point.Raw)
+      {
+        k--;
+      }
+
+      if (k > 0 && curve.Raw[k - 1] == point.Raw)
+      {
+        continue;
+      }
+
+      for (int m = curve.Count; m > k; m--)
+      {
+        curve.Raw[m] = curve.Raw[m - 1];
+        curve.Milliamps[m] = curve.Milliamps[m - 1];
+      }
+      curve.Raw[k] = point.Raw;
+      curve.Milliamps[k] = point.Milliamps;
+      curve.Count++;
+    }
+
+    for (int k = 0; k + 1 < curve.Count; k++)
+    {
+      int32_t rise = (int32_t)curve.Milliamps[k + 1] - (int32_t)curve.Milliamps[k];
+      curve.Slope[k] = ((int64_t)rise << 16) / (curve.Raw[k + 1] - curve.Raw[k]);
+    }
+
+    if (curve.Count == 1)
+    {
+      // One point is a line through the origin
+      curve.Slope[0] = curve.Raw[0] ? ((int64_t)curve.Milliamps[0] << 16) / curve.Raw[0] : 0;
+    }
+    else if (curve.Count > 1)
+    {
+      curve.Slope[curve.Count - 1] = curve.Slope[curve.Count - 2];
+    }
+
+    // The wire model converts readings in the ADC interrupt
+    noInterrupts();
+    CalibrationCurves[channel][mode] = curve;
+    interrupts();
+  }
+}
+
+void ApplyAllCalibration()
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    ApplyCalibration(i);
+  }
+}
+
+uint32_t CalibratedMilliamps(const CalibrationCurve &curve, uint16_t raw)
+{
+  // Readings below the first point or above the last extend the nearest segment
+  uint8_t k = 0;
+  while (k + 1 < curve.Count && raw >= curve.Raw[k + 1])
+  {
+    k++;
+  }
+
+  int64_t milliamps = curve.Milliamps[k] + (((int64_t)((int32_t)raw - curve.Raw[k]) * curve.Slope[k] + 0x8000) >> 16);
+
+  return milliamps > 0 ? milliamps : 0;
+}
+
+uint16_t CalibratedSense(const CalibrationCurve &curve, uint32_t milliamps)
+{
+  uint8_t k = 0;
+  while (k + 1 < curve.Count && milliamps >= curve.Milliamps[k + 1])
+  {
+    k++;
+  }
+
+  if (curve.Slope[k] <= 0)
+  {
+    return curve.Raw[k];
+  }
+
+  int64_t raw = curve.Raw[k] + (((((int64_t)milliamps - curve.Milliamps[k]) << 16) + curve.Slope[k] / 2) / curve.Slope[k]);
+
+  return constrain(raw, 0, ADCres);
+}
+
+const CalibrationCurve *ChannelCalibration(uint8_t channel)
+{
+  uint8_t type = Channels[channel].ChanType;
+  const CalibrationCurve &curve = CalibrationCurves[channel][(type == DIG_PWM || type == CAN_PWM || type == ANA_PWM) ? CAL_PWM : CAL_DIGITAL];
+
+  return curve.Count > 0 ? &curve : nullptr;
+}
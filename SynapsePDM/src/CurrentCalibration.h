@@ -0,0 +1,103 @@
+/*  CurrentCalibration.h Per-channel multi-point current sense calibration.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef CurrentCalibration_H
+#define CurrentCalibration_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Most calibration points per channel and mode
+#define CAL_POINTS 8
+
+/// @brief Calibration tables held for each channel
+enum CalibrationMode
+{
+  CAL_DIGITAL, // Mean current of a digital output
+  CAL_PWM,     // On-state current of a PWM output
+  CAL_MODES
+};
+
+/// @brief One measured load
+struct __attribute__((packed)) CalibrationPoint
+{
+  uint16_t Raw;       // Current sense reading (ADC counts)
+  uint16_t Milliamps; // Load current measured at that reading (mA)
+};
+
+/// @brief Measured points of one channel and mode, in any order. A table with no points uses CurrentGain and CurrentOffset.
+struct __attribute__((packed)) CalibrationTable
+{
+  uint8_t Count;                       // Number of points in use
+  CalibrationPoint Points[CAL_POINTS]; // Measured points
+};
+
+/// @brief Calibration config union for reading and writing from and to EEPROM storage
+union CalibrationConfigUnion
+{
+  CalibrationTable data[NUM_CHANNELS][CAL_MODES];
+  byte dataBytes[sizeof(CalibrationTable) * NUM_CHANNELS * CAL_MODES];
+};
+
+/// @brief Stored calibration tables, indexed by channel and CalibrationMode
+extern CalibrationConfigUnion CalibrationConfigData;
+
+/// @brief Piecewise-linear curve built from a calibration table. Converting a reading takes no division.
+struct CalibrationCurve
+{
+  uint8_t Count;                  // Number of points. 0 if the channel isn't calibrated in this mode.
+  uint16_t Raw[CAL_POINTS];       // Readings in ascending order
+  uint32_t Milliamps[CAL_POINTS]; // Current at each reading (mA)
+  int32_t Slope[CAL_POINTS];      // mA per count from each point to the next (Q16). The last continues the segment before it.
+};
+
+/// @brief Curves in use, indexed by channel and CalibrationMode
+extern CalibrationCurve CalibrationCurves[NUM_CHANNELS][CAL_MODES];
+
+/// @brief Clear every calibration table
+void InitialiseCalibrationData();
+
+/// @brief Rebuild a channel's curves from its calibration tables. Points with a repeated reading are dropped.
+/// @param channel Channel index
+void ApplyCalibration(uint8_t channel);
+
+/// @brief Rebuild every channel's curves
+void ApplyAllCalibration();
+
+/// @brief Current of a reading on a calibrated curve. Safe to call from interrupts.
+/// @param curve Curve with at least one point
+/// @param raw Current sense reading (ADC counts)
+/// @return Load current (mA)
+uint32_t CalibratedMilliamps(const CalibrationCurve &curve, uint16_t raw);
+
+/// @brief Reading at which a calibrated curve reaches a current
+/// @param curve Curve with at least one point
+/// @param milliamps Load current (mA)
+/// @return Current sense reading (ADC counts)
+uint16_t CalibratedSense(const CalibrationCurve &curve, uint32_t milliamps);
+
+/// @brief Curve for a channel's output type. PWM outputs (DIG_PWM, CAN_PWM and ANA_PWM) use their CAL_PWM table, everything else CAL_DIGITAL.
+/// @param channel Channel index
+/// @return The curve, or nullptr if the channel isn't calibrated for its output type
+const CalibrationCurve *ChannelCalibration(uint8_t channel);
+
+#endif
@@ -22,6 +22,7 @@
 */
 
 #include <Display.h>
+#include <ControlLoop.h>
 
 #define SCREENWIDTH 320
 #define SCREENHEIGHT 240
@@ -35,7 +36,7 @@ SPIClass &spix = SPI;
 
 TFT_eSPI tft = TFT_eSPI(); // Invoke custom library
 
-long splashCounter;
+uint32_t splashCounter;
 
 static bool prevEnabled[NUM_CHANNELS] = {false};
 static int prevErrorFlags[NUM_CHANNELS] = {0};
@@ -239,6 +240,9 @@ void DrawBackground()
 
 void UpdateDisplay()
 {
+  ControlSnapshot snapshot;
+  ReadControlSnapshot(snapshot);
+
   spix.begin();
   tft.startWrite();
 
@@ -279,7 +283,7 @@ void UpdateDisplay()
     prevSDOK = !SDCardOK;
     prevGPSOK = !GPSFix;
     prevMotionStatus = !SystemParams.AllowMotionDetect;
-    systemErrorFlags = !SystemRuntimeParams.ErrorFlags;
+    systemErrorFlags = !snapshot.System.ErrorFlags;
     previousConnectionStatus = !pcCommsOK;
     invalidateDisplay = false;
   }
@@ -322,13 +326,13 @@ void UpdateDisplay()
   }
   for (int i = 0; i < NUM_CHANNELS; i++)
   {
-    if (Channels[i].Enabled != prevEnabled[i] || ChannelRuntime[i].ErrorFlags != prevErrorFlags[i])
+    if (Channels[i].Enabled != prevEnabled[i] || snapshot.Channels[i].ErrorFlags != prevErrorFlags[i])
     {
-      if (Channels[i].Enabled && ChannelRuntime[i].ErrorFlags == 0)
+      if (Channels[i].Enabled && snapshot.Channels[i].ErrorFlags == 0)
       {
         tft.pushImage(lights[i][0] - 10, lights[i][1] - 8, 24, 24, (uint16_t *)greenLED);
       }
-      else if (Channels[i].Enabled && ChannelRuntime[i].ErrorFlags != 0)
+      else if (snapshot.Channels[i].ErrorFlags != 0)
       {
         tft.pushImage(lights[i][0] - 10, lights[i][1] - 8, 24, 24, (uint16_t *)redLED);
       }
@@ -339,11 +343,11 @@ void UpdateDisplay()
 
       // Update previous states
       prevEnabled[i] = Channels[i].Enabled;
-      prevErrorFlags[i] = ChannelRuntime[i].ErrorFlags;
+      prevErrorFlags[i] = snapshot.Channels[i].ErrorFlags;
     }
 
     // Update current values
-    float currentValueRounded = round(ChannelRuntime[i].CurrentValue * 10) / 10.0;
+    float currentValueRounded = round(snapshot.Channels[i].CurrentValue * 10) / 10.0;
     float prevValueRounded = round(prevCurrentValues[i] * 10) / 10.0;
 
     if (currentValueRounded != prevValueRounded)
@@ -361,7 +365,7 @@ void UpdateDisplay()
       tft.setCursor(xCoordinate, currentReadingCoordinates[i][1]);
       tft.print(currentValueRounded, 1);
       tft.print("A");
-      prevCurrentValues[i] = ChannelRuntime[i].CurrentValue;
+      prevCurrentValues[i] = snapshot.Channels[i].CurrentValue;
     }
     tft.setTextColor(TFT_WHITE, TFT_BLACK);
   }
@@ -417,23 +421,23 @@ void UpdateDisplay()
   }
 
   // Check for system error flags change
-  if (SystemRuntimeParams.ErrorFlags != systemErrorFlags)
+  if (snapshot.System.ErrorFlags != systemErrorFlags)
   {
     int16_t textWidth = tft.textWidth("EFFFF");
     int16_t textHeight = tft.fontHeight();
-    if (SystemRuntimeParams.ErrorFlags != 0)
+    if (snapshot.System.ErrorFlags != 0)
     {
       tft.setTextColor(TFT_ORANGE, TFT_BLACK);
       tft.fillRect(269, 40, textWidth + 5, textHeight, TFT_BLACK);
       tft.setCursor(269, 40);
-      tft.printf("E%04X", SystemRuntimeParams.ErrorFlags);
+      tft.printf("E%04X", snapshot.System.ErrorFlags);
       tft.setTextColor(TFT_WHITE, TFT_BLACK);
     }
     else
     {
       tft.fillRect(269, 40, textWidth + 5, textHeight, TFT_BLACK);
     }
-    systemErrorFlags = SystemRuntimeParams.ErrorFlags;
+    systemErrorFlags = snapshot.System.ErrorFlags;
   }
 
   // Check for PC connection status change
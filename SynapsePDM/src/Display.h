@@ -34,7 +34,7 @@
 #define USE_DMA_TO_TFT
 
 /// @brief Counter for splash screen delay
-extern long splashCounter;
+extern uint32_t splashCounter;
 
 /// @brief Initialise LCD
 void InitialiseDisplay();
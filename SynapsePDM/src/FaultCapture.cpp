@@ -0,0 +1,252 @@
+/*  FaultCapture.cpp Current sense waveform capture around output faults, saved to the SD card.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "FaultCapture.h"
+#include "OutputHandler.h"
+#include <STM32SD.h>
+#include <CRC32.h>
+
+enum CaptureState
+{
+  CAPTURE_ARMED,     // Recording
+  CAPTURE_TRIGGERED, // Recording the scans after the trigger
+  CAPTURE_FROZEN,    // Held until it's written
+  CAPTURE_WRITING    // Being written to the SD card
+};
+
+// Every current sense reading, in scan order as the DMA writes them
+static uint16_t captureRing[CAPTURE_SCANS][ADC_SCAN_CHANNELS];
+
+static volatile uint8_t captureState = CAPTURE_ARMED;
+
+// Next ring row to write
+static volatile uint16_t captureHead;
+
+// Rows written since the capture was armed, up to CAPTURE_SCANS
+static volatile uint16_t captureFilled;
+
+// Rows still to record after the trigger
+static volatile int32_t capturePost;
+
+// Trigger position and details
+static volatile uint16_t captureTriggerRow;
+static volatile uint16_t capturePre;
+static volatile uint8_t captureChannel;
+static volatile uint8_t captureTrigger;
+static volatile uint16_t captureTripRaw;
+static volatile uint32_t captureVBatt;
+
+// File being written
+static File captureFile;
+static CRC32 captureCRC;
+static uint16_t captureWritten;
+
+uint32_t CaptureCount = 0;
+volatile uint32_t CaptureMissed = 0;
+
+void CaptureBlock(const volatile uint16_t *block, uint16_t scans)
+{
+  uint8_t state = captureState;
+  if (state != CAPTURE_ARMED && state != CAPTURE_TRIGGERED)
+  {
+    return;
+  }
+
+  for (int s = 0; s < scans; s++)
+  {
+    uint16_t *row = captureRing[captureHead];
+    for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+    {
+      row[i] = block[i];
+    }
+    block += ADC_SCAN_CHANNELS;
+    captureHead = (captureHead + 1) % CAPTURE_SCANS;
+  }
+
+  if (captureFilled < CAPTURE_SCANS)
+  {
+    captureFilled = min(captureFilled + scans, CAPTURE_SCANS);
+  }
+
+  if (state == CAPTURE_TRIGGERED)
+  {
+    capturePost -= scans;
+    if (capturePost <= 0)
+    {
+      captureState = CAPTURE_FROZEN;
+    }
+  }
+}
+
+void CaptureTrigger(uint8_t channel, uint8_t trigger, uint16_t tripRaw, uint16_t scanOffset)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (captureState == CAPTURE_ARMED)
+  {
+    // The block being converted goes into the ring at the head
+    captureTriggerRow = (captureHead + scanOffset) % CAPTURE_SCANS;
+    capturePre = min((uint16_t)(captureFilled + scanOffset), (uint16_t)CAPTURE_PRE_SCANS);
+    capturePost = CAPTURE_POST_SCANS + scanOffset;
+    captureChannel = channel;
+    captureTrigger = trigger;
+    captureTripRaw = tripRaw;
+    captureVBatt = VBattMillivolts;
+    captureState = CAPTURE_TRIGGERED;
+  }
+  else if (captureChannel != channel)
+  {
+    // The same fault seen again by the control loop isn't a miss
+    CaptureMissed++;
+  }
+
+  __set_PRIMASK(primask);
+}
+
+static void rearm()
+{
+  noInterrupts();
+  captureFilled = 0;
+  captureState = CAPTURE_ARMED;
+  interrupts();
+}
+
+// Create the file and write the header
+static bool openCapture()
+{
+  char name[40];
+  snprintf(name, sizeof(name), "FAULT_%04d-%02d-%02d_%02d-%02d-%02d_CH%02d.bin", (2000 + rtc.getYear()), rtc.getMonth(), rtc.getDay(),
+           rtc.getHours(), rtc.getMinutes(), rtc.getSeconds(), captureChannel + 1);
+
+  captureFile = SD.open(name, FILE_WRITE);
+  if (!captureFile)
+  {
+    return false;
+  }
+
+  const ChannelConfig &channel = Channels[captureChannel];
+  const CalibrationCurve *curve = ChannelCalibration(captureChannel);
+  const PWMBank &bank = PWMBanks[PWM_BANK_G];
+
+  CaptureHeader header = {};
+  memcpy(header.Magic, "SPFC", sizeof(header.Magic));
+  header.Version = CAPTURE_VERSION;
+  header.Channel = captureChannel;
+  header.Trigger = captureTrigger;
+  header.ChanType = channel.ChanType;
+  header.Epoch = rtc.getEpoch();
+  header.SamplePeriod = (uint64_t)ADCSlotDivider * bank.SlotCycles * 1000 / (PWM_TIMER_CLOCK / 1000000);
+  header.Samples = capturePre + CAPTURE_POST_SCANS;
+  header.PreSamples = capturePre;
+  header.TripRaw = captureTripRaw;
+  header.FaultRaw = FAULT_THRESHOLD_RAW;
+  header.VBattMillivolts = captureVBatt;
+  header.CurrentGain = channel.CurrentGain ? channel.CurrentGain : CURRENT_GAIN_NOMINAL;
+  header.CurrentOffset = channel.CurrentOffset;
+  if (curve)
+  {
+    header.CurveCount = curve->Count;
+    for (int k = 0; k < CAL_POINTS; k++)
+    {
+      header.CurveRaw[k] = curve->Raw[k];
+      header.CurveMilliamps[k] = curve->Milliamps[k];
+      header.CurveSlope[k] = curve->Slope[k];
+    }
+  }
+
+  captureCRC = CRC32();
+  captureCRC.update((const uint8_t *)&header, sizeof(header));
+  captureWritten = 0;
+
+  return captureFile.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+}
+
+// Write the next piece of the capture. Returns true once it's all written.
+static bool writeCapture()
+{
+  uint16_t samples[CAPTURE_WRITE_SAMPLES];
+  uint16_t total = capturePre + CAPTURE_POST_SCANS;
+  uint16_t first = (captureTriggerRow + CAPTURE_SCANS - capturePre) % CAPTURE_SCANS;
+  uint16_t count = min((uint16_t)(total - captureWritten), (uint16_t)CAPTURE_WRITE_SAMPLES);
+
+  for (int n = 0; n < count; n++)
+  {
+    samples[n] = captureRing[(first + captureWritten + n) % CAPTURE_SCANS][captureChannel];
+  }
+
+  captureCRC.update((const uint8_t *)samples, count * sizeof(uint16_t));
+  captureFile.write((const uint8_t *)samples, count * sizeof(uint16_t));
+  captureWritten += count;
+
+  if (captureWritten < total)
+  {
+    return false;
+  }
+
+  uint32_t crc = captureCRC.finalize();
+  captureFile.write((const uint8_t *)&crc, sizeof(crc));
+  captureFile.close();
+  return true;
+}
+
+void UpdateCapture()
+{
+  switch (captureState)
+  {
+  case CAPTURE_FROZEN:
+    // File names need the time. Without the card the capture is lost.
+    if (!SDCardOK || !RTCSet || !openCapture())
+    {
+      if (captureFile)
+      {
+        captureFile.close();
+      }
+      CaptureMissed++;
+      rearm();
+      break;
+    }
+    captureState = CAPTURE_WRITING;
+    break;
+
+  case CAPTURE_WRITING:
+    if (writeCapture())
+    {
+      CaptureCount++;
+      rearm();
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+void StopCapture()
+{
+  if (captureState == CAPTURE_WRITING)
+  {
+    // Left without its CRC. The decoder reports it as incomplete.
+    captureFile.close();
+  }
+  rearm();
+}
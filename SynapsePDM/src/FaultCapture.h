@@ -0,0 +1,101 @@
+/*  FaultCapture.h Current sense waveform capture around output faults, saved to the SD card.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef FaultCapture_H
+#define FaultCapture_H
+
+#include <Arduino.h>
+#include <Globals.h>
+#include <ADCHandler.h>
+#include <CurrentCalibration.h>
+
+// Scans held in the capture ring. Every current sense input every ADC_SCAN_PERIOD, 51.2ms at 100µs, ~14kB.
+#define CAPTURE_SCANS 512
+
+// Scans kept after the trigger, 12.8ms at 100µs. Scans are ADC_SCAN_PERIOD apart whatever the PWM settings.
+#define CAPTURE_POST_SCANS 128
+
+// Scans kept before the trigger, 32ms at 100µs. The ring fills by whole DMA blocks, so one DMA buffer is left for the trigger position and the last block.
+#define CAPTURE_PRE_SCANS (CAPTURE_SCANS - CAPTURE_POST_SCANS - ADC_SCAN_DEPTH)
+
+// Samples written to the file per UpdateCapture() call
+#define CAPTURE_WRITE_SAMPLES 128
+
+// Capture file format version
+#define CAPTURE_VERSION 1
+
+/// @brief What froze the capture
+enum CaptureTrigger
+{
+  CAPTURE_WATCHDOG,    // Analog watchdog trip
+  CAPTURE_OVERCURRENT, // Averaged current over the high threshold (CHN_OVERCURRENT)
+  CAPTURE_IS_FAULT     // Sense output signalling a fault (IS_FAULT)
+};
+
+/// @brief Capture file header. Followed by Samples raw readings (uint16_t) and a CRC32 of everything before it. Little endian.
+struct __attribute__((packed)) CaptureHeader
+{
+  char Magic[4];             // "SPFC"
+  uint8_t Version;           // CAPTURE_VERSION
+  uint8_t Channel;           // Channel index
+  uint8_t Trigger;           // CaptureTrigger
+  uint8_t ChanType;          // ChannelType
+  uint32_t Epoch;            // RTC time the capture was written (seconds since 1970)
+  uint32_t SamplePeriod;     // Time between samples (nanoseconds), from the timer so readers don't assume ADC_SCAN_PERIOD
+  uint16_t Samples;          // Readings in the file
+  uint16_t PreSamples;       // Readings before the trigger
+  uint16_t TripRaw;          // Reading that tripped the analog watchdog. 0 for other triggers
+  uint16_t FaultRaw;         // Reading above which the BTS50010 is signalling a fault
+  uint32_t VBattMillivolts;  // Battery voltage at the trigger
+  uint32_t CurrentGain;      // Channel's current sense gain (mA per count, Q16). Used when the curve has no points
+  int16_t CurrentOffset;     // Channel's current sense offset (counts)
+  uint8_t CurveCount;        // Calibration curve in use. Readings convert as CalibratedMilliamps()
+  uint16_t CurveRaw[CAL_POINTS];       // Curve readings
+  uint32_t CurveMilliamps[CAL_POINTS]; // Curve current at each reading (mA)
+  int32_t CurveSlope[CAL_POINTS];      // Curve mA per count (Q16)
+};
+
+/// @brief Captures written to the SD card since start up
+extern uint32_t CaptureCount;
+
+/// @brief Triggers lost because a capture was already in progress, or dropped because the SD card wasn't available
+extern volatile uint32_t CaptureMissed;
+
+/// @brief Copy a block of ADC scans into the capture ring. Called by the ADC DMA interrupt.
+/// @param block First scan of the block
+/// @param scans Scans in the block
+void CaptureBlock(const volatile uint16_t *block, uint16_t scans);
+
+/// @brief Freeze a capture around a channel fault. Ignored while a capture is being held or written. Safe from any interrupt.
+/// @param channel Channel index
+/// @param trigger CaptureTrigger
+/// @param tripRaw Reading that tripped the analog watchdog, or 0
+/// @param scanOffset Scans into the block being converted where the trigger happened
+void CaptureTrigger(uint8_t channel, uint8_t trigger, uint16_t tripRaw, uint16_t scanOffset);
+
+/// @brief Write a frozen capture to the SD card, a piece at a time, then re-arm. Call from the main loop.
+void UpdateCapture();
+
+/// @brief Close a capture file being written and re-arm. Call before the SD card is stopped.
+void StopCapture();
+
+#endif
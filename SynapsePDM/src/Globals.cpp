@@ -30,14 +30,8 @@ ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
 AnalogueInputs AnalogueIns[NUM_ANA_CHANNELS];
 
 uint32_t imuWWtimer;
-uint32_t DisplayTimer;
-uint32_t CommsTimer;
-uint32_t LogTimer;
-uint32_t GPSTimer;
-uint32_t signalTimer;
 uint32_t BLTimer;
 uint32_t wakeDebounceTimer;
-uint32_t systemCANTimer;
 int blLevel = 0;
 
 STM32RTC &rtc = STM32RTC::getInstance();
@@ -89,6 +83,17 @@ void InitialiseChannelData()
     Channels[i].ActiveHigh = true;
     Channels[i].RunOn = false;
     Channels[i].RunOnTime = 0;
+    Channels[i].RampProfile = RAMP_NONE;
+    Channels[i].RampUpTime = 0;
+    Channels[i].RampDownTime = 0;
+    Channels[i].CurrentGain = 0;
+    Channels[i].CurrentOffset = 0;
+    Channels[i].WireCrossSection = 0;
+    Channels[i].WireRatedCurrent = 0;
+    Channels[i].WireTimeConstant = 0;
+    Channels[i].RetryCooldown = 0;
+    Channels[i].Compensation = VBATT_COMP_POWER;
+    Channels[i].OffDiagnostics = OFF_DIAG_PASSIVE;
     Channels[i].MultiChannel = false;    
     Channels[i].RetryCount = 3;
     Channels[i].InrushDelay = INRUSH_DELAY;
@@ -114,5 +119,11 @@ void InitialiseAnalogueData()
     AnalogueIns[i].ScaleMax = CURRENT_MAX; // Maximum scale value
     AnalogueIns[i].PWMMin = 0;         // Minimum PWM value
     AnalogueIns[i].PWMMax = 100;       // Maximum PWM value
+    AnalogueIns[i].FilterTime = 0;     // No filtering
+    AnalogueIns[i].MapPoints = 0;      // Linear scale
+    AnalogueIns[i].DebounceTime = DEFAULT_DEBOUNCE_TIME;
+    AnalogueIns[i].CaptureMode = ANA_CAPTURE_NONE;
+    AnalogueIns[i].FilterMode = ANA_FILTER_IIR;
+    AnalogueIns[i].MedianLength = DEFAULT_MEDIAN_LENGTH;
   }
 }
@@ -50,17 +50,35 @@
 // Number of analogue input channels
 #define NUM_ANA_CHANNELS 8
 
-// Delay (microseconds) before making an analog reading
-// TODO: measure actual turn on delay and adjust this value
+// Points in an analogue input duty map
+#define ANA_MAP_POINTS 6
+
+// Current sense settling time (microseconds) after an output has turned on, before its current is sampled
+// TODO: measure actual IS settling time and adjust this value
 #define ANALOG_DELAY 100
 
-// Maximum PWM duty accounting for turn off delay. Above this value, a PWM channel will be set to 100% duty
-// BTS50010-1LUA max turn off time is 220µs. Default PWM frequency is 200Hz (5000µs period). Therefore, max. PWM duty is limited to about 95%, 4750µs
-#define MAX_DUTY 95
+// BTS50010-1LUA maximum turn on and turn off times (microseconds)
+#define BTS_TURN_ON_TIME 190
+#define BTS_TURN_OFF_TIME 220
+
+// Minimum time between ADC scan triggers (microseconds). A scan of all current sense inputs takes about 75µs.
+#define ADC_MIN_SCAN_PERIOD 80
+
+// Time between ADC scan triggers (microseconds), 10kHz. Bank G's timer triggers the scans, so its slot time is fitted to
+// a whole fraction of this whatever the PWM settings.
+#define ADC_SCAN_PERIOD 100
+
+#if ADC_SCAN_PERIOD < ADC_MIN_SCAN_PERIOD
+#error "ADC_SCAN_PERIOD is shorter than a scan takes"
+#endif
 
-// Min duty accounting for turn on delay. Above this value, a PWM channel will be set to 0% duty.
-// BTS50010-1LUA max turn on delay is 190µs. Default PWM frequency is 200Hz (5000µs period). Therefore, min. PWM duty is limited to about 10% (500µs, 190µs turn-on delay + analog read)
-#define MIN_DUTY 10
+// Minimum PWM on time (microseconds) accounting for turn on delay and an analog read. Shorter on times are set to 0% duty.
+// At 200Hz (5000µs period) this limits the minimum duty to about 10%.
+#define PWM_MIN_ON_TIME (BTS_TURN_ON_TIME + ANALOG_DELAY + 2 * ADC_SCAN_PERIOD)
+
+// Minimum PWM off time (microseconds) accounting for turn off delay. Shorter off times are set to 100% duty.
+// At 200Hz (5000µs period) this limits the maximum duty to about 95%.
+#define PWM_MIN_OFF_TIME BTS_TURN_OFF_TIME
 
 // IS current fault threshold voltage. Above this threshold, the channel is either open circuit, short circuit or over temperature
 #define FAULT_THRESHOLD 2.00
@@ -90,6 +108,7 @@
 #define GPS_INTERVAL 1000
 #define SIGNAL_QUALITY_INTERVAL 5000
 #define SYSTEM_CAN_INTERVAL 100
+#define STAGGER_INTERVAL 10
 #define BL_FADE_INTRVAL 0
 
 #define DEBUG_INTERVAL 1000
@@ -130,12 +149,18 @@
 #define SDCARD_ERROR 0x0010
 #define PC_COMMS_CHECKSUM_ERROR 0x0020
 #define GPS_ERROR 0x0040
+#define CONTROL_OVERRUN 0x0080 // A control update took longer than its period. Latched until restart
 
 // Channel error bitmasks
 #define CHN_OVERCURRENT 0x01
 #define CHN_UNDERCURRENT 0x02
 #define IS_FAULT 0x04
 #define RETRY_LOCKOUT 0x08
+#define CHN_OPEN_LOAD 0x10        // No current on an off-state probe pulse
+#define CHN_SHORT_TO_BATTERY 0x20 // Sense output signalling a fault with the channel off
+
+// Channel error flags set by the off-state diagnostics. Kept while the channel is off.
+#define OFF_DIAG_FLAGS (CHN_OPEN_LOAD | CHN_SHORT_TO_BATTERY)
 
 // ECU CAN addresses
 #define CHAN_CAN_ID 0x700
@@ -153,6 +178,16 @@
 // Default wake window for IMU checks
 #define DEFAULT_WW 5000
 
+// Default PWM frequency (Hz) and table length (slots) for both output banks. 200Hz, 1% resolution.
+#define DEFAULT_PWM_FREQUENCY 200
+#define DEFAULT_PWM_SLOTS 100
+
+// Default input debounce time (milliseconds)
+#define DEFAULT_DEBOUNCE_TIME 10
+
+// Default analogue input median filter length (samples)
+#define DEFAULT_MEDIAN_LENGTH 5
+
 // Default motion dead time (minutes). Ignore motion after ignition off for this period (gives time for vehicle to come to rest, passengers to disembark etc.)
 #define DEFAULT_MOTION_DEADTIME 5
 
@@ -195,6 +230,7 @@
 #define IMU_WAKING 5
 #define IMU_WAKE 6
 #define IMU_WAKE_WINDOW 7
+#define RUN_ON 8
 
 // SPI 2 Pins
 #define PICO PB15
@@ -264,6 +300,24 @@ extern bool pendingEEPROMSave;
 /// @brief Flag to indicate to the main look that the channel config needs to be saved to EEPROM. When EEPROMSaveTimout is exceeded, the config will be saved and this reset to false.
 extern bool saveEEPROMOnTimeout;
 
+/// @brief What an analogue input's thresholds, scale and duty map are compared with. Capture inputs must be set as digital,
+/// on a pin with an edge interrupt (not PF4 or PF8 - PF10).
+enum AnalogueCaptureMode
+{
+  ANA_CAPTURE_NONE,      // Input voltage (V, map in mV)
+  ANA_CAPTURE_DUTY,      // Measured duty of a PWM input (%, map in 0.1%)
+  ANA_CAPTURE_FREQUENCY, // Measured frequency of a pulse input (Hz, map in Hz)
+  ANA_CAPTURE_MODES
+};
+
+/// @brief Filter applied to the decimated samples of an analogue input
+enum AnalogueFilterMode
+{
+  ANA_FILTER_IIR,    // First order low pass over FilterTime
+  ANA_FILTER_MEDIAN, // Median of the last MedianLength samples. Rejects spikes without smearing steps
+  ANA_FILTER_MODES
+};
+
 /// @brief Analogue input config structure
 struct __attribute__((packed)) AnalogueInputs
 {
@@ -280,7 +334,15 @@ struct __attribute__((packed)) AnalogueInputs
   float ScaleMax;       // Maximum scale value (Used for PWM scaled inputs)
   uint8_t PWMMin;       // Minimum PWM value (0-100%)
   uint8_t PWMMax;       // Maximum PWM value (0-100%)
-  uint8_t Reserved[32]; // Reserved for future use
+  uint16_t FilterTime;  // Input filter time constant with ANA_FILTER_IIR (in milliseconds). 0 for no filtering
+  uint8_t MapPoints;    // Number of duty map points in use. Fewer than 2 uses the linear scale (Used for PWM scaled inputs)
+  uint16_t MapMillivolts[ANA_MAP_POINTS]; // Duty map input voltages in ascending order (millivolts)
+  uint8_t MapDuty[ANA_MAP_POINTS];        // Duty map PWM values (0-100%)
+  uint8_t DebounceTime; // Debounce time when used as a digital input (milliseconds). 0 for none
+  uint8_t CaptureMode;  // AnalogueCaptureMode
+  uint8_t FilterMode;   // AnalogueFilterMode
+  uint8_t MedianLength; // Samples in the median filter. Odd, 1 to ANA_MEDIAN_MAX
+  uint8_t Reserved[7];  // Reserved for future use
 };
 
 /// @brief Channel digital input pins (defaults)
@@ -306,15 +368,9 @@ extern bool CANChannelEnableFlags[NUM_CHANNELS];
 
 // Timers for main tasks
 extern uint32_t imuWWtimer;
-extern uint32_t DisplayTimer;
-extern uint32_t CommsTimer;
 extern uint32_t BattTimer;
-extern uint32_t LogTimer;
-extern uint32_t GPSTimer;
-extern uint32_t signalTimer;
 extern uint32_t BLTimer;
 extern uint32_t wakeDebounceTimer;
-extern uint32_t systemCANTimer;
 extern int blLevel;
 
 /// @brief HSD Output channels
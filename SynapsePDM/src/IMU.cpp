@@ -113,3 +113,17 @@ void DisableMotionDetect()
   imu.disableFeature(BMI2_ANY_MOTION);
   IMUOK = !err;
 }
+
+void SleepIMU()
+{
+  imu.disableFeature(BMI2_GYRO);
+  imu.disableFeature(BMI2_ACCEL);
+}
+
+void WakeIMU()
+{
+  int8_t err = BMI2_OK;
+  err |= imu.enableFeature(BMI2_ACCEL);
+  err |= imu.enableFeature(BMI2_GYRO);
+  IMUOK = !err;
+}
@@ -35,6 +35,12 @@ void EnableMotionDetect();
 /// @brief Disable the interrupt for run mode
 void DisableMotionDetect();
 
+/// @brief Stop the accelerometer and gyro while the system is off
+void SleepIMU();
+
+/// @brief Restart the accelerometer and gyro
+void WakeIMU();
+
 /// @brief IMU initialisation status
 extern bool IMUOK;
 
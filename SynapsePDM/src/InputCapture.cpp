@@ -0,0 +1,169 @@
+/*  InputCapture.cpp Frequency and duty measurement of pulse and PWM inputs.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "InputCapture.h"
+
+/// @brief Periods of one input, timed against the DWT cycle counter
+struct CaptureState
+{
+  uint32_t Periods[CAPTURE_WINDOW]; // Rising edge to rising edge (cycles)
+  uint32_t Highs[CAPTURE_WINDOW];   // High time in each period (cycles)
+  uint32_t PeriodSum;               // Sum of Periods
+  uint32_t HighSum;                 // Sum of Highs
+  uint32_t LastRise;                // Cycle count at the last rising edge
+  uint32_t LastFall;                // Cycle count at the last falling edge
+  uint32_t LastEdge;                // Cycle count at the last edge
+  uint8_t Next;                     // Next slot in the window
+  uint8_t Count;                    // Periods in the window
+  bool Level;                       // Level after the last edge
+  bool Rose;                        // LastRise starts a period
+  bool Started;                     // Level is known
+};
+
+uint32_t InputMillihertz[CAPTURE_INPUTS];
+uint16_t InputDutyCycle[CAPTURE_INPUTS];
+InputCaptureStatistics InputCaptureStats;
+
+static volatile CaptureState captures[CAPTURE_INPUTS];
+static uint32_t timeoutCycles;
+static uint64_t edgeCyclesSum;
+
+void InputCaptureEdge(uint8_t input, bool level, uint32_t cycles)
+{
+  uint32_t start = DWT->CYCCNT;
+  volatile CaptureState &s = captures[input];
+
+  if (level == s.Level && s.Started)
+  {
+    // Missed the edge between. The period in progress can't be trusted.
+    InputCaptureStats.Glitches++;
+    s.Rose = false;
+  }
+  else if (level)
+  {
+    uint32_t period = cycles - s.LastRise;
+    uint32_t high = s.LastFall - s.LastRise;
+    if (s.Rose && period <= timeoutCycles && high <= period)
+    {
+      // Moving window. The oldest period drops out of the sums as the new one goes in.
+      uint8_t k = s.Next;
+      s.PeriodSum += period - s.Periods[k];
+      s.HighSum += high - s.Highs[k];
+      s.Periods[k] = period;
+      s.Highs[k] = high;
+      s.Next = (k + 1) & (CAPTURE_WINDOW - 1);
+      if (s.Count < CAPTURE_WINDOW)
+      {
+        s.Count++;
+      }
+    }
+    s.LastRise = cycles;
+    s.Rose = true;
+  }
+  else
+  {
+    s.LastFall = cycles;
+  }
+
+  s.Level = level;
+  s.LastEdge = cycles;
+  s.Started = true;
+
+  uint32_t spent = DWT->CYCCNT - start;
+  InputCaptureStats.Edges++;
+  InputCaptureStats.MaxCycles = max(InputCaptureStats.MaxCycles, spent);
+  edgeCyclesSum += spent;
+  InputCaptureStats.MeanCycles = edgeCyclesSum / InputCaptureStats.Edges;
+}
+
+// Empty an input's window
+static void clearCapture(volatile CaptureState &s)
+{
+  for (int k = 0; k < CAPTURE_WINDOW; k++)
+  {
+    s.Periods[k] = 0;
+    s.Highs[k] = 0;
+  }
+  s.PeriodSum = 0;
+  s.HighSum = 0;
+  s.Next = 0;
+  s.Count = 0;
+  s.Rose = false;
+}
+
+void UpdateInputCapture()
+{
+  uint32_t now = DWT->CYCCNT;
+
+  for (int i = 0; i < CAPTURE_INPUTS; i++)
+  {
+    volatile CaptureState &s = captures[i];
+
+    noInterrupts();
+    uint8_t count = s.Count;
+    uint32_t periodSum = s.PeriodSum;
+    uint32_t highSum = s.HighSum;
+    uint32_t sinceRise = now - s.LastRise;
+    uint32_t sinceEdge = now - s.LastEdge;
+    bool rose = s.Rose;
+    bool level = s.Level;
+    if (count && sinceEdge > timeoutCycles)
+    {
+      clearCapture(s);
+      count = 0;
+    }
+    interrupts();
+
+    if (count == 0)
+    {
+      InputMillihertz[i] = 0;
+      InputDutyCycle[i] = level ? 1000 : 0;
+      continue;
+    }
+
+    // A signal slowing down shows before its next edge. The period in progress is at least as long as the time since it started.
+    uint32_t period = periodSum / count;
+    if (rose && sinceRise > period)
+    {
+      period = sinceRise;
+    }
+
+    InputMillihertz[i] = (uint64_t)SystemCoreClock * 1000 / period;
+    InputDutyCycle[i] = (uint64_t)highSum * 1000 / periodSum;
+  }
+}
+
+void ResetInputCapture()
+{
+  timeoutCycles = (uint64_t)SystemCoreClock * CAPTURE_TIMEOUT / 1000;
+
+  noInterrupts();
+  for (int i = 0; i < CAPTURE_INPUTS; i++)
+  {
+    clearCapture(captures[i]);
+    captures[i].Level = false;
+    captures[i].Started = false;
+    InputMillihertz[i] = 0;
+    InputDutyCycle[i] = 0;
+  }
+  interrupts();
+}
@@ -0,0 +1,68 @@
+/*  InputCapture.h Frequency and duty measurement of pulse and PWM inputs.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef InputCapture_H
+#define InputCapture_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Inputs measured. The digital inputs in DIchannelInputPins order, then the analogue inputs
+#define CAPTURE_INPUTS (NUM_DI_CHANNELS + NUM_ANA_CHANNELS)
+
+// Periods averaged for each result. A power of two
+#define CAPTURE_WINDOW 8
+
+// Time without an edge before an input reads 0Hz (milliseconds). Also the longest period measured.
+#define CAPTURE_TIMEOUT 2000
+
+/// @brief Input capture statistics since start up
+struct __attribute__((packed)) InputCaptureStatistics
+{
+  uint32_t Edges;      // Edges measured
+  uint32_t Glitches;   // Edges with the input already at the new level. The edge between was missed and the period dropped
+  uint32_t MaxCycles;  // Longest time to measure an edge (CPU cycles)
+  uint32_t MeanCycles; // Mean time to measure an edge (CPU cycles)
+};
+
+/// @brief Frequency of each input (millihertz). 0 once no edge has been seen for CAPTURE_TIMEOUT
+extern uint32_t InputMillihertz[CAPTURE_INPUTS];
+
+/// @brief Duty of each input (0 - 1000, 0.1%). 0 or 1000 when the input isn't switching
+extern uint16_t InputDutyCycle[CAPTURE_INPUTS];
+
+/// @brief Capture statistics
+extern InputCaptureStatistics InputCaptureStats;
+
+/// @brief Measure an input edge. Called from the edge interrupts, takes a bounded number of cycles.
+/// @param input Capture input index
+/// @param level Input level after the edge
+/// @param cycles DWT cycle count at the edge
+void InputCaptureEdge(uint8_t input, bool level, uint32_t cycles);
+
+/// @brief Work out each input's frequency and duty from its latest periods. Call each control update.
+void UpdateInputCapture();
+
+/// @brief Forget every input's periods, after the edge interrupts change or a wake
+void ResetInputCapture();
+
+#endif
@@ -0,0 +1,229 @@
+/*  InputDebounce.cpp Timer sampled debounce filter for the digital inputs.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "InputDebounce.h"
+#include <InputHandler.h>
+#include <InputEdges.h>
+#include <System.h>
+
+// Where each port's inputs sit in the input word: first pin in the port and first bit in the word
+static const uint8_t portShift[NUM_INPUT_PORTS] = {8, 3};
+static const uint8_t portOffset[NUM_INPUT_PORTS] = {0, 8};
+
+HardwareTimer debounceTimer(TIM6);
+static bool debounceRunning = false;
+
+// Vertical counters. Bit n of each word is one bit of input n's counter, so every input is counted with the same
+// few word operations. An input's counter runs while its sample differs from the debounced state, and resets when they agree.
+static uint16_t counter[DEBOUNCE_COUNTER_BITS];
+static uint16_t limit[DEBOUNCE_COUNTER_BITS]; // Debounce time of each input, sliced the same way
+static uint16_t bypass;                       // Inputs without a debounce time
+static volatile uint16_t debounced;
+static volatile uint32_t debounceSequence;
+
+// Digital input channels switched by each input
+static volatile uint16_t inputChannels[DEBOUNCE_INPUTS];
+
+// Input word from the port registers
+static inline uint16_t sampleInputs()
+{
+  uint16_t sample = 0;
+  for (int p = 0; p < NUM_INPUT_PORTS; p++)
+  {
+    sample |= ((inputPorts[p]->IDR >> portShift[p]) & 0xFF) << portOffset[p];
+  }
+  return sample;
+}
+
+// Bit of an input in the input word, -1 if it isn't sampled
+static int inputBit(uint8_t port, uint32_t mask)
+{
+  int bit = __builtin_ctz(mask) - portShift[port];
+  return (port < NUM_INPUT_PORTS && mask && bit >= 0 && bit < 8) ? bit + portOffset[port] : -1;
+}
+
+// Port index and mask of a pin
+static int pinBit(uint8_t pin)
+{
+  for (int p = 0; p < NUM_INPUT_PORTS; p++)
+  {
+    if (digitalPinToPort(pin) == inputPorts[p])
+    {
+      return inputBit(p, digitalPinToBitMask(pin));
+    }
+  }
+  return -1;
+}
+
+static void debounceTick()
+{
+  uint16_t sample = sampleInputs();
+  uint16_t changed = sample ^ debounced;
+
+  // Count the inputs that differ, reset the rest
+  uint16_t carry = changed & ~bypass;
+  uint16_t counting = carry;
+  for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++)
+  {
+    uint16_t bit = counter[k];
+    counter[k] = (bit ^ carry) & counting;
+    carry &= bit;
+  }
+
+  // Inputs whose count has reached their debounce time
+  uint16_t settled = counting;
+  for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++)
+  {
+    settled &= ~(counter[k] ^ limit[k]);
+  }
+
+  uint16_t flips = settled | (changed & bypass);
+  if (!flips)
+    return;
+
+  debounced ^= flips;
+  debounceSequence++;
+  for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++)
+  {
+    counter[k] &= ~flips;
+  }
+
+  // Switch the channels on inputs that have settled. Inputs with an edge interrupt have usually been handled already.
+  while (flips)
+  {
+    uint8_t bit = __builtin_ctz(flips);
+    flips &= flips - 1;
+
+    uint16_t channels = inputChannels[bit];
+    while (channels)
+    {
+      uint8_t i = __builtin_ctz(channels);
+      channels &= channels - 1;
+
+      const InputRoute &route = inputRoutes[i];
+      InputFastSwitch(i, ((DebouncedPort(route.Port) & route.Mask) != 0) != route.Invert);
+    }
+  }
+}
+
+uint8_t InputDebounceTime(uint8_t port, uint32_t mask)
+{
+  int bit = inputBit(port, mask);
+  if (bit < 0)
+    return 0;
+
+  for (int i = 0; i < NUM_DI_CHANNELS; i++)
+  {
+    if (pinBit(DIchannelInputPins[i]) == bit)
+      return SystemParams.DigitalDebounce[i];
+  }
+
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    if (pinBit(AnalogueIns[i].InputPin) == bit)
+      return AnalogueIns[i].DebounceTime;
+  }
+
+  return 0;
+}
+
+void ConfigureDebounce()
+{
+  uint16_t newLimit[DEBOUNCE_COUNTER_BITS] = {};
+  uint16_t newBypass = 0;
+  for (int p = 0; p < NUM_INPUT_PORTS; p++)
+  {
+    for (int b = 0; b < 8; b++)
+    {
+      uint8_t time = InputDebounceTime(p, 1UL << (b + portShift[p]));
+      uint16_t bit = 1 << (b + portOffset[p]);
+      if (time == 0)
+      {
+        newBypass |= bit;
+      }
+      for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++)
+      {
+        if (time & (1 << k))
+        {
+          newLimit[k] |= bit;
+        }
+      }
+    }
+  }
+
+  uint16_t channels[DEBOUNCE_INPUTS] = {};
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    const InputRoute &route = inputRoutes[i];
+    bool digital = Channels[i].ChanType == DIG || Channels[i].ChanType == DIG_PWM;
+    int bit = inputBit(route.Port, route.Mask);
+    if (route.Source == ROUTE_DIGITAL && digital && bit >= 0)
+    {
+      channels[bit] |= 1 << i;
+    }
+  }
+
+  noInterrupts();
+  for (int k = 0; k < DEBOUNCE_COUNTER_BITS; k++)
+  {
+    limit[k] = newLimit[k];
+    counter[k] = 0;
+  }
+  bypass = newBypass;
+  for (int i = 0; i < DEBOUNCE_INPUTS; i++)
+  {
+    inputChannels[i] = channels[i];
+  }
+  if (!debounceRunning)
+  {
+    // Start from the inputs as they are, rather than waiting out the debounce time after a wake
+    debounced = sampleInputs();
+  }
+  interrupts();
+
+  if (!debounceRunning)
+  {
+    // Same priority as the edge interrupts so the two never interrupt each other's fast path
+    debounceTimer.setOverflow(DEBOUNCE_RATE, HERTZ_FORMAT);
+    debounceTimer.attachInterrupt(debounceTick);
+    debounceTimer.setInterruptPriority(EXTI_IRQ_PRIO, 0);
+    debounceTimer.resume();
+    debounceRunning = true;
+  }
+}
+
+void StopDebounce()
+{
+  debounceTimer.pause();
+  debounceRunning = false;
+}
+
+uint32_t DebouncedPort(uint8_t port)
+{
+  uint16_t state = (debounced & ~bypass) | (sampleInputs() & bypass);
+  return (uint32_t)((state >> portOffset[port]) & 0xFF) << portShift[port];
+}
+
+uint32_t DebounceCount()
+{
+  return debounceSequence;
+}
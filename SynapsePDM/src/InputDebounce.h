@@ -0,0 +1,57 @@
+/*  InputDebounce.h Timer sampled debounce filter for the digital inputs.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef InputDebounce_H
+#define InputDebounce_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Sample rate (Hz). Debounce times are counted in samples, so one per millisecond
+#define DEBOUNCE_RATE 1000
+
+// Bits in each input's counter. Enough for the longest debounce time of 255ms
+#define DEBOUNCE_COUNTER_BITS 8
+
+// Inputs filtered. The digital inputs (PE8-PE15) are bits 0-7, the analogue inputs used as digital (PF3-PF10) bits 8-15
+#define DEBOUNCE_INPUTS 16
+
+/// @brief Debounce time of the input on a pin
+/// @param port Index into the sampled input ports
+/// @param mask Pin mask within the port
+/// @return Debounce time (milliseconds). 0 if the input isn't debounced
+uint8_t InputDebounceTime(uint8_t port, uint32_t mask);
+
+/// @brief Load the debounce times from the config and start sampling. Call after the input routing changes.
+void ConfigureDebounce();
+
+/// @brief Stop sampling
+void StopDebounce();
+
+/// @brief Debounced state of a sampled input port, laid out like its input register. Inputs without a debounce time read as they are now.
+/// @param port Index into the sampled input ports
+uint32_t DebouncedPort(uint8_t port);
+
+/// @brief Debounced input changes since start up. Changes whenever the filter switches an input.
+uint32_t DebounceCount();
+
+#endif
@@ -0,0 +1,321 @@
+/*  InputEdges.cpp Interrupt driven input edge capture and output fast path.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "InputEdges.h"
+#include <InputHandler.h>
+#include <OutputHandler.h>
+#include <ADCHandler.h>
+#include <ChannelFSM.h>
+#include <ChannelGroups.h>
+#include <InputDebounce.h>
+#include <InputCapture.h>
+
+#define EXTI_LINES 16
+
+InputEdgeStatistics InputEdgeStats;
+
+// Single producer (edge interrupts) single consumer (control update) queue
+static InputEdge edgeQueue[INPUT_EDGE_QUEUE_SIZE];
+static volatile uint32_t edgeHead;
+static volatile uint32_t edgeTail;
+static volatile uint32_t edgeSequence;
+
+// Pin attached to each EXTI line, NUM_DIGITAL_PINS if none. A line serves one port, so inputs sharing a line with
+// another interrupt can't have one.
+static uint8_t linePins[EXTI_LINES];
+static uint8_t linePorts[EXTI_LINES];
+
+// Capture input measured on each line, CAPTURE_INPUTS if none
+static uint8_t lineInputs[EXTI_LINES];
+
+// Channels each line can switch from its interrupt
+static volatile uint16_t lineChannels[EXTI_LINES];
+
+static uint64_t fastNanosSum;
+static uint32_t fastCount;
+static uint64_t tickMicrosSum;
+static uint32_t tickCount;
+
+// EXTI line of a pin, its pin number within the port
+static uint8_t pinLine(uint8_t pin)
+{
+  return __builtin_ctz(digitalPinToBitMask(pin));
+}
+
+uint8_t InputFastSwitch(uint8_t channel, bool on)
+{
+  if (PowerState != RUN || ChannelRuntime[channel].Override)
+    return FAST_NONE;
+
+  // Group membership changes with the control update, so it's checked here
+  if (GroupLeader[channel] != channel || (GroupMembers[channel] & ~(1 << channel)))
+    return FAST_NONE;
+
+  uint8_t state = ChannelStates.State[channel];
+  bool pwm = Channels[channel].ChanType == DIG_PWM;
+  bool immediate = !pwm && Channels[channel].RampProfile == RAMP_NONE;
+
+  if (on)
+  {
+    if (state != CHANNEL_OFF || Channels[channel].Enabled)
+      return FAST_NONE;
+
+    Channels[channel].Enabled = true;
+
+    // The watchdog only checks idle channels once the control update has run. Fault level until then.
+    ADCArmTripLevel(channel, FAULT_THRESHOLD_RAW);
+    if (immediate)
+    {
+      forceOutputOn(channel);
+    }
+    else
+    {
+      updatePWMDutyCycle(channel, pwm ? Channels[channel].PWMSetDuty * (PWM_DUTY_MAX / 100) : PWM_DUTY_MAX);
+    }
+  }
+  else
+  {
+    if (!Channels[channel].Enabled)
+      return FAST_NONE;
+
+    Channels[channel].Enabled = false;
+    if (immediate)
+    {
+      forceOutputOff(channel);
+    }
+    else
+    {
+      updatePWMDutyCycle(channel, 0); // Soft stop
+    }
+  }
+
+  if (immediate)
+  {
+    InputEdgeStats.FastSwitched++;
+    return FAST_SWITCHED;
+  }
+
+  InputEdgeStats.FastDeferred++;
+  return FAST_DEFERRED;
+}
+
+static void inputEdge(uint8_t line)
+{
+  uint32_t start = DWT->CYCCNT;
+  uint32_t level = inputPorts[linePorts[line]]->IDR;
+
+  edgeSequence++;
+  uint32_t head = edgeHead;
+  if (head - edgeTail < INPUT_EDGE_QUEUE_SIZE)
+  {
+    InputEdge &edge = edgeQueue[head & (INPUT_EDGE_QUEUE_SIZE - 1)];
+    edge.Time = micros();
+    edge.Level = level;
+    edge.Line = line;
+    edge.Port = linePorts[line];
+    edgeHead = head + 1;
+    InputEdgeStats.Edges++;
+  }
+  else
+  {
+    InputEdgeStats.Dropped++;
+  }
+
+  if (lineInputs[line] < CAPTURE_INPUTS)
+  {
+    InputCaptureEdge(lineInputs[line], level & (1 << line), start);
+  }
+
+  uint16_t channels = lineChannels[line];
+  while (channels)
+  {
+    uint8_t i = __builtin_ctz(channels);
+    channels &= channels - 1;
+
+    const InputRoute &route = inputRoutes[i];
+    if (InputFastSwitch(i, ((level & route.Mask) != 0) != route.Invert) == FAST_SWITCHED)
+    {
+      uint32_t nanos = (uint64_t)(DWT->CYCCNT - start) * 1000000000ULL / SystemCoreClock;
+      InputEdgeStats.FastMaxNanos = max(InputEdgeStats.FastMaxNanos, nanos);
+      fastNanosSum += nanos;
+      fastCount++;
+      InputEdgeStats.FastMeanNanos = fastNanosSum / fastCount;
+    }
+  }
+}
+
+// One handler per line, so the interrupt knows which line fired without reading EXTI->PR
+template <uint8_t line>
+static void edgeHandler()
+{
+  inputEdge(line);
+}
+
+static void (*const edgeHandlers[EXTI_LINES])() = {
+    edgeHandler<0>, edgeHandler<1>, edgeHandler<2>, edgeHandler<3>, edgeHandler<4>, edgeHandler<5>, edgeHandler<6>, edgeHandler<7>,
+    edgeHandler<8>, edgeHandler<9>, edgeHandler<10>, edgeHandler<11>, edgeHandler<12>, edgeHandler<13>, edgeHandler<14>, edgeHandler<15>};
+
+// Attach a line to a pin, or detach it with NUM_DIGITAL_PINS. Returns true if the line changed.
+static bool attachLine(uint8_t line, uint8_t pin)
+{
+  if (linePins[line] == pin)
+    return false;
+
+  if (linePins[line] != NUM_DIGITAL_PINS)
+  {
+    detachInterrupt(digitalPinToInterrupt(linePins[line]));
+  }
+
+  linePins[line] = pin;
+  if (pin != NUM_DIGITAL_PINS)
+  {
+    for (int p = 0; p < NUM_INPUT_PORTS; p++)
+    {
+      if (digitalPinToPort(pin) == inputPorts[p])
+      {
+        linePorts[line] = p;
+      }
+    }
+    attachInterrupt(digitalPinToInterrupt(pin), edgeHandlers[line], CHANGE);
+  }
+
+  return true;
+}
+
+void ConfigureInputEdges()
+{
+  static bool started = false;
+  if (!started)
+  {
+    // Cycle counter for the fast path timing
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (int l = 0; l < EXTI_LINES; l++)
+    {
+      linePins[l] = NUM_DIGITAL_PINS;
+      lineInputs[l] = CAPTURE_INPUTS;
+    }
+    started = true;
+  }
+
+  // Lines kept for the sleep wake interrupts, and those taken by the digital inputs
+  uint16_t reserved = digitalPinToBitMask(IGN_INPUT) | digitalPinToBitMask(IMU_INT1);
+  uint8_t wanted[EXTI_LINES];
+  uint8_t inputs[EXTI_LINES];
+  for (int l = 0; l < EXTI_LINES; l++)
+  {
+    wanted[l] = NUM_DIGITAL_PINS;
+    inputs[l] = CAPTURE_INPUTS;
+  }
+
+  for (int i = 0; i < NUM_DI_CHANNELS; i++)
+  {
+    uint8_t line = pinLine(DIchannelInputPins[i]);
+    wanted[line] = DIchannelInputPins[i];
+    inputs[line] = i;
+    reserved |= 1 << line;
+  }
+
+  // Analogue inputs used as digital on a free line. PF4 shares with the IMU interrupt, PF8 - PF10 with the digital inputs.
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    uint8_t line = pinLine(AnalogueIns[i].InputPin);
+    if (AnalogueIns[i].IsDigital && !(reserved & (1 << line)))
+    {
+      wanted[line] = AnalogueIns[i].InputPin;
+      inputs[line] = NUM_DI_CHANNELS + i;
+    }
+  }
+
+  // Periods measured across a change of pin would be wrong, so measurement starts again
+  bool changed = false;
+  noInterrupts();
+  for (int l = 0; l < EXTI_LINES; l++)
+  {
+    lineInputs[l] = inputs[l];
+  }
+  interrupts();
+  for (int l = 0; l < EXTI_LINES; l++)
+  {
+    changed |= attachLine(l, wanted[l]);
+  }
+  if (changed)
+  {
+    ResetInputCapture();
+  }
+
+  // Digital channels on an attached line. Debounced inputs are switched by the debounce filter once they've settled.
+  uint16_t channels[EXTI_LINES] = {};
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    const InputRoute &route = inputRoutes[i];
+    bool digital = Channels[i].ChanType == DIG || Channels[i].ChanType == DIG_PWM;
+    if (route.Source != ROUTE_DIGITAL || !digital || InputDebounceTime(route.Port, route.Mask))
+      continue;
+
+    uint8_t line = __builtin_ctz(route.Mask);
+    if (linePins[line] != NUM_DIGITAL_PINS && linePorts[line] == route.Port)
+    {
+      channels[line] |= 1 << i;
+    }
+  }
+
+  noInterrupts();
+  for (int l = 0; l < EXTI_LINES; l++)
+  {
+    lineChannels[l] = channels[l];
+  }
+  interrupts();
+}
+
+void StopInputEdges()
+{
+  for (int l = 0; l < EXTI_LINES; l++)
+  {
+    lineChannels[l] = 0;
+    if (linePins[l] != NUM_DIGITAL_PINS)
+    {
+      attachLine(l, NUM_DIGITAL_PINS);
+    }
+  }
+}
+
+uint32_t InputEdgeCount()
+{
+  return edgeSequence;
+}
+
+void UpdateInputEdges(uint32_t now)
+{
+  while (edgeTail != edgeHead)
+  {
+    const InputEdge &edge = edgeQueue[edgeTail & (INPUT_EDGE_QUEUE_SIZE - 1)];
+    uint32_t waited = now - edge.Time;
+    InputEdgeStats.TickMaxMicros = max(InputEdgeStats.TickMaxMicros, waited);
+    tickMicrosSum += waited;
+    tickCount++;
+    InputEdgeStats.TickMeanMicros = tickMicrosSum / tickCount;
+    edgeTail = edgeTail + 1;
+  }
+}
@@ -0,0 +1,86 @@
+/*  InputEdges.h Interrupt driven input edge capture and output fast path.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef InputEdges_H
+#define InputEdges_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Edges held between control updates. A power of two
+#define INPUT_EDGE_QUEUE_SIZE 64
+
+/// @brief One input edge, stamped in the EXTI interrupt
+struct InputEdge
+{
+  uint32_t Time;  // micros() at the interrupt
+  uint16_t Level; // Port input register bits 0-15 at the interrupt
+  uint8_t Line;   // EXTI line, the pin number within its port
+  uint8_t Port;   // Index into the sampled input ports
+};
+
+/// @brief What the fast path did with a channel
+enum FastResult
+{
+  FAST_NONE,     // Left to the control update
+  FAST_DEFERRED, // Duty requested for the next PWM period (PWM or soft start)
+  FAST_SWITCHED  // Output switched straight away
+};
+
+/// @brief Edge capture and fast path statistics since start up
+struct __attribute__((packed)) InputEdgeStatistics
+{
+  uint32_t Edges;          // Edges queued
+  uint32_t Dropped;        // Edges lost to a full queue
+  uint32_t FastSwitched;   // Outputs switched by the fast path
+  uint32_t FastDeferred;   // Outputs handed to the DMA interrupt for the next PWM period (PWM or soft start)
+  uint32_t FastMaxNanos;   // Longest edge interrupt entry to output time for a switched output
+  uint32_t FastMeanNanos;  // Mean edge interrupt entry to output time for a switched output
+  uint32_t TickMaxMicros;  // Longest edge to control update time. What every edge waited before the fast path
+  uint32_t TickMeanMicros; // Mean edge to control update time
+};
+
+/// @brief Edge statistics
+extern InputEdgeStatistics InputEdgeStats;
+
+/// @brief Switch a digital input channel to follow its input, ahead of the next control update. Turning on is left to the
+/// control update for faulted, locked out, overridden and ganged channels, and any already in the requested state. Call from interrupts.
+/// @param channel Channel index
+/// @param on Input is active
+/// @return FastResult
+uint8_t InputFastSwitch(uint8_t channel, bool on);
+
+/// @brief Attach EXTI interrupts to the digital inputs and the analogue inputs used as digital, and work out which channels
+/// each one switches. Call after the input routing changes.
+void ConfigureInputEdges();
+
+/// @brief Detach the input interrupts
+void StopInputEdges();
+
+/// @brief Edges queued since start up. Changes whenever an edge interrupt runs.
+uint32_t InputEdgeCount();
+
+/// @brief Take queued edges and record how long they waited. Call each control update.
+/// @param now micros()
+void UpdateInputEdges(uint32_t now);
+
+#endif
@@ -21,6 +21,42 @@
 */
 
 #include "InputHandler.h"
+#include <AnalogueControl.h>
+#include <OutputHandler.h>
+#include <InputEdges.h>
+#include <InputDebounce.h>
+#include <InputCapture.h>
+#include <LogicEngine.h>
+
+// Digital inputs are on PE8-PE15, analogue inputs used as digital on PF3-PF10
+GPIO_TypeDef *const inputPorts[NUM_INPUT_PORTS] = {GPIOE, GPIOF};
+
+InputRoute inputRoutes[NUM_CHANNELS];
+
+// Pull resistor and input mode state last written to the pins. -1 when unknown
+int8_t appliedPullDown[NUM_ANA_CHANNELS];
+int8_t appliedPullUp[NUM_ANA_CHANNELS];
+int8_t appliedDigital[NUM_ANA_CHANNELS];
+
+/// @brief Routes a channel to a digital pin in one of the sampled ports
+/// @param route Route to fill in
+/// @param pin Input pin
+/// @param invert True if the input is active low
+static void routeDigitalPin(InputRoute &route, uint8_t pin, bool invert)
+{
+    GPIO_TypeDef *port = digitalPinToPort(pin);
+    for (int i = 0; i < NUM_INPUT_PORTS; i++)
+    {
+        if (port == inputPorts[i])
+        {
+            route.Source = ROUTE_DIGITAL;
+            route.Port = i;
+            route.Mask = digitalPinToBitMask(pin);
+            route.Invert = invert;
+            return;
+        }
+    }
+}
 
 void InitialiseInputs()
 {
@@ -90,125 +126,234 @@ void InitialiseInputs()
         {
             pinMode(AnalogueIns[i].InputPin, INPUT_ANALOG);
         }
+
+        appliedPullDown[i] = AnalogueIns[i].PullDownEnable;
+        appliedPullUp[i] = AnalogueIns[i].PullUpEnable;
+        appliedDigital[i] = AnalogueIns[i].IsDigital;
     }
+
+    CompileInputRouting();
 }
 
+static void routeInputs();
+
 void HandleInputs()
 {
+    // Measure pulse inputs, then filter the latest analogue input samples
+    UpdateInputCapture();
+    UpdateAnalogueInputs();
+
+    // Logic programs see this tick's inputs and the channel states from the last output update
+    EvaluateLogic();
+
+    // Edges have already been applied by the fast path. Record how long they waited for this update.
+    UpdateInputEdges(micros());
+
+    // An edge or debounced change between sampling the ports and setting the channels would be undone, so go again if one arrives
+    uint32_t edges;
+    uint32_t changes;
+    do
+    {
+        edges = InputEdgeCount();
+        changes = DebounceCount();
+        routeInputs();
+    } while (edges != InputEdgeCount() || changes != DebounceCount());
+}
+
+// Set each channel's enable from its input route
+static void routeInputs()
+{
+    // Debounced digital inputs, a port at a time
+    uint32_t portInputs[NUM_INPUT_PORTS];
+    for (int i = 0; i < NUM_INPUT_PORTS; i++)
+    {
+        portInputs[i] = DebouncedPort(i);
+    }
+
     // Check channel type and enable for active level
     for (int i = 0; i < NUM_CHANNELS; i++)
     {
-        // Find the input pin index first and what type it is
-        int inputPin = -1;
-        bool inputIsDigital = false;
+        const InputRoute &route = inputRoutes[i];
+        switch (route.Source)
+        {
+        case ROUTE_DIGITAL:
+            // Override takes precedence over input control pin
+            Channels[i].Enabled = ChannelRuntime[i].Override || (((portInputs[route.Port] & route.Mask) != 0) != route.Invert);
+            break;
 
-        for (int j = 0; j < NUM_DI_CHANNELS; j++)
+        case ROUTE_ANALOGUE:
         {
-            if (Channels[i].InputControlPin == DIchannelInputPins[j])
+            // ANA channels switch on the input's thresholds. ANA_PWM channels take their duty from the input,
+            // and are on while it maps to a duty above zero, or by the thresholds if the input is set as thresholded.
+            bool active = AnalogueActive[route.Index];
+            if (Channels[i].ChanType == ANA_PWM)
             {
-                inputPin = j;
-                inputIsDigital = true;
-                break;
+                ChannelRuntime[i].InputDuty = AnalogueDuty[route.Index];
+                active = AnalogueIns[route.Index].IsThreshold ? active : AnalogueDuty[route.Index] > 0;
             }
+            Channels[i].Enabled = ChannelRuntime[i].Override || active;
+            break;
         }
 
-        if (inputPin == -1)
+        case ROUTE_CAN:
+            // Override takes precedence over CAN message
+            Channels[i].Enabled = ChannelRuntime[i].Override || CANChannelEnableFlags[i];
+            break;
+
+        case ROUTE_LOGIC:
+            // Override takes precedence over the program. ANA_PWM channels still take their duty from their analogue input
+            if (Channels[i].ChanType == ANA_PWM)
+            {
+                ChannelRuntime[i].InputDuty = route.Index < NUM_ANA_CHANNELS ? AnalogueDuty[route.Index] : PWM_DUTY_MAX;
+            }
+            Channels[i].Enabled = ChannelRuntime[i].Override || LogicResult[i];
+            break;
+
+        case ROUTE_OVERRIDE:
+            // Analogue channel without an analogue input
+            ChannelRuntime[i].InputDuty = 0;
+            Channels[i].Enabled = ChannelRuntime[i].Override;
+            break;
+
+        case ROUTE_HOLD:
+        default:
+            // Digital channel without a usable input keeps its state unless overridden
+            if (ChannelRuntime[i].Override)
+            {
+                Channels[i].Enabled = true;
+            }
+            break;
+        }
+
+        // Used for inrush delay timing
+        if (enabledFlags[i] != Channels[i].Enabled)
         {
-            for (int j = 0; j < NUM_ANA_CHANNELS; j++)
+            enabledFlags[i] = Channels[i].Enabled;
+            if (Channels[i].Enabled)
             {
-                if (Channels[i].InputControlPin == ANAchannelInputPins[j])
-                {
-                    inputPin = j;
-                    inputIsDigital = false;
-                    break;
-                }
+                enabledTimers[i] = millis();
             }
         }
-        switch (Channels[i].ChanType)
+
+        if (!Channels[i].Enabled)
         {
-        case DIG:
-        case DIG_PWM:
+            // Clear error flags on disable. Off-state diagnostics keep theirs.
+            ChannelRuntime[i].ErrorFlags &= OFF_DIAG_FLAGS;
+        }
+    }
+}
 
-            // Override takes precedence over input control pin
-            if (ChannelRuntime[i].Override)
+void CompileInputRouting()
+{
+    // Pull resistors and input modes only change with the config
+    for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+    {
+        if (appliedPullDown[i] != AnalogueIns[i].PullDownEnable)
+        {
+            digitalWrite(AnalogueIns[i].PullDownPin, AnalogueIns[i].PullDownEnable);
+            appliedPullDown[i] = AnalogueIns[i].PullDownEnable;
+        }
+
+        if (appliedPullUp[i] != AnalogueIns[i].PullUpEnable)
+        {
+            digitalWrite(AnalogueIns[i].PullUpPin, AnalogueIns[i].PullUpEnable);
+            appliedPullUp[i] = AnalogueIns[i].PullUpEnable;
+        }
+
+        if (appliedDigital[i] != AnalogueIns[i].IsDigital)
+        {
+            pinMode(AnalogueIns[i].InputPin, AnalogueIns[i].IsDigital ? INPUT : INPUT_ANALOG);
+            appliedDigital[i] = AnalogueIns[i].IsDigital;
+        }
+    }
+
+    // Built aside so the edge interrupts never see a half written route
+    InputRoute routes[NUM_CHANNELS];
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+        InputRoute &route = routes[i];
+        route.Source = ROUTE_HOLD;
+        route.Index = 0;
+        route.Port = 0;
+        route.Mask = 0;
+        route.Invert = false;
+
+        // Find the input pin index and what type it is
+        int diIndex = -1;
+        int anaIndex = -1;
+        for (int j = 0; j < NUM_DI_CHANNELS && diIndex < 0; j++)
+        {
+            if (Channels[i].InputControlPin == DIchannelInputPins[j])
             {
-                Channels[i].Enabled = true;
+                diIndex = j;
             }
-            else
+        }
+
+        for (int j = 0; j < NUM_ANA_CHANNELS && diIndex < 0 && anaIndex < 0; j++)
+        {
+            if (Channels[i].InputControlPin == ANAchannelInputPins[j])
             {
-                if (inputIsDigital)
-                {
-                    Channels[i].Enabled = digitalRead(Channels[i].InputControlPin);
-                }
-                else
-                {
-                    // Analogue input used as digital
-                    if (AnalogueIns[inputPin].IsDigital)
-                    {
-                        if (AnalogueIns[inputPin].PullUpEnable)
-                        {
-                            // Active low
-                            Channels[i].Enabled = !digitalRead(AnalogueIns[inputPin].InputPin);
-                        }
-                        else
-                        {
-                            // Active high
-                            Channels[i].Enabled = digitalRead(AnalogueIns[inputPin].InputPin);
-                        }
-                    }
-                }
+                anaIndex = j;
             }
+        }
 
-            // Used for inrush delay timing
-            if (enabledFlags[i] != Channels[i].Enabled)
+        switch (Channels[i].ChanType)
+        {
+        case DIG:
+        case DIG_PWM:
+            if (diIndex >= 0)
+            {
+                // Active high
+                routeDigitalPin(route, DIchannelInputPins[diIndex], false);
+            }
+            else if (anaIndex >= 0 && AnalogueIns[anaIndex].IsDigital)
             {
-                enabledFlags[i] = Channels[i].Enabled;
-                if (Channels[i].Enabled)
-                {
-                    enabledTimers[i] = millis();
-                }
+                // Analogue input used as digital. Active low with the pull-up
+                routeDigitalPin(route, AnalogueIns[anaIndex].InputPin, AnalogueIns[anaIndex].PullUpEnable);
             }
             break;
 
-        case CAN_DIGITAL:
-        case CAN_PWM:
-            // Override takes precedence over CAN message
-            if (ChannelRuntime[i].Override)
+        case ANA:
+        case ANA_PWM:
+            // Needs an analogue input
+            if (anaIndex >= 0)
             {
-                Channels[i].Enabled = true;
+                route.Source = ROUTE_ANALOGUE;
+                route.Index = anaIndex;
             }
             else
             {
-                Channels[i].Enabled = CANChannelEnableFlags[i];
-
-                // Used for inrush delay timing
-                if (enabledFlags[i] != Channels[i].Enabled)
-                {
-                    enabledFlags[i] = Channels[i].Enabled;
-                    if (Channels[i].Enabled)
-                    {
-                        enabledTimers[i] = millis();
-                    }
-                }
+                route.Source = ROUTE_OVERRIDE;
             }
             break;
+
+        case CAN_DIGITAL:
+        case CAN_PWM:
+            route.Source = ROUTE_CAN;
+            break;
+
         default:
             break;
         }
 
-        if (!Channels[i].Enabled)
+        // A logic program replaces the channel's input
+        if (LogicActive(i))
         {
-            // Clear error flags on disable
-            ChannelRuntime[i].ErrorFlags = 0;
+            route.Source = ROUTE_LOGIC;
+            route.Index = anaIndex >= 0 ? anaIndex : NUM_ANA_CHANNELS;
+            route.Port = 0;
+            route.Mask = 0;
+            route.Invert = false;
         }
     }
 
-    // Check analogue inputs. Set pull-ups/pull-downs
-    for (int i = 0; i < NUM_ANA_CHANNELS; i++)
-    {
-        digitalWrite(AnalogueIns[i].PullDownPin, AnalogueIns[i].PullDownEnable);
-        digitalWrite(AnalogueIns[i].PullUpPin, AnalogueIns[i].PullUpEnable);
-    }
+    noInterrupts();
+    memcpy(inputRoutes, routes, sizeof(inputRoutes));
+    interrupts();
+
+    ConfigureAnalogueFilters();
+    ConfigureDebounce();
+    ConfigureInputEdges();
 }
 
 void PullResistorSleep()
@@ -217,5 +362,7 @@ void PullResistorSleep()
     {
         pinMode(AnalogueIns[i].PullDownPin, INPUT_ANALOG);
         pinMode(AnalogueIns[i].PullUpPin, INPUT_ANALOG);
+        appliedPullDown[i] = -1;
+        appliedPullUp[i] = -1;
     }
 }
\ No newline at end of file
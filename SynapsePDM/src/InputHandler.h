@@ -26,12 +26,45 @@
 #include <Arduino.h>
 #include <Globals.h>
 
+/// @brief Number of GPIO ports the digital inputs are sampled from
+#define NUM_INPUT_PORTS 2
+
+/// @brief Where a channel takes its enable from
+enum InputRouteSource
+{
+    ROUTE_HOLD,     // No usable input. Keeps its state unless overridden
+    ROUTE_DIGITAL,  // Digital input pin, or analogue input used as digital
+    ROUTE_ANALOGUE, // Analogue input thresholds or duty
+    ROUTE_CAN,      // CAN enable flags
+    ROUTE_OVERRIDE, // Analogue channel without an analogue input. Override only
+    ROUTE_LOGIC     // Result of the channel's logic program
+};
+
+/// @brief Input routing for a channel, compiled from the config
+struct InputRoute
+{
+    uint8_t Source; // InputRouteSource
+    uint8_t Index;  // Analogue input index. For ROUTE_LOGIC, where an ANA_PWM channel takes its duty from, or NUM_ANA_CHANNELS for full duty
+    uint8_t Port;   // Index into the sampled ports
+    bool Invert;    // Active low
+    uint32_t Mask;  // Pin mask within the port
+};
+
+/// @brief Ports the digital inputs are sampled from. GPIOE has the digital inputs, GPIOF the analogue inputs
+extern GPIO_TypeDef *const inputPorts[NUM_INPUT_PORTS];
+
+/// @brief Input routing of each channel
+extern InputRoute inputRoutes[NUM_CHANNELS];
+
 /// @brief Initialise inputs
 void InitialiseInputs();
 
 /// @brief Handles reading of inputs
 void HandleInputs();
 
+/// @brief Rebuilds the input routing table and applies pull resistors. Call whenever channel or analogue input config changes
+void CompileInputRouting();
+
 /// @brief Disables all pull-up and pull-down resistor outputs
 void PullResistorSleep();
 
@@ -0,0 +1,440 @@
+/*  LogicEngine.cpp Bytecode logic conditions for output channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "LogicEngine.h"
+#include <AnalogueControl.h>
+#include <InputDebounce.h>
+#include <ChannelFSM.h>
+#include <System.h>
+
+LogicConfigUnion LogicConfigData;
+int32_t LogicRegisters[LOGIC_REGISTERS];
+bool LogicResult[NUM_CHANNELS];
+LogicStatistics LogicStats[NUM_CHANNELS];
+
+/// @brief What each instruction takes
+struct LogicOpInfo
+{
+  uint8_t Operands; // Operand bytes after the opcode
+  uint8_t Pops;     // Values taken off the stack
+  uint8_t Pushes;   // Values put on the stack
+  uint8_t Slot;     // Operand is a slot index
+};
+
+/// @brief Indexed by LogicOpcode
+static const LogicOpInfo logicOpInfo[LOGIC_OPCODES] = {
+    {0, 1, 0, false}, // LOGIC_END
+    {1, 0, 1, false}, // LOGIC_PUSH8
+    {2, 0, 1, false}, // LOGIC_PUSH16
+    {4, 0, 1, false}, // LOGIC_PUSH32
+    {1, 0, 1, false}, // LOGIC_LOAD
+    {0, 2, 1, false}, // LOGIC_ADD
+    {0, 2, 1, false}, // LOGIC_SUB
+    {0, 2, 1, false}, // LOGIC_MUL
+    {0, 2, 1, false}, // LOGIC_DIV
+    {0, 2, 1, false}, // LOGIC_MOD
+    {0, 1, 1, false}, // LOGIC_NEG
+    {0, 2, 1, false}, // LOGIC_MIN
+    {0, 2, 1, false}, // LOGIC_MAX
+    {0, 2, 1, false}, // LOGIC_LT
+    {0, 2, 1, false}, // LOGIC_LE
+    {0, 2, 1, false}, // LOGIC_GT
+    {0, 2, 1, false}, // LOGIC_GE
+    {0, 2, 1, false}, // LOGIC_EQ
+    {0, 2, 1, false}, // LOGIC_NE
+    {0, 2, 1, false}, // LOGIC_AND
+    {0, 2, 1, false}, // LOGIC_OR
+    {0, 1, 1, false}, // LOGIC_NOT
+    {0, 3, 1, false}, // LOGIC_SEL
+    {1, 2, 1, true},  // LOGIC_ONDELAY
+    {1, 2, 1, true},  // LOGIC_OFFDELAY
+    {1, 2, 1, true},  // LOGIC_LATCH
+    {1, 1, 1, true},  // LOGIC_TOGGLE
+    {0, 2, 1, false}  // LOGIC_FLASH
+};
+
+/// @brief State of a timer, latch or toggle
+struct LogicSlot
+{
+  uint32_t Since; // Time the timer started (milliseconds)
+  uint8_t State;  // Timer phase, or latch and toggle output
+  uint8_t Last;   // Input on the previous tick
+};
+
+// On-delay timer phases
+enum
+{
+  ONDELAY_IDLE,
+  ONDELAY_TIMING,
+  ONDELAY_DONE
+};
+
+static LogicSlot logicSlots[NUM_CHANNELS][LOGIC_SLOTS];
+
+// Programs that passed verification. Only these are run
+static bool logicValid[NUM_CHANNELS];
+
+void InitialiseLogicData()
+{
+  memset(LogicConfigData.dataBytes, 0, sizeof(LogicConfigData.dataBytes));
+}
+
+bool VerifyLogicProgram(const uint8_t *code, uint8_t length)
+{
+  if (length == 0 || length > LOGIC_CODE_SIZE)
+  {
+    return false;
+  }
+
+  int depth = 0;
+  int pc = 0;
+  while (pc < length)
+  {
+    uint8_t op = code[pc];
+    if (op >= LOGIC_OPCODES)
+    {
+      return false;
+    }
+
+    const LogicOpInfo &info = logicOpInfo[op];
+    if (pc + 1 + info.Operands > length || depth < info.Pops)
+    {
+      return false;
+    }
+
+    if ((op == LOGIC_LOAD && code[pc + 1] >= LOGIC_REGISTERS) || (info.Slot && code[pc + 1] >= LOGIC_SLOTS))
+    {
+      return false;
+    }
+
+    if (op == LOGIC_END)
+    {
+      // The result is the only value left, and nothing follows
+      return depth == 1 && pc + 1 == length;
+    }
+
+    depth += info.Pushes - info.Pops;
+    if (depth > LOGIC_STACK_DEPTH)
+    {
+      return false;
+    }
+
+    pc += 1 + info.Operands;
+  }
+
+  // Ran off the end without LOGIC_END
+  return false;
+}
+
+void ApplyLogic(uint8_t channel)
+{
+  const LogicProgram &program = LogicConfigData.data[channel];
+  logicValid[channel] = VerifyLogicProgram(program.Code, program.Length);
+  LogicResult[channel] = false;
+  memset(logicSlots[channel], 0, sizeof(logicSlots[channel]));
+  memset(&LogicStats[channel], 0, sizeof(LogicStats[channel]));
+}
+
+void ApplyAllLogic()
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    ApplyLogic(i);
+  }
+}
+
+bool LogicActive(uint8_t channel)
+{
+  return logicValid[channel];
+}
+
+/// @brief Checks if a timer has run for a time
+/// @param slot Timer
+/// @param t Time (milliseconds). 0 or less has always passed
+/// @param now Time (milliseconds)
+/// @return True once t has passed since the timer started
+static inline bool timerPassed(const LogicSlot &slot, int32_t t, uint32_t now)
+{
+  return t <= 0 || now - slot.Since >= (uint32_t)t;
+}
+
+bool RunLogicProgram(uint8_t channel, uint32_t now)
+{
+  // Verified before it gets here, so nothing is bounds checked
+  const uint8_t *code = LogicConfigData.data[channel].Code;
+  LogicSlot *slots = logicSlots[channel];
+  int32_t stack[LOGIC_STACK_DEPTH];
+  int sp = 0;
+  int pc = 0;
+
+  while (true)
+  {
+    uint8_t op = code[pc++];
+
+    // Operands of the two operand instructions. a is below b
+    int32_t a = sp >= 2 ? stack[sp - 2] : 0;
+    int32_t b = sp >= 1 ? stack[sp - 1] : 0;
+    int32_t result;
+
+    switch (op)
+    {
+    case LOGIC_END:
+      return stack[0] != 0;
+
+    case LOGIC_PUSH8:
+      stack[sp++] = (int8_t)code[pc];
+      pc += 1;
+      continue;
+
+    case LOGIC_PUSH16:
+      stack[sp++] = (int16_t)(code[pc] | (code[pc + 1] << 8));
+      pc += 2;
+      continue;
+
+    case LOGIC_PUSH32:
+      stack[sp++] = (int32_t)((uint32_t)code[pc] | ((uint32_t)code[pc + 1] << 8) | ((uint32_t)code[pc + 2] << 16) | ((uint32_t)code[pc + 3] << 24));
+      pc += 4;
+      continue;
+
+    case LOGIC_LOAD:
+      stack[sp++] = LogicRegisters[code[pc++]];
+      continue;
+
+    case LOGIC_NEG:
+      stack[sp - 1] = (int32_t)(0u - (uint32_t)b);
+      continue;
+
+    case LOGIC_NOT:
+      stack[sp - 1] = !b;
+      continue;
+
+    case LOGIC_SEL:
+      // c a b. Both sides have already been worked out, so their timers keep running
+      sp -= 2;
+      stack[sp - 1] = stack[sp - 1] ? a : b;
+      continue;
+
+    case LOGIC_TOGGLE:
+    {
+      LogicSlot &slot = slots[code[pc++]];
+      bool level = b != 0;
+      if (level && !slot.Last)
+      {
+        slot.State = !slot.State;
+      }
+      slot.Last = level;
+      stack[sp - 1] = slot.State;
+      continue;
+    }
+
+    // Arithmetic wraps rather than overflowing
+    case LOGIC_ADD:
+      result = (int32_t)((uint32_t)a + (uint32_t)b);
+      break;
+    case LOGIC_SUB:
+      result = (int32_t)((uint32_t)a - (uint32_t)b);
+      break;
+    case LOGIC_MUL:
+      result = (int32_t)((uint32_t)a * (uint32_t)b);
+      break;
+    case LOGIC_DIV:
+      result = (b == 0) ? 0 : (b == -1) ? (int32_t)(0u - (uint32_t)a) : a / b;
+      break;
+    case LOGIC_MOD:
+      result = (b == 0 || b == -1) ? 0 : a % b;
+      break;
+    case LOGIC_MIN:
+      result = min(a, b);
+      break;
+    case LOGIC_MAX:
+      result = max(a, b);
+      break;
+    case LOGIC_LT:
+      result = a < b;
+      break;
+    case LOGIC_LE:
+      result = a <= b;
+      break;
+    case LOGIC_GT:
+      result = a > b;
+      break;
+    case LOGIC_GE:
+      result = a >= b;
+      break;
+    case LOGIC_EQ:
+      result = a == b;
+      break;
+    case LOGIC_NE:
+      result = a != b;
+      break;
+    case LOGIC_AND:
+      result = a && b;
+      break;
+    case LOGIC_OR:
+      result = a || b;
+      break;
+
+    case LOGIC_ONDELAY:
+    {
+      // a is the input, b the delay
+      LogicSlot &slot = slots[code[pc++]];
+      if (!a)
+      {
+        slot.State = ONDELAY_IDLE;
+      }
+      else
+      {
+        if (slot.State == ONDELAY_IDLE)
+        {
+          slot.State = ONDELAY_TIMING;
+          slot.Since = now;
+        }
+
+        // Held once done, so the output doesn't drop when the time wraps
+        if (slot.State == ONDELAY_TIMING && timerPassed(slot, b, now))
+        {
+          slot.State = ONDELAY_DONE;
+        }
+      }
+      result = slot.State == ONDELAY_DONE;
+      break;
+    }
+
+    case LOGIC_OFFDELAY:
+    {
+      // a is the input, b the delay
+      LogicSlot &slot = slots[code[pc++]];
+      if (a)
+      {
+        slot.State = true;
+        slot.Last = true;
+      }
+      else if (slot.State)
+      {
+        // Timed from the first tick the input is seen off
+        if (slot.Last)
+        {
+          slot.Last = false;
+          slot.Since = now;
+        }
+
+        if (timerPassed(slot, b, now))
+        {
+          slot.State = false;
+        }
+      }
+      result = slot.State;
+      break;
+    }
+
+    case LOGIC_LATCH:
+    {
+      // a sets, b resets
+      LogicSlot &slot = slots[code[pc++]];
+      if (b)
+      {
+        slot.State = false;
+      }
+      else if (a)
+      {
+        slot.State = true;
+      }
+      result = slot.State;
+      break;
+    }
+
+    case LOGIC_FLASH:
+    {
+      // a is the on time, b the off time. Negative times count as 0
+      uint32_t on = a > 0 ? a : 0;
+      uint32_t period = on + (b > 0 ? b : 0);
+      result = period > 0 && now % period < on;
+      break;
+    }
+
+    default:
+      return false;
+    }
+
+    // Two operands in, one result out
+    sp--;
+    stack[sp - 1] = result;
+  }
+}
+
+/// @brief Fill the register file from the latest inputs and channel states
+/// @param now Time (milliseconds)
+static void fillRegisters(uint32_t now)
+{
+  uint32_t digital = DebouncedPort(0);
+  for (int i = 0; i < NUM_DI_CHANNELS; i++)
+  {
+    LogicRegisters[LOGIC_REG_DIN + i] = (digital & digitalPinToBitMask(DIchannelInputPins[i])) != 0;
+  }
+
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    LogicRegisters[LOGIC_REG_ANA_MV + i] = AnalogueMillivolts[i];
+    LogicRegisters[LOGIC_REG_ANA_ACTIVE + i] = AnalogueActive[i];
+  }
+
+  for (int i = 0; i < CAPTURE_INPUTS; i++)
+  {
+    LogicRegisters[LOGIC_REG_HZ + i] = (int32_t)min(InputMillihertz[i], (uint32_t)INT32_MAX);
+    LogicRegisters[LOGIC_REG_DUTY + i] = InputDutyCycle[i];
+  }
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    LogicRegisters[LOGIC_REG_CH_ON + i] = channelStateInfo[ChannelStates.State[i]].OutputOn;
+    LogicRegisters[LOGIC_REG_CH_MA + i] = (int32_t)min(ChannelRuntime[i].CurrentMilliamps, (uint32_t)INT32_MAX);
+    LogicRegisters[LOGIC_REG_CH_FAULT + i] = ChannelRuntime[i].ErrorFlags;
+    LogicRegisters[LOGIC_REG_CAN + i] = CANChannelEnableFlags[i];
+  }
+
+  LogicRegisters[LOGIC_REG_IGN] = digitalRead(IGN_INPUT) != 0;
+  LogicRegisters[LOGIC_REG_VBATT] = (int32_t)(SystemRuntimeParams.VBatt * 1000.0f);
+  LogicRegisters[LOGIC_REG_TEMP] = SystemRuntimeParams.SystemTemperature;
+  LogicRegisters[LOGIC_REG_TIME] = (int32_t)now;
+}
+
+void EvaluateLogic()
+{
+  uint32_t now = millis();
+  fillRegisters(now);
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (!logicValid[i])
+    {
+      continue;
+    }
+
+    // A program is one pass of at most LOGIC_CODE_SIZE instructions. Cycles are measured to show the cost in practice.
+    uint32_t start = DWT->CYCCNT;
+    LogicResult[i] = RunLogicProgram(i, now);
+    uint32_t cycles = DWT->CYCCNT - start;
+
+    LogicStats[i].LastCycles = cycles;
+    LogicStats[i].MaxCycles = max(LogicStats[i].MaxCycles, cycles);
+  }
+}
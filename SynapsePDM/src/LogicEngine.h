@@ -0,0 +1,157 @@
+/*  LogicEngine.h Bytecode logic conditions for output channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef LogicEngine_H
+#define LogicEngine_H
+
+#include <Arduino.h>
+#include <Globals.h>
+#include <InputCapture.h>
+
+// Bytecode bytes per program
+#define LOGIC_CODE_SIZE 48
+
+// Deepest the value stack can go
+#define LOGIC_STACK_DEPTH 8
+
+// Timer, latch and toggle states per program
+#define LOGIC_SLOTS 8
+
+/// @brief Register file indices. Registers are filled once per control tick, before any program runs.
+enum LogicRegister
+{
+  LOGIC_REG_DIN = 0,                                          // Debounced digital input levels (0 or 1)
+  LOGIC_REG_ANA_MV = LOGIC_REG_DIN + NUM_DI_CHANNELS,         // Filtered analogue input voltages (mV)
+  LOGIC_REG_ANA_ACTIVE = LOGIC_REG_ANA_MV + NUM_ANA_CHANNELS, // Analogue inputs past their thresholds (0 or 1)
+  LOGIC_REG_HZ = LOGIC_REG_ANA_ACTIVE + NUM_ANA_CHANNELS,     // Input frequency (mHz). Digital inputs then analogue inputs
+  LOGIC_REG_DUTY = LOGIC_REG_HZ + CAPTURE_INPUTS,             // Input duty (0.1%). Digital inputs then analogue inputs
+  LOGIC_REG_CH_ON = LOGIC_REG_DUTY + CAPTURE_INPUTS,          // Channel outputs driven (0 or 1)
+  LOGIC_REG_CH_MA = LOGIC_REG_CH_ON + NUM_CHANNELS,           // Channel load currents (mA)
+  LOGIC_REG_CH_FAULT = LOGIC_REG_CH_MA + NUM_CHANNELS,        // Channel error flags
+  LOGIC_REG_CAN = LOGIC_REG_CH_FAULT + NUM_CHANNELS,          // CAN channel enable flags (0 or 1)
+  LOGIC_REG_IGN = LOGIC_REG_CAN + NUM_CHANNELS,               // Ignition input (0 or 1)
+  LOGIC_REG_VBATT,                                            // Battery voltage (mV)
+  LOGIC_REG_TEMP,                                             // Board temperature (degrees C)
+  LOGIC_REG_TIME,                                             // millis()
+  LOGIC_REGISTERS
+};
+
+/// @brief Instructions. Operands follow the opcode. Values are int32. Booleans are 0 or 1, any non-zero value is true.
+/// There are no jumps, so a program takes at most one pass of its code.
+enum LogicOpcode
+{
+  LOGIC_END,      // Stop. The value left on the stack is the result
+  LOGIC_PUSH8,    // Push a signed byte operand
+  LOGIC_PUSH16,   // Push a signed 16-bit operand, little endian
+  LOGIC_PUSH32,   // Push a 32-bit operand, little endian
+  LOGIC_LOAD,     // Push a register. Operand is the LogicRegister
+  LOGIC_ADD,      // a b -> a + b
+  LOGIC_SUB,      // a b -> a - b
+  LOGIC_MUL,      // a b -> a * b
+  LOGIC_DIV,      // a b -> a / b. 0 if b is 0
+  LOGIC_MOD,      // a b -> a % b. 0 if b is 0
+  LOGIC_NEG,      // a -> -a
+  LOGIC_MIN,      // a b -> smaller of a and b
+  LOGIC_MAX,      // a b -> larger of a and b
+  LOGIC_LT,       // a b -> a < b
+  LOGIC_LE,       // a b -> a <= b
+  LOGIC_GT,       // a b -> a > b
+  LOGIC_GE,       // a b -> a >= b
+  LOGIC_EQ,       // a b -> a == b
+  LOGIC_NE,       // a b -> a != b
+  LOGIC_AND,      // a b -> a && b
+  LOGIC_OR,       // a b -> a || b
+  LOGIC_NOT,      // a -> !a
+  LOGIC_SEL,      // c a b -> c ? a : b
+  LOGIC_ONDELAY,  // x t -> x has been true for t ms. Operand is the slot
+  LOGIC_OFFDELAY, // x t -> x is true, or was within the last t ms. Operand is the slot
+  LOGIC_LATCH,    // set reset -> on after set until reset. Reset wins. Operand is the slot
+  LOGIC_TOGGLE,   // x -> flips on each rising edge of x. Operand is the slot
+  LOGIC_FLASH,    // on off -> true for on ms, then false for off ms, repeating
+  LOGIC_OPCODES
+};
+
+/// @brief A channel's condition. A channel with a program takes its enable from the result instead of its input.
+struct __attribute__((packed)) LogicProgram
+{
+  uint8_t Length;                // Bytes of code in use. 0 for no program
+  uint8_t Code[LOGIC_CODE_SIZE]; // Bytecode
+};
+
+/// @brief Logic config union for reading and writing from and to EEPROM storage
+union LogicConfigUnion
+{
+  LogicProgram data[NUM_CHANNELS];
+  byte dataBytes[sizeof(LogicProgram) * NUM_CHANNELS];
+};
+
+/// @brief Evaluation cost of a program
+struct __attribute__((packed)) LogicStatistics
+{
+  uint32_t LastCycles; // Latest evaluation (CPU cycles)
+  uint32_t MaxCycles;  // Longest evaluation since the program was loaded (CPU cycles)
+};
+
+/// @brief Stored programs, indexed by channel
+extern LogicConfigUnion LogicConfigData;
+
+/// @brief Register file the programs read
+extern int32_t LogicRegisters[LOGIC_REGISTERS];
+
+/// @brief Result of each channel's program. False for channels without a valid program
+extern bool LogicResult[NUM_CHANNELS];
+
+/// @brief Evaluation cost of each channel's program
+extern LogicStatistics LogicStats[NUM_CHANNELS];
+
+/// @brief Clear every program
+void InitialiseLogicData();
+
+/// @brief Check a program can run. Every instruction and operand is within the code, registers and slots are in range,
+/// the stack never underflows or goes past LOGIC_STACK_DEPTH and exactly one value is left at LOGIC_END.
+/// @param code Bytecode
+/// @param length Bytes of code
+/// @return True if the program is safe to run
+bool VerifyLogicProgram(const uint8_t *code, uint8_t length);
+
+/// @brief Verify a channel's program and reset its timers, latches and statistics. Call whenever the program changes
+/// @param channel Channel index
+void ApplyLogic(uint8_t channel);
+
+/// @brief Apply every channel's program
+void ApplyAllLogic();
+
+/// @brief Check if a channel has a program that passed verification
+/// @param channel Channel index
+/// @return True if the channel is controlled by its program
+bool LogicActive(uint8_t channel);
+
+/// @brief Fill the register file and run every program. Called once per control tick
+void EvaluateLogic();
+
+/// @brief Run one program over the register file. Exposed so programs can be evaluated with made-up registers
+/// @param channel Channel index, selecting the program's timer and latch states
+/// @param now Time (milliseconds)
+/// @return Program result
+bool RunLogicProgram(uint8_t channel, uint32_t now);
+
+#endif
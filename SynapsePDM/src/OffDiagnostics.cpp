@@ -0,0 +1,169 @@
+/*  OffDiagnostics.cpp Open load and short to battery detection on channels that are off.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "OffDiagnostics.h"
+#include "OutputHandler.h"
+#include "ADCHandler.h"
+#include "ChannelFSM.h"
+#include "ChannelGroups.h"
+
+// Channel being probed, or -1
+static int8_t probeChannel = -1;
+
+// Next channel to probe
+static uint8_t probeNext;
+
+// Start of the last probe (micros), and how long it's held (microseconds)
+static uint32_t probeStart;
+static uint32_t probeLength;
+
+// Highest on-sample average seen during the probe, and whether any pulse was sampled
+static uint16_t probeOnRaw;
+static bool probeSampled;
+
+// Results in a row disagreeing with each flag
+static uint8_t shortCount[NUM_CHANNELS];
+static uint8_t openCount[NUM_CHANNELS];
+
+bool OffDiagnosticIdle(uint8_t channel)
+{
+  return ChannelStates.State[channel] == CHANNEL_OFF && !Channels[channel].Enabled && !OutputRamping(channel) &&
+         (uint32_t)(micros() - ChannelStates.Entered[channel]) >= OFF_DIAG_SETTLE_TIME;
+}
+
+bool OffDiagnosticProbing(uint8_t channel)
+{
+  return probeChannel == channel;
+}
+
+// Set or clear a flag once OFF_DIAG_CONFIRM results in a row disagree with it
+static void confirm(uint8_t channel, uint8_t flag, bool fault, uint8_t &count)
+{
+  bool set = ChannelRuntime[channel].ErrorFlags & flag;
+  if (fault == set)
+  {
+    count = 0;
+  }
+  else if (++count >= OFF_DIAG_CONFIRM)
+  {
+    ChannelRuntime[channel].ErrorFlags ^= flag;
+    count = 0;
+  }
+}
+
+// Pulse the next idle channel set up for probing
+static void startProbe(uint32_t now)
+{
+  for (int n = 0; n < NUM_CHANNELS; n++)
+  {
+    uint8_t i = (probeNext + n) % NUM_CHANNELS;
+    if (Channels[i].OffDiagnostics == OFF_DIAG_PROBE && !GroupFollower(i) && OffDiagnosticIdle(i) &&
+        !(ChannelRuntime[i].ErrorFlags & CHN_SHORT_TO_BATTERY))
+    {
+      probeOutput(i, true);
+      probeChannel = i;
+      probeNext = (i + 1) % NUM_CHANNELS;
+      probeStart = now;
+      probeLength = OFF_DIAG_PROBE_PERIODS * PWMPeriodMicros(i) + ADCBlockMicros();
+      probeOnRaw = 0;
+      probeSampled = false;
+      return;
+    }
+  }
+}
+
+void UpdateOffDiagnostics(uint32_t now)
+{
+  int8_t probed = probeChannel;
+
+  // ADCOnResults only has the probe's samples in updates where a block with a pulse in it completed, so the highest is kept.
+  // Any current at all means the load is there.
+  if (probed >= 0)
+  {
+    bool idle = OffDiagnosticIdle(probed);
+    probeOnRaw = max(probeOnRaw, ADCOnResults[probed]);
+    probeSampled |= ADCOnSamplesAveraged[probed] > 0;
+
+    // Ended early without a result if the channel is turned on
+    if (!idle || (uint32_t)(now - probeStart) >= probeLength)
+    {
+      probeOutput(probed, false);
+      probeChannel = -1;
+
+      // No on samples if the pulse was never output
+      if (idle && probeSampled)
+      {
+        confirm(probed, CHN_OPEN_LOAD, senseToMilliamps(probed, probeOnRaw) == 0, openCount[probed]);
+      }
+    }
+  }
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (GroupFollower(i))
+    {
+      continue;
+    }
+
+    if (Channels[i].OffDiagnostics == OFF_DIAG_NONE || !OffDiagnosticIdle(i))
+    {
+      // On-state protection takes over once the channel is turned on
+      ChannelRuntime[i].ErrorFlags &= ~OFF_DIAG_FLAGS;
+      shortCount[i] = 0;
+      openCount[i] = 0;
+      continue;
+    }
+
+    if (Channels[i].OffDiagnostics != OFF_DIAG_PROBE)
+    {
+      ChannelRuntime[i].ErrorFlags &= ~CHN_OPEN_LOAD;
+    }
+
+    // With the output off the sense output only carries the fault current, when the output is pulled up.
+    // A short to battery, or an open load where the harness has an off-state pull-up. The probe's samples are skipped.
+    if (i != probed)
+    {
+      confirm(i, CHN_SHORT_TO_BATTERY, ADCResults[i] > FAULT_THRESHOLD_RAW, shortCount[i]);
+    }
+  }
+
+  // Probes cost energy. Not while running on or on the way to sleep.
+  if (probeChannel < 0 && PowerState == RUN && (uint32_t)(now - probeStart) >= OFF_DIAG_PROBE_INTERVAL)
+  {
+    startProbe(now);
+  }
+}
+
+void ResetOffDiagnostics()
+{
+  if (probeChannel >= 0)
+  {
+    probeOutput(probeChannel, false);
+    probeChannel = -1;
+  }
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    ChannelRuntime[i].ErrorFlags &= ~OFF_DIAG_FLAGS;
+    shortCount[i] = 0;
+    openCount[i] = 0;
+  }
+}
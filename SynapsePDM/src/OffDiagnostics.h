@@ -0,0 +1,59 @@
+/*  OffDiagnostics.h Open load and short to battery detection on channels that are off.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef OffDiagnostics_H
+#define OffDiagnostics_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+// Time a channel must have been off before it's diagnosed. Lets the load discharge and the sense output settle (microseconds)
+#define OFF_DIAG_SETTLE_TIME 250000
+
+// Time between probes (microseconds). Only one channel is probed at a time.
+#define OFF_DIAG_PROBE_INTERVAL 1000000
+
+// PWM periods a probe is held for. A probe starts at the end of the period it's asked for in, so this is at least one
+// whole pulse. One ADC block is added for the pulse's samples to reach ADCUpdate(). At 200Hz that's 3 pulses of
+// PWM_MIN_ON_TIME in every second across all channels.
+#define OFF_DIAG_PROBE_PERIODS 2
+
+// Results in a row needed to set or clear a flag
+#define OFF_DIAG_CONFIRM 2
+
+/// @brief Channel is off and has been long enough to be diagnosed. Its output is only on while it's being probed.
+/// @param channel Channel index
+bool OffDiagnosticIdle(uint8_t channel);
+
+/// @brief Channel is being pulsed by an off-state probe
+/// @param channel Channel index
+bool OffDiagnosticProbing(uint8_t channel);
+
+/// @brief Check the idle channels and schedule the next probe. Call each control update, after ADCUpdate() and before the outputs are updated.
+/// Sets and clears CHN_SHORT_TO_BATTERY and CHN_OPEN_LOAD in ChannelRuntime.ErrorFlags. Ganged followers aren't diagnosed separately.
+/// @param now Time of the update (micros)
+void UpdateOffDiagnostics(uint32_t now);
+
+/// @brief End any probe and clear the diagnostic results
+void ResetOffDiagnostics();
+
+#endif
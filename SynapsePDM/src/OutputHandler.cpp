@@ -23,61 +23,192 @@
 */
 
 #include "OutputHandler.h"
-
-// Pins to update
-const uint16_t GPIOG_PINS[] = {GPIO_PIN_10, GPIO_PIN_9, GPIO_PIN_6, GPIO_PIN_5, GPIO_PIN_4, GPIO_PIN_3, GPIO_PIN_2}; // Outputs 1 to 7
-const uint8_t NUM_PINS_G = sizeof(GPIOG_PINS) / sizeof(GPIOG_PINS[0]);
-
-const uint16_t GPIOF_PINS[] = {GPIO_PIN_15, GPIO_PIN_14, GPIO_PIN_13, GPIO_PIN_12, GPIO_PIN_2, GPIO_PIN_1, GPIO_PIN_0}; // Outputs 8 to 14
-const uint8_t NUM_PINS_F = sizeof(GPIOF_PINS) / sizeof(GPIOF_PINS[0]);
-
-// DMA buffer for multiple pins
-uint32_t pwmBufferG[100] = {0};
-uint32_t pwmBufferF[100] = {0};
+#include <ADCHandler.h>
+#include <WireProtection.h>
+#include <ChannelGroups.h>
+#include <ChannelFSM.h>
+#include <CurrentCalibration.h>
+#include <OffDiagnostics.h>
+#include <FaultCapture.h>
 
 // Independent duty cycle tracking
-uint8_t dutyCycles[14] = {0};
+uint16_t dutyCycles[NUM_CHANNELS] = {0};
 
-// Timer and DMA handles
+// Timer handles
 TIM_HandleTypeDef htim8;
 TIM_HandleTypeDef htim1;
 
-volatile uint8_t analogCounter;
-uint analogValues[NUM_CHANNELS][ANALOG_READ_SAMPLES];
+// Output banks
+PWMBank PWMBanks[PWM_BANKS];
 
 // Channel number used to identify associated channel
 int channelNum;
 
-// Track if retries are pending
-bool retriesPending[NUM_CHANNELS] = {false};
+/// @brief Handle output control
+void InitialiseOutputs()
+{
+  PWMBanks[PWM_BANK_G].Port = GPIOG;
+  PWMBanks[PWM_BANK_G].Pins = GPIOG_PINS;
+  PWMBanks[PWM_BANK_G].NumPins = NUM_PINS_G;
+  PWMBanks[PWM_BANK_G].FirstChannel = 0;
+  PWMBanks[PWM_BANK_G].htim = &htim8;
+
+  PWMBanks[PWM_BANK_F].Port = GPIOF;
+  PWMBanks[PWM_BANK_F].Pins = GPIOF_PINS;
+  PWMBanks[PWM_BANK_F].NumPins = NUM_PINS_F;
+  PWMBanks[PWM_BANK_F].FirstChannel = NUM_PINS_G;
+  PWMBanks[PWM_BANK_F].htim = &htim1;
+
+  // All outputs off in both tables
+  for (int b = 0; b < PWM_BANKS; b++)
+  {
+    PWMBank &bank = PWMBanks[b];
 
-// Retry timers
-unsigned long retryTimers[NUM_CHANNELS] = {0};
+    uint16_t frequency = SystemParams.PWMFrequency[b] ? SystemParams.PWMFrequency[b] : DEFAULT_PWM_FREQUENCY;
+    uint16_t slots = SystemParams.PWMSlots[b] ? SystemParams.PWMSlots[b] : DEFAULT_PWM_SLOTS;
+    setPWMBankTiming(bank, frequency, slots, b == PWM_BANK_G);
 
-// Channel lock status
-bool channelLocked[NUM_CHANNELS] = {false};
+    uint32_t resetMask = 0;
+    for (int p = 0; p < bank.NumPins; p++)
+    {
+      resetMask |= (uint32_t)bank.Pins[p] << 16; // BSRR reset value is the pin shifted left by 16
+      bank.TableOnSlots[0][p] = 0;
+      bank.TableOnSlots[1][p] = 0;
+      bank.TableStart[0][p] = 0;
+      bank.TableStart[1][p] = 0;
+      bank.TargetDuty[p] = 0;
+      bank.RampDuty[p] = 0;
+      bank.RampFrom[p] = 0;
+      bank.RampTo[p] = 0;
+      bank.RampStep[p] = 0;
+      bank.RampSteps[p] = 0;
+      bank.TargetOnSlots[p] = 0;
+      bank.TargetStart[p] = 0;
+      bank.ProbeOnSlots[p] = 0;
+      bank.PlacedOnSlots[p] = 0;
+      bank.PlacedCurrent[p] = 0.0f;
+    }
+    for (int i = 0; i < bank.Slots; i++)
+    {
+      bank.Table[0][i] = resetMask;
+      bank.Table[1][i] = resetMask;
+    }
+    bank.WordsTouched = 0;
+  }
 
-// per-channel counters
-uint8_t retryCount[NUM_CHANNELS] = {0};
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    dutyCycles[i] = 0;
+  }
+  ResetWireProtection();
+  ResetChannelFSM();
 
-/// @brief Handle output control
-void InitialiseOutputs()
-{
   setupGPIO();
   configureDMA();
   configureTimer();
+}
 
-  for (int i = 0; i < NUM_CHANNELS; i++)
+void ConfigureOutputs()
+{
+  // Wire models follow the groups, as a group's wire is modelled by its leader
+  ConfigureGroups();
+  ConfigureWireProtection();
+}
+
+void StartOutputs()
+{
+  // TIM8 is armed in trigger mode. Starting TIM1 starts both.
+  HAL_TIM_Base_Start(&htim1);
+}
+
+// Difference between two cycle counts
+static inline uint32_t cycleDistance(uint32_t a, uint32_t b)
+{
+  return a > b ? a - b : b - a;
+}
+
+void setPWMBankTiming(PWMBank &bank, uint16_t frequency, uint16_t slots, bool scanLocked)
+{
+  frequency = constrain(frequency, PWM_MIN_FREQUENCY, PWM_MAX_FREQUENCY);
+  slots = constrain(slots, PWM_MIN_SLOTS, PWM_MAX_SLOTS);
+
+  // Fewer slots at high frequencies
+  if ((uint32_t)frequency * slots > PWM_MAX_SLOT_RATE)
+  {
+    slots = PWM_MAX_SLOT_RATE / frequency;
+  }
+
+  // Timer clock cycles per slot, split into a prescaler and a 16 bit reload
+  uint32_t cycles = PWM_TIMER_CLOCK / ((uint32_t)frequency * slots);
+
+  if (scanLocked)
+  {
+    // Slot times that fit a whole number of times into a scan and keep the table length and slot rate within their limits
+    const uint32_t scanCycles = (uint32_t)ADC_SCAN_PERIOD * (PWM_TIMER_CLOCK / 1000000);
+    uint32_t shortest = max(PWM_TIMER_CLOCK / PWM_MAX_SLOT_RATE, (PWM_TIMER_CLOCK / frequency + PWM_MAX_SLOTS - 1) / PWM_MAX_SLOTS);
+    uint32_t longest = PWM_TIMER_CLOCK / frequency / PWM_MIN_SLOTS;
+
+    uint32_t fitted = 0;
+    for (uint32_t n = 1; scanCycles / n >= shortest; n++)
+    {
+      uint32_t candidate = scanCycles / n;
+      if (scanCycles % n == 0 && candidate <= longest && (fitted == 0 || cycleDistance(candidate, cycles) < cycleDistance(fitted, cycles)))
+      {
+        fitted = candidate;
+      }
+    }
+
+    if (fitted)
+    {
+      cycles = fitted;
+      slots = constrain((PWM_TIMER_CLOCK / cycles + frequency / 2) / frequency, (uint32_t)PWM_MIN_SLOTS, (uint32_t)PWM_MAX_SLOTS);
+    }
+  }
+  bank.Prescaler = cycles / 65536 + 1;
+  bank.SlotTicks = cycles / bank.Prescaler;
+  bank.SlotCycles = (uint32_t)bank.Prescaler * bank.SlotTicks;
+  bank.Slots = slots;
+  bank.Frequency = PWM_TIMER_CLOCK / (bank.SlotCycles * slots);
+
+  // Duty limits from the BTS50010 switching times
+  uint32_t cyclesPerMicro = PWM_TIMER_CLOCK / 1000000;
+  uint16_t minOffSlots = ((uint32_t)PWM_MIN_OFF_TIME * cyclesPerMicro + bank.SlotCycles - 1) / bank.SlotCycles;
+  bank.MinOnSlots = ((uint32_t)PWM_MIN_ON_TIME * cyclesPerMicro + bank.SlotCycles - 1) / bank.SlotCycles;
+  bank.MaxOnSlots = minOffSlots < slots ? slots - minOffSlots : 0;
+}
+
+uint16_t dutyToOnSlots(const PWMBank &bank, uint16_t dutyCycle)
+{
+  if (dutyCycle >= PWM_DUTY_MAX)
   {
-    updatePWMDutyCycle(i, 0);
+    return bank.Slots;
   }
 
-  // Reset the counters
-  analogCounter = 0;
+  uint16_t onSlots = ((uint32_t)dutyCycle * bank.Slots + PWM_DUTY_MAX / 2) / PWM_DUTY_MAX;
+
+  // Above the maximum the output doesn't have time to turn off, below the minimum it doesn't have time to turn on.
+  // At high frequencies the two can cross, leaving only off and fully on.
+  if (onSlots > bank.MaxOnSlots)
+  {
+    return bank.Slots;
+  }
+  if (onSlots < bank.MinOnSlots)
+  {
+    return 0;
+  }
+  return onSlots;
 }
 
 void SleepOutputs()
 {
+  // Stop the tables so the timers restart in phase on wake
+  HAL_TIM_Base_Stop(&htim1);
+  HAL_TIM_Base_Stop(&htim8);
+  for (int b = 0; b < PWM_BANKS; b++)
+  {
+    HAL_DMA_Abort(&PWMBanks[b].hdma);
+  }
+
   __HAL_RCC_GPIOA_CLK_SLEEP_DISABLE();
   __HAL_RCC_GPIOB_CLK_SLEEP_DISABLE();
   __HAL_RCC_GPIOC_CLK_SLEEP_DISABLE();
@@ -114,341 +245,715 @@ void setupGPIO()
   HAL_GPIO_Init(GPIOF, &GPIOF_InitStruct);
 }
 
+// Bank that owns a DMA handle
+static PWMBank *bankForDMA(DMA_HandleTypeDef *hdma)
+{
+  return (hdma == &PWMBanks[PWM_BANK_G].hdma) ? &PWMBanks[PWM_BANK_G] : &PWMBanks[PWM_BANK_F];
+}
+
+// Battery compensation used by a channel. Digital outputs are always fully on.
+static inline uint8_t compensationMode(const ChannelConfig &channel)
+{
+  bool pwm = channel.ChanType == DIG_PWM || channel.ChanType == CAN_PWM || channel.ChanType == ANA_PWM;
+
+  return (pwm && channel.Compensation < VBATT_COMP_MODES) ? channel.Compensation : (uint8_t)VBATT_COMP_NONE;
+}
+
+// Advance one output's ramp by one period
+static void rampOutput(PWMBank &bank, int p)
+{
+  // Ganged outputs ramp with their group leader's profile
+  const ChannelConfig &channel = Channels[GroupLeader[bank.FirstChannel + p]];
+  uint16_t target = bank.TargetDuty[p];
+
+  // New request. Ramp from wherever the output is now, taking the configured time for a full 0 - 100% change.
+  if (target != bank.RampTo[p])
+  {
+    uint16_t rampTime = target > bank.RampDuty[p] ? channel.RampUpTime : channel.RampDownTime;
+    uint16_t change = abs((int)target - (int)bank.RampDuty[p]);
+
+    bank.RampFrom[p] = bank.RampDuty[p];
+    bank.RampTo[p] = target;
+    bank.RampStep[p] = 0;
+    bank.RampSteps[p] = (channel.RampProfile == RAMP_NONE) ? 0 : ((uint32_t)rampTime * bank.Frequency / 1000) * change / PWM_DUTY_MAX;
+  }
+
+  if (bank.RampStep[p] < bank.RampSteps[p])
+  {
+    bank.RampStep[p]++;
+  }
+  bank.RampDuty[p] = rampDuty(channel.RampProfile, bank.RampFrom[p], bank.RampTo[p], bank.RampStep[p], bank.RampSteps[p]);
+
+  // Battery compensation follows the filtered voltage from the last ADC block. The table is only patched if the on slots change.
+  uint32_t duty = ((uint64_t)bank.RampDuty[p] * VBattCompensation[compensationMode(channel)] + 0x8000) >> 16;
+  bank.TargetOnSlots[p] = max(dutyToOnSlots(bank, min(duty, (uint32_t)PWM_DUTY_MAX)), bank.ProbeOnSlots[p]);
+}
+
+// End of a period. The DMA has switched tables, so the one it just finished can be brought up to date.
+static void pwmTableComplete(DMA_HandleTypeDef *hdma)
+{
+  PWMBank &bank = *bankForDMA(hdma);
+  uint8_t idle = (hdma->Instance->CR & DMA_SxCR_CT) ? 0 : 1;
+
+  for (int p = 0; p < bank.NumPins; p++)
+  {
+    // The ADC watchdog can force an output off from a higher priority interrupt. Ramped and written with it held off,
+    // or an on time worked out before the force off would be written back into the table and turn the output on again.
+    noInterrupts();
+    rampOutput(bank, p);
+
+    uint16_t target = bank.TargetOnSlots[p];
+    uint16_t start = bank.TargetStart[p];
+    if (bank.TableOnSlots[idle][p] != target || bank.TableStart[idle][p] != start)
+    {
+      bank.WordsTouched += patchPWMTable(bank.Table[idle], bank.Slots, bank.Pins[p], bank.TableStart[idle][p], bank.TableOnSlots[idle][p], start, target);
+      bank.TableOnSlots[idle][p] = target;
+      bank.TableStart[idle][p] = start;
+    }
+    interrupts();
+  }
+}
+
+// The stream stops on a transfer error. Don't leave the bank's outputs latched on.
+static void pwmTableError(DMA_HandleTypeDef *hdma)
+{
+  PWMBank &bank = *bankForDMA(hdma);
+  for (int p = 0; p < bank.NumPins; p++)
+  {
+    forceOutputOff(bank.FirstChannel + p);
+  }
+}
+
+static void startTableDMA(PWMBank &bank, DMA_Stream_TypeDef *stream, uint32_t channel)
+{
+  bank.hdma.Instance = stream;
+  bank.hdma.Init.Channel = channel;
+  bank.hdma.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  bank.hdma.Init.PeriphInc = DMA_PINC_DISABLE;
+  bank.hdma.Init.MemInc = DMA_MINC_ENABLE;
+  bank.hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  bank.hdma.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  bank.hdma.Init.Mode = DMA_CIRCULAR;
+  bank.hdma.Init.Priority = DMA_PRIORITY_HIGH;
+  bank.hdma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+  HAL_DMA_Init(&bank.hdma);
+  bank.htim->hdma[TIM_DMA_ID_UPDATE] = &bank.hdma;
+
+  // Both table complete callbacks do the same job, the current target (CT) bit says which table is idle
+  bank.hdma.XferCpltCallback = pwmTableComplete;
+  bank.hdma.XferM1CpltCallback = pwmTableComplete;
+  bank.hdma.XferHalfCpltCallback = NULL;
+  bank.hdma.XferM1HalfCpltCallback = NULL;
+  bank.hdma.XferErrorCallback = pwmTableError;
+
+  HAL_DMAEx_MultiBufferStart_IT(&bank.hdma, (uint32_t)bank.Table[0], (uint32_t)&bank.Port->BSRR, (uint32_t)bank.Table[1], bank.Slots);
+}
+
 void configureDMA()
 {
   __HAL_RCC_DMA2_CLK_ENABLE();
 
   // First DMA (Stream 1, Channel 7)
-  static DMA_HandleTypeDef hdma;
-  hdma.Instance = DMA2_Stream1;
-  hdma.Init.Channel = DMA_CHANNEL_7;
-  hdma.Init.Direction = DMA_MEMORY_TO_PERIPH;
-  hdma.Init.PeriphInc = DMA_PINC_DISABLE;
-  hdma.Init.MemInc = DMA_MINC_ENABLE;
-  hdma.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
-  hdma.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
-  hdma.Init.Mode = DMA_CIRCULAR;
-  hdma.Init.Priority = DMA_PRIORITY_HIGH;
-  hdma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
-
-  HAL_DMA_Init(&hdma);
-  htim8.hdma[TIM_DMA_ID_UPDATE] = &hdma;
-
-  HAL_DMA_Start(&hdma, (uint32_t)pwmBufferG, (uint32_t)&GPIOG->BSRR, 100);
+  startTableDMA(PWMBanks[PWM_BANK_G], DMA2_Stream1, DMA_CHANNEL_7);
 
   // Second DMA (Stream 5, Channel 6)
-  static DMA_HandleTypeDef hdma_tim1_up;
-  hdma_tim1_up.Instance = DMA2_Stream5;
-  hdma_tim1_up.Init.Channel = DMA_CHANNEL_6;
-  hdma_tim1_up.Init.Direction = DMA_MEMORY_TO_PERIPH;
-  hdma_tim1_up.Init.PeriphInc = DMA_PINC_DISABLE;
-  hdma_tim1_up.Init.MemInc = DMA_MINC_ENABLE;
-  hdma_tim1_up.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
-  hdma_tim1_up.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
-  hdma_tim1_up.Init.Mode = DMA_CIRCULAR;
-  hdma_tim1_up.Init.Priority = DMA_PRIORITY_HIGH;
-  hdma_tim1_up.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  startTableDMA(PWMBanks[PWM_BANK_F], DMA2_Stream5, DMA_CHANNEL_6);
+
+  // Table patching must finish well within a period. Higher priority than the ADC.
+  HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+  HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
+}
 
-  HAL_DMA_Init(&hdma_tim1_up);
-  htim1.hdma[TIM_DMA_ID_UPDATE] = &hdma;
+extern "C" void DMA2_Stream1_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&PWMBanks[PWM_BANK_G].hdma);
+}
 
-  HAL_DMA_Start(&hdma_tim1_up, (uint32_t)pwmBufferF, (uint32_t)&GPIOF->BSRR, 100);
+extern "C" void DMA2_Stream5_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&PWMBanks[PWM_BANK_F].hdma);
 }
 
 void configureTimer()
 {
+  // TIM1 is the master. Its enable starts TIM8 on the same clock edge so both tables stay in phase with the ADC sample rows.
+  PWMBank &bankF = PWMBanks[PWM_BANK_F];
+  __HAL_RCC_TIM1_CLK_ENABLE();
+
+  htim1.Instance = TIM1;
+  htim1.Init.Prescaler = bankF.Prescaler - 1;
+  htim1.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim1.Init.Period = bankF.SlotTicks - 1;
+  htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+
+  HAL_TIM_Base_Init(&htim1);
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_ENABLE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_ENABLE;
+  HAL_TIMEx_MasterConfigSynchronization(&htim1, &sMasterConfig);
+
+  __HAL_TIM_ENABLE_DMA(&htim1, TIM_DMA_UPDATE);
+
+  PWMBank &bankG = PWMBanks[PWM_BANK_G];
   __HAL_RCC_TIM8_CLK_ENABLE();
 
   htim8.Instance = TIM8;
-  htim8.Init.Prescaler = 84 - 1; // 84MHz / 84 = 1MHz
+  htim8.Init.Prescaler = bankG.Prescaler - 1;
   htim8.Init.CounterMode = TIM_COUNTERMODE_UP;
-  htim8.Init.Period = 100 - 1; // 1MHz / 100 = 10kHz
+  htim8.Init.Period = bankG.SlotTicks - 1;
   htim8.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
   htim8.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
 
   HAL_TIM_Base_Init(&htim8);
-  HAL_TIM_Base_Start(&htim8);
+
+  // TIM8 starts on the TIM1 enable trigger (ITR0)
+  TIM_SlaveConfigTypeDef sSlaveConfig = {0};
+  sSlaveConfig.SlaveMode = TIM_SLAVEMODE_TRIGGER;
+  sSlaveConfig.InputTrigger = TIM_TS_ITR0;
+  HAL_TIM_SlaveConfigSynchro(&htim8, &sSlaveConfig);
+
+  // TIM8 update clocks the ADC sample timer (TIM2)
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_ENABLE;
+  HAL_TIMEx_MasterConfigSynchronization(&htim8, &sMasterConfig);
 
   __HAL_TIM_ENABLE_DMA(&htim8, TIM_DMA_UPDATE);
 
-  __HAL_RCC_TIM1_CLK_ENABLE();
+  // Armed but not enabled while in trigger mode
+  HAL_TIM_Base_Start(&htim8);
+}
 
-  htim1.Instance = TIM1;
-  htim1.Init.Prescaler = 84 - 1; // 84MHz / 84 = 1MHz
-  htim1.Init.CounterMode = TIM_COUNTERMODE_UP;
-  htim1.Init.Period = 100 - 1; // 1MHz / 100 = 10kHz
-  htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-  htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+// Write a run of slots of one pin's window, wrapping at the end of the table
+static uint16_t writePWMSlots(uint32_t *table, uint16_t slots, uint16_t pin, uint16_t start, uint16_t from, uint16_t to, bool on)
+{
+  uint32_t setMask = pin;
+  uint32_t resetMask = (uint32_t)pin << 16; // BSRR reset value is the pin shifted left by 16
 
-  HAL_TIM_Base_Init(&htim1);
-  HAL_TIM_Base_Start(&htim1);
+  uint16_t i = start + from;
+  if (i >= slots)
+  {
+    i -= slots;
+  }
 
-  __HAL_TIM_ENABLE_DMA(&htim1, TIM_DMA_UPDATE);
+  for (uint16_t k = from; k < to; k++)
+  {
+    if (on)
+    {
+      table[i] = (table[i] & ~resetMask) | setMask; // Set pin high
+    }
+    else
+    {
+      table[i] = (table[i] & ~setMask) | resetMask; // Set pin low
+    }
+
+    if (++i == slots)
+    {
+      i = 0;
+    }
+  }
+
+  return to - from;
 }
 
-// Setup PWM buffer
-void updatePWMDutyCycle(uint8_t pinIndex, uint8_t dutyCycle)
+uint16_t patchPWMTable(uint32_t *table, uint16_t slots, uint16_t pin, uint16_t oldStart, uint16_t oldOnSlots, uint16_t newStart, uint16_t newOnSlots)
 {
-  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
-    return; // Ensure valid index
+  // Empty and full windows have no phase
+  if (oldOnSlots == 0 || oldOnSlots >= slots)
+  {
+    oldStart = newStart;
+  }
+  if (newOnSlots == 0 || newOnSlots >= slots)
+  {
+    newStart = oldStart;
+  }
 
-  dutyCycles[pinIndex] = dutyCycle; // Store the new duty cycle
+  if (oldStart == newStart)
+  {
+    if (newOnSlots > oldOnSlots)
+    {
+      return writePWMSlots(table, slots, pin, newStart, oldOnSlots, newOnSlots, true);
+    }
+    return writePWMSlots(table, slots, pin, newStart, newOnSlots, oldOnSlots, false);
+  }
 
-  for (int i = 0; i < 100; i++)
+  // Moved. Clear the old window then set the new one.
+  return writePWMSlots(table, slots, pin, oldStart, 0, oldOnSlots, false) + writePWMSlots(table, slots, pin, newStart, 0, newOnSlots, true);
+}
+
+uint8_t choosePWMStartBin(const float *profile, uint8_t onBins, float amps, uint8_t currentBin)
+{
+  uint8_t bestBin = currentBin;
+  float bestPeak = 0.0f;
+  float bestOverlap = 0.0f;
+
+  for (int n = 0; n < PWM_STAGGER_BINS; n++)
   {
-    uint32_t setMask;
-    uint32_t resetMask;
+    // Current start first so ties leave the output where it is
+    int start = currentBin + n;
+    if (start >= PWM_STAGGER_BINS)
+    {
+      start -= PWM_STAGGER_BINS;
+    }
 
-    if (pinIndex < NUM_PINS_G)
+    // On from start up to end, wrapping round to the bins before start
+    int end = start + onBins;
+    float peak = 0.0f;
+    float overlap = 0.0f;
+    for (int b = 0; b < PWM_STAGGER_BINS; b++)
     {
-      setMask = GPIOG_PINS[pinIndex];
-      resetMask = GPIOG_PINS[pinIndex] << 16; // BSRR reset value is the pin shifted left by 16
-      if (i < dutyCycle)
+      bool on = (b >= start && b < end) || b + PWM_STAGGER_BINS < end;
+      float total = profile[b] + (on ? amps : 0.0f);
+      if (total > peak)
       {
-        pwmBufferG[i] |= setMask; // Set pin high
-        pwmBufferG[i] &= ~resetMask;
+        peak = total;
       }
-      else
+      if (on)
       {
-        pwmBufferG[i] |= resetMask; // Set pin low
-        pwmBufferG[i] &= ~setMask;
+        overlap += profile[b];
       }
     }
-    else
+
+    // Lowest peak, then least overlap with the other outputs (lowest RMS)
+    if (n == 0 || peak < bestPeak - 0.01f || (peak < bestPeak + 0.01f && overlap < bestOverlap - 0.01f))
     {
-      setMask = GPIOF_PINS[pinIndex - NUM_PINS_G];
-      resetMask = GPIOF_PINS[pinIndex - NUM_PINS_G] << 16; // BSRR reset value is the pin shifted left by 16
-      if (i < dutyCycle)
+      bestBin = start;
+      bestPeak = peak;
+      bestOverlap = overlap;
+    }
+  }
+
+  return bestBin;
+}
+
+// Predicted on-state current of a PWM output
+static float predictedCurrent(uint8_t channel)
+{
+  float amps = ChannelRuntime[channel].CurrentValue;
+  return amps > 0.1f ? amps : PWM_STAGGER_DEFAULT_CURRENT;
+}
+
+static void staggerBank(PWMBank &bank)
+{
+  for (int p = 0; p < bank.NumPins; p++)
+  {
+    uint16_t onSlots = bank.TargetOnSlots[p];
+
+    // Off and fully on outputs have no phase
+    if (onSlots == 0 || onSlots >= bank.Slots)
+    {
+      bank.PlacedOnSlots[p] = onSlots;
+      continue;
+    }
+
+    // Ganged outputs switch with their group leader. In the same table word when they share a bank, otherwise the same slot if the bank timing matches.
+    uint8_t leader = GroupLeader[bank.FirstChannel + p];
+    if (leader != bank.FirstChannel + p)
+    {
+      const PWMBank &leaderBank = leader < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+      if (leaderBank.Slots == bank.Slots && leaderBank.Frequency == bank.Frequency)
       {
-        pwmBufferF[i] |= setMask; // Set pin high
-        pwmBufferF[i] &= ~resetMask;
+        bank.TargetStart[p] = leaderBank.TargetStart[leader - leaderBank.FirstChannel];
+        bank.PlacedOnSlots[p] = onSlots;
+        continue;
       }
-      else
+    }
+
+    // Only move an output when its load has changed noticeably
+    float amps = predictedCurrent(bank.FirstChannel + p);
+    uint16_t binSlots = bank.Slots / PWM_STAGGER_BINS;
+    bool dutyChanged = abs((int)onSlots - (int)bank.PlacedOnSlots[p]) > binSlots;
+    bool currentChanged = fabsf(amps - bank.PlacedCurrent[p]) > bank.PlacedCurrent[p] * PWM_STAGGER_CURRENT_CHANGE;
+    if (!dutyChanged && !currentChanged)
+    {
+      continue;
+    }
+
+    // Predicted current of the other PWM outputs in each bin
+    float profile[PWM_STAGGER_BINS] = {0.0f};
+    for (int q = 0; q < bank.NumPins; q++)
+    {
+      uint16_t otherOn = bank.TargetOnSlots[q];
+      if (q == p || otherOn == 0 || otherOn >= bank.Slots)
       {
-        pwmBufferF[i] |= resetMask; // Set pin low
-        pwmBufferF[i] &= ~setMask;
+        continue;
+      }
+
+      float otherAmps = predictedCurrent(bank.FirstChannel + q);
+      uint8_t startBin = ((uint32_t)bank.TargetStart[q] * PWM_STAGGER_BINS) / bank.Slots;
+      uint8_t bins = ((uint32_t)otherOn * PWM_STAGGER_BINS + bank.Slots - 1) / bank.Slots;
+      for (int b = 0, bin = startBin; b < bins; b++, bin++)
+      {
+        if (bin == PWM_STAGGER_BINS)
+        {
+          bin = 0;
+        }
+        profile[bin] += otherAmps;
       }
     }
+
+    uint8_t onBins = ((uint32_t)onSlots * PWM_STAGGER_BINS + bank.Slots - 1) / bank.Slots;
+    uint8_t currentBin = ((uint32_t)bank.TargetStart[p] * PWM_STAGGER_BINS) / bank.Slots;
+    uint8_t startBin = choosePWMStartBin(profile, onBins, amps, currentBin);
+
+    // Picked up with the duty by the DMA interrupt at the end of the period
+    bank.TargetStart[p] = ((uint32_t)startBin * bank.Slots) / PWM_STAGGER_BINS;
+    bank.PlacedOnSlots[p] = onSlots;
+    bank.PlacedCurrent[p] = amps;
+  }
+}
+
+void StaggerOutputs()
+{
+  for (int b = 0; b < PWM_BANKS; b++)
+  {
+    staggerBank(PWMBanks[b]);
+  }
+}
+
+// Setup PWM buffer
+void updatePWMDutyCycle(uint8_t pinIndex, uint16_t dutyCycle)
+{
+  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
+    return; // Ensure valid index
+
+  dutyCycles[pinIndex] = dutyCycle; // Store the new duty cycle
+
+  PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+
+  // Picked up and ramped by the DMA interrupt at the end of the period
+  bank.TargetDuty[pinIndex - bank.FirstChannel] = dutyCycle > PWM_DUTY_MAX ? PWM_DUTY_MAX : dutyCycle;
+}
+
+uint32_t senseToMilliamps(uint8_t pinIndex, uint16_t raw)
+{
+  if (raw < CURRENT_NOISE_FLOOR)
+  {
+    // No current detected
+    return 0;
+  }
+
+  const CalibrationCurve *curve = ChannelCalibration(pinIndex);
+  if (curve)
+  {
+    return CalibratedMilliamps(*curve, raw);
+  }
+
+  const ChannelConfig &channel = Channels[pinIndex];
+  uint32_t gain = channel.CurrentGain ? channel.CurrentGain : CURRENT_GAIN_NOMINAL;
+  int32_t counts = (int32_t)raw - channel.CurrentOffset;
+
+  if (counts <= 0)
+  {
+    return 0;
+  }
+
+  return ((uint64_t)counts * gain + 0x8000) >> 16;
+}
+
+uint16_t milliampsToSense(uint8_t pinIndex, uint32_t milliamps)
+{
+  const CalibrationCurve *curve = ChannelCalibration(pinIndex);
+  if (curve)
+  {
+    return CalibratedSense(*curve, milliamps);
+  }
+
+  const ChannelConfig &channel = Channels[pinIndex];
+  uint32_t gain = channel.CurrentGain ? channel.CurrentGain : CURRENT_GAIN_NOMINAL;
+  int64_t raw = ((((uint64_t)milliamps << 16) + gain / 2) / gain) + channel.CurrentOffset;
+
+  return constrain(raw, 0, ADCres);
+}
+
+uint16_t rampDuty(uint8_t profile, uint16_t from, uint16_t to, uint32_t step, uint32_t steps)
+{
+  if (step >= steps)
+  {
+    return to;
+  }
+
+  float x = (float)step / steps;
+  float shape;
+
+  switch (profile)
+  {
+  case RAMP_SCURVE:
+    shape = x * x * (3.0f - 2.0f * x);
+    break;
+  case RAMP_EXPONENTIAL:
+    // 1 - e^-5x, scaled to finish at 1. Within 1% of the end by 60% of the ramp time.
+    shape = (1.0f - expf(-5.0f * x)) / (1.0f - expf(-5.0f));
+    break;
+  case RAMP_LINEAR:
+  default:
+    shape = x;
+    break;
   }
+
+  return from + (int)roundf(((int)to - (int)from) * shape);
+}
+
+bool OutputRamping(uint8_t pinIndex)
+{
+  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
+    return false; // Ensure valid index
+
+  PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+  uint8_t p = pinIndex - bank.FirstChannel;
+  return bank.RampDuty[p] != bank.TargetDuty[p];
+}
+
+const uint32_t *PWMActiveTable(uint8_t bank)
+{
+  return PWMBanks[bank].Table[(PWMBanks[bank].hdma.Instance->CR & DMA_SxCR_CT) ? 1 : 0];
+}
+
+void forceOutputOff(uint8_t pinIndex)
+{
+  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
+    return; // Ensure valid index
+
+  dutyCycles[pinIndex] = 0;
+
+  PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+  uint8_t p = pinIndex - bank.FirstChannel;
+  uint16_t pin = bank.Pins[p];
+
+  // Drive the pin low directly, then clear both tables with the DMA interrupt held off. No soft stop.
+  noInterrupts();
+  bank.Port->BSRR = (uint32_t)pin << 16;
+  bank.TargetDuty[p] = 0;
+  bank.RampDuty[p] = 0;
+  bank.RampTo[p] = 0;
+  bank.RampSteps[p] = 0;
+  bank.ProbeOnSlots[p] = 0;
+  bank.TargetOnSlots[p] = 0;
+  for (int t = 0; t < 2; t++)
+  {
+    bank.WordsTouched += patchPWMTable(bank.Table[t], bank.Slots, pin, bank.TableStart[t][p], bank.TableOnSlots[t][p], bank.TableStart[t][p], 0);
+    bank.TableOnSlots[t][p] = 0;
+  }
+
+  // Again, in case the DMA turned it back on before the tables were cleared
+  bank.Port->BSRR = (uint32_t)pin << 16;
+  interrupts();
+}
+
+void forceOutputOn(uint8_t pinIndex)
+{
+  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
+    return; // Ensure valid index
+
+  dutyCycles[pinIndex] = PWM_DUTY_MAX;
+
+  PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+  uint8_t p = pinIndex - bank.FirstChannel;
+  uint16_t pin = bank.Pins[p];
+
+  // Fill both tables with the DMA interrupt held off so the next period doesn't start a ramp, then drive the pin
+  noInterrupts();
+  bank.TargetDuty[p] = PWM_DUTY_MAX;
+  bank.RampDuty[p] = PWM_DUTY_MAX;
+  bank.RampFrom[p] = PWM_DUTY_MAX;
+  bank.RampTo[p] = PWM_DUTY_MAX;
+  bank.RampSteps[p] = 0;
+  bank.TargetOnSlots[p] = bank.Slots;
+  for (int t = 0; t < 2; t++)
+  {
+    bank.WordsTouched += patchPWMTable(bank.Table[t], bank.Slots, pin, bank.TableStart[t][p], bank.TableOnSlots[t][p], bank.TableStart[t][p], bank.Slots);
+    bank.TableOnSlots[t][p] = bank.Slots;
+  }
+  bank.Port->BSRR = pin;
+  interrupts();
+}
+
+void probeOutput(uint8_t pinIndex, bool on)
+{
+  if (pinIndex >= NUM_PINS_G + NUM_PINS_F)
+    return; // Ensure valid index
+
+  PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+
+  // Picked up by the DMA interrupt at the end of the period
+  bank.ProbeOnSlots[pinIndex - bank.FirstChannel] = on ? constrain(bank.MinOnSlots, 1, bank.Slots) : 0;
+}
+
+uint32_t PWMPeriodMicros(uint8_t pinIndex)
+{
+  const PWMBank &bank = pinIndex < NUM_PINS_G ? PWMBanks[PWM_BANK_G] : PWMBanks[PWM_BANK_F];
+  return bank.SlotCycles * bank.Slots / (PWM_TIMER_CLOCK / 1000000);
+}
+
+// Current threshold in amps to milliamps
+static inline uint32_t thresholdMilliamps(float amps)
+{
+  return amps > 0.0f ? (uint32_t)(amps * 1000.0f) : 0;
+}
+
+// Raw level at which the analog watchdog turns an output off. The IS fault level always applies.
+// The high current threshold applies while the channel is being monitored and not ramping, unless the wire model is handling overcurrent.
+// Ganged outputs use their group's settings. One member carrying the whole group threshold is a fault.
+static uint16_t hardTripLevel(uint8_t i)
+{
+  uint8_t leader = GroupLeader[i];
+  uint16_t level = FAULT_THRESHOLD_RAW;
+
+  // Nothing to turn off. Stops an off-state fault current firing the watchdog every block.
+  if (OffDiagnosticIdle(leader) && !OffDiagnosticProbing(leader))
+  {
+    return ADCres;
+  }
+
+  if (ChannelMonitoring(leader) && !OutputRamping(leader) && !WireModelEnabled(leader))
+  {
+    level = min(level, milliampsToSense(i, thresholdMilliamps(Channels[leader].CurrentThresholdHigh)));
+  }
+
+  return level;
 }
 
 /// @brief Update PWM or digital outputs
 void UpdateOutputs()
 {
+  uint32_t now = micros();
+
+  UpdateGroups();
+
+  // Uses the sense readings taken with the outputs as they were set last update, so runs before they change
+  UpdateOffDiagnostics(now);
+
+  uint16_t tripLevels[NUM_CHANNELS];
+
   // Check the type of channel we're dealing with (digital or PWM) and handle output accordingly
   for (int i = 0; i < NUM_CHANNELS; i++)
   {
-    switch (Channels[i].ChanType)
-    {
-    case DIG_PWM:
-      if (Channels[i].Enabled)
-      {
-        // Calculate the adjusted PWM for volage/average power
-        float squared = (VBATT_NOMINAL / SystemRuntimeParams.VBatt) * (VBATT_NOMINAL / SystemRuntimeParams.VBatt);
-        int pwmActual = round(Channels[i].PWMSetDuty * squared);
+    tripLevels[i] = hardTripLevel(i);
 
-        // PWM range check
-        if (pwmActual > 100)
-        {
-          pwmActual = 100;
-        }
-        else if (pwmActual < 0)
-        {
-          pwmActual = 0;
-        }
-        updatePWMDutyCycle(i, pwmActual);
-
-        // TODO: Calibrate current readings for the BTS50025
-        int sum = 0;
-        uint8_t total = 0;
-        for (int j = 0; j < ANALOG_READ_SAMPLES; j++)
-        {
-          sum += analogRead(Channels[i].CurrentSensePin);
-          total++;
-        }
-        float analogMean = 0.0f;
-        if (total)
-        {
-          analogMean = sum / total;
-          ChannelRuntime[i].AnalogRaw = analogMean;
-        }
-
-        float isVoltage = (ChannelRuntime[i].AnalogRaw / ADCres) * V_REF;
-        float amps = (PWM_M * ChannelRuntime[i].AnalogRaw) + PWM_C;
+    // Ganged followers are switched and protected with their group leader, which has already been updated
+    if (GroupFollower(i))
+    {
+      ChannelRuntime[i].AnalogRaw = ADCOnResults[i];
+      ChannelRuntime[i].CurrentMilliamps = senseToMilliamps(i, ChannelRuntime[i].AnalogRaw);
+      ChannelRuntime[i].CurrentValue = ChannelRuntime[i].CurrentMilliamps / 1000.0f;
+      ChannelRuntime[i].ErrorFlags = ChannelRuntime[GroupLeader[i]].ErrorFlags;
+      continue;
+    }
 
-        if (ChannelRuntime[i].AnalogRaw < 5)
-        {
-          // No current detected, set to 0
-          amps = 0.0;
-        }
+    ChannelFSMInputs in = {};
+    uint16_t duty;
 
-        // Check for fault condition and current thresholds
-        if (isVoltage > FAULT_THRESHOLD)
-        {
-          ChannelRuntime[i].ErrorFlags |= IS_FAULT;
-        }
-        else if (amps > Channels[i].CurrentThresholdHigh)
-        {
-          ChannelRuntime[i].ErrorFlags |= CHN_OVERCURRENT;
-        }
-        else if (amps < Channels[i].CurrentThresholdLow)
-        {
-          ChannelRuntime[i].ErrorFlags |= CHN_UNDERCURRENT;
-        }
-        else
-        {
-          // No conditions found. Clear flag
-          if (!channelLocked[i])
-          {
-            ChannelRuntime[i].ErrorFlags = 0;
-          }
-        }
+    switch (Channels[i].ChanType)
+    {
+    case DIG_PWM:
+    case CAN_PWM:
+    case ANA_PWM:
+    {
+      // Duty set by the config, or by the analogue input for scaled channels. Battery compensation is applied each period by the output DMA interrupt.
+      duty = Channels[i].ChanType == ANA_PWM ? ChannelRuntime[i].InputDuty : Channels[i].PWMSetDuty * (PWM_DUTY_MAX / 100);
+      duty = min(duty, (uint16_t)PWM_DUTY_MAX);
 
-        ChannelRuntime[i].CurrentValue = amps;
-      }
-      else
-      {
-        updatePWMDutyCycle(i, 0);
-        ChannelRuntime[i].CurrentValue = 0.0;
-      }
+      // Mean of the samples taken while the output was on and settled. This is the on-state current, not the average.
+      ChannelRuntime[i].AnalogRaw = ADCOnResults[i];
+      in.Milliamps = Groups[i].OnMilliamps;
       break;
+    }
     case DIG:
     case CAN_DIGITAL:
-      if (Channels[i].Enabled)
-      {
-        static uint8_t trySampleCount[NUM_CHANNELS] = {0};
-        static float tryCurrentSum[NUM_CHANNELS] = {0.0f};
+    case ANA:
+      duty = PWM_DUTY_MAX;
 
-        // Read analog values first
-        int sum = 0;
-        uint8_t total = 0;
-        for (int j = 0; j < ANALOG_READ_SAMPLES; j++)
-        {
-          sum += analogRead(Channels[i].CurrentSensePin);
-          total++;
-        }
-        float analogMean = 0.0f;
-        if (total)
-        {
-          analogMean = sum / total;
-          ChannelRuntime[i].AnalogRaw = analogMean;
-        }
+      // Mean of all DMA samples since the last update
+      ChannelRuntime[i].AnalogRaw = ADCResults[i];
+      in.Milliamps = Groups[i].Milliamps;
+      break;
+    default:
+      updateGroupDutyCycle(i, 0);
+      ChannelRuntime[i].CurrentMilliamps = 0;
+      ChannelRuntime[i].CurrentValue = 0.0;
+      continue;
+    }
 
-        float milliVolts = (analogMean / (float)ADCres) * V_REF;
+    // Thresholds apply to the total current of a ganged group. Overcurrent is left to the wire model when it's configured.
+    in.Enabled = Channels[i].Enabled;
+    in.Settling = OutputRamping(i);
+    in.HighMilliamps = WireModelEnabled(i) ? 0 : thresholdMilliamps(Channels[i].CurrentThresholdHigh);
+    in.LowMilliamps = thresholdMilliamps(Channels[i].CurrentThresholdLow);
+    in.InrushTime = min(Channels[i].InrushDelay, (uint32_t)INRUSH_MAX) * 1000;
+    in.CooldownTime = (uint32_t)(Channels[i].RetryCooldown ? Channels[i].RetryCooldown : RETRY_COOLDOWN_DEFAULT) * 1000;
+    in.RetryCount = Channels[i].RetryCount;
+
+    // Faults that don't wait for the averaged current. The watchdog and wire model have already turned the output off.
+    uint16_t tripRaw = ADCCollectTrip(i);
+    if (tripRaw > 0)
+    {
+      in.Trip = tripRaw > FAULT_THRESHOLD_RAW ? IS_FAULT : CHN_OVERCURRENT;
+    }
+    else if (Groups[i].MaxOnRaw > FAULT_THRESHOLD_RAW)
+    {
+      in.Trip = IS_FAULT;
+    }
+    else if (WireTripped(i))
+    {
+      in.Trip = CHN_OVERCURRENT;
+    }
+    in.TripHeld = WireTripped(i) && !WireCooled(i);
 
-        float I_IS = milliVolts / R_IS;
-        ChannelRuntime[i].CurrentValue = k_ILIS * I_IS;
+    uint8_t previous = ChannelStates.State[i];
+    uint8_t state = ChannelFSMStep(i, in, now, ChannelRuntime[i].ErrorFlags);
 
-        if (ChannelRuntime[i].AnalogRaw < 5)
-        {
-          // No current detected, set to 0
-          ChannelRuntime[i].CurrentValue = 0.0;
-        }
+    // Keep the current waveform leading up to the fault. A watchdog trip has already frozen one.
+    if (state != previous && !channelStateInfo[state].OutputOn && (ChannelRuntime[i].ErrorFlags & (CHN_OVERCURRENT | IS_FAULT)))
+    {
+      CaptureTrigger(i, (ChannelRuntime[i].ErrorFlags & IS_FAULT) ? CAPTURE_IS_FAULT : CAPTURE_OVERCURRENT, 0, 0);
+    }
 
-        // Inrush delay expired. Now start evaluating current samples
-        if (millis() - enabledTimers[i] > (unsigned long)(Channels[i].InrushDelay))
-        {
-          // Add to rolling sum
-          tryCurrentSum[i] += ChannelRuntime[i].CurrentValue;
-          trySampleCount[i]++;
-
-          // Only evaluate once every 3 calls (~150ms)
-          if (trySampleCount[i] >= 3)
-          {
-            float avgCurrent = tryCurrentSum[i] / trySampleCount[i];
-            trySampleCount[i] = 0;
-            tryCurrentSum[i] = 0.0f;
-
-            // --- Fault checks using avgCurrent ---
-            if (!channelLocked[i])
-            {
-              ChannelRuntime[i].ErrorFlags = 0; // reset before checks
-            }
-
-            if (avgCurrent > Channels[i].CurrentThresholdHigh)
-            {
-              ChannelRuntime[i].ErrorFlags |= CHN_OVERCURRENT;
-            }
-            else if (avgCurrent < Channels[i].CurrentThresholdLow)
-            {
-              ChannelRuntime[i].ErrorFlags |= CHN_UNDERCURRENT;
-            }
-
-            // --- Retry / lockout handling ---
-            if (ChannelRuntime[i].ErrorFlags == 0)
-            {
-              // Only re-enable if not permanently locked
-              if (!channelLocked[i])
-              {
-                updatePWMDutyCycle(i, 255);
-              }
-              else
-              {
-                updatePWMDutyCycle(i, 0); // Keep it off if locked
-              }
-              retriesPending[i] = false;
-            }
-            else
-            {
-              if (!channelLocked[i])
-              {
-                retryCount[i]++;
-                updatePWMDutyCycle(i, 0); // turn off this try
-
-                if (retryCount[i] > Channels[i].RetryCount)
-                {
-                  channelLocked[i] = true;
-                  ChannelRuntime[i].ErrorFlags |= RETRY_LOCKOUT;
-                  updatePWMDutyCycle(i, 0);
-                }
-              }
-              else
-              {
-                updatePWMDutyCycle(i, 0); // locked
-              }
-            }
-          }
-        }
-        else
-        {
-          // Collecting samples: only keep channel ON if not permanently locked
-          if (!channelLocked[i])
-          {
-            updatePWMDutyCycle(i, 255); // keep channel ON so current can stabilise
-          }
-          else
-          {
-            updatePWMDutyCycle(i, 0); // keep locked channels OFF
-          }
-        }
-      }
-      else
-      {
-        updatePWMDutyCycle(i, 0);
-        // Reset retry state
-        retriesPending[i] = false;
-        retryCount[i] = 0;
-        channelLocked[i] = false;
-        ChannelRuntime[i].CurrentValue = 0.0;
-      }
-      break;
-    default:
-      updatePWMDutyCycle(i, 0);
+    // A wire trip is cleared once its cooldown is over, or when the channel is off and the wire has cooled
+    if ((previous == CHANNEL_FAULT_COOLDOWN && state == CHANNEL_RETRY) || (state == CHANNEL_OFF && !in.TripHeld))
+    {
+      ResetWireTrip(i);
+    }
+
+    if (channelStateInfo[state].OutputOn)
+    {
+      updateGroupDutyCycle(i, duty);
+    }
+    else if (state == CHANNEL_OFF)
+    {
+      updateGroupDutyCycle(i, 0); // Soft stop
+    }
+    else
+    {
+      ForceGroupOff(i); // Faulted or locked out. No soft stop.
+    }
+
+    if (state == CHANNEL_OFF)
+    {
+      ChannelRuntime[i].CurrentMilliamps = 0;
       ChannelRuntime[i].CurrentValue = 0.0;
-      break;
+    }
+    else
+    {
+      ChannelRuntime[i].CurrentMilliamps = senseToMilliamps(i, ChannelRuntime[i].AnalogRaw);
+      ChannelRuntime[i].CurrentValue = ChannelRuntime[i].CurrentMilliamps / 1000.0f;
     }
   }
+
+  ADCSetTripLevels(tripLevels);
 }
 
 void OutputsOff()
 {
   for (int i = 0; i < NUM_CHANNELS; i++)
   {
-    updatePWMDutyCycle(i, 0);
+    forceOutputOff(i);
     ChannelRuntime[i].CurrentValue = 0.0;
     ChannelRuntime[i].ErrorFlags = 0;
-    retriesPending[i] = false;
-    retryCount[i] = 0;
-    channelLocked[i] = false;
   }
+  ResetChannelFSM();
+  ResetOffDiagnostics();
 }
\ No newline at end of file
@@ -28,11 +28,78 @@
 #include <Globals.h>
 #include <System.h>
 
-// How many current sense samples to collect to calculate a mean
-#define ANALOG_READ_SAMPLES 100
-
-#define PWM_M 0.0168F
-#define PWM_C 0.0062F
+// PWM timer clock. TIM1 and TIM8 are on APB2 (84MHz) and run at twice the bus clock.
+#define PWM_TIMER_CLOCK 168000000
+
+// PWM frequency range (Hz)
+#define PWM_MIN_FREQUENCY 50
+#define PWM_MAX_FREQUENCY 2000
+
+// Output table length range. The table length sets the duty resolution, 1000 slots = 0.1%.
+// Tables are double buffered for each bank: 2 banks x 2 tables x 1000 slots x 4 bytes = 16kB.
+#define PWM_MIN_SLOTS 20
+#define PWM_MAX_SLOTS 1000
+
+// Maximum table slot rate (Hz). Limits DMA bus load; higher frequencies get fewer slots. 200kHz = 1000 slots at 200Hz, 100 slots at 2kHz.
+#define PWM_MAX_SLOT_RATE 200000
+
+// Duty cycle resolution used by updatePWMDutyCycle(). 1000 = 100.0%
+#define PWM_DUTY_MAX 1000
+
+// Phase staggering. The period is split into bins and each PWM output's on time is placed to minimise the peak predicted bank current.
+#define PWM_STAGGER_BINS 50
+#define PWM_STAGGER_DEFAULT_CURRENT 1.0F // Amps assumed for an output with no current reading yet
+#define PWM_STAGGER_CURRENT_CHANGE 0.25F // Relative change in an output's current before it is placed again
+
+// Output banks. Each bank is one GPIO port driven by its own timer and DMA stream.
+#define PWM_BANKS 2
+#define PWM_BANK_G 0 // GPIOG, TIM8, DMA2 Stream 1. Outputs 1 to 7
+#define PWM_BANK_F 1 // GPIOF, TIM1, DMA2 Stream 5. Outputs 8 to 14
+#define PWM_BANK_MAX_PINS 7
+
+// Pins to update
+const uint16_t GPIOG_PINS[] = {GPIO_PIN_10, GPIO_PIN_9, GPIO_PIN_6, GPIO_PIN_5, GPIO_PIN_4, GPIO_PIN_3, GPIO_PIN_2}; // Outputs 1 to 7
+const uint8_t NUM_PINS_G = sizeof(GPIOG_PINS) / sizeof(GPIOG_PINS[0]);
+
+const uint16_t GPIOF_PINS[] = {GPIO_PIN_15, GPIO_PIN_14, GPIO_PIN_13, GPIO_PIN_12, GPIO_PIN_2, GPIO_PIN_1, GPIO_PIN_0}; // Outputs 8 to 14
+const uint8_t NUM_PINS_F = sizeof(GPIOF_PINS) / sizeof(GPIOF_PINS[0]);
+
+/// @brief Output bank. Two BSRR tables are written to the port by DMA in double buffer mode (M0AR/M1AR), one slot per timer update.
+/// Duty changes are patched into the table that isn't being read and go live when the DMA switches to it at the end of a period.
+struct PWMBank
+{
+  GPIO_TypeDef *Port;
+  const uint16_t *Pins;
+  uint8_t NumPins;
+  uint8_t FirstChannel;                               // Channel index of Pins[0]
+  uint16_t Frequency;                                 // Achieved PWM frequency (Hz)
+  uint16_t Slots;                                     // Table length
+  uint16_t Prescaler;                                 // Timer prescaler
+  uint16_t SlotTicks;                                 // Timer ticks per slot
+  uint32_t SlotCycles;                                // Timer clock cycles per slot
+  uint16_t MinOnSlots;                                // Shortest on time. Shorter on times are set to 0%
+  uint16_t MaxOnSlots;                                // Longest on time. Longer on times are set to 100%
+  uint32_t Table[2][PWM_MAX_SLOTS];                   // BSRR tables
+  uint16_t TableOnSlots[2][PWM_BANK_MAX_PINS];        // On slots currently written into each table
+  uint16_t TableStart[2][PWM_BANK_MAX_PINS];          // First on slot currently written into each table
+  volatile uint16_t TargetDuty[PWM_BANK_MAX_PINS];    // Requested duty (0 - PWM_DUTY_MAX)
+  volatile uint16_t RampDuty[PWM_BANK_MAX_PINS];      // Duty being output while ramping towards TargetDuty
+  uint16_t RampFrom[PWM_BANK_MAX_PINS];               // Duty at the start of the ramp
+  uint16_t RampTo[PWM_BANK_MAX_PINS];                 // Duty at the end of the ramp
+  uint32_t RampStep[PWM_BANK_MAX_PINS];               // Periods since the start of the ramp
+  uint32_t RampSteps[PWM_BANK_MAX_PINS];              // Length of the ramp in periods
+  volatile uint16_t TargetOnSlots[PWM_BANK_MAX_PINS]; // Requested on slots
+  volatile uint16_t TargetStart[PWM_BANK_MAX_PINS];   // Requested first on slot (phase offset)
+  volatile uint16_t ProbeOnSlots[PWM_BANK_MAX_PINS];  // Least on slots while an off-state diagnostic probe is running
+  uint16_t PlacedOnSlots[PWM_BANK_MAX_PINS];          // On slots when the phase offset was last chosen
+  float PlacedCurrent[PWM_BANK_MAX_PINS];             // Predicted current when the phase offset was last chosen
+  uint32_t WordsTouched;                              // Table words written by patches since start up
+  DMA_HandleTypeDef hdma;
+  TIM_HandleTypeDef *htim;
+};
+
+/// @brief Output banks, indexed by PWM_BANK_G and PWM_BANK_F
+extern PWMBank PWMBanks[PWM_BANKS];
 
 #define V_REF 3.294F  // Reference voltage for ADC
 #define R_IS 1000.0F  // Sense resistor value in ohms (1kΩ)
@@ -40,25 +107,131 @@
 
 #define k_ILIS 18407.72F // Current sense ratio
 
-/// @brief Setup interrupts and analog read timers
+// Nominal current sense gain (mA per ADC count, Q16). Used for channels without a calibrated CurrentGain.
+#define CURRENT_GAIN_NOMINAL ((uint32_t)(k_ILIS * V_REF * 1000.0F / (ADCres * R_IS) * 65536.0F + 0.5F))
+
+// Raw current sense reading below which no current is reported
+#define CURRENT_NOISE_FLOOR 5
+
+// Raw current sense reading above which the BTS50010 is signalling a fault (FAULT_THRESHOLD volts)
+#define FAULT_THRESHOLD_RAW ((uint16_t)(FAULT_THRESHOLD / V_REF * ADCres))
+
+/// @brief Setup output GPIO, DMA and timers from the system PWM settings. Outputs don't run until StartOutputs().
 void InitialiseOutputs();
 
+/// @brief Start the output timers. Call after InitialiseADC() so the ADC is ready for the first sample trigger.
+void StartOutputs();
+
+/// @brief Rebuild what the outputs derive from the channel and system config: ganged groups and wire models.
+/// Called with the control loop held or stopped, so no update sees half a change.
+void ConfigureOutputs();
+
 /// @brief Put outputs to sleep (disable DMA and timers)
 void SleepOutputs();
 
 /// @brief Setup GPIO for outputs. Push-pull, no pullups.
 void setupGPIO();
 
-/// @brief Configure DMA. Memory -> peripheral to set BSRR.
+/// @brief Configure DMA. Memory -> peripheral to set BSRR, double buffered.
 void configureDMA();
 
-/// @brief Configure two timers to trigger DMA.
+/// @brief Configure two timers to trigger DMA. TIM8 is armed to start with TIM1.
 void configureTimer();
 
-/// @brief Update duty cycle
+/// @brief Calculate the timer settings and duty limits of a bank
+/// @param bank Bank to set up
+/// @param frequency Requested PWM frequency (Hz), limited to PWM_MIN_FREQUENCY - PWM_MAX_FREQUENCY
+/// @param slots Requested table length, limited to PWM_MIN_SLOTS - PWM_MAX_SLOTS and PWM_MAX_SLOT_RATE
+/// @param scanLocked Fit the slot time to a whole fraction of ADC_SCAN_PERIOD, for the bank whose timer triggers the ADC
+/// scans. The slot time nearest the request is used and the table length is then chosen for the frequency.
+void setPWMBankTiming(PWMBank &bank, uint16_t frequency, uint16_t slots, bool scanLocked = false);
+
+/// @brief Convert a duty cycle to table slots, applying the bank's minimum on and off times
+/// @param bank Output bank
+/// @param dutyCycle Duty cycle (0 - PWM_DUTY_MAX)
+/// @return On slots
+uint16_t dutyToOnSlots(const PWMBank &bank, uint16_t dutyCycle);
+
+/// @brief Update duty cycle. The change starts at the next PWM period, ramped by the channel's soft start / soft stop profile.
+/// @param pinIndex Pin index
+/// @param dutyCycle Duty cycle in tenths of a percent (0 - PWM_DUTY_MAX). Higher values are fully on.
+void updatePWMDutyCycle(uint8_t pinIndex, uint16_t dutyCycle);
+
+/// @brief Convert a raw current sense reading to load current using the channel calibration
+/// @param pinIndex Pin index
+/// @param raw Mean raw ADC reading
+/// @return Load current in milliamps
+uint32_t senseToMilliamps(uint8_t pinIndex, uint16_t raw);
+
+/// @brief Convert a load current to the raw current sense reading using the channel calibration
+/// @param pinIndex Pin index
+/// @param milliamps Load current in milliamps
+/// @return Raw ADC reading (0 - ADCres)
+uint16_t milliampsToSense(uint8_t pinIndex, uint32_t milliamps);
+
+/// @brief Duty at a point along a ramp
+/// @param profile Ramp profile
+/// @param from Duty at the start of the ramp
+/// @param to Duty at the end of the ramp
+/// @param step Periods since the start of the ramp
+/// @param steps Length of the ramp in periods
+/// @return Duty (0 - PWM_DUTY_MAX)
+uint16_t rampDuty(uint8_t profile, uint16_t from, uint16_t to, uint32_t step, uint32_t steps);
+
+/// @brief Check if an output is still ramping to its requested duty
+/// @param pinIndex Pin index
+/// @return True while ramping
+bool OutputRamping(uint8_t pinIndex);
+
+/// @brief Patch one pin in a BSRR table from its old to its new on window. With an unchanged start only the slots between
+/// the old and new on times are written.
+/// @param table BSRR table
+/// @param slots Table length
+/// @param pin GPIO pin mask
+/// @param oldStart First on slot currently in the table
+/// @param oldOnSlots On slots currently in the table
+/// @param newStart Required first on slot
+/// @param newOnSlots Required on slots
+/// @return Number of table words written
+uint16_t patchPWMTable(uint32_t *table, uint16_t slots, uint16_t pin, uint16_t oldStart, uint16_t oldOnSlots, uint16_t newStart, uint16_t newOnSlots);
+
+/// @brief Choose the phase of one output's on time against the predicted current of the other outputs in its bank
+/// @param profile Predicted bank current (A) in each of PWM_STAGGER_BINS bins
+/// @param onBins On time in bins
+/// @param amps Predicted on-state current of the output (A)
+/// @param currentBin Bin the output currently starts in. Kept unless another bin gives a lower peak.
+/// @return Start bin
+uint8_t choosePWMStartBin(const float *profile, uint8_t onBins, float amps, uint8_t currentBin);
+
+/// @brief Spread the on times of PWM outputs across the period. Outputs are only moved when their duty or current changes.
+/// Run from the main loop every STAGGER_INTERVAL rather than the control update. Placing an output takes
+/// PWM_STAGGER_BINS² steps, so a pass is bounded by the PWM channel count but too long to run every update.
+void StaggerOutputs();
+
+/// @brief Table currently being read by a bank's DMA stream
+/// @param bank PWM_BANK_G or PWM_BANK_F
+/// @return Active BSRR table
+const uint32_t *PWMActiveTable(uint8_t bank);
+
+/// @brief Turn an output off immediately, without waiting for the end of the PWM period or a soft stop. Used for faults.
+/// @param pinIndex Pin index
+void forceOutputOff(uint8_t pinIndex);
+
+/// @brief Turn an output fully on immediately, without waiting for the end of the PWM period or a soft start.
+/// Only for outputs without PWM or battery compensation. Used by the input edge fast path.
+/// @param pinIndex Pin index
+void forceOutputOn(uint8_t pinIndex);
+
+/// @brief Pulse an idle output for the shortest on time that gives a settled current sense sample, every period.
+/// Bypasses the soft start and battery compensation. Ended by probeOutput(pinIndex, false) or forceOutputOff().
+/// @param pinIndex Pin index
+/// @param on Start or stop the probe
+void probeOutput(uint8_t pinIndex, bool on);
+
+/// @brief Length of an output's PWM period. A change of duty or a probe waits for the end of the period to be output.
 /// @param pinIndex Pin index
-/// @param dutyCycle Duty cycle in percentage (0 - 100)
-void updatePWMDutyCycle(uint8_t pinIndex, uint8_t dutyCycle);
+/// @return Period (microseconds)
+uint32_t PWMPeriodMicros(uint8_t pinIndex);
 
 /// @brief Set PWM or digital outputs
 void UpdateOutputs();
@@ -0,0 +1,202 @@
+/*  RunOn.cpp Ignition-off run-on of selected output channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "RunOn.h"
+#include "ChannelFSM.h"
+#include <ChannelGroups.h>
+#include <OutputHandler.h>
+
+RunOnStatistics RunOnStats;
+
+// Channels held on, and their run-on times (milliseconds)
+static bool runOnHeld[NUM_CHANNELS];
+static uint32_t runOnTime[NUM_CHANNELS];
+
+// Start of the run-on (millis)
+static uint32_t runOnStart;
+
+// Totals for the mean current
+static uint64_t runOnMilliampTotal;
+static uint32_t runOnUpdates;
+
+// Time asleep (microseconds). Moved into the statistics each update.
+static uint32_t runOnSleepMicros;
+
+// Held channels are all steadily on
+static volatile bool runOnSteady;
+
+// Free running 1 MHz count. Keeps time while SysTick is stopped.
+static TIM_HandleTypeDef htim5;
+
+static void startSleepTimer()
+{
+  __HAL_RCC_TIM5_CLK_ENABLE();
+
+  // APB1 is divided, so its timers run at twice PCLK1
+  htim5.Instance = TIM5;
+  htim5.Init.Prescaler = HAL_RCC_GetPCLK1Freq() * 2 / 1000000 - 1;
+  htim5.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim5.Init.Period = 0xFFFFFFFF;
+  htim5.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim5.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+
+  HAL_TIM_Base_Init(&htim5);
+  HAL_TIM_Base_Start(&htim5);
+}
+
+static void stopSleepTimer()
+{
+  HAL_TIM_Base_Stop(&htim5);
+  HAL_TIM_Base_DeInit(&htim5);
+  __HAL_RCC_TIM5_CLK_DISABLE();
+}
+
+bool StartRunOn()
+{
+  bool running = false;
+  memset(&RunOnStats, 0, sizeof(RunOnStats));
+  runOnStart = millis();
+  runOnMilliampTotal = 0;
+  runOnUpdates = 0;
+  runOnSleepMicros = 0;
+  runOnSteady = false;
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    // The control loop holds the inputs while the ignition is off, so a channel switched off by the ignition is still on here
+    bool on = Channels[i].Enabled || channelStateInfo[ChannelStates.State[i]].OutputOn;
+    runOnHeld[i] = Channels[i].RunOn && on && Channels[i].RunOnTime > 0;
+    runOnTime[i] = min(Channels[i].RunOnTime, (uint32_t)MAX_RUN_ON_TIME);
+    running |= runOnHeld[i];
+  }
+
+  if (running)
+  {
+    startSleepTimer();
+  }
+
+  return running;
+}
+
+bool RunOnHeld(uint8_t channel)
+{
+  return runOnHeld[channel];
+}
+
+uint32_t RunOnRemaining()
+{
+  uint32_t elapsed = millis() - runOnStart;
+  uint32_t remaining = 0;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (runOnHeld[i] && runOnTime[i] > elapsed)
+    {
+      remaining = max(remaining, runOnTime[i] - elapsed);
+    }
+  }
+  return remaining;
+}
+
+void UpdateRunOn()
+{
+  uint32_t elapsed = millis() - runOnStart;
+  uint32_t milliamps = 0;
+  bool steady = true;
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (runOnHeld[i] && elapsed >= runOnTime[i])
+    {
+      runOnHeld[i] = false;
+    }
+
+    // Inputs aren't read while running on. Held channels stay on, with their fault handling, until their time is up.
+    Channels[i].Enabled = runOnHeld[i];
+    ChannelRuntime[i].Override = false;
+
+    // Group followers are stepped by their leader
+    if (runOnHeld[i] && !GroupFollower(i) && (ChannelStates.State[i] != CHANNEL_MONITOR || OutputRamping(i)))
+    {
+      steady = false;
+    }
+
+    milliamps += ChannelRuntime[i].CurrentMilliamps;
+  }
+
+  runOnSteady = steady;
+  runOnMilliampTotal += milliamps;
+  runOnUpdates++;
+
+  RunOnStats.Duration = elapsed;
+  RunOnStats.SleepTime = runOnSleepMicros / 1000;
+  RunOnStats.MeanLoadMilliamps = runOnMilliampTotal / runOnUpdates;
+  RunOnStats.PeakLoadMilliamps = max(RunOnStats.PeakLoadMilliamps, milliamps);
+}
+
+bool RunOnSteady()
+{
+  return runOnSteady;
+}
+
+void RunOnSleep()
+{
+  // Sleep rather than STOP mode. STOP halts the timers and DMA generating the PWM and sampling the current sense.
+  // Any interrupt wakes the MCU: the control loop timer, SysTick, the output and ADC DMA, or the ignition input.
+  // Interrupts are masked so the one that wakes it runs after the HAL tick has caught up.
+  noInterrupts();
+  bool steady = runOnSteady;
+  uint32_t start = htim5.Instance->CNT;
+
+  // Position within the current SysTick millisecond
+  uint32_t phase = micros() - millis() * 1000;
+
+  if (steady)
+  {
+    HAL_SuspendTick();
+  }
+
+  HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+  uint32_t slept = htim5.Instance->CNT - start;
+
+  if (steady)
+  {
+    // SysTick kept counting without its interrupt. Add the milliseconds it would have counted.
+    uwTick += (phase + slept) / 1000;
+    HAL_ResumeTick();
+  }
+  interrupts();
+
+  runOnSleepMicros += slept;
+  RunOnStats.WakeCount++;
+}
+
+void StopRunOn()
+{
+  RunOnStats.Duration = millis() - runOnStart;
+  RunOnStats.SleepTime = runOnSleepMicros / 1000;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    runOnHeld[i] = false;
+  }
+  runOnSteady = false;
+  stopSleepTimer();
+}
@@ -0,0 +1,70 @@
+/*  RunOn.h Ignition-off run-on of selected output channels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef RunOn_H
+#define RunOn_H
+
+#include <Arduino.h>
+#include <Globals.h>
+
+/// @brief Statistics for the current or most recent run-on.
+/// The board has no sense on its own supply, so its sleep current can't be measured. The load current of the held outputs
+/// stands in for it, with SleepTime against Duration for how much of the run-on the MCU spent in its low power state.
+struct __attribute__((packed)) RunOnStatistics
+{
+  uint32_t Duration;          // Time spent running on (milliseconds)
+  uint32_t SleepTime;         // Time the MCU spent asleep between wakes (milliseconds)
+  uint32_t WakeCount;         // Wakes from sleep, by any interrupt
+  uint32_t MeanLoadMilliamps; // Mean total current of the held outputs' loads. The PDM's own supply current isn't included
+  uint32_t PeakLoadMilliamps; // Highest total current of the held outputs' loads
+};
+
+/// @brief Run-on statistics. Kept until the next run-on starts
+extern RunOnStatistics RunOnStats;
+
+/// @brief Start running on at ignition off. Run-on channels that are on stay on for their run-on time, every other channel is turned off
+/// @return True if any channel is running on
+bool StartRunOn();
+
+/// @brief Channel is being held on after ignition off
+/// @param channel Channel index
+bool RunOnHeld(uint8_t channel);
+
+/// @brief Time until the last run-on channel turns off (milliseconds). Zero once they've all finished
+uint32_t RunOnRemaining();
+
+/// @brief Update the run-on channels. Turns off channels whose run-on time has passed and records the load current.
+/// Call each control update in place of HandleInputs(), before UpdateOutputs()
+void UpdateRunOn();
+
+/// @brief Every held channel is steadily on: past its inrush, not ramping and not faulted. Nothing needs the full control
+/// rate, so the control loop slows to CONTROL_RATE_RUN_ON and SysTick is stopped while asleep.
+bool RunOnSteady();
+
+/// @brief Sleep until the next interrupt. The output timers, DMA and ADC keep running. SysTick is stopped while the
+/// channels are steady, and the time asleep is added to the HAL tick on waking.
+void RunOnSleep();
+
+/// @brief Finish running on, at ignition on or when the last channel turns off
+void StopRunOn();
+
+#endif
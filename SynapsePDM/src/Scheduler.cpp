@@ -0,0 +1,209 @@
+/*  Scheduler.cpp Prioritised cooperative task scheduler.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "Scheduler.h"
+
+static SchedulerTask *schedulerTasks;
+static uint8_t schedulerCount;
+static uint32_t (*schedulerClock)();
+
+// Next background task to get a turn
+static uint8_t schedulerBackground;
+
+// Modes in force at the last run
+static uint16_t schedulerModes;
+
+/// @brief Time from one point to another. Right across a wrap of the clock as long as they're within 2^31 microseconds.
+static inline int32_t elapsed(uint32_t from, uint32_t to)
+{
+  return (int32_t)(to - from);
+}
+
+void InitialiseScheduler(SchedulerTask *tasks, uint8_t count, uint32_t (*clock)())
+{
+  schedulerTasks = tasks;
+  schedulerCount = count;
+  schedulerClock = clock;
+  schedulerBackground = 0;
+  schedulerModes = 0;
+
+  uint32_t now = clock();
+  for (int i = 0; i < count; i++)
+  {
+    SchedulerTask &task = tasks[i];
+    task.Release = now;
+    task.Held = false;
+    task.TotalMicros = 0;
+    memset(&task.Stats, 0, sizeof(task.Stats));
+  }
+}
+
+/// @brief Check if a task has to wait for a higher priority task
+/// @param task Task about to start
+/// @param now Time (microseconds)
+/// @param modes Modes in force
+/// @return True if a higher priority task is released before the task's longest run would end
+static bool heldBack(const SchedulerTask &task, uint32_t now, uint16_t modes)
+{
+  // Once at its deadline the task runs anyway, or it would never get a turn
+  if (task.Period && elapsed(task.Release, now) >= (int32_t)task.Deadline)
+  {
+    return false;
+  }
+
+  for (int i = 0; i < schedulerCount; i++)
+  {
+    const SchedulerTask &other = schedulerTasks[i];
+    if (other.Priority >= task.Priority || !other.Period || !(other.Modes & modes))
+    {
+      continue;
+    }
+
+    // A task too long for any gap between the other task's runs would never start, so it goes now and takes the miss
+    if (task.Stats.MaxMicros + other.Stats.MaxMicros >= other.Period)
+    {
+      continue;
+    }
+
+    if (elapsed(now, other.Release) < (int32_t)task.Stats.MaxMicros)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// @brief Run a task and record its timing
+/// @param task Task to run
+static void runTask(SchedulerTask &task)
+{
+  uint32_t start = schedulerClock();
+  task.Run();
+  uint32_t end = schedulerClock();
+
+  uint32_t runTime = end - start;
+  task.Stats.Runs++;
+  task.TotalMicros += runTime;
+  task.Stats.MeanMicros = task.TotalMicros / task.Stats.Runs;
+  task.Stats.MaxMicros = max(task.Stats.MaxMicros, runTime);
+
+  if (!task.Period)
+  {
+    return;
+  }
+
+  task.Stats.MaxLateMicros = max(task.Stats.MaxLateMicros, (uint32_t)elapsed(task.Release, start));
+  if (elapsed(task.Release, end) > (int32_t)task.Deadline)
+  {
+    task.Stats.Missed++;
+  }
+
+  // Next period starts a whole period on, so the task doesn't drift. A release that's already due runs late. Only releases
+  // a whole period or more behind are skipped and missed, so the task ends up at most one period behind.
+  task.Release += task.Period;
+  if (elapsed(task.Release, end) >= (int32_t)task.Period)
+  {
+    uint32_t behind = (end - task.Release) / task.Period;
+    task.Stats.Missed += behind;
+    task.Release += behind * task.Period;
+  }
+  task.Held = false;
+}
+
+bool RunScheduler(uint16_t modes)
+{
+  uint32_t now = schedulerClock();
+
+  // Highest priority periodic task that's been released
+  SchedulerTask *next = nullptr;
+  for (int i = 0; i < schedulerCount; i++)
+  {
+    SchedulerTask &task = schedulerTasks[i];
+    if (!(task.Modes & modes))
+    {
+      continue;
+    }
+
+    if (!(task.Modes & schedulerModes))
+    {
+      // Released as soon as it's back in its modes, without counting the time out of them as missed
+      task.Release = now;
+      task.Held = false;
+    }
+
+    if (!task.Period || elapsed(task.Release, now) < 0)
+    {
+      continue;
+    }
+
+    if (!next || task.Priority < next->Priority ||
+        (task.Priority == next->Priority && elapsed(task.Release + task.Deadline, next->Release + next->Deadline) > 0))
+    {
+      next = &task;
+    }
+  }
+
+  schedulerModes = modes;
+
+  // Background tasks take turns when nothing periodic is due
+  for (int i = 0; !next && i < schedulerCount; i++)
+  {
+    SchedulerTask &task = schedulerTasks[(schedulerBackground + i) % schedulerCount];
+    if (!task.Period && (task.Modes & modes))
+    {
+      next = &task;
+    }
+  }
+
+  if (!next)
+  {
+    return false;
+  }
+
+  if (heldBack(*next, now, modes))
+  {
+    if (next->Period && !next->Held)
+    {
+      next->Held = true;
+      next->Stats.Deferred++;
+    }
+    return false;
+  }
+
+  if (!next->Period)
+  {
+    schedulerBackground = (next - schedulerTasks + 1) % schedulerCount;
+  }
+  runTask(*next);
+  return true;
+}
+
+uint8_t SchedulerTaskCount()
+{
+  return schedulerCount;
+}
+
+const SchedulerStatistics &SchedulerStats(uint8_t task)
+{
+  return schedulerTasks[task].Stats;
+}
@@ -0,0 +1,74 @@
+/*  Scheduler.h Prioritised cooperative task scheduler.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef Scheduler_H
+#define Scheduler_H
+
+#include <Arduino.h>
+
+/// @brief Timing statistics of a task since start up
+struct __attribute__((packed)) SchedulerStatistics
+{
+  uint32_t Runs;          // Times the task has run
+  uint32_t Missed;        // Releases not finished by their deadline, including any skipped because the task fell a whole period behind
+  uint32_t Deferred;      // Releases held back so a higher priority task could start on time
+  uint32_t MaxMicros;     // Longest run (microseconds)
+  uint32_t MeanMicros;    // Mean run (microseconds)
+  uint32_t MaxLateMicros; // Longest wait from release to start (microseconds)
+};
+
+/// @brief A task in the scheduler's table. Fill in the first five fields, the rest belong to the scheduler.
+struct SchedulerTask
+{
+  void (*Run)();     // Task function. Runs to completion
+  uint32_t Period;   // Time between releases (microseconds). 0 for a background task, run whenever no periodic task is due
+  uint32_t Deadline; // Time after release the run must finish by (microseconds)
+  uint8_t Priority;  // 0 is the highest. Ties go to the earliest deadline
+  uint16_t Modes;    // Modes the task runs in, one bit each. Out of these modes the task isn't released
+
+  uint32_t Release;          // Start of the current period (microseconds)
+  bool Held;                 // Deferred in the current period
+  uint64_t TotalMicros;      // Run time of every run, for the mean (microseconds)
+  SchedulerStatistics Stats; // Timing statistics
+};
+
+/// @brief Start scheduling a task table. Every task is released straight away.
+/// @param tasks Task table. Must outlive the scheduler
+/// @param count Tasks in the table
+/// @param clock Time source (microseconds). Wraps through 2^32
+void InitialiseScheduler(SchedulerTask *tasks, uint8_t count, uint32_t (*clock)());
+
+/// @brief Run the most urgent task that's due, if any. A task only starts if its longest run so far ends before the next
+/// release of a higher priority task, unless it's already at its deadline, so a slow task can't hold up a more urgent one.
+/// @param modes Modes in force, one bit each
+/// @return True if a task ran
+bool RunScheduler(uint16_t modes);
+
+/// @brief Number of tasks in the table
+uint8_t SchedulerTaskCount();
+
+/// @brief Timing statistics of a task
+/// @param task Index into the task table
+/// @return Statistics
+const SchedulerStatistics &SchedulerStats(uint8_t task);
+
+#endif
@@ -21,11 +21,25 @@
 
 */
 #include "SerialComms.h"
+#include <WireProtection.h>
+#include <ADCHandler.h>
+#include <ChannelGroups.h>
+#include <ChannelFSM.h>
+#include <CurrentCalibration.h>
+#include <AnalogueControl.h>
+#include <RunOn.h>
+#include <FaultCapture.h>
+#include <InputEdges.h>
+#include <InputCapture.h>
+#include <LogicEngine.h>
+#include <Scheduler.h>
+#include <ControlLoop.h>
 
 ChannelConfigUnion SerialChannelData;
 byte configBuffer[1000] = {0};
 
-byte statusBuffer[1000] = {0};
+// Status packet. Sized for the whole REQUEST reply (getting on for 2 kB) with room to grow.
+byte statusBuffer[3072] = {0};
 int statusIndex = 0;
 
 bool receivingConfig = false;
@@ -36,6 +50,17 @@ uint32_t lastComms = 0;
 
 unsigned int readBufIdx = 0;
 
+// Add bytes to the status buffer and checksum
+static void addStatusBytes(const void *data, size_t length, uint32_t &checkSum)
+{
+    const byte *bytes = (const byte *)data;
+    for (size_t j = 0; j < length; j++)
+    {
+        statusBuffer[statusIndex++] = bytes[j];
+        checkSum += bytes[j];
+    }
+}
+
 void InitialiseSerial()
 {
     Serial.begin(921600); // 921600 baud. Doesn't matter on USB CDC. Good to match the PC side though.
@@ -104,6 +129,10 @@ void CheckSerial()
             byte threeBytePacket[3];
             byte twoBytePacket[2];
             byte chanSize = 0;
+
+            // Runtime data from one control update
+            ControlSnapshot snapshot;
+            ReadControlSnapshot(snapshot);
             byte send = 0;
             statusIndex = 0;
             memset(statusBuffer, 0, sizeof(statusBuffer));
@@ -129,8 +158,8 @@ void CheckSerial()
                 statusBuffer[statusIndex++] = (byte)Channels[i].ChanType;
                 checkSum += (byte)Channels[i].ChanType;
 
-                statusBuffer[statusIndex++] = ChannelRuntime[i].Override;
-                checkSum += ChannelRuntime[i].Override;
+                statusBuffer[statusIndex++] = snapshot.Channels[i].Override;
+                checkSum += snapshot.Channels[i].Override;
 
                 statusBuffer[statusIndex++] = Channels[i].CurrentSensePin;
                 checkSum += Channels[i].CurrentSensePin;
@@ -149,7 +178,7 @@ void CheckSerial()
                     checkSum += fourBytePacket[j];
                 }
 
-                memcpy(&fourBytePacket, &ChannelRuntime[i].CurrentValue, sizeof(ChannelRuntime[i].CurrentValue));
+                memcpy(&fourBytePacket, &snapshot.Channels[i].CurrentValue, sizeof(snapshot.Channels[i].CurrentValue));
                 for (uint j = 0; j < sizeof(fourBytePacket); j++)
                 {
                     statusBuffer[statusIndex++] = fourBytePacket[j];
@@ -159,8 +188,8 @@ void CheckSerial()
                 statusBuffer[statusIndex++] = Channels[i].Enabled;
                 checkSum += Channels[i].Enabled;
 
-                statusBuffer[statusIndex++] = ChannelRuntime[i].ErrorFlags;
-                checkSum += ChannelRuntime[i].ErrorFlags;
+                statusBuffer[statusIndex++] = snapshot.Channels[i].ErrorFlags;
+                checkSum += snapshot.Channels[i].ErrorFlags;
 
                 statusBuffer[statusIndex++] = Channels[i].GroupNumber;
                 checkSum += Channels[i].GroupNumber;
@@ -243,10 +272,33 @@ void CheckSerial()
 
                 statusBuffer[statusIndex++] = AnalogueIns[i].PWMMax;
                 checkSum += AnalogueIns[i].PWMMax;
+
+                memcpy(&twoBytePacket, &AnalogueIns[i].FilterTime, sizeof(AnalogueIns[i].FilterTime));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &AnalogueMillivolts[i], sizeof(AnalogueMillivolts[i]));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                statusBuffer[statusIndex++] = AnalogueIns[i].DebounceTime;
+                checkSum += AnalogueIns[i].DebounceTime;
+                statusBuffer[statusIndex++] = AnalogueIns[i].CaptureMode;
+                checkSum += AnalogueIns[i].CaptureMode;
+                statusBuffer[statusIndex++] = AnalogueIns[i].FilterMode;
+                checkSum += AnalogueIns[i].FilterMode;
+                statusBuffer[statusIndex++] = AnalogueIns[i].MedianLength;
+                checkSum += AnalogueIns[i].MedianLength;
             }
 
             // Send system parameters
-            memcpy(&fourBytePacket, &SystemRuntimeParams.SystemTemperature, sizeof(SystemRuntimeParams.SystemTemperature));
+            memcpy(&fourBytePacket, &snapshot.System.SystemTemperature, sizeof(snapshot.System.SystemTemperature));
             for (uint j = 0; j < sizeof(fourBytePacket); j++)
             {
                 statusBuffer[statusIndex++] = fourBytePacket[j];
@@ -256,14 +308,14 @@ void CheckSerial()
             statusBuffer[statusIndex++] = SystemParams.CANResEnabled;
             checkSum += SystemParams.CANResEnabled;
 
-            memcpy(&fourBytePacket, &SystemRuntimeParams.VBatt, sizeof(SystemRuntimeParams.VBatt));
+            memcpy(&fourBytePacket, &snapshot.System.VBatt, sizeof(snapshot.System.VBatt));
             for (uint j = 0; j < sizeof(fourBytePacket); j++)
             {
                 statusBuffer[statusIndex++] = fourBytePacket[j];
                 checkSum += fourBytePacket[j];
             }
 
-            memcpy(&fourBytePacket, &SystemRuntimeParams.SystemCurrent, sizeof(SystemRuntimeParams.SystemCurrent));
+            memcpy(&fourBytePacket, &snapshot.System.SystemCurrent, sizeof(snapshot.System.SystemCurrent));
             for (uint j = 0; j < sizeof(fourBytePacket); j++)
             {
                 statusBuffer[statusIndex++] = fourBytePacket[j];
@@ -273,7 +325,7 @@ void CheckSerial()
             statusBuffer[statusIndex++] = SystemParams.SystemCurrentLimit;
             checkSum += SystemParams.SystemCurrentLimit;
 
-            memcpy(&twoBytePacket, &SystemRuntimeParams.ErrorFlags, sizeof(SystemRuntimeParams.ErrorFlags));
+            memcpy(&twoBytePacket, &snapshot.System.ErrorFlags, sizeof(snapshot.System.ErrorFlags));
             for (uint j = 0; j < sizeof(twoBytePacket); j++)
             {
                 statusBuffer[statusIndex++] = twoBytePacket[j];
@@ -334,6 +386,149 @@ void CheckSerial()
             statusBuffer[statusIndex++] = mobileSignalBars;
             checkSum += mobileSignalBars;
 
+            for (int i = 0; i < 2; i++)
+            {
+                memcpy(&twoBytePacket, &SystemParams.PWMFrequency[i], sizeof(SystemParams.PWMFrequency[i]));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &SystemParams.PWMSlots[i], sizeof(SystemParams.PWMSlots[i]));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+            }
+
+            // Digital input debounce times (ms)
+            addStatusBytes(SystemParams.DigitalDebounce, sizeof(SystemParams.DigitalDebounce), checkSum);
+
+            for (int i = 0; i < NUM_CHANNELS; i++)
+            {
+                statusBuffer[statusIndex++] = Channels[i].RampProfile;
+                checkSum += Channels[i].RampProfile;
+
+                memcpy(&twoBytePacket, &Channels[i].RampUpTime, sizeof(Channels[i].RampUpTime));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &Channels[i].RampDownTime, sizeof(Channels[i].RampDownTime));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&fourBytePacket, &Channels[i].CurrentGain, sizeof(Channels[i].CurrentGain));
+                for (uint j = 0; j < sizeof(fourBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = fourBytePacket[j];
+                    checkSum += fourBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &Channels[i].CurrentOffset, sizeof(Channels[i].CurrentOffset));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &Channels[i].WireCrossSection, sizeof(Channels[i].WireCrossSection));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &Channels[i].WireRatedCurrent, sizeof(Channels[i].WireRatedCurrent));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                memcpy(&twoBytePacket, &Channels[i].WireTimeConstant, sizeof(Channels[i].WireTimeConstant));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                statusBuffer[statusIndex++] = WireHeatPercent(i);
+                checkSum += WireHeatPercent(i);
+
+                statusBuffer[statusIndex++] = GroupImbalance[i];
+                checkSum += (uint8_t)GroupImbalance[i];
+
+                memcpy(&twoBytePacket, &Channels[i].RetryCooldown, sizeof(Channels[i].RetryCooldown));
+                for (uint j = 0; j < sizeof(twoBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = twoBytePacket[j];
+                    checkSum += twoBytePacket[j];
+                }
+
+                statusBuffer[statusIndex++] = ChannelStates.State[i];
+                checkSum += ChannelStates.State[i];
+
+                statusBuffer[statusIndex++] = Channels[i].Compensation;
+                checkSum += Channels[i].Compensation;
+
+                statusBuffer[statusIndex++] = Channels[i].OffDiagnostics;
+                checkSum += Channels[i].OffDiagnostics;
+            }
+
+            // Channels left out of their configured group
+            addStatusBytes((const void *)&GroupRejects, sizeof(GroupRejects), checkSum);
+
+            // Analog watchdog trip statistics
+            uint32_t tripStats[4] = {ADCTripCount, ADCTripLatency, ADCTripLatencyMax, ADCWatchdogRaises};
+            for (int i = 0; i < 4; i++)
+            {
+                memcpy(&fourBytePacket, &tripStats[i], sizeof(tripStats[i]));
+                for (uint j = 0; j < sizeof(fourBytePacket); j++)
+                {
+                    statusBuffer[statusIndex++] = fourBytePacket[j];
+                    checkSum += fourBytePacket[j];
+                }
+            }
+
+            // Statistics from the last run-on after ignition off: duration, time asleep, wakes, mean and peak load current of the held
+            // outputs. There's no board supply current to report, so the load current stands in for the sleep current.
+            addStatusBytes(&RunOnStats, sizeof(RunOnStats), checkSum);
+
+            // Fault captures written to the SD card, and those lost
+            uint32_t captureStats[2] = {CaptureCount, CaptureMissed};
+            addStatusBytes(captureStats, sizeof(captureStats), checkSum);
+
+            // Input edges: queued, dropped, switched and deferred by the fast path, and edge to output / control update times
+            addStatusBytes(&InputEdgeStats, sizeof(InputEdgeStats), checkSum);
+
+            // Measured frequency (mHz) and duty (0.1%) of each input, digital inputs first, and the per-edge cost of measuring them
+            addStatusBytes(InputMillihertz, sizeof(InputMillihertz), checkSum);
+            addStatusBytes(InputDutyCycle, sizeof(InputDutyCycle), checkSum);
+            addStatusBytes(&InputCaptureStats, sizeof(InputCaptureStats), checkSum);
+
+            // Result of each channel's logic program and the cycles it took, latest and longest
+            addStatusBytes(LogicResult, sizeof(LogicResult), checkSum);
+            addStatusBytes(LogicStats, sizeof(LogicStats), checkSum);
+
+            // Main task timing: runs, deadlines missed, starts deferred for the control task, and run and start lateness (microseconds)
+            uint8_t taskCount = SchedulerTaskCount();
+            addStatusBytes(&taskCount, sizeof(taskCount), checkSum);
+            for (int i = 0; i < taskCount; i++)
+            {
+                addStatusBytes(&SchedulerStats(i), sizeof(SchedulerStatistics), checkSum);
+            }
+
+            // Control loop timing (nanoseconds): updates, late starts, overruns, updates over budget, and latest, mean and worst case run times
+            addStatusBytes(&ControlLoopStats, sizeof(ControlLoopStats), checkSum);
+
             send = SERIAL_TRAILER & 0xFF;
             checkSum += send;
             statusBuffer[statusIndex++] = send;
@@ -376,6 +571,9 @@ void CheckSerial()
                 }
             }
 
+            // Applied between control updates, so they never see half a change
+            HoldControlLoop();
+
             // Check header and trailer
             if ((configBuffer[0] == (SERIAL_HEADER & 0XFF)) && (configBuffer[1] == (SERIAL_HEADER >> 8)) &&
                 (configBuffer[readBufIdx - 6] == (SERIAL_TRAILER & 0xFF)) && (configBuffer[readBufIdx - 5] == (SERIAL_TRAILER >> 8)))
@@ -466,6 +664,56 @@ void CheckSerial()
                                 Channels[configBuffer[CONFIG_DATA_INDEX]].RunOnTime = 0;
                             }
                             break;
+                        case 13: // Ramp profile
+                            if (configBuffer[CONFIG_DATA_START_INDEX] > RAMP_EXPONENTIAL)
+                            {
+                                Channels[configBuffer[CONFIG_DATA_INDEX]].RampProfile = RAMP_NONE;
+                            }
+                            else
+                            {
+                                Channels[configBuffer[CONFIG_DATA_INDEX]].RampProfile = configBuffer[CONFIG_DATA_START_INDEX];
+                            }
+                            break;
+                        case 14: // Ramp up time
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].RampUpTime, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].RampUpTime));
+                            break;
+                        case 15: // Ramp down time
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].RampDownTime, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].RampDownTime));
+                            break;
+                        case 16: // Current sense gain (mA per count, Q16). 0 restores the nominal gain.
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].CurrentGain, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].CurrentGain));
+                            break;
+                        case 17: // Current sense offset (counts)
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].CurrentOffset, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].CurrentOffset));
+                            break;
+                        case 18: // Wire cross section (0.01 mm²)
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].WireCrossSection, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].WireCrossSection));
+                            break;
+                        case 19: // Wire rated current (0.1 A)
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].WireRatedCurrent, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].WireRatedCurrent));
+                            break;
+                        case 20: // Wire time constant (ms)
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].WireTimeConstant, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].WireTimeConstant));
+                            break;
+                        case 21: // Retry cooldown (ms)
+                            memcpy(&Channels[configBuffer[CONFIG_DATA_INDEX]].RetryCooldown, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(Channels[configBuffer[CONFIG_DATA_INDEX]].RetryCooldown));
+                            break;
+                        case 22: // Battery voltage compensation
+                            if (configBuffer[CONFIG_DATA_START_INDEX] >= VBATT_COMP_MODES)
+                            {
+                                validPacket = false;
+                                break;
+                            }
+                            Channels[configBuffer[CONFIG_DATA_INDEX]].Compensation = configBuffer[CONFIG_DATA_START_INDEX];
+                            break;
+                        case 23: // Off-state diagnostics
+                            if (configBuffer[CONFIG_DATA_START_INDEX] >= OFF_DIAG_MODES)
+                            {
+                                validPacket = false;
+                                break;
+                            }
+                            Channels[configBuffer[CONFIG_DATA_INDEX]].OffDiagnostics = configBuffer[CONFIG_DATA_START_INDEX];
+                            break;
 
                         default:
                             // Channel parameter out of range. Ignore packet
@@ -507,6 +755,61 @@ void CheckSerial()
                         case 9: // PWM max
                             AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].PWMMax = configBuffer[CONFIG_DATA_START_INDEX];
                             break;
+                        case 10: // Filter time constant (ms)
+                            memcpy(&AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].FilterTime, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].FilterTime));
+                            break;
+                        case 11: // Duty map. Point count then (millivolts, duty) pairs in ascending voltage.
+                        {
+                            AnalogueInputs &input = AnalogueIns[configBuffer[CONFIG_DATA_INDEX]];
+                            uint8_t points = configBuffer[CONFIG_DATA_START_INDEX];
+                            if (points > ANA_MAP_POINTS)
+                            {
+                                validPacket = false;
+                                break;
+                            }
+
+                            input.MapPoints = points;
+                            for (int p = 0; p < points; p++)
+                            {
+                                const byte *point = &configBuffer[CONFIG_DATA_START_INDEX + 1 + p * 3];
+                                memcpy(&input.MapMillivolts[p], point, sizeof(input.MapMillivolts[p]));
+                                input.MapDuty[p] = point[2];
+                            }
+                            break;
+                        }
+                        case 12: // Debounce time when used as digital (ms)
+                            AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].DebounceTime = configBuffer[CONFIG_DATA_START_INDEX];
+                            break;
+                        case 13: // Capture mode
+                            if (configBuffer[CONFIG_DATA_START_INDEX] < ANA_CAPTURE_MODES)
+                            {
+                                AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].CaptureMode = configBuffer[CONFIG_DATA_START_INDEX];
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
+                        case 14: // Filter mode
+                            if (configBuffer[CONFIG_DATA_START_INDEX] < ANA_FILTER_MODES)
+                            {
+                                AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].FilterMode = configBuffer[CONFIG_DATA_START_INDEX];
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
+                        case 15: // Median filter length (samples). Odd, up to ANA_MEDIAN_MAX
+                            if ((configBuffer[CONFIG_DATA_START_INDEX] & 1) && configBuffer[CONFIG_DATA_START_INDEX] <= ANA_MEDIAN_MAX)
+                            {
+                                AnalogueIns[configBuffer[CONFIG_DATA_INDEX]].MedianLength = configBuffer[CONFIG_DATA_START_INDEX];
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
                         default:
                             // Analogue parameter out of range. Ignore packet
                             validPacket = false;
@@ -554,6 +857,26 @@ void CheckSerial()
                         case 10: // System config CAN ID
                             memcpy(&SystemParams.SystemConfigDataCANID, &configBuffer[CONFIG_DATA_START_INDEX], sizeof(SystemParams.SystemConfigDataCANID));
                             break;
+                        case 11: // PWM frequency. Data index is the output bank. Applied on next wake.
+                            if (configBuffer[CONFIG_DATA_INDEX] < 2)
+                            {
+                                memcpy(&SystemParams.PWMFrequency[configBuffer[CONFIG_DATA_INDEX]], &configBuffer[CONFIG_DATA_START_INDEX], sizeof(SystemParams.PWMFrequency[0]));
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
+                        case 12: // PWM table length. Data index is the output bank. Applied on next wake.
+                            if (configBuffer[CONFIG_DATA_INDEX] < 2)
+                            {
+                                memcpy(&SystemParams.PWMSlots[configBuffer[CONFIG_DATA_INDEX]], &configBuffer[CONFIG_DATA_START_INDEX], sizeof(SystemParams.PWMSlots[0]));
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
                         default:
                             // System parameter out of range. Ignore packet
                             validPacket = false;
@@ -564,10 +887,73 @@ void CheckSerial()
                         break;
 
                     case CONFIG_DATA_DIGITAL:
+                        switch (configBuffer[CONFIG_PARAMETER_INDEX])
+                        {
+                        case 0: // Debounce time (ms). Data index is the digital input.
+                            if (configBuffer[CONFIG_DATA_INDEX] < NUM_DI_CHANNELS)
+                            {
+                                SystemParams.DigitalDebounce[configBuffer[CONFIG_DATA_INDEX]] = configBuffer[CONFIG_DATA_START_INDEX];
+                            }
+                            else
+                            {
+                                validPacket = false;
+                            }
+                            break;
+                        default:
+                            // Digital parameter out of range. Ignore packet
+                            validPacket = false;
+                            break;
+                        }
                         connectionStatus = 6;
 
                         break;
 
+                    case CONFIG_DATA_CALIBRATION:
+                    {
+                        uint8_t channel = configBuffer[CONFIG_DATA_INDEX];
+                        uint8_t mode = configBuffer[CONFIG_PARAMETER_INDEX];
+                        uint8_t count = configBuffer[CONFIG_DATA_START_INDEX];
+
+                        if (channel >= NUM_CHANNELS || mode >= CAL_MODES || count > CAL_POINTS ||
+                            readBufIdx != CONFIG_DATA_START_INDEX + 1 + count * sizeof(CalibrationPoint) + 6)
+                        {
+                            validPacket = false;
+                            break;
+                        }
+
+                        // Points are applied straight away and stored with the next save
+                        CalibrationTable &table = CalibrationConfigData.data[channel][mode];
+                        memset(&table, 0, sizeof(table));
+                        table.Count = count;
+                        memcpy(table.Points, &configBuffer[CONFIG_DATA_START_INDEX + 1], count * sizeof(CalibrationPoint));
+                        ApplyCalibration(channel);
+                        break;
+                    }
+
+                    case CONFIG_DATA_LOGIC:
+                    {
+                        uint8_t channel = configBuffer[CONFIG_DATA_INDEX];
+                        uint8_t length = configBuffer[CONFIG_DATA_START_INDEX];
+                        const byte *code = &configBuffer[CONFIG_DATA_START_INDEX + 1];
+
+                        // Programs that could fail at run time are turned away here
+                        if (channel >= NUM_CHANNELS || length > LOGIC_CODE_SIZE ||
+                            readBufIdx != CONFIG_DATA_START_INDEX + 1 + length + 6 ||
+                            (length > 0 && !VerifyLogicProgram(code, length)))
+                        {
+                            validPacket = false;
+                            break;
+                        }
+
+                        // Runs from the next control tick and is stored with the next save
+                        LogicProgram &program = LogicConfigData.data[channel];
+                        memset(&program, 0, sizeof(program));
+                        program.Length = length;
+                        memcpy(program.Code, code, length);
+                        ApplyLogic(channel);
+                        break;
+                    }
+
                     default:
                         // Config type out of range. Ignore packet
                         validPacket = false;
@@ -586,6 +972,12 @@ void CheckSerial()
                 connectionStatus = 9;
             }
 
+            if (validPacket)
+            {
+                CompileInputRouting();
+            }
+            ReleaseControlLoop();
+
             if (validPacket)
             {
                 Serial.write(COMMAND_ID_CONFIM);
@@ -607,6 +999,8 @@ void CheckSerial()
             SaveChannelConfig();
             SaveSystemConfig();
             SaveAnalogueConfig();
+            SaveCalibrationConfig();
+            SaveLogicConfig();
 
             bool allSaved = true;
 
@@ -633,7 +1027,9 @@ void CheckSerial()
             if (LoadAnalogueConfig())
             {
                 allSaved &= true;
+                HoldControlLoop();
                 InitialiseInputs();
+                ReleaseControlLoop();
             }
             else
             {
@@ -641,6 +1037,26 @@ void CheckSerial()
                 connectionStatus = 13;
             }
 
+            if (LoadCalibrationConfig())
+            {
+                allSaved &= true;
+            }
+            else
+            {
+                allSaved &= false;
+                connectionStatus = 14;
+            }
+
+            if (LoadLogicConfig())
+            {
+                allSaved &= true;
+            }
+            else
+            {
+                allSaved &= false;
+                connectionStatus = 15;
+            }
+
             if (allSaved)
             {
                 backgroundDrawn = false; // Force display redraw
@@ -650,6 +1066,42 @@ void CheckSerial()
                                   : COMMAND_ID_CHECKSUM_FAIL);
             break;
         }
+        case COMMAND_ID_CAL_CAPTURE:
+        {
+            // Current sense reading of one channel for calibration. The channel number follows the command.
+            delay(10); // Wait for the channel number
+            byte channel = Serial.available() ? Serial.read() : NUM_CHANNELS;
+            if (channel >= NUM_CHANNELS)
+            {
+                Serial.write(COMMAND_ID_CHECKSUM_FAIL);
+                break;
+            }
+
+            uint32_t checkSum = 0;
+            uint8_t type = Channels[channel].ChanType;
+            ControlSnapshot snapshot;
+            ReadControlSnapshot(snapshot);
+            uint16_t analogRaw = snapshot.Channels[channel].AnalogRaw;
+            uint32_t milliamps = snapshot.Channels[channel].CurrentMilliamps;
+            statusIndex = 0;
+
+            addStatusBytes(&SERIAL_HEADER, sizeof(SERIAL_HEADER), checkSum);
+            addStatusBytes(&COMMAND_ID_CAL_CAPTURE, sizeof(COMMAND_ID_CAL_CAPTURE), checkSum);
+            addStatusBytes(&channel, sizeof(channel), checkSum);
+            addStatusBytes(&type, sizeof(type), checkSum);
+
+            // Reading the calibration applies to (mean for digital outputs, on-state mean for PWM) and the current it gives now
+            addStatusBytes(&analogRaw, sizeof(analogRaw), checkSum);
+            addStatusBytes(&milliamps, sizeof(milliamps), checkSum);
+            addStatusBytes(&SERIAL_TRAILER, sizeof(SERIAL_TRAILER), checkSum);
+
+            memcpy(&statusBuffer[statusIndex], &checkSum, sizeof(checkSum));
+            statusIndex += sizeof(checkSum);
+
+            Serial.write(statusBuffer, statusIndex);
+            break;
+        }
+
         case COMMAND_ID_FW_VER:
             Serial.write(FW_VER);
             break;
@@ -56,6 +56,7 @@ const byte COMMAND_ID_CHECKSUM_FAIL = 'f';
 const byte COMMAND_ID_SAVECHANGES = 'S';
 const byte COMMAND_ID_FW_VER = 'v';
 const byte COMMAND_ID_BUILD_DATE = 'd';
+const byte COMMAND_ID_CAL_CAPTURE = 'a';
 
 /// @brief Config type index, channel, input or system
 const byte CONFIG_TYPE_INDEX = 2;
@@ -73,6 +74,8 @@ const byte CONFIG_DATA_CHANNELS = 0;
 const byte CONFIG_DATA_ANALOGUE = 1;
 const byte CONFIG_DATA_SYSTEM = 2;
 const byte CONFIG_DATA_DIGITAL = 3;
+const byte CONFIG_DATA_CALIBRATION = 4; // Parameter index is the CalibrationMode. Data is the point count then (raw, mA) pairs.
+const byte CONFIG_DATA_LOGIC = 5;       // Data index is the channel. Data is the program length then its bytecode. Length 0 removes the program.
 
 /// @brief Config storage union
 extern ChannelConfigUnion SerialChannelData;
@@ -22,6 +22,10 @@
 */
 
 #include "Storage.h"
+#include <CurrentCalibration.h>
+#include <LogicEngine.h>
+#include <InputCapture.h>
+#include <ControlLoop.h>
 
 uint16_t bufferIndex = 0;
 StorageConfigUnion StorageConfigData;
@@ -34,6 +38,8 @@ uint32_t BytesStored;
 bool UndervoltageLatch;
 bool StorageCRCValid;
 bool AnalogueCRCValid;
+bool CalibrationCRCValid;
+bool LogicCRCValid;
 bool SDFileOpen = false; // Track whether SD file is currently open
 
 CircularBuffer<String, 10> logs;
@@ -44,6 +50,7 @@ M95640R EEPROMext(&SPI_2, CS1);
 
 const char systemHeader[] = "Date,Time,System Temp,System Voltage,System Current,Error Flags,IMU Accel X,IMU Accel Y,IMU Accel Z,IMU Gyro X,IMU Gyro Y,IMU Gyro Z,Lat,Lon,Alt,Speed,Accuracy,";
 const char channelHeader[] = "Channel Type,Enabled,Current Value,Current Threshold High,Current Threshold Low,Multi-Channel,Group Number,Channel Error Flags";
+const char captureHeader[] = "Input Frequency,Input Duty";
 
 long startMillis;
 long endMillis;
@@ -171,7 +178,9 @@ bool LoadChannelConfig()
     if (result == checksum)
     {
         validCRC = true;
+        HoldControlLoop();
         memcpy(&Channels, &ChannelConfigData.data, sizeof(Channels));
+        ReleaseControlLoop();
     }
 
     EEPROMindex = 0;
@@ -344,7 +353,9 @@ bool LoadSystemConfig()
     if (result == checksum)
     {
         validCRC = true;
+        HoldControlLoop();
         memcpy(&SystemParams, &SystemConfigData.data, sizeof(SystemParams));
+        ReleaseControlLoop();
     }
 
     EEPROMindex = 0;
@@ -634,7 +645,267 @@ bool LoadAnalogueConfig()
     {
         validCRC = true;
         // Copy analogue input info
+        HoldControlLoop();
         memcpy(&AnalogueIns, &AnalogueConfigData.data, sizeof(AnalogueIns));
+        ReleaseControlLoop();
+    }
+
+    // Reset EEPROM index
+    EEPROMindex = 0;
+    EEPROMext.end();
+    SPI_2.end();
+
+    return validCRC;
+}
+
+void SaveCalibrationConfig()
+{
+    SPI_2.begin();
+    EEPROMext.begin(EEPROM_SPI_SPEED);
+
+    // Calibration follows channel + CRC + system + CRC + storage + CRC + analogue + CRC
+    EEPROMindex =
+        sizeof(ChannelConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(SystemConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(StorageConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(AnalogueConfigData.dataBytes) + sizeof(uint32_t);
+
+    // Calculate CRC
+    uint32_t checksum = CRC32::calculate(
+        CalibrationConfigData.dataBytes,
+        sizeof(CalibrationConfigData.dataBytes));
+
+    uint8_t int32Buf[4] =
+        {
+            (uint8_t)(checksum >> 24),
+            (uint8_t)(checksum >> 16),
+            (uint8_t)(checksum >> 8),
+            (uint8_t)(checksum)};
+
+    // Write calibration data in 32-byte page-safe chunks
+    uint16_t addr = EEPROMindex;
+    const uint8_t *src = CalibrationConfigData.dataBytes;
+    uint16_t bytesRemaining = sizeof(CalibrationConfigData.dataBytes);
+
+    while (bytesRemaining > 0)
+    {
+        uint8_t pageOffset = addr % EEPROM_PAGE_SIZE;
+        uint8_t spaceInPage = EEPROM_PAGE_SIZE - pageOffset;
+        uint8_t writeLen =
+            (bytesRemaining < spaceInPage) ? bytesRemaining : spaceInPage;
+
+        EEPROMext.EepromWrite(addr, writeLen, (uint8_t *)src);
+        EEPROMext.EepromWaitEndWriteOperation();
+
+        addr += writeLen;
+        src += writeLen;
+        bytesRemaining -= writeLen;
+    }
+
+    EEPROMindex += sizeof(CalibrationConfigData.dataBytes);
+
+#ifdef DEBUG
+    Serial.print("Calibration Checksum written: ");
+    Serial.print(checksum, HEX);
+    Serial.print(", at index: ");
+    Serial.println(EEPROMindex);
+#endif
+
+    // Write CRC
+    EEPROMext.EepromWrite(EEPROMindex, sizeof(int32Buf), int32Buf);
+    EEPROMext.EepromWaitEndWriteOperation();
+
+    EEPROMindex = 0;
+    EEPROMext.end();
+    SPI_2.end();
+}
+
+bool LoadCalibrationConfig()
+{
+    SPI_2.begin();
+    EEPROMext.begin(EEPROM_SPI_SPEED);
+    // Set valid CRC flag to false
+    bool validCRC = false;
+
+    // Calibration comes straight after the analogue config
+    EEPROMindex = sizeof(ChannelConfigData.dataBytes) + sizeof(uint32_t) + sizeof(SystemConfigData.dataBytes) + sizeof(uint32_t) +
+                  sizeof(StorageConfigData.dataBytes) + sizeof(uint32_t) + sizeof(AnalogueConfigData.dataBytes) + sizeof(uint32_t);
+
+    uint8_t int32Buf[4];
+    // Read into a copy so a bad CRC leaves the tables in use untouched
+    CalibrationConfigUnion stored;
+    uint16_t bytesRemaining = sizeof(stored.dataBytes);
+    uint16_t addr = EEPROMindex;
+    uint8_t *dst = stored.dataBytes;
+
+    while (bytesRemaining > 0)
+    {
+        uint8_t chunk = (bytesRemaining > EEPROM_PAGE_SIZE) ? EEPROM_PAGE_SIZE : bytesRemaining;
+
+        EEPROMext.EepromRead(addr, chunk, dst);
+
+        addr += chunk;
+        dst += chunk;
+        bytesRemaining -= chunk;
+    }
+
+    EEPROMindex += sizeof(stored.dataBytes);
+
+    // Read stored CRC
+    EEPROMext.EepromRead(EEPROMindex, sizeof(int32Buf), int32Buf);
+
+    uint32_t result = (uint32_t(int32Buf[0]) << 24) |
+                      (uint32_t(int32Buf[1]) << 16) |
+                      (uint32_t(int32Buf[2]) << 8) |
+                      (uint32_t(int32Buf[3]));
+#ifdef DEBUG
+    Serial.print("Calibration Checksum read: ");
+    Serial.print(result, HEX);
+    Serial.print(", at index: ");
+    Serial.println(EEPROMindex);
+#endif
+    // Check stored CRC vs calculated CRC
+    if (result == CRC32::calculate(stored.dataBytes, sizeof(stored.dataBytes)))
+    {
+        validCRC = true;
+        HoldControlLoop();
+        memcpy(CalibrationConfigData.dataBytes, stored.dataBytes, sizeof(stored.dataBytes));
+        ApplyAllCalibration();
+        ReleaseControlLoop();
+    }
+
+    // Reset EEPROM index
+    EEPROMindex = 0;
+    EEPROMext.end();
+    SPI_2.end();
+
+    return validCRC;
+}
+
+void SaveLogicConfig()
+{
+    SPI_2.begin();
+    EEPROMext.begin(EEPROM_SPI_SPEED);
+
+    // Logic follows channel + CRC + system + CRC + storage + CRC + analogue + CRC + calibration + CRC
+    EEPROMindex =
+        sizeof(ChannelConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(SystemConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(StorageConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(AnalogueConfigData.dataBytes) + sizeof(uint32_t) +
+        sizeof(CalibrationConfigData.dataBytes) + sizeof(uint32_t);
+
+    // Calculate CRC
+    uint32_t checksum = CRC32::calculate(
+        LogicConfigData.dataBytes,
+        sizeof(LogicConfigData.dataBytes));
+
+    uint8_t int32Buf[4] =
+        {
+            (uint8_t)(checksum >> 24),
+            (uint8_t)(checksum >> 16),
+            (uint8_t)(checksum >> 8),
+            (uint8_t)(checksum)};
+
+    // Write logic programs in 32-byte page-safe chunks
+    uint16_t addr = EEPROMindex;
+    const uint8_t *src = LogicConfigData.dataBytes;
+    uint16_t bytesRemaining = sizeof(LogicConfigData.dataBytes);
+
+    while (bytesRemaining > 0)
+    {
+        uint8_t pageOffset = addr % EEPROM_PAGE_SIZE;
+        uint8_t spaceInPage = EEPROM_PAGE_SIZE - pageOffset;
+        uint8_t writeLen =
+            (bytesRemaining < spaceInPage) ? bytesRemaining : spaceInPage;
+
+        EEPROMext.EepromWrite(addr, writeLen, (uint8_t *)src);
+        EEPROMext.EepromWaitEndWriteOperation();
+
+        addr += writeLen;
+        src += writeLen;
+        bytesRemaining -= writeLen;
+    }
+
+    EEPROMindex += sizeof(LogicConfigData.dataBytes);
+
+#ifdef DEBUG
+    Serial.print("Logic Checksum written: ");
+    Serial.print(checksum, HEX);
+    Serial.print(", at index: ");
+    Serial.println(EEPROMindex);
+#endif
+
+    // Write CRC
+    EEPROMext.EepromWrite(EEPROMindex, sizeof(int32Buf), int32Buf);
+    EEPROMext.EepromWaitEndWriteOperation();
+
+    EEPROMindex = 0;
+    EEPROMext.end();
+    SPI_2.end();
+}
+
+bool LoadLogicConfig()
+{
+    SPI_2.begin();
+    EEPROMext.begin(EEPROM_SPI_SPEED);
+    // Set valid CRC flag to false
+    bool validCRC = false;
+
+    // Logic comes straight after the calibration tables
+    EEPROMindex = sizeof(ChannelConfigData.dataBytes) + sizeof(uint32_t) + sizeof(SystemConfigData.dataBytes) + sizeof(uint32_t) +
+                  sizeof(StorageConfigData.dataBytes) + sizeof(uint32_t) + sizeof(AnalogueConfigData.dataBytes) + sizeof(uint32_t) +
+                  sizeof(CalibrationConfigData.dataBytes) + sizeof(uint32_t);
+
+    uint8_t int32Buf[4];
+    // Read into a copy so a bad CRC leaves the programs in use untouched
+    LogicConfigUnion stored;
+    uint16_t bytesRemaining = sizeof(stored.dataBytes);
+    uint16_t addr = EEPROMindex;
+    uint8_t *dst = stored.dataBytes;
+
+    while (bytesRemaining > 0)
+    {
+        uint8_t chunk = (bytesRemaining > EEPROM_PAGE_SIZE) ? EEPROM_PAGE_SIZE : bytesRemaining;
+
+        EEPROMext.EepromRead(addr, chunk, dst);
+
+        addr += chunk;
+        dst += chunk;
+        bytesRemaining -= chunk;
+    }
+
+    EEPROMindex += sizeof(stored.dataBytes);
+
+    // Read stored CRC
+    EEPROMext.EepromRead(EEPROMindex, sizeof(int32Buf), int32Buf);
+
+    uint32_t result = (uint32_t(int32Buf[0]) << 24) |
+                      (uint32_t(int32Buf[1]) << 16) |
+                      (uint32_t(int32Buf[2]) << 8) |
+                      (uint32_t(int32Buf[3]));
+#ifdef DEBUG
+    Serial.print("Logic Checksum read: ");
+    Serial.print(result, HEX);
+    Serial.print(", at index: ");
+    Serial.println(EEPROMindex);
+#endif
+    // Check stored CRC vs calculated CRC
+    if (result == CRC32::calculate(stored.dataBytes, sizeof(stored.dataBytes)))
+    {
+        validCRC = true;
+
+        // Programs already running keep their timers and latches, so saving doesn't disturb the outputs
+        HoldControlLoop();
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            if (memcmp(&LogicConfigData.data[i], &stored.data[i], sizeof(stored.data[i])) != 0)
+            {
+                memcpy(&LogicConfigData.data[i], &stored.data[i], sizeof(stored.data[i]));
+                ApplyLogic(i);
+            }
+        }
+        ReleaseControlLoop();
     }
 
     // Reset EEPROM index
@@ -750,9 +1021,16 @@ void InitialiseSD()
             for (int i = 0; i < NUM_CHANNELS; i++)
             {
                 BytesStored += dataFile.print(channelHeader);
+                BytesStored += dataFile.print(",");
+            }
+
+            // Measured frequency and duty of each input, digital inputs first
+            for (int i = 0; i < CAPTURE_INPUTS; i++)
+            {
+                BytesStored += dataFile.print(captureHeader);
 
-                // Print a separating comma unless we're on the last channel
-                if (i < NUM_CHANNELS - 1)
+                // Print a separating comma unless we're on the last input
+                if (i < CAPTURE_INPUTS - 1)
                 {
                     BytesStored += dataFile.print(",");
                 }
@@ -785,7 +1063,12 @@ void LogData()
     char sysLog[150];
     char channelLog[150];
     int writtenBytes = 0;
-    if (!(SystemRuntimeParams.ErrorFlags & UNDERVOLTAGE) && SDCardOK)
+
+    // Every value in a line from the same control update
+    ControlSnapshot snapshot;
+    ReadControlSnapshot(snapshot);
+
+    if (!(snapshot.System.ErrorFlags & UNDERVOLTAGE) && SDCardOK)
     {
         // Timestamp
         snprintf(timeStamp, sizeof(timeStamp), "%04d-%02d-%02d,%02d:%02d:%02d.%04d,", (2000 + rtc.getYear()), rtc.getMonth(), rtc.getDay(), rtc.getHours(), rtc.getMinutes(), rtc.getSeconds(), rtc.getSubSeconds() % 1000);
@@ -802,8 +1085,8 @@ void LogData()
         BytesStored += writtenBytes;
 
         // System Parameters Log
-        snprintf(sysLog, sizeof(sysLog), "%d,%.2f,%.2f,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.6f,%.6f,%.2f,%.2f,%.2f,", SystemRuntimeParams.SystemTemperature, SystemRuntimeParams.VBatt, SystemRuntimeParams.SystemCurrent,
-                 SystemRuntimeParams.ErrorFlags, accelX, accelY, accelZ, gyroX, gyroY, gyroZ, lat, lon, alt, speed, accuracy);
+        snprintf(sysLog, sizeof(sysLog), "%d,%.2f,%.2f,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.6f,%.6f,%.2f,%.2f,%.2f,", snapshot.System.SystemTemperature, snapshot.System.VBatt, snapshot.System.SystemCurrent,
+                 snapshot.System.ErrorFlags, accelX, accelY, accelZ, gyroX, gyroY, gyroZ, lat, lon, alt, speed, accuracy);
         writtenBytes = dataFile.write(sysLog, strlen(sysLog));
         if (writtenBytes == 0)
         {
@@ -845,13 +1128,13 @@ void LogData()
             snprintf(channelLog, sizeof(channelLog), "%s,%d,%.2f,%.2f,%.2f,%d,%d,%d%s",
                      chanType,
                      Channels[i].Enabled,
-                     ChannelRuntime[i].CurrentValue,
+                     snapshot.Channels[i].CurrentValue,
                      Channels[i].CurrentThresholdHigh,
                      Channels[i].CurrentThresholdLow,
                      Channels[i].MultiChannel,
                      Channels[i].GroupNumber,
-                     ChannelRuntime[i].ErrorFlags,
-                     (i < NUM_CHANNELS - 1) ? "," : "\n");
+                     snapshot.Channels[i].ErrorFlags,
+                     ",");
             writtenBytes = dataFile.write(channelLog, strlen(channelLog));
             BytesStored += writtenBytes;
             if (writtenBytes == 0)
@@ -865,6 +1148,24 @@ void LogData()
             }
         }
 
+        // Input frequency (Hz) and duty (%)
+        for (int i = 0; i < CAPTURE_INPUTS; i++)
+        {
+            char captureLog[24];
+            snprintf(captureLog, sizeof(captureLog), "%.3f,%.1f%s", InputMillihertz[i] / 1000.0f, InputDutyCycle[i] / 10.0f, (i < CAPTURE_INPUTS - 1) ? "," : "\n");
+            writtenBytes = dataFile.write(captureLog, strlen(captureLog));
+            BytesStored += writtenBytes;
+            if (writtenBytes == 0)
+            {
+                // Clear flags for next attempt
+                __HAL_SD_CLEAR_FLAG(&uSdHandle, SDIO_STATIC_FLAGS);
+                SDCardOK = false;
+                CloseSDFile();
+                InitialiseSD();
+                return;
+            }
+        }
+
         // Periodic SD Flushing
         lineCount++;
         dataFile.flush();
@@ -883,7 +1184,7 @@ void LogData()
             CloseSDFile();
             UndervoltageLatch = true;
         }
-        if (SystemRuntimeParams.ErrorFlags & UNDERVOLTAGE)
+        if (snapshot.System.ErrorFlags & UNDERVOLTAGE)
         {
             SDCardOK = false;
         }
@@ -92,6 +92,12 @@ extern bool StorageCRCValid;
 /// @brief Analogue input config CRC check failed flag
 extern bool AnalogueCRCValid;
 
+/// @brief Current calibration CRC check failed flag
+extern bool CalibrationCRCValid;
+
+/// @brief Logic program CRC check failed flag
+extern bool LogicCRCValid;
+
 /// @brief Saves the channel config data to EEPROM along with a calculated CRC
 void SaveChannelConfig();
 
@@ -120,6 +126,20 @@ void SaveAnalogueConfig();
 /// @return True if the CRC check was successful
 bool LoadAnalogueConfig();
 
+/// @brief Saves the current calibration tables to EEPROM along with a calculated CRC
+void SaveCalibrationConfig();
+
+/// @brief Loads the current calibration tables from EEPROM storage
+/// @return True if the CRC check was successful
+bool LoadCalibrationConfig();
+
+/// @brief Saves the channel logic programs to EEPROM along with a calculated CRC
+void SaveLogicConfig();
+
+/// @brief Loads the channel logic programs from EEPROM storage
+/// @return True if the CRC check was successful
+bool LoadLogicConfig();
+
 /// @brief Inititalise storage data to known values
 void InitialiseStorageData();
 
@@ -22,6 +22,7 @@
 */
 
 #include "System.h"
+#include <ADCHandler.h>
 
 SystemConfigUnion SystemConfigData;
 SystemParameters SystemParams;
@@ -38,7 +39,11 @@ bool DisplayBacklightInitialised = false;
 
 void IgnitionWake()
 {
-    PowerState = IGNITION_WAKING;
+    // Run-on polls the ignition input itself, with the clocks still running
+    if (PowerState != RUN_ON)
+    {
+        PowerState = IGNITION_WAKING;
+    }
 }
 
 void IMUWake()
@@ -114,6 +119,15 @@ void InitialiseSystemData()
     SystemParams.SpeedUnitPref = 1;
     SystemParams.DistanceUnitPref = 1;
     SystemParams.AllowMotionDetect = 1;
+    for (int i = 0; i < 2; i++)
+    {
+        SystemParams.PWMFrequency[i] = DEFAULT_PWM_FREQUENCY;
+        SystemParams.PWMSlots[i] = DEFAULT_PWM_SLOTS;
+    }
+    for (int i = 0; i < NUM_DI_CHANNELS; i++)
+    {
+        SystemParams.DigitalDebounce[i] = DEFAULT_DEBOUNCE_TIME;
+    }
 }
 
 void UpdateSystem()
@@ -122,8 +136,8 @@ void UpdateSystem()
     int32_t VRef = readVref();
     SystemRuntimeParams.SystemTemperature = readTempSensor(VRef);
 
-    // Calculate battery voltage
-    SystemRuntimeParams.VBatt = analogRead(VBATT_ANALOG_PIN) * 0.0039787f;
+    // Filtered battery voltage
+    SystemRuntimeParams.VBatt = VBattMillivolts / 1000.0f;
 
     // Calculate system current draw
     SystemRuntimeParams.SystemCurrent = 0.0f;
@@ -230,10 +244,10 @@ void WakeSystem()
 
 static int32_t readTempSensor(int32_t VRef)
 {
-    return (__LL_ADC_CALC_TEMPERATURE(VRef, analogRead(ATEMP), LL_ADC_RESOLUTION));
+    return (__LL_ADC_CALC_TEMPERATURE(VRef, ADCTemperatureRaw, LL_ADC_RESOLUTION));
 }
 
 static int32_t readVref()
 {
-    return (__LL_ADC_CALC_VREFANALOG_VOLTAGE(analogRead(AVREF), LL_ADC_RESOLUTION));
+    return ADCVrefMillivolts(ADCResults[ADC_VREFINT_INDEX]);
 }
@@ -52,7 +52,10 @@ struct __attribute__((packed)) SystemParameters
   uint8_t AllowData;               // Allow mobile data
   uint8_t AllowGPS;                // Allow GPS
   uint8_t AllowMotionDetect;       // Allow motion detection wake
-  uint8_t Reserved[30];            // Reserved for future use
+  uint16_t PWMFrequency[2];        // PWM frequency (Hz) of outputs 1-7 and outputs 8-14. 0 = default
+  uint16_t PWMSlots[2];            // PWM table length (slots, 1000 = 0.1% resolution) of outputs 1-7 and outputs 8-14. 0 = default
+  uint8_t DigitalDebounce[8];      // Debounce time (milliseconds) of each digital input. 0 for none
+  uint8_t Reserved[14];            // Reserved for future use
 };
 
 /// @brief System runtime data structure
@@ -89,7 +92,7 @@ extern bool ChannelCRCValid;
 /// @brief SD card OK flag
 extern bool SDCardOK;
 
-/// @brief Power state. 0 = Run, 1 = prepare for sleep, 2 = sleeping, 3 = Ignition wake, 4 = IMU wake
+/// @brief Power state. 0 = Run, 1 = prepare for sleep, 2 = sleeping, 3 = Ignition wake, 4 = IMU wake, 8 = Run-on after ignition off
 extern volatile uint8_t PowerState;
 
 /// @brief Flag to denote RTC has been set
@@ -0,0 +1,212 @@
+/*  WireProtection.cpp I²t thermal model of each output's wiring, updated from the ADC sample stream.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "WireProtection.h"
+#include "OutputHandler.h"
+#include <ADCHandler.h>
+#include <ChannelGroups.h>
+
+WireModel WireModels[NUM_CHANNELS];
+
+// Heat without being interrupted by the ADC DMA
+static int64_t wireHeat(uint8_t channel)
+{
+  noInterrupts();
+  int64_t heat = WireModels[channel].Heat;
+  interrupts();
+  return heat;
+}
+
+void ConfigureWireProtection()
+{
+  // ADC scan period in timer clock cycles
+  uint32_t scanCycles = ADCSlotDivider * PWMBanks[PWM_BANK_G].SlotCycles;
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    const ChannelConfig &channel = Channels[i];
+    WireModel &model = WireModels[i];
+    uint32_t ratedCurrent = channel.WireRatedCurrent;
+    uint32_t timeConstant = channel.WireTimeConstant;
+
+    // Fill in whatever isn't configured from the largest standard size that doesn't exceed the cross section
+    if (channel.WireCrossSection > 0)
+    {
+      const WireSize *size = &wireSizes[0];
+      for (const WireSize &s : wireSizes)
+      {
+        if (s.CrossSection <= channel.WireCrossSection)
+        {
+          size = &s;
+        }
+      }
+
+      if (ratedCurrent == 0)
+      {
+        ratedCurrent = size->RatedCurrent;
+      }
+      if (timeConstant == 0)
+      {
+        timeConstant = size->TimeConstant;
+      }
+    }
+
+    // Currents above WIRE_MAX_MILLIAMPS can't be modelled
+    if (ratedCurrent > WIRE_MAX_MILLIAMPS / 100)
+    {
+      ratedCurrent = WIRE_MAX_MILLIAMPS / 100;
+    }
+
+    if (timeConstant == 0)
+    {
+      timeConstant = WIRE_DEFAULT_TIME_CONSTANT;
+    }
+    else if (timeConstant < WIRE_MIN_TIME_CONSTANT)
+    {
+      timeConstant = WIRE_MIN_TIME_CONSTANT;
+    }
+
+    uint32_t gain = channel.CurrentGain ? channel.CurrentGain : CURRENT_GAIN_NOMINAL;
+    const CalibrationCurve *curve = ChannelCalibration(i);
+    uint64_t tripLevel = (uint64_t)(ratedCurrent * 100) * (ratedCurrent * 100);
+    // A ganged group shares one wire. Its leader's model takes the total current.
+    uint32_t alpha = (ratedCurrent > 0 && !GroupFollower(i)) ? ((uint64_t)scanCycles << 32) / ((uint64_t)timeConstant * (PWM_TIMER_CLOCK / 1000)) : 0;
+
+    // The ADC DMA interrupt reads the model every scan. It sees the old parameters or the new, never a mix.
+    noInterrupts();
+    model.Gain = gain;
+    model.Offset = channel.CurrentOffset;
+    model.Curve = curve;
+    model.TripLevel = tripLevel;
+    model.Alpha = alpha;
+    interrupts();
+  }
+}
+
+void ResetWireProtection()
+{
+  noInterrupts();
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    WireModels[i].Heat = 0;
+    WireModels[i].Tripped = false;
+  }
+  interrupts();
+}
+
+// Load current of one sample (mA)
+static inline uint32_t sampleMilliamps(const WireModel &model, uint16_t raw)
+{
+  if (raw < CURRENT_NOISE_FLOOR)
+  {
+    return 0;
+  }
+
+  if (model.Curve)
+  {
+    return CalibratedMilliamps(*model.Curve, raw);
+  }
+
+  int32_t counts = (int32_t)raw - model.Offset;
+  if (counts <= 0)
+  {
+    return 0;
+  }
+  return ((uint64_t)counts * model.Gain + 0x8000) >> 16;
+}
+
+void WireModelScan(const volatile uint16_t *scan)
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    if (WireModels[i].Alpha == 0)
+    {
+      continue;
+    }
+
+    // Total of the group's members. Just the channel itself if it isn't ganged.
+    uint16_t members = GroupMembers[i];
+    uint32_t milliamps = 0;
+    for (int m = i; m < NUM_CHANNELS; m++)
+    {
+      if (members & (1 << m))
+      {
+        milliamps += sampleMilliamps(WireModels[m], scan[m]);
+      }
+    }
+
+    WireModelSample(i, milliamps);
+  }
+}
+
+void WireModelSample(uint8_t channel, uint32_t milliamps)
+{
+  WireModel &model = WireModels[channel];
+
+  if (milliamps > WIRE_MAX_MILLIAMPS)
+  {
+    milliamps = WIRE_MAX_MILLIAMPS;
+  }
+
+  // First order filter of I². The longest scan period is one 1 ms slot and the time constant is at least WIRE_MIN_TIME_CONSTANT,
+  // so Alpha is at most 2^32 / 100. With I² at most 1.6 * 10^11 the product stays under 2^63.
+  int64_t difference = (int64_t)((uint64_t)milliamps * milliamps) - (model.Heat >> 16);
+  model.Heat += (difference * model.Alpha) >> 16;
+
+  if (!model.Tripped && (model.Heat >> 16) >= (int64_t)model.TripLevel)
+  {
+    model.Tripped = true;
+    ForceGroupOff(channel);
+  }
+}
+
+bool WireModelEnabled(uint8_t channel)
+{
+  return WireModels[channel].Alpha != 0;
+}
+
+bool WireTripped(uint8_t channel)
+{
+  return WireModels[channel].Tripped;
+}
+
+bool WireCooled(uint8_t channel)
+{
+  return (wireHeat(channel) >> 16) * 100 <= (int64_t)WireModels[channel].TripLevel * WIRE_RESET_PERCENT;
+}
+
+void ResetWireTrip(uint8_t channel)
+{
+  WireModels[channel].Tripped = false;
+}
+
+uint8_t WireHeatPercent(uint8_t channel)
+{
+  const WireModel &model = WireModels[channel];
+  if (model.Alpha == 0 || model.TripLevel == 0)
+  {
+    return 0;
+  }
+
+  int64_t percent = (wireHeat(channel) >> 16) * 100 / (int64_t)model.TripLevel;
+  return percent > 100 ? 100 : (uint8_t)percent;
+}
@@ -0,0 +1,111 @@
+/*  WireProtection.h I²t thermal model of each output's wiring, updated from the ADC sample stream.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef WireProtection_H
+#define WireProtection_H
+
+#include <Arduino.h>
+#include <Globals.h>
+#include <CurrentCalibration.h>
+
+// Shortest permitted wire time constant (milliseconds). Keeps the per sample filter step small enough for 64 bit arithmetic.
+#define WIRE_MIN_TIME_CONSTANT 100
+
+// Largest load current the model takes (mA). Keeps I² times the filter step within 64 bits. Ganged groups can exceed 65.5 A.
+#define WIRE_MAX_MILLIAMPS 400000
+
+// Time constant used when only a rated current is configured (milliseconds)
+#define WIRE_DEFAULT_TIME_CONSTANT 10000
+
+// Percentage of the trip level the wire must cool to before a tripped output is retried
+#define WIRE_RESET_PERCENT 50
+
+/// @brief Typical continuous rating and thermal time constant of a single core automotive cable in free air
+struct WireSize
+{
+  uint16_t CrossSection; // Conductor cross section (0.01 mm²)
+  uint16_t RatedCurrent; // Continuous current (0.1 A)
+  uint16_t TimeConstant; // Thermal time constant (milliseconds)
+};
+
+/// @brief Standard wire sizes, smallest first. Used when a channel only configures its cross section.
+const WireSize wireSizes[] = {{35, 80, 6000}, {50, 110, 8000}, {75, 140, 11000}, {100, 170, 14000}, {150, 210, 20000}, {250, 290, 30000}, {400, 390, 45000}};
+
+/// @brief Thermal state of one output's wiring.
+/// Heat is the load current squared filtered with the wire's time constant, so it settles at I² for a steady load.
+/// The output trips when it reaches the rated current squared. For a step from cold to I the trip time is -τ ln(1 - In² / I²).
+struct WireModel
+{
+  uint32_t Gain;                 // Current sense gain (mA per ADC count, Q16)
+  int16_t Offset;                // Current sense offset (ADC counts)
+  const CalibrationCurve *Curve; // Calibration curve used instead of Gain and Offset. nullptr if the channel isn't calibrated.
+  uint32_t Alpha;                // Sample period / time constant (Q32). 0 when the model is disabled.
+  uint64_t TripLevel;            // Rated current squared (mA²)
+  int64_t Heat;                  // Filtered current squared (mA², Q16)
+  volatile uint8_t Tripped;      // Output has been turned off by the model
+};
+
+/// @brief Wire model for each channel
+extern WireModel WireModels[NUM_CHANNELS];
+
+/// @brief Load the wire model parameters from the channel config and the current ADC sample rate.
+/// Called by ConfigureOutputs() when the config changes. Needs the groups from ConfigureGroups().
+void ConfigureWireProtection();
+
+/// @brief Clear the thermal state of every channel. The wiring is assumed to be cold.
+void ResetWireProtection();
+
+/// @brief Add one ADC scan to every enabled wire model. Ganged groups are modelled as one wire carrying the total current.
+/// Called from the ADC DMA interrupt for every scan.
+/// @param scan Raw current sense results, one per channel
+void WireModelScan(const volatile uint16_t *scan);
+
+/// @brief Add one load current sample to a channel's wire model. Turns the output, or its whole group, off if the wire overheats.
+/// @param channel Channel index
+/// @param milliamps Load current (mA). Limited to WIRE_MAX_MILLIAMPS.
+void WireModelSample(uint8_t channel, uint32_t milliamps);
+
+/// @brief Check if a channel's wire model is configured
+/// @param channel Channel index
+/// @return True if the model is protecting the channel
+bool WireModelEnabled(uint8_t channel);
+
+/// @brief Check if a channel has been turned off by its wire model
+/// @param channel Channel index
+/// @return True if tripped
+bool WireTripped(uint8_t channel);
+
+/// @brief Check if a tripped channel's wire has cooled enough to retry (WIRE_RESET_PERCENT of the trip level)
+/// @param channel Channel index
+/// @return True if cooled
+bool WireCooled(uint8_t channel);
+
+/// @brief Clear a channel's trip so the output can be turned on again
+/// @param channel Channel index
+void ResetWireTrip(uint8_t channel);
+
+/// @brief Wire heat as a percentage of the trip level
+/// @param channel Channel index
+/// @return 0 - 100. 0 if the model is disabled.
+uint8_t WireHeatPercent(uint8_t channel);
+
+#endif
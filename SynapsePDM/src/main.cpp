@@ -68,20 +68,34 @@
 
 #include <SystemClock.h>
 #include <Arduino.h>
-#include <Bounce2.h>
 #include <Globals.h>
 #include <OutputHandler.h>
+#include <ADCHandler.h>
+#include <CurrentCalibration.h>
+#include <LogicEngine.h>
+#include <AnalogueControl.h>
+#include <RunOn.h>
+#include <FaultCapture.h>
 #include <InputHandler.h>
+#include <InputEdges.h>
+#include <InputDebounce.h>
 #include <Storage.h>
 #include <CANComms.h>
 #include <SerialComms.h>
 #include <GSM.h>
 #include <Display.h>
+#include <Scheduler.h>
+#include <ControlLoop.h>
 
 constexpr int SPLASH_SCREEN_DELAY = 2000;
 constexpr int RTC_YEAR_THRESHOLD = 24;
 
+// Display, SD, comms and peripheral rails are off. Set when running on, so they aren't stopped twice on the way to sleep.
+bool peripheralsAsleep = false;
+
 void SleepFunctions();
+void SleepPeripherals();
+void WakePeripherals();
 void alarmMatch(void *data);
 
 // #define DEBUG
@@ -205,15 +219,116 @@ void Debug()
   Serial.print(", ");
   Serial.print(AnalogueCRCValid ? "Valid" : "Invalid");
   Serial.print(", ");
+  Serial.print(CalibrationCRCValid ? "Valid" : "Invalid");
+  Serial.print(", ");
+  Serial.print(LogicCRCValid ? "Valid" : "Invalid");
+  Serial.print(", ");
 
   Serial.print(hitInit ? "Yep" : "Nope");
   Serial.print(", ");
 
-  Serial.println(SystemRuntimeParams.ErrorFlags, HEX);
+  ControlSnapshot snapshot;
+  ReadControlSnapshot(snapshot);
+  Serial.println(snapshot.System.ErrorFlags, HEX);
 
 #endif
 }
 
+void SystemCANTask()
+{
+  BroadcastSystemStatus();
+}
+
+void IMUTask()
+{
+  ReadIMU();
+}
+
+void DisplayTask()
+{
+  // If we're heading for sleep, don't update the display. Something with the DMA seems to keeep the SPI bus active. Drastically increases sleep current.
+  if (PowerState == PREPARE_SLEEP || PowerState == SLEEPING)
+  {
+    return;
+  }
+
+  if (backgroundDrawn)
+  {
+    UpdateDisplay();
+  }
+  else if ((int32_t)(millis() - splashCounter) > 0)
+  {
+    DrawBackground();
+    bootToSleep = true;
+  }
+}
+
+void LogTask()
+{
+  if (!RTCSet && year > RTC_YEAR_THRESHOLD)
+  {
+    RTCSet = true;
+    // GPS time must be updated, use that
+    rtc.setDate(day, month, (year % 100));
+    rtc.setTime(hour, minute, second);
+    InitialiseSD();
+  }
+  else if (RTCSet)
+  {
+    // RTC is set. log SD card data
+    LogData();
+  }
+}
+
+void GPSTask()
+{
+  UpdateSIM7600(GPS);
+  Debug();
+}
+
+void SignalTask()
+{
+  UpdateSIM7600(SIGNAL_QUALITY);
+}
+
+void CommsTask()
+{
+  CheckSerial();
+  ReadCANMessages();
+}
+
+// Fault captures are written a piece at a time between everything else
+void CaptureTask()
+{
+  UpdateCapture();
+}
+
+// PWM phases follow the duties and currents set by the control loop. Too long to place outputs in every control update.
+void StaggerTask()
+{
+  StaggerOutputs();
+}
+
+// Main tasks, most urgent first. The outputs and inputs aren't among them: the control loop runs them from a timer interrupt.
+// The scheduler statistics give each task's worst case, the stagger task's included.
+SchedulerTask Tasks[] = {
+    // Function, period (us), deadline (us), priority, power states
+    {StaggerTask, STAGGER_INTERVAL * 1000, STAGGER_INTERVAL * 1000, 0, 1 << RUN | 1 << RUN_ON},
+    {SystemCANTask, SYSTEM_CAN_INTERVAL * 1000, SYSTEM_CAN_INTERVAL * 1000, 1, 1 << RUN},
+    {IMUTask, COMMS_INTERVAL * 1000, COMMS_INTERVAL * 1000, 2, 1 << RUN},
+    {DisplayTask, DISPLAY_INTERVAL * 1000, DISPLAY_INTERVAL * 1000, 3, 1 << RUN},
+    {LogTask, LOG_INTERVAL * 1000, LOG_INTERVAL * 1000, 4, 1 << RUN},
+    {GPSTask, GPS_INTERVAL * 1000, GPS_INTERVAL * 1000, 5, 1 << RUN},
+    {SignalTask, SIGNAL_QUALITY_INTERVAL * 1000, SIGNAL_QUALITY_INTERVAL * 1000, 6, 1 << RUN},
+    {CommsTask, 0, 0, 7, 1 << RUN},
+    {CaptureTask, 0, 0, 7, 1 << RUN},
+};
+
+uint32_t schedulerClock()
+{
+  return micros();
+}
+
 void setup()
 {
 
@@ -226,7 +341,6 @@ void setup()
   rtc.setClockSource(STM32RTC::LSE_CLOCK);
   rtc.begin();
   InitialiseSerial();
-  InitialiseOutputs();
   InitialiseStorageData();
   InitialiseDisplay();
   InitialiseChannelData();
@@ -268,6 +382,30 @@ void setup()
     SaveAnalogueConfig();
   }
 
+  // Load current calibration tables. Uncalibrated channels use their gain and offset.
+  CalibrationCRCValid = LoadCalibrationConfig();
+  if (!CalibrationCRCValid)
+  {
+    InitialiseCalibrationData();
+    ApplyAllCalibration();
+    SaveCalibrationConfig();
+  }
+
+  // Load channel logic programs. Channels without one follow their inputs.
+  LogicCRCValid = LoadLogicConfig();
+  if (!LogicCRCValid)
+  {
+    InitialiseLogicData();
+    ApplyAllLogic();
+    SaveLogicConfig();
+  }
+
+  // Outputs use the PWM settings from the system config
+  InitialiseOutputs();
+  InitialiseADC();
+  InitialiseAnalogueADC();
+  StartOutputs();
+
   InitialiseInputs();
 
   // Only initialise the SD card if we've got an accurate RTC
@@ -298,6 +436,8 @@ void setup()
   SystemParams.MotionDeadTime = 1;
 
   LowPower.enableWakeupFrom(&rtc, alarmMatch);
+  InitialiseScheduler(Tasks, sizeof(Tasks) / sizeof(Tasks[0]), schedulerClock);
+  StartControlLoop();
   IWatchdog.begin(2000 * 1000); // 2 second watchdog (microseconds) on boot.
 }
 
@@ -311,8 +451,51 @@ void handlePowerState()
       delay(WAKE_DEBOUNCE_TIME); // Debounce
       if (!digitalRead(IGN_INPUT) && bootToSleep)
       {
+        if (StartRunOn())
+        {
+          // Keep the run-on channels going with everything else off. The control loop holds them from here.
+          PowerState = RUN_ON;
+          SleepIMU();
+          SleepPeripherals();
+          GPSFix = false;
+          wakeDebounceTimer = millis();
+        }
+        else
+        {
+          PowerState = PREPARE_SLEEP;
+        }
+      }
+    }
+    break;
+  case RUN_ON:
+    if (digitalRead(IGN_INPUT))
+    {
+      // Ignition back on. Wake the rest of the system once it's been on for the debounce time.
+      if (millis() - wakeDebounceTimer > WAKE_DEBOUNCE_TIME)
+      {
+        // Run-on channels stay held until the inputs are back. Switched over between control updates, or they'd drop out for one.
+        WakeIMU();
+        WakePeripherals();
+        HoldControlLoop();
+        StopRunOn();
+        PowerState = RUN;
+        ReleaseControlLoop();
+      }
+    }
+    else
+    {
+      wakeDebounceTimer = millis();
+      if (RunOnRemaining() == 0)
+      {
+        // Last run-on channel has timed out
+        StopRunOn();
+        WakeIMU();
         PowerState = PREPARE_SLEEP;
       }
+      else
+      {
+        RunOnSleep();
+      }
     }
     break;
   case PREPARE_SLEEP:
@@ -364,6 +547,9 @@ void handlePowerState()
       WakeSystem();
       InitialiseInputs();
       InitialiseOutputs();
+      InitialiseADC();
+      InitialiseAnalogueADC();
+      StartOutputs();
       HandleInputs();
       UpdateOutputs();
       DisableMotionDetect();
@@ -374,7 +560,9 @@ void handlePowerState()
       DrawBackground();
       analogWrite(TFT_BL, 1023);
       ResumeSD();
+      peripheralsAsleep = false;
       PowerState = RUN;
+      StartControlLoop();
     }
     break;
   case IMU_WAKING:
@@ -401,6 +589,7 @@ void handlePowerState()
         InitialiseCAN();
         InitialiseGSM(false);
         ResumeSD();
+        peripheralsAsleep = false;
         imuWWtimer = millis() + SystemParams.IMUwakeWindow;
         PowerState = IMU_WAKE_WINDOW;
       }
@@ -413,7 +602,7 @@ void handlePowerState()
     }
     break;
   case IMU_WAKE_WINDOW:
-    if (millis() < imuWWtimer)
+    if ((int32_t)(millis() - imuWWtimer) < 0)
     {
       // TODO: work out what to do if the IMU has woken the controller
     }
@@ -429,90 +618,38 @@ void handlePowerState()
 void loop()
 {
   IWatchdog.reload();
-  if (PowerState == RUN)
-  {
-    if (millis() > DisplayTimer)
-    {
-      DisplayTimer = millis() + DISPLAY_INTERVAL;
-      // Update channel outputs
-      UpdateOutputs();
-
-      // Read input channel status
-      HandleInputs();
-
-      // If we're heading for sleep, don't update the display. Something with the DMA seems to keeep the SPI bus active. Drastically increases sleep current.
-      if (backgroundDrawn && PowerState != PREPARE_SLEEP && PowerState != SLEEPING)
-      {
-        UpdateDisplay();
-      }
-      UpdateSystem();
-    }
 
-    if (millis() > CommsTimer)
-    {
-      CommsTimer = millis() + COMMS_INTERVAL;
-      ReadIMU();
-    }
-
-    if (millis() > LogTimer)
-    {
-      LogTimer = millis() + LOG_INTERVAL;
-
-      if (!RTCSet && year > RTC_YEAR_THRESHOLD)
-      {
-        RTCSet = true;        
-        // GPS time must be updated, use that
-        rtc.setDate(day, month, (year % 100));
-        rtc.setTime(hour, minute, second);
-        InitialiseSD();
-      }
-      else if (RTCSet)
-      {
-        // RTC is set. log SD card data
-        LogData();
-      }
-    }
-
-    if (millis() > GPSTimer)
-    {
-      GPSTimer = millis() + GPS_INTERVAL;
-      UpdateSIM7600(GPS);
-      Debug();
-    }
-
-    if (millis() > signalTimer)
-    {
-      signalTimer = millis() + SIGNAL_QUALITY_INTERVAL;
-      UpdateSIM7600(SIGNAL_QUALITY);
-    }
-
-    if (millis() > systemCANTimer)
-    {
-      systemCANTimer = millis() + SYSTEM_CAN_INTERVAL; 
-      BroadcastSystemStatus();
-    }
-
-    if (millis() > splashCounter && !backgroundDrawn && PowerState != PREPARE_SLEEP && PowerState != SLEEPING)
-    {
-      DrawBackground();
-      bootToSleep = true;
-    }
-    CheckSerial();
-    ReadCANMessages();
-  }
+  // One task per pass, so power state changes are picked up in between
+  RunScheduler(1 << PowerState);
   handlePowerState();
-  
-  if(millis() > EEPROMSaveTimout && saveEEPROMOnTimeout)
-  {    
+
+  if (saveEEPROMOnTimeout && (int32_t)(millis() - EEPROMSaveTimout) > 0)
+  {
     saveEEPROMOnTimeout = false;
-    EEPROMSaveTimout = 0;   
-    SaveChannelConfig();    
+    EEPROMSaveTimout = 0;
+    SaveChannelConfig();
     SaveSystemConfig();
   }
 }
 
 void SleepFunctions()
 {
+  StopControlLoop();
+  SleepPeripherals();
+  OutputsOff();
+  SleepOutputs();
+  SleepADC();
+  SleepAnalogueADC();
+  IMUWakeMode = false;
+}
+
+void SleepPeripherals()
+{
+  if (peripheralsAsleep)
+  {
+    return;
+  }
+
   if (saveEEPROMOnTimeout)
   {
     // Do it now.
@@ -522,14 +659,29 @@ void SleepFunctions()
   }
   analogWrite(TFT_BL, 0);
   PullResistorSleep();
+  StopInputEdges();
+  StopDebounce();
+  StopCapture();
   SleepSD();
-  OutputsOff();
-  SleepOutputs();
   SleepComms();
   StopDisplay();
   SleepSystem();
-  IMUWakeMode = false;
   invalidateDisplay = true;
+  peripheralsAsleep = true;
+}
+
+void WakePeripherals()
+{
+  // Outputs and ADCs kept running through run-on
+  WakeSystem();
+  InitialiseInputs();
+  InitialiseSerial();
+  InitialiseGSM(false);
+  StartDisplay();
+  DrawBackground();
+  analogWrite(TFT_BL, 1023);
+  ResumeSD();
+  peripheralsAsleep = false;
 }
 
 void alarmMatch(void *data)
@@ -0,0 +1,189 @@
+/*  Arduino.h STM32duino stand-in for host unit tests.
+    Time and input pins are plain variables the tests set. Everything else does nothing.
+*/
+
+#pragma once
+
+// Standard headers the tests use, before min and max are defined as macros
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef unsigned int uint;
+
+#define F_CPU 168000000L
+#define HIGH 1
+#define LOW 0
+#define PROGMEM
+
+enum
+{
+  INPUT,
+  OUTPUT,
+  INPUT_PULLUP,
+  INPUT_PULLDOWN,
+  INPUT_ANALOG
+};
+
+enum
+{
+  RISING = 1,
+  FALLING,
+  CHANGE
+};
+
+enum
+{
+  DEC = 10,
+  HEX = 16
+};
+
+// Pin numbers in port order, 16 to a port
+enum
+{
+  PA0, PA1, PA2, PA3, PA4, PA5, PA6, PA7, PA8, PA9, PA10, PA11, PA12, PA13, PA14, PA15,
+  PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7, PB8, PB9, PB10, PB11, PB12, PB13, PB14, PB15,
+  PC0, PC1, PC2, PC3, PC4, PC5, PC6, PC7, PC8, PC9, PC10, PC11, PC12, PC13, PC14, PC15,
+  PD0, PD1, PD2, PD3, PD4, PD5, PD6, PD7, PD8, PD9, PD10, PD11, PD12, PD13, PD14, PD15,
+  PE0, PE1, PE2, PE3, PE4, PE5, PE6, PE7, PE8, PE9, PE10, PE11, PE12, PE13, PE14, PE15,
+  PF0, PF1, PF2, PF3, PF4, PF5, PF6, PF7, PF8, PF9, PF10, PF11, PF12, PF13, PF14, PF15,
+  PG0, PG1, PG2, PG3, PG4, PG5, PG6, PG7, PG8, PG9, PG10, PG11, PG12, PG13, PG14, PG15,
+  ATEMP,
+  AVREF
+};
+
+#define NUM_DIGITAL_PINS 112
+#define EXTI_IRQ_PRIO 6
+
+#define TFT_RST PD8
+#define TFT_DC PD9
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#include "hal.h"
+
+// Fake time. Tests move it on by hand.
+inline uint32_t stubMicros = 0;
+
+inline unsigned long micros() { return stubMicros; }
+inline unsigned long millis() { return stubMicros / 1000; }
+inline void delay(unsigned long ms) { stubMicros += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { stubMicros += us; }
+
+// Pins read through the GPIO input registers, so digitalRead() and direct port reads agree
+inline GPIO_TypeDef *digitalPinToPort(uint32_t pin)
+{
+  GPIO_TypeDef *ports[] = {GPIOA, GPIOB, GPIOC, GPIOD, GPIOE, GPIOF, GPIOG};
+  return ports[(pin / 16) % 7];
+}
+inline uint32_t digitalPinToBitMask(uint32_t pin) { return 1u << (pin % 16); }
+inline int digitalRead(uint32_t pin) { return (digitalPinToPort(pin)->IDR & digitalPinToBitMask(pin)) ? HIGH : LOW; }
+inline void digitalWrite(uint32_t pin, uint32_t value)
+{
+  if (value)
+  {
+    digitalPinToPort(pin)->ODR |= digitalPinToBitMask(pin);
+  }
+  else
+  {
+    digitalPinToPort(pin)->ODR &= ~digitalPinToBitMask(pin);
+  }
+}
+
+/// @brief Set the level a test input pin reads back
+inline void stubSetPin(uint32_t pin, bool high)
+{
+  if (high)
+  {
+    digitalPinToPort(pin)->IDR |= digitalPinToBitMask(pin);
+  }
+  else
+  {
+    digitalPinToPort(pin)->IDR &= ~digitalPinToBitMask(pin);
+  }
+}
+
+inline void pinMode(uint32_t, uint32_t) {}
+inline int analogRead(uint32_t) { return 0; }
+inline void analogWrite(uint32_t, int) {}
+inline void analogReadResolution(int) {}
+inline void analogWriteResolution(int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline void attachInterrupt(uint32_t, void (*)(void), uint32_t) {}
+inline void detachInterrupt(uint32_t) {}
+inline uint32_t digitalPinToInterrupt(uint32_t pin) { return pin; }
+
+class String
+{
+public:
+  String() {}
+  String(const char *) {}
+  String(float, int) {}
+  void toCharArray(char *, unsigned) {}
+  bool operator==(const String &) const { return true; }
+};
+
+class Stream
+{
+public:
+  int available() { return 0; }
+  int read() { return -1; }
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t n) { return n; }
+  size_t write(const char *) { return 0; }
+  size_t write(const char *, size_t n) { return n; }
+  template <typename T>
+  size_t print(T, int = DEC) { return 0; }
+  template <typename T>
+  size_t println(T, int = DEC) { return 0; }
+  size_t println() { return 0; }
+  void begin(unsigned long) {}
+  void end() {}
+  void flush() {}
+  operator bool() { return true; }
+};
+
+inline Stream Serial;
+inline Stream Serial1;
+
+enum
+{
+  MICROSEC_FORMAT,
+  HERTZ_FORMAT,
+  TICK_FORMAT
+};
+
+class HardwareTimer
+{
+public:
+  HardwareTimer(TIM_TypeDef *) {}
+  void setOverflow(uint32_t, int) {}
+  void attachInterrupt(void (*callback)(void)) { Callback = callback; }
+  void resume() { Running = true; }
+  void pause() { Running = false; }
+  void setInterruptPriority(uint32_t, uint32_t) {}
+  uint32_t getCount() { return 0; }
+  void setPrescaleFactor(uint32_t) {}
+  void setCount(uint32_t) {}
+
+  void (*Callback)(void) = nullptr; // Update interrupt, for the test to call
+  bool Running = false;
+};
@@ -0,0 +1,15 @@
+/*  CircularBuffer.hpp Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+template <class T, int N>
+class CircularBuffer
+{
+public:
+  bool isFull() { return false; }
+  void unshift(T) {}
+  T last() { return T(); }
+  int size() { return 0; }
+  T operator[](int) { return T(); }
+};
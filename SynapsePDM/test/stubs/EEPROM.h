@@ -0,0 +1,3 @@
+/*  EEPROM.h Host unit test stand-in. */
+
+#pragma once
@@ -0,0 +1,16 @@
+/*  IWatchdog.h Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+class IWatchdogClass
+{
+public:
+  void begin(uint32_t) {}
+  void reload() {}
+  void set(uint32_t) {}
+  bool isReset() { return false; }
+  void clearReset() {}
+};
+
+inline IWatchdogClass IWatchdog;
@@ -0,0 +1,16 @@
+/*  M95640R.h Host unit test stand-in. */
+
+#pragma once
+#include <SPI.h>
+
+class M95640R
+{
+public:
+  M95640R(SPIClass *, int) {}
+  void begin(uint32_t) {}
+  void end() {}
+  void EepromWrite(uint16_t, uint16_t, uint8_t *) {}
+  void EepromRead(uint16_t, uint16_t, uint8_t *) {}
+  void EepromWaitEndWriteOperation() {}
+  uint8_t EepromStatus() { return 0; }
+};
@@ -0,0 +1,14 @@
+/*  SPI.h Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+class SPIClass
+{
+public:
+  SPIClass(uint32_t = 0, uint32_t = 0, uint32_t = 0) {}
+  void begin() {}
+  void end() {}
+};
+
+inline SPIClass SPI;
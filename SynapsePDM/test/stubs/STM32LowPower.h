@@ -0,0 +1,29 @@
+/*  STM32LowPower.h Host unit test stand-in. Counts sleeps so tests can see them. */
+
+#pragma once
+#include <Arduino.h>
+#include <STM32RTC.h>
+
+enum
+{
+  SLEEP_MODE,
+  DEEP_SLEEP_MODE,
+  SHUTDOWN_MODE,
+  IDLE_MODE
+};
+
+class STM32LowPower
+{
+public:
+  void begin() {}
+  void attachInterruptWakeup(uint32_t, void (*)(void), uint32_t, uint32_t) {}
+  void enableWakeupFrom(STM32RTC *, void (*)(void *), void * = nullptr) {}
+  void sleep(uint32_t ms = 0) { Sleeps++, SleptMicros += ms * 1000; }
+  void deepSleep(uint32_t ms = 0) { Sleeps++, SleptMicros += ms * 1000; }
+  void idle(uint32_t ms = 0) { Sleeps++, SleptMicros += ms * 1000; }
+
+  uint32_t Sleeps = 0;
+  uint32_t SleptMicros = 0;
+};
+
+inline STM32LowPower LowPower;
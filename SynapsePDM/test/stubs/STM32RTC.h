@@ -0,0 +1,39 @@
+/*  STM32RTC.h Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+class STM32RTC
+{
+public:
+  enum Source
+  {
+    LSE_CLOCK
+  };
+  enum Alarm_Match
+  {
+    MATCH_DHHMMSS,
+    MATCH_SS
+  };
+
+  static STM32RTC &getInstance()
+  {
+    static STM32RTC instance;
+    return instance;
+  }
+  void setClockSource(Source) {}
+  void begin() {}
+  bool isTimeSet() { return false; }
+  uint8_t getYear() { return 0; }
+  uint8_t getMonth() { return 0; }
+  uint8_t getDay() { return 0; }
+  uint8_t getHours() { return 0; }
+  uint8_t getMinutes() { return 0; }
+  uint8_t getSeconds() { return 0; }
+  uint32_t getSubSeconds() { return 0; }
+  uint32_t getEpoch() { return 0; }
+  void setAlarmEpoch(uint32_t) {}
+  void enableAlarm(Alarm_Match) {}
+  void setDate(int, int, int) {}
+  void setTime(int, int, int) {}
+};
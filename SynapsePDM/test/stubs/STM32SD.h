@@ -0,0 +1,48 @@
+/*  STM32SD.h Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+#define FILE_WRITE 1
+#define FILE_READ 0
+
+class File
+{
+public:
+  operator bool() { return false; }
+  size_t print(const char *) { return 0; }
+  size_t println() { return 0; }
+  size_t write(const char *, size_t n) { return n; }
+  size_t write(const uint8_t *, size_t n) { return n; }
+  void flush() {}
+  void close() {}
+  bool seek(uint32_t) { return false; }
+  uint32_t size() { return 0; }
+  bool isDirectory() { return false; }
+  const char *name() { return ""; }
+  File openNextFile() { return File(); }
+};
+
+class SDClass
+{
+public:
+  void setDx(int, int, int, int) {}
+  void setCMD(int) {}
+  void setCK(int) {}
+  bool begin() { return false; }
+  File open(const char *, int = 0) { return File(); }
+  bool exists(const char *) { return false; }
+  bool remove(const char *) { return false; }
+  void end() {}
+  bool mkdir(const char *) { return false; }
+};
+
+inline SDClass SD;
+
+typedef struct
+{
+  int x;
+} SD_HandleTypeDef;
+
+#define __HAL_SD_CLEAR_FLAG(a, b) (void)0
+#define SDIO_STATIC_FLAGS 0
@@ -0,0 +1,3 @@
+/*  SparkFun_BMI270_Arduino_Library.h Host unit test stand-in. */
+
+#pragma once
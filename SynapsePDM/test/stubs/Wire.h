@@ -0,0 +1,14 @@
+/*  Wire.h Host unit test stand-in. */
+
+#pragma once
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+  void setSCL(uint32_t) {}
+  void setSDA(uint32_t) {}
+  void begin() {}
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,215 @@
+/*  hal.h STM32F4 HAL and CMSIS stand-ins for host unit tests.
+    Only what the firmware uses. Registers are plain memory and HAL calls succeed without doing anything.
+*/
+
+#pragma once
+#include <stdint.h>
+#define __IO volatile
+typedef struct { __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2]; } GPIO_TypeDef;
+typedef struct { __IO uint32_t CR1,CR2,SMCR,DIER,SR,EGR,CCMR1,CCMR2,CCER,CNT,PSC,ARR,RCR,CCR1,CCR2,CCR3,CCR4,BDTR,DCR,DMAR; } TIM_TypeDef;
+typedef struct { __IO uint32_t CR, NDTR, PAR, M0AR, M1AR, FCR; } DMA_Stream_TypeDef;
+typedef struct { __IO uint32_t LISR, HISR, LIFCR, HIFCR; } DMA_TypeDef;
+typedef struct { __IO uint32_t SR,CR1,CR2,SMPR1,SMPR2,JOFR1,JOFR2,JOFR3,JOFR4,HTR,LTR,SQR1,SQR2,SQR3,JSQR,JDR1,JDR2,JDR3,JDR4,DR; } ADC_TypeDef;
+typedef struct { __IO uint32_t CSR, CCR, CDR; } ADC_Common_TypeDef;
+typedef struct { __IO uint32_t IMR,EMR,RTSR,FTSR,SWIER,PR; } EXTI_TypeDef;
+typedef struct { __IO uint32_t CTRL, CYCCNT; } DWT_Type;
+typedef struct { __IO uint32_t DEMCR; } CoreDebug_Type;
+typedef struct { __IO uint32_t CR, CSR; } PWR_TypeDef;
+typedef struct { __IO uint32_t SCR; } SCB_Type;
+// Peripherals are plain structs in RAM. Tests can read back what the code under test wrote to them.
+#define STUB_PERIPHERAL(type, name) \
+  inline type name##_Registers = {}; \
+  inline type *name = &name##_Registers;
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOA)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOB)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOC)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOD)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOE)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOF)
+STUB_PERIPHERAL(GPIO_TypeDef, GPIOG)
+STUB_PERIPHERAL(TIM_TypeDef, TIM1)
+STUB_PERIPHERAL(TIM_TypeDef, TIM2)
+STUB_PERIPHERAL(TIM_TypeDef, TIM5)
+STUB_PERIPHERAL(TIM_TypeDef, TIM6)
+STUB_PERIPHERAL(TIM_TypeDef, TIM7)
+STUB_PERIPHERAL(TIM_TypeDef, TIM8)
+STUB_PERIPHERAL(DMA_Stream_TypeDef, DMA2_Stream0)
+STUB_PERIPHERAL(DMA_Stream_TypeDef, DMA2_Stream1)
+STUB_PERIPHERAL(DMA_Stream_TypeDef, DMA2_Stream4)
+STUB_PERIPHERAL(DMA_Stream_TypeDef, DMA2_Stream5)
+STUB_PERIPHERAL(DMA_Stream_TypeDef, DMA1_Stream4)
+STUB_PERIPHERAL(DMA_TypeDef, DMA1)
+STUB_PERIPHERAL(DMA_TypeDef, DMA2)
+STUB_PERIPHERAL(ADC_TypeDef, ADC1)
+STUB_PERIPHERAL(ADC_TypeDef, ADC3)
+STUB_PERIPHERAL(ADC_Common_TypeDef, ADC123_COMMON)
+STUB_PERIPHERAL(EXTI_TypeDef, EXTI)
+STUB_PERIPHERAL(DWT_Type, DWT)
+STUB_PERIPHERAL(CoreDebug_Type, CoreDebug)
+STUB_PERIPHERAL(SCB_Type, SCB)
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+#define CoreDebug_DEMCR_TRCENA_Msk (1u<<24)
+#define DMA_SxCR_EN 1u
+#define DMA_SxCR_DBM (1u<<18)
+#define DMA_SxCR_CT (1u<<19)
+#define DMA_SxCR_TCIE (1u<<4)
+#define DMA_SxCR_HTIE (1u<<3)
+#define ADC_CR1_AWDIE (1u<<6)
+#define ADC_CR1_AWDEN (1u<<23)
+#define ADC_CR1_AWDSGL (1u<<9)
+#define ADC_CR1_AWDCH_Pos 0
+#define ADC_CR1_AWDCH (0x1Fu)
+#define ADC_SR_AWD 1u
+#define ADC_CR2_SWSTART (1u<<30)
+#define ADC_CR2_JSWSTART (1u<<22)
+#define ADC_CR1_JAUTO (1u<<10)
+#define ADC_CCR_TSVREFE (1u<<23)
+#define TIM_CR1_CEN 1u
+#define TIM_SR_UIF 1u
+typedef enum { HAL_OK, HAL_ERROR } HAL_StatusTypeDef;
+typedef struct { uint32_t Pin, Mode, Pull, Speed, Alternate; } GPIO_InitTypeDef;
+#define GPIO_PIN_0 0x0001u
+#define GPIO_PIN_1 0x0002u
+#define GPIO_PIN_2 0x0004u
+#define GPIO_PIN_3 0x0008u
+#define GPIO_PIN_4 0x0010u
+#define GPIO_PIN_5 0x0020u
+#define GPIO_PIN_6 0x0040u
+#define GPIO_PIN_7 0x0080u
+#define GPIO_PIN_8 0x0100u
+#define GPIO_PIN_9 0x0200u
+#define GPIO_PIN_10 0x0400u
+#define GPIO_PIN_11 0x0800u
+#define GPIO_PIN_12 0x1000u
+#define GPIO_PIN_13 0x2000u
+#define GPIO_PIN_14 0x4000u
+#define GPIO_PIN_15 0x8000u
+enum { GPIO_MODE_OUTPUT_PP=1, GPIO_MODE_ANALOG, GPIO_MODE_INPUT, GPIO_MODE_IT_RISING_FALLING, GPIO_NOPULL=0, GPIO_PULLDOWN, GPIO_PULLUP, GPIO_SPEED_FREQ_HIGH=2, GPIO_SPEED_FREQ_LOW=0 };
+inline void HAL_GPIO_Init(GPIO_TypeDef*, GPIO_InitTypeDef*) {}
+typedef struct { uint32_t Channel, Direction, PeriphInc, MemInc, PeriphDataAlignment, MemDataAlignment, Mode, Priority, FIFOMode; } DMA_InitTypeDef;
+struct __DMA_HandleTypeDef; typedef struct __DMA_HandleTypeDef { DMA_Stream_TypeDef *Instance; DMA_InitTypeDef Init; void *Parent; void (*XferCpltCallback)(struct __DMA_HandleTypeDef*); void (*XferHalfCpltCallback)(struct __DMA_HandleTypeDef*); void (*XferM1CpltCallback)(struct __DMA_HandleTypeDef*); void (*XferM1HalfCpltCallback)(struct __DMA_HandleTypeDef*); void (*XferErrorCallback)(struct __DMA_HandleTypeDef*);} DMA_HandleTypeDef;
+enum { DMA_CHANNEL_0=0, DMA_CHANNEL_1, DMA_CHANNEL_2, DMA_CHANNEL_3, DMA_CHANNEL_4, DMA_CHANNEL_5, DMA_CHANNEL_6, DMA_CHANNEL_7 };
+enum { DMA_MEMORY_TO_PERIPH=1, DMA_PERIPH_TO_MEMORY=0, DMA_PINC_DISABLE=0, DMA_MINC_ENABLE=1, DMA_PDATAALIGN_WORD=2, DMA_MDATAALIGN_WORD=2, DMA_PDATAALIGN_HALFWORD=1, DMA_MDATAALIGN_HALFWORD=1, DMA_CIRCULAR=1, DMA_PRIORITY_HIGH=2, DMA_PRIORITY_VERY_HIGH=3, DMA_PRIORITY_MEDIUM=1, DMA_PRIORITY_LOW=0, DMA_FIFOMODE_DISABLE=0 };
+inline HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef*, uint32_t, uint32_t, uint32_t) { return {}; } inline HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef*, uint32_t, uint32_t, uint32_t) { return {}; }
+inline HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef*) { return {}; } inline void HAL_DMA_IRQHandler(DMA_HandleTypeDef*) {}
+inline HAL_StatusTypeDef HAL_DMAEx_MultiBufferStart_IT(DMA_HandleTypeDef*, uint32_t, uint32_t, uint32_t, uint32_t) { return {}; }
+typedef struct { uint32_t Prescaler, CounterMode, Period, ClockDivision, RepetitionCounter, AutoReloadPreload; } TIM_Base_InitTypeDef;
+enum { TIM_DMA_ID_UPDATE=0, TIM_DMA_ID_CC1, TIM_DMA_ID_CC2, TIM_DMA_ID_CC3, TIM_DMA_ID_CC4, TIM_DMA_ID_COMMUTATION, TIM_DMA_ID_TRIGGER };
+typedef struct { TIM_TypeDef *Instance; TIM_Base_InitTypeDef Init; DMA_HandleTypeDef *hdma[7]; } TIM_HandleTypeDef;
+enum { TIM_COUNTERMODE_UP=0, TIM_CLOCKDIVISION_DIV1=0, TIM_AUTORELOAD_PRELOAD_ENABLE=0x80, TIM_DMA_UPDATE=0x100, TIM_TRGO_UPDATE=0x20, TIM_TRGO_OC1REF=0x40, TIM_MASTERSLAVEMODE_DISABLE=0, TIM_OCMODE_PWM1=0x60, TIM_OCMODE_TIMING=0, TIM_OCPOLARITY_HIGH=0, TIM_OCFAST_DISABLE=0, TIM_CHANNEL_1=0, TIM_CHANNEL_2=4, TIM_CHANNEL_3=8, TIM_CHANNEL_4=12, TIM_IT_UPDATE=1, TIM_FLAG_UPDATE=1, TIM_TRGO_OC4REF=0x70, TIM_TRGO_RESET=0 };
+typedef struct { uint32_t MasterOutputTrigger, MasterSlaveMode; } TIM_MasterConfigTypeDef;
+typedef struct { uint32_t OCMode, Pulse, OCPolarity, OCNPolarity, OCFastMode, OCIdleState, OCNIdleState; } TIM_OC_InitTypeDef;
+inline HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_TIM_Base_DeInit(TIM_HandleTypeDef*) { return {}; }
+inline HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(TIM_HandleTypeDef*, TIM_MasterConfigTypeDef*) { return {}; }
+inline HAL_StatusTypeDef HAL_TIM_OC_Init(TIM_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_TIM_OC_ConfigChannel(TIM_HandleTypeDef*, TIM_OC_InitTypeDef*, uint32_t) { return {}; } inline HAL_StatusTypeDef HAL_TIM_OC_Start(TIM_HandleTypeDef*, uint32_t) { return {}; }
+#define __HAL_TIM_ENABLE_DMA(h, x) ((h)->Instance->DIER |= (x))
+#define __HAL_TIM_DISABLE_DMA(h, x) ((h)->Instance->DIER &= ~(x))
+#define __HAL_TIM_SET_COMPARE(h, c, v) ((h)->Instance->CCR1 = (v))
+#define __HAL_TIM_SET_AUTORELOAD(h, v) ((h)->Instance->ARR = (v))
+#define __HAL_TIM_SET_PRESCALER(h, v) ((h)->Instance->PSC = (v))
+#define __HAL_TIM_GET_COUNTER(h) ((h)->Instance->CNT)
+#define __HAL_DMA_GET_COUNTER(h) ((h)->Instance->NDTR)
+#define __HAL_DMA_ENABLE_IT(h, x) ((h)->Instance->CR |= (x))
+#define __HAL_DMA_DISABLE_IT(h, x) ((h)->Instance->CR &= ~(x))
+#define DMA_IT_TC DMA_SxCR_TCIE
+#define DMA_IT_HT DMA_SxCR_HTIE
+typedef struct { uint32_t ClockPrescaler, Resolution, ScanConvMode, ContinuousConvMode, DiscontinuousConvMode, NbrOfDiscConversion, ExternalTrigConvEdge, ExternalTrigConv, DataAlign, NbrOfConversion, DMAContinuousRequests, EOCSelection; } ADC_InitTypeDef;
+typedef struct { ADC_TypeDef *Instance; ADC_InitTypeDef Init; DMA_HandleTypeDef *DMA_Handle; } ADC_HandleTypeDef;
+typedef struct { uint32_t Channel, Rank, SamplingTime, Offset; } ADC_ChannelConfTypeDef;
+typedef struct { uint32_t InjectedChannel, InjectedRank, InjectedSamplingTime, InjectedOffset, InjectedNbrOfConversion, InjectedDiscontinuousConvMode, AutoInjectedConv, ExternalTrigInjecConv, ExternalTrigInjecConvEdge; } ADC_InjectionConfTypeDef;
+typedef struct { uint32_t WatchdogMode, HighThreshold, LowThreshold, Channel, ITMode, WatchdogNumber; } ADC_AnalogWDGConfTypeDef;
+enum { ADC_CLOCK_SYNC_PCLK_DIV4=1, ADC_CLOCK_SYNC_PCLK_DIV2=0, ADC_RESOLUTION_12B=0, ENABLE=1, DISABLE=0, ADC_EXTERNALTRIGCONVEDGE_NONE=0, ADC_EXTERNALTRIGCONVEDGE_RISING=1, ADC_SOFTWARE_START=0x0F000001, ADC_EXTERNALTRIGCONV_T8_TRGO=0x0E000000, ADC_EXTERNALTRIGCONV_T1_CC1=0, ADC_EXTERNALTRIGCONV_T8_CC1=0x0D000000, ADC_DATAALIGN_RIGHT=0, ADC_EOC_SEQ_CONV=0, ADC_EXTERNALTRIGINJECCONV_T1_CC4=0, ADC_EXTERNALTRIGINJECCONV_T8_CC4=0x00070000, ADC_EXTERNALTRIGINJECCONVEDGE_NONE=0, ADC_EXTERNALTRIGINJECCONVEDGE_RISING=0x00100000, ADC_INJECTED_SOFTWARE_START=0x0F000001, ADC_ANALOGWATCHDOG_SINGLE_REG=0x00800200, ADC_ANALOGWATCHDOG_SINGLE_INJEC=0x00400200, ADC_ANALOGWATCHDOG_ALL_REG=0x00800000 };
+enum { ADC_CHANNEL_0=0, ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_4, ADC_CHANNEL_5, ADC_CHANNEL_6, ADC_CHANNEL_7, ADC_CHANNEL_8, ADC_CHANNEL_9, ADC_CHANNEL_10, ADC_CHANNEL_11, ADC_CHANNEL_12, ADC_CHANNEL_13, ADC_CHANNEL_14, ADC_CHANNEL_15, ADC_CHANNEL_16, ADC_CHANNEL_17, ADC_CHANNEL_18 };
+#define ADC_CHANNEL_VREFINT ADC_CHANNEL_17
+#define ADC_CHANNEL_TEMPSENSOR ADC_CHANNEL_18
+enum { ADC_SAMPLETIME_3CYCLES=0, ADC_SAMPLETIME_15CYCLES, ADC_SAMPLETIME_28CYCLES, ADC_SAMPLETIME_56CYCLES, ADC_SAMPLETIME_84CYCLES, ADC_SAMPLETIME_112CYCLES, ADC_SAMPLETIME_144CYCLES, ADC_SAMPLETIME_480CYCLES };
+enum { ADC_INJECTED_RANK_1=1, ADC_INJECTED_RANK_2, ADC_INJECTED_RANK_3, ADC_INJECTED_RANK_4 };
+inline HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_ADC_DeInit(ADC_HandleTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_ADC_ConfigChannel(ADC_HandleTypeDef*, ADC_ChannelConfTypeDef*) { return {}; }
+inline HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef*, uint32_t*, uint32_t) { return {}; } inline HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef*) { return {}; }
+inline HAL_StatusTypeDef HAL_ADCEx_InjectedConfigChannel(ADC_HandleTypeDef*, ADC_InjectionConfTypeDef*) { return {}; } inline uint32_t HAL_ADCEx_InjectedGetValue(ADC_HandleTypeDef*, uint32_t) { return {}; }
+inline HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef*, ADC_AnalogWDGConfTypeDef*) { return {}; } inline void HAL_ADC_IRQHandler(ADC_HandleTypeDef*) {}
+#define __HAL_LINKDMA(h, f, d) do { (h)->f = &(d); (d).Parent = (h); } while (0)
+#define __HAL_ADC_ENABLE_IT(h, x) ((h)->Instance->CR1 |= (x))
+#define __HAL_ADC_DISABLE_IT(h, x) ((h)->Instance->CR1 &= ~(x))
+#define __HAL_ADC_CLEAR_FLAG(h, x) ((h)->Instance->SR = ~(x))
+#define __HAL_ADC_GET_FLAG(h, x) (((h)->Instance->SR & (x)) == (x))
+#define __HAL_ADC_GET_IT_SOURCE(h, x) (((h)->Instance->CR1 & (x)) == (x))
+#define ADC_IT_AWD ADC_CR1_AWDIE
+#define ADC_IT_OVR (1u<<26)
+#define ADC_FLAG_AWD ADC_SR_AWD
+typedef enum { DMA2_Stream0_IRQn=56, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn, DMA2_Stream4_IRQn, DMA2_Stream5_IRQn=68, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn, ADC_IRQn=18, SDIO_IRQn=49, EXTI9_5_IRQn=23, EXTI15_10_IRQn=40, TIM6_DAC_IRQn=54, TIM7_IRQn=55, EXTI3_IRQn=9, EXTI4_IRQn=10, TIM8_UP_TIM13_IRQn=44, TIM1_UP_TIM10_IRQn=25 } IRQn_Type;
+inline void HAL_NVIC_SetPriority(IRQn_Type, uint32_t, uint32_t) {} inline void HAL_NVIC_EnableIRQ(IRQn_Type) {} inline void HAL_NVIC_DisableIRQ(IRQn_Type) {} inline void HAL_NVIC_ClearPendingIRQ(IRQn_Type) {}
+inline void NVIC_SetPriority(IRQn_Type, uint32_t) {} inline void NVIC_EnableIRQ(IRQn_Type) {} inline void NVIC_DisableIRQ(IRQn_Type) {}
+#define __HAL_RCC_GPIOA_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOB_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOC_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOD_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOE_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOF_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOG_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_DMA1_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_DMA2_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_TIM1_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_TIM8_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_ADC1_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_ADC3_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_TIM5_CLK_SLEEP_DISABLE() (void)0
+#define __HAL_RCC_GPIOG_CLK_ENABLE() (void)0
+#define __HAL_RCC_GPIOF_CLK_ENABLE() (void)0
+#define __HAL_RCC_GPIOE_CLK_ENABLE() (void)0
+#define __HAL_RCC_GPIOA_CLK_ENABLE() (void)0
+#define __HAL_RCC_GPIOB_CLK_ENABLE() (void)0
+#define __HAL_RCC_GPIOC_CLK_ENABLE() (void)0
+#define __HAL_RCC_DMA2_CLK_ENABLE() (void)0
+#define __HAL_RCC_TIM8_CLK_ENABLE() (void)0
+#define __HAL_RCC_TIM1_CLK_ENABLE() (void)0
+#define __HAL_RCC_TIM5_CLK_ENABLE() (void)0
+#define __HAL_RCC_TIM6_CLK_ENABLE() (void)0
+#define __HAL_RCC_ADC1_CLK_ENABLE() (void)0
+#define __HAL_RCC_ADC3_CLK_ENABLE() (void)0
+#define __HAL_RCC_ADC1_CLK_DISABLE() (void)0
+#define __HAL_RCC_ADC3_CLK_DISABLE() (void)0
+#define __HAL_RCC_SPI2_CLK_DISABLE() (void)0
+#define __HAL_RCC_TIM5_CLK_DISABLE() (void)0
+inline void HAL_SuspendTick() {} inline void HAL_ResumeTick() {} inline void HAL_PWR_EnableBkUpAccess() {}
+inline void HAL_PWR_EnterSTOPMode(uint32_t, uint8_t) {} inline void HAL_PWR_EnterSLEEPMode(uint32_t, uint8_t) {}
+enum { PWR_LOWPOWERREGULATOR_ON=1, PWR_MAINREGULATOR_ON=0, PWR_SLEEPENTRY_WFI=1 };
+#define __LL_ADC_CALC_TEMPERATURE(a,b,c) ((int32_t)(b))
+// VREFINT factory calibration: its 12-bit reading with a 3.3V analogue supply. A typical 1.21V part unless a test sets it.
+#define VREFINT_CAL_VREF 3300U
+inline uint16_t VREFINT_CAL_VALUE = 1502;
+#define __LL_ADC_CALC_VREFANALOG_VOLTAGE(a,b) ((int32_t)((VREFINT_CAL_VREF * (uint32_t)VREFINT_CAL_VALUE) / (a)))
+#define __LL_ADC_CALC_DATA_TO_VOLTAGE(a,b,c) ((a)*(b))
+#define LL_ADC_RESOLUTION_12B 0
+// Cortex-M4 intrinsics
+inline uint32_t __UADD16(uint32_t a, uint32_t b) { return ((a + b) & 0xFFFFu) | ((((a >> 16) + (b >> 16)) & 0xFFFFu) << 16); }
+inline uint32_t __CLZ(uint32_t x) { return x ? __builtin_clz(x) : 32; }
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+inline void __DSB() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline void __ISB() {}
+inline void __DMB() { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+inline void __WFI() {}
+inline uint32_t HAL_GetTick() { return {}; } inline uint32_t HAL_RCC_GetPCLK2Freq() { return {}; } inline uint32_t HAL_RCC_GetPCLK1Freq() { return {}; }
+#define __HAL_GPIO_EXTI_CLEAR_IT(x) (EXTI->PR = (x))
+#define __HAL_GPIO_EXTI_GET_IT(x) (EXTI->PR & (x))
+#define SCB_SCR_SLEEPDEEP_Msk (1u<<2)
+#define UNUSED(x) (void)(x)
+#define TIM_DMA_CC1 (1u<<9)
+#define TIM_DMA_CC4 (1u<<12)
+typedef struct { uint32_t PLLState, PLLSource, PLLM, PLLN, PLLP, PLLQ, PLLR; } RCC_PLLInitTypeDef;
+typedef struct { uint32_t OscillatorType, HSEState, LSEState; RCC_PLLInitTypeDef PLL; } RCC_OscInitTypeDef;
+typedef struct { uint32_t ClockType, SYSCLKSource, AHBCLKDivider, APB1CLKDivider, APB2CLKDivider; } RCC_ClkInitTypeDef;
+enum { PWR_REGULATOR_VOLTAGE_SCALE1, RCC_OSCILLATORTYPE_HSE=1, RCC_OSCILLATORTYPE_LSE=2, RCC_HSE_ON, RCC_LSE_ON, RCC_PLL_ON, RCC_PLLSOURCE_HSE, RCC_PLLP_DIV2, RCC_CLOCKTYPE_HCLK=1, RCC_CLOCKTYPE_SYSCLK=2, RCC_CLOCKTYPE_PCLK1=4, RCC_CLOCKTYPE_PCLK2=8, RCC_SYSCLKSOURCE_PLLRCLK, RCC_SYSCLK_DIV1, RCC_HCLK_DIV4, RCC_HCLK_DIV2, FLASH_LATENCY_5 };
+#define __HAL_RCC_PWR_CLK_ENABLE() (void)0
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(x) (void)0
+inline HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef*) { return {}; } inline HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef*, uint32_t) { return {}; } inline void Error_Handler() {}
+enum { TIM_SLAVEMODE_TRIGGER=6, TIM_SLAVEMODE_EXTERNAL1=7, TIM_TS_ITR0=0, TIM_TS_ITR1=0x10, TIM_TS_ITR2=0x20, TIM_TS_ITR3=0x30, TIM_TRGO_ENABLE=0x10, TIM_MASTERSLAVEMODE_ENABLE=0x80 };
+typedef struct { uint32_t SlaveMode, InputTrigger, TriggerPolarity, TriggerPrescaler, TriggerFilter; } TIM_SlaveConfigTypeDef;
+inline HAL_StatusTypeDef HAL_TIM_SlaveConfigSynchro(TIM_HandleTypeDef*, TIM_SlaveConfigTypeDef*) { return {}; }
+enum { ADC_EXTERNALTRIGCONV_T2_TRGO=0x06000000 };
+#define __HAL_RCC_TIM2_CLK_ENABLE() (void)0
+#define __HAL_RCC_TIM2_CLK_DISABLE() (void)0
+inline uint32_t SystemCoreClock = 168000000;
+#define NUM_DIGITAL_PINS 112
+#define EXTI_IRQ_PRIO 6
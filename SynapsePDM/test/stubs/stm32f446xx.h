@@ -0,0 +1,3 @@
+/*  stm32f446xx.h Host unit test stand-in. The registers are in hal.h. */
+
+#pragma once
@@ -0,0 +1,137 @@
+/*  test_main.cpp Analogue supply correction from VREFINT.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ADCHandler.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+PWMBank PWMBanks[PWM_BANKS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static uint32_t offTable[PWM_MAX_SLOTS];
+
+const uint32_t *PWMActiveTable(uint8_t bank)
+{
+  return offTable;
+}
+
+void ForceGroupOff(uint8_t channel) {}
+void WireModelScan(const volatile uint16_t *scan) {}
+void CaptureBlock(const volatile uint16_t *block, uint16_t scans) {}
+void CaptureTrigger(uint8_t channel, uint8_t trigger, uint16_t tripRaw, uint16_t scanOffset) {}
+
+// VREFINT of the modelled part (volts)
+static const double vrefint = VREFINT_CAL_VREF / 1000.0 * VREFINT_CAL_VALUE / ADCres;
+
+// Analogue supplies across the STM32F446 range, and the nominal one
+static const double SUPPLIES[] = {1.8, 3.0, 3.3, 3.6};
+
+// 12-bit reading of a voltage with an analogue supply
+static uint16_t reading(double volts, double supply)
+{
+  return min(lround(volts / supply * ADCres), (long)ADCres);
+}
+
+void setUp(void)
+{
+  vbattFilterLoaded = false;
+}
+
+void tearDown(void) {}
+
+void test_default_before_first_reading(void)
+{
+  TEST_ASSERT_EQUAL_INT32(ADC_VREF_DEFAULT_MV, ADCVrefMillivolts(0));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, ADC_VREF_DEFAULT_MV / 1000.0f, ADCToVolts(ADCres, 0));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, ADCToVolts(0, 0));
+}
+
+void test_supply_from_vrefint(void)
+{
+  // At the calibration supply, the factory value reads back exactly
+  TEST_ASSERT_EQUAL_INT32(VREFINT_CAL_VREF, ADCVrefMillivolts(VREFINT_CAL_VALUE));
+
+  // Within the error of one VREFINT count: about 2mV at 3.3V, 4mV at 3.6V
+  for (double supply : SUPPLIES)
+  {
+    uint16_t raw = reading(vrefint, supply);
+    double count = supply * supply / vrefint / ADCres;
+    TEST_ASSERT_INT32_WITHIN((int32_t)(count * 1000.0) + 1, lround(supply * 1000.0), ADCVrefMillivolts(raw));
+  }
+}
+
+void test_volts_follow_the_input_not_the_supply(void)
+{
+  // The same input voltage read with each supply converts to within a few millivolts of it. Uncorrected, a 3.0V supply
+  // would read 10% high.
+  const double inputs[] = {0.1, 0.5, 1.0, 1.65, 2.5, 2.95};
+  for (double supply : SUPPLIES)
+  {
+    uint16_t vrefRaw = reading(vrefint, supply);
+    for (double volts : inputs)
+    {
+      if (volts >= supply)
+      {
+        continue;
+      }
+      TEST_ASSERT_FLOAT_WITHIN(0.005f, volts, ADCToVolts(reading(volts, supply), vrefRaw));
+    }
+
+    // Full scale is the supply
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, supply, ADCToVolts(ADCres, vrefRaw));
+  }
+}
+
+void test_battery_voltage_is_corrected(void)
+{
+  // Divider ratio from the scale at the nominal supply
+  const double divider = VBATT_SCALE * ADCres / (ADC_VREF_DEFAULT_MV / 1000.0);
+  const double batteries[] = {9.0, 12.0, 13.8, 16.0};
+
+  for (double supply : SUPPLIES)
+  {
+    uint16_t vrefRaw = reading(vrefint, supply);
+    for (double battery : batteries)
+    {
+      if (battery / divider >= supply)
+      {
+        continue;
+      }
+
+      // One count of the divided battery voltage is about 4mV at 3.3V
+      vbattFilterLoaded = false;
+      updateVBatt(reading(battery / divider, supply), vrefRaw);
+      TEST_ASSERT_INT32_WITHIN(10, lround(battery * 1000.0), VBattMillivolts);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_default_before_first_reading);
+  RUN_TEST(test_supply_from_vrefint);
+  RUN_TEST(test_volts_follow_the_input_not_the_supply);
+  RUN_TEST(test_battery_voltage_is_corrected);
+  return UNITY_END();
+}
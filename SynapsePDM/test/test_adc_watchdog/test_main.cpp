@@ -0,0 +1,266 @@
+/*  test_main.cpp Analog watchdog trips with channels running between their trip levels.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ADCHandler.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+PWMBank PWMBanks[PWM_BANKS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static uint32_t offTable[PWM_MAX_SLOTS];
+static TIM_HandleTypeDef bankTimer;
+static uint16_t forcedOff;
+
+const uint32_t *PWMActiveTable(uint8_t bank)
+{
+  return offTable;
+}
+
+void ForceGroupOff(uint8_t channel)
+{
+  forcedOff |= 1 << channel;
+}
+
+void WireModelScan(const volatile uint16_t *scan) {}
+void CaptureBlock(const volatile uint16_t *block, uint16_t scans) {}
+void CaptureTrigger(uint8_t channel, uint8_t trigger, uint16_t tripRaw, uint16_t scanOffset) {}
+
+static const uint32_t bufferLength = ADC_SCAN_DEPTH * ADC_SCAN_CHANNELS;
+
+// Next buffer entry the DMA writes
+static uint32_t dmaNext;
+
+// Current sense of each channel (raw)
+static uint16_t sense[NUM_CHANNELS];
+
+// One regular scan, converted and written in channel order as the ADC and DMA do. The watchdog flags any conversion
+// above the high threshold while its interrupt is enabled. Half and whole buffers complete the blocks.
+static void scan()
+{
+  for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+  {
+    adcBuffer[dmaNext] = sense[i];
+    dmaNext = (dmaNext + 1) % bufferLength;
+    DMA2_Stream4->NDTR = bufferLength - dmaNext;
+
+    if (sense[i] > ADC1->HTR)
+    {
+      ADC1->SR |= ADC_SR_AWD;
+      ADC_IRQHandler();
+    }
+  }
+
+  if (dmaNext == bufferLength / 2)
+  {
+    HAL_ADC_ConvHalfCpltCallback(&hadc1);
+  }
+  else if (dmaNext == 0)
+  {
+    HAL_ADC_ConvCpltCallback(&hadc1);
+  }
+}
+
+// Scans until the block in progress completes
+static void finishBlock()
+{
+  do
+  {
+    scan();
+  } while (dmaNext % (bufferLength / 2) != 0);
+}
+
+static void setLevels(uint16_t level)
+{
+  uint16_t levels[NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    levels[i] = level;
+  }
+  ADCSetTripLevels(levels);
+}
+
+void setUp(void)
+{
+  // 200 Hz and 100 slots. Two slots a scan.
+  for (int b = 0; b < PWM_BANKS; b++)
+  {
+    PWMBanks[b].Slots = 100;
+    PWMBanks[b].Prescaler = 1;
+    PWMBanks[b].SlotTicks = PWM_TIMER_CLOCK / (200 * 100);
+    PWMBanks[b].SlotCycles = PWM_TIMER_CLOCK / (200 * 100);
+  }
+  PWMBanks[PWM_BANK_G].htim = &bankTimer;
+  bankTimer.Instance = TIM8;
+
+  InitialiseADC();
+  ADC1->CR1 |= ADC_IT_AWD; // Set by HAL_ADC_AnalogWDGConfig()
+  ADC1->SR = 0;
+
+  for (uint32_t n = 0; n < bufferLength; n++)
+  {
+    adcBuffer[n] = 0;
+  }
+  memset(sense, 0, sizeof(sense));
+  dmaNext = 0;
+  forcedOff = 0;
+  ADCTripCount = 0;
+  ADCWatchdogRaises = 0;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    GroupLeader[i] = i;
+    ADCCollectTrip(i);
+  }
+}
+
+void tearDown(void) {}
+
+void test_channel_over_its_level_trips_in_the_scan(void)
+{
+  setLevels(1000);
+  scan();
+  TEST_ASSERT_EQUAL_UINT16(0, forcedOff);
+
+  sense[3] = 1200;
+  scan();
+  TEST_ASSERT_EQUAL_UINT16(1 << 3, forcedOff);
+  TEST_ASSERT_EQUAL_UINT16(1200, ADCCollectTrip(3));
+  TEST_ASSERT_EQUAL_UINT32(1, ADCTripCount);
+}
+
+void test_channel_between_levels_raises_the_watchdog(void)
+{
+  uint16_t levels[NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    levels[i] = 3000;
+  }
+  levels[0] = 400;
+  levels[1] = 2000;
+  ADCSetTripLevels(levels);
+  TEST_ASSERT_EQUAL_UINT32(400, ADC1->HTR);
+
+  // Channel 1 is legitimately above channel 0's level. The watchdog moves up to channel 1's own level rather than
+  // being turned off.
+  sense[1] = 1000;
+  scan();
+  TEST_ASSERT_EQUAL_UINT16(0, forcedOff);
+  TEST_ASSERT_EQUAL_UINT32(2000, ADC1->HTR);
+  TEST_ASSERT_TRUE(ADC1->CR1 & ADC_IT_AWD);
+  TEST_ASSERT_EQUAL_UINT32(1, ADCWatchdogRaises);
+
+  // No more interrupts from it for the rest of the block
+  scan();
+  scan();
+  TEST_ASSERT_EQUAL_UINT32(1, ADCWatchdogRaises);
+
+  // Still tripped in the scan it goes over its own level, and so is any other channel over 2000
+  sense[1] = 2100;
+  sense[5] = 3100;
+  scan();
+  TEST_ASSERT_EQUAL_UINT16((1 << 1) | (1 << 5), forcedOff);
+  TEST_ASSERT_EQUAL_UINT32(2, ADCTripCount);
+}
+
+void test_lower_level_is_caught_within_a_block(void)
+{
+  uint16_t levels[NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    levels[i] = 3000;
+  }
+  levels[0] = 400;
+  levels[1] = 2000;
+  ADCSetTripLevels(levels);
+
+  // Worst case: channel 0 goes over its level just after channel 1 raised the watchdog at the start of a block
+  finishBlock();
+  sense[1] = 1000;
+  scan();
+  sense[0] = 500;
+
+  int scans = 0;
+  while (!forcedOff && scans < ADC_SCAN_DEPTH)
+  {
+    scan();
+    scans++;
+  }
+
+  // Caught by the first scan after the watchdog goes back down at the end of the block
+  TEST_ASSERT_EQUAL_UINT16(1 << 0, forcedOff);
+  TEST_ASSERT_EQUAL_INT(ADC_SCAN_DEPTH / 2, scans);
+  TEST_ASSERT_EQUAL_UINT16(500, ADCCollectTrip(0));
+}
+
+void test_watchdog_goes_back_down_each_block(void)
+{
+  uint16_t levels[NUM_CHANNELS];
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    levels[i] = 3000;
+  }
+  levels[0] = 400;
+  ADCSetTripLevels(levels);
+
+  // Raised once a block while a channel runs between the levels
+  sense[2] = 1000;
+  for (int block = 0; block < 4; block++)
+  {
+    finishBlock();
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, ADCWatchdogRaises);
+  TEST_ASSERT_EQUAL_UINT16(0, forcedOff);
+
+  sense[2] = 0;
+  finishBlock();
+  TEST_ASSERT_EQUAL_UINT32(400, ADC1->HTR);
+}
+
+void test_armed_level_survives_the_block(void)
+{
+  setLevels(3000);
+  ADCArmTripLevel(6, 800);
+  TEST_ASSERT_EQUAL_UINT32(800, ADC1->HTR);
+
+  // Never raised by arming
+  ADCArmTripLevel(6, 900);
+  TEST_ASSERT_EQUAL_UINT32(800, ADC1->HTR);
+
+  finishBlock();
+  TEST_ASSERT_EQUAL_UINT32(800, ADC1->HTR);
+
+  sense[6] = 850;
+  scan();
+  TEST_ASSERT_EQUAL_UINT16(1 << 6, forcedOff);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_channel_over_its_level_trips_in_the_scan);
+  RUN_TEST(test_channel_between_levels_raises_the_watchdog);
+  RUN_TEST(test_lower_level_is_caught_within_a_block);
+  RUN_TEST(test_watchdog_goes_back_down_each_block);
+  RUN_TEST(test_armed_level_survives_the_block);
+  return UNITY_END();
+}
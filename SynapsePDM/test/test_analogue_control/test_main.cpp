@@ -0,0 +1,253 @@
+/*  test_main.cpp Analogue input switching and duty scaling.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "AnalogueControl.cpp"
+
+AnalogueInputs AnalogueIns[NUM_ANA_CHANNELS];
+uint16_t ADCResults[ADC_RESULT_CHANNELS];
+uint32_t InputMillihertz[CAPTURE_INPUTS];
+uint16_t InputDutyCycle[CAPTURE_INPUTS];
+
+int32_t ADCVrefMillivolts(uint16_t vrefRaw)
+{
+  return ADC_VREF_DEFAULT_MV;
+}
+
+// The input the tests drive
+static const uint8_t INPUT_INDEX = 3;
+
+static AnalogueInputs &input = AnalogueIns[INPUT_INDEX];
+
+void setUp(void)
+{
+  memset(AnalogueIns, 0, sizeof(AnalogueIns));
+  memset(AnalogueActive, 0, sizeof(AnalogueActive));
+}
+
+void tearDown(void) {}
+
+// Switch from a state and return the new one
+static bool switchFrom(bool active, int32_t millivolts, int32_t on, int32_t off)
+{
+  return AnalogueSwitch(active, millivolts, on, off);
+}
+
+void test_active_high_hysteresis(void)
+{
+  // On at 2.5V, off at 2.0V
+  TEST_ASSERT_FALSE(switchFrom(false, 2499, 2500, 2000));
+  TEST_ASSERT_TRUE(switchFrom(false, 2500, 2500, 2000));
+  TEST_ASSERT_TRUE(switchFrom(false, 4000, 2500, 2000));
+
+  // Inside the band, either state holds
+  for (int32_t mv = 2001; mv < 2500; mv++)
+  {
+    TEST_ASSERT_FALSE(switchFrom(false, mv, 2500, 2000));
+    TEST_ASSERT_TRUE(switchFrom(true, mv, 2500, 2000));
+  }
+
+  TEST_ASSERT_FALSE(switchFrom(true, 2000, 2500, 2000));
+  TEST_ASSERT_FALSE(switchFrom(true, 0, 2500, 2000));
+}
+
+void test_active_low_hysteresis(void)
+{
+  // On at 1.0V and below, off at 1.5V and above
+  TEST_ASSERT_FALSE(switchFrom(false, 1001, 1000, 1500));
+  TEST_ASSERT_TRUE(switchFrom(false, 1000, 1000, 1500));
+  TEST_ASSERT_TRUE(switchFrom(false, 0, 1000, 1500));
+
+  for (int32_t mv = 1001; mv < 1500; mv++)
+  {
+    TEST_ASSERT_FALSE(switchFrom(false, mv, 1000, 1500));
+    TEST_ASSERT_TRUE(switchFrom(true, mv, 1000, 1500));
+  }
+
+  TEST_ASSERT_FALSE(switchFrom(true, 1500, 1000, 1500));
+  TEST_ASSERT_FALSE(switchFrom(true, 5000, 1000, 1500));
+}
+
+void test_equal_thresholds_switch_on(void)
+{
+  // No band. At the threshold it's on, from either state.
+  TEST_ASSERT_TRUE(switchFrom(false, 3000, 3000, 3000));
+  TEST_ASSERT_TRUE(switchFrom(true, 3000, 3000, 3000));
+  TEST_ASSERT_FALSE(switchFrom(true, 2999, 3000, 3000));
+}
+
+void test_thresholds_to_the_millivolt(void)
+{
+  // Thresholds are configured in volts as floats. Each must switch at exactly its millivolt, from UpdateAnalogueInputs().
+  // A frequency capture input gives the exact value to switch on (mHz against thresholds in Hz).
+  input.CaptureMode = ANA_CAPTURE_FREQUENCY;
+  anaSampleCount = 1;
+
+  for (int32_t mv = 1; mv <= 5000; mv++)
+  {
+    input.OnThreshold = mv / 1000.0f;
+    input.OffThreshold = (mv - 1) / 1000.0f;
+
+    AnalogueActive[INPUT_INDEX] = false;
+    InputMillihertz[NUM_DI_CHANNELS + INPUT_INDEX] = mv - 1;
+    UpdateAnalogueInputs();
+    TEST_ASSERT_FALSE(AnalogueActive[INPUT_INDEX]);
+
+    InputMillihertz[NUM_DI_CHANNELS + INPUT_INDEX] = mv;
+    UpdateAnalogueInputs();
+    TEST_ASSERT_TRUE_MESSAGE(AnalogueActive[INPUT_INDEX], "On threshold");
+
+    InputMillihertz[NUM_DI_CHANNELS + INPUT_INDEX] = mv - 1;
+    UpdateAnalogueInputs();
+    TEST_ASSERT_FALSE_MESSAGE(AnalogueActive[INPUT_INDEX], "Off threshold");
+  }
+}
+
+void test_linear_scale(void)
+{
+  // 0.5 - 4.5V to 10 - 90%
+  input.ScaleMin = 0.5f;
+  input.ScaleMax = 4.5f;
+  input.PWMMin = 10;
+  input.PWMMax = 90;
+
+  TEST_ASSERT_EQUAL_UINT16(100, AnalogueMapDuty(input, 0));
+  TEST_ASSERT_EQUAL_UINT16(100, AnalogueMapDuty(input, 500));
+  TEST_ASSERT_EQUAL_UINT16(101, AnalogueMapDuty(input, 505));
+  TEST_ASSERT_EQUAL_UINT16(300, AnalogueMapDuty(input, 1500));
+  TEST_ASSERT_EQUAL_UINT16(500, AnalogueMapDuty(input, 2500));
+  TEST_ASSERT_EQUAL_UINT16(700, AnalogueMapDuty(input, 3500));
+  TEST_ASSERT_EQUAL_UINT16(900, AnalogueMapDuty(input, 4500));
+  TEST_ASSERT_EQUAL_UINT16(900, AnalogueMapDuty(input, 5000));
+
+  // Falling
+  input.PWMMin = 90;
+  input.PWMMax = 10;
+  TEST_ASSERT_EQUAL_UINT16(900, AnalogueMapDuty(input, 500));
+  TEST_ASSERT_EQUAL_UINT16(500, AnalogueMapDuty(input, 2500));
+  TEST_ASSERT_EQUAL_UINT16(100, AnalogueMapDuty(input, 4500));
+
+  // Percentages over 100 clamp
+  input.PWMMin = 0;
+  input.PWMMax = 200;
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, AnalogueMapDuty(input, 4500));
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX / 2, AnalogueMapDuty(input, 2500));
+}
+
+void test_linear_scale_without_span(void)
+{
+  // A step at the scale voltage
+  input.ScaleMin = 2.0f;
+  input.ScaleMax = 2.0f;
+  input.PWMMin = 0;
+  input.PWMMax = 100;
+  TEST_ASSERT_EQUAL_UINT16(0, AnalogueMapDuty(input, 1999));
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, AnalogueMapDuty(input, 2000));
+}
+
+void test_linear_scale_is_monotonic(void)
+{
+  input.ScaleMin = 0.25f;
+  input.ScaleMax = 4.75f;
+  input.PWMMin = 0;
+  input.PWMMax = 100;
+
+  uint16_t last = 0;
+  for (int32_t mv = 0; mv <= 5000; mv++)
+  {
+    uint16_t duty = AnalogueMapDuty(input, mv);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(last, duty);
+    last = duty;
+  }
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, last);
+}
+
+void test_map_table(void)
+{
+  // Rising, then falling after 3V
+  const uint16_t mv[] = {500, 1000, 3000, 4500};
+  const uint8_t duty[] = {0, 20, 60, 30};
+  input.MapPoints = 4;
+  for (int k = 0; k < 4; k++)
+  {
+    input.MapMillivolts[k] = mv[k];
+    input.MapDuty[k] = duty[k];
+  }
+
+  // Clamped beyond either end, and exact at each point
+  TEST_ASSERT_EQUAL_UINT16(0, AnalogueMapDuty(input, 0));
+  TEST_ASSERT_EQUAL_UINT16(300, AnalogueMapDuty(input, 5000));
+  for (int k = 0; k < 4; k++)
+  {
+    TEST_ASSERT_EQUAL_UINT16(duty[k] * 10, AnalogueMapDuty(input, mv[k]));
+  }
+
+  // Interpolated between them
+  TEST_ASSERT_EQUAL_UINT16(100, AnalogueMapDuty(input, 750));
+  TEST_ASSERT_EQUAL_UINT16(400, AnalogueMapDuty(input, 2000));
+  TEST_ASSERT_EQUAL_UINT16(450, AnalogueMapDuty(input, 3750));
+  TEST_ASSERT_EQUAL_UINT16(500, AnalogueMapDuty(input, 2500));
+
+  // Either side of a point
+  TEST_ASSERT_EQUAL_UINT16(199, AnalogueMapDuty(input, 999));
+  TEST_ASSERT_EQUAL_UINT16(200, AnalogueMapDuty(input, 1001));
+}
+
+void test_map_table_limits(void)
+{
+  // Points beyond ANA_MAP_POINTS are ignored, and percentages over 100 clamp
+  input.MapPoints = ANA_MAP_POINTS + 3;
+  for (int k = 0; k < ANA_MAP_POINTS; k++)
+  {
+    input.MapMillivolts[k] = 1000 * (k + 1);
+    input.MapDuty[k] = 50 * k;
+  }
+  TEST_ASSERT_EQUAL_UINT16(0, AnalogueMapDuty(input, 1000));
+  TEST_ASSERT_EQUAL_UINT16(250, AnalogueMapDuty(input, 1500));
+  TEST_ASSERT_EQUAL_UINT16(750, AnalogueMapDuty(input, 2500));
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, AnalogueMapDuty(input, 3000));
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, AnalogueMapDuty(input, 60000));
+
+  // One point isn't a table. The linear scale is used instead.
+  input.MapPoints = 1;
+  input.ScaleMin = 0.0f;
+  input.ScaleMax = 5.0f;
+  input.PWMMin = 0;
+  input.PWMMax = 100;
+  TEST_ASSERT_EQUAL_UINT16(500, AnalogueMapDuty(input, 2500));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_active_high_hysteresis);
+  RUN_TEST(test_active_low_hysteresis);
+  RUN_TEST(test_equal_thresholds_switch_on);
+  RUN_TEST(test_thresholds_to_the_millivolt);
+  RUN_TEST(test_linear_scale);
+  RUN_TEST(test_linear_scale_without_span);
+  RUN_TEST(test_linear_scale_is_monotonic);
+  RUN_TEST(test_map_table);
+  RUN_TEST(test_map_table_limits);
+  return UNITY_END();
+}
@@ -0,0 +1,291 @@
+/*  test_main.cpp Analogue input decimation resolution, filter settling time and noise floor.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "AnalogueControl.cpp"
+
+AnalogueInputs AnalogueIns[NUM_ANA_CHANNELS];
+
+// The input the tests drive. Others read 0.
+static const uint8_t INPUT_INDEX = 2;
+
+static std::mt19937 rng(23);
+
+static const double MV_PER_COUNT = (double)ANA_FULL_SCALE_MV / ANA_DECIMATED_MAX;
+
+/// @brief Fill one half of the DMA buffer with scans of an input at a level, and decimate and filter it as the DMA interrupt does
+/// @param counts Input level (decimated counts)
+/// @param noise Gaussian noise on each 12-bit conversion (LSB)
+/// @param spikeRate Chance of each conversion being off by 1500 LSB
+/// @return Filtered sample (decimated counts)
+static uint16_t sampleAt(double counts, double noise, double spikeRate)
+{
+  std::normal_distribution<double> gaussian(0, noise);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (int s = 0; s < ANA_OVERSAMPLE; s++)
+  {
+    double v = counts * (1 << ANA_DECIMATE_SHIFT) / ANA_OVERSAMPLE + (noise > 0 ? gaussian(rng) : 0);
+    if (uniform(rng) < spikeRate)
+    {
+      v += uniform(rng) < 0.5 ? -1500 : 1500;
+    }
+    anaBuffer[s * NUM_ANA_CHANNELS + INPUT_INDEX] = constrain(lround(v), 0L, (long)ADCres);
+  }
+  anaBlockComplete(&anaBuffer[0]);
+  return anaPublished[INPUT_INDEX];
+}
+
+static void configure(uint8_t mode, uint8_t length, uint16_t filterTime)
+{
+  AnalogueIns[INPUT_INDEX].FilterMode = mode;
+  AnalogueIns[INPUT_INDEX].MedianLength = length;
+  AnalogueIns[INPUT_INDEX].FilterTime = filterTime;
+  ConfigureAnalogueFilters();
+
+  // Start from empty, as after power up
+  anaFilters[INPUT_INDEX] = {};
+}
+
+/// @brief Samples after a step until the output stays within a fraction of the step
+static uint32_t settlingSamples(double from, double to, double fraction)
+{
+  for (int k = 0; k < 2000; k++)
+  {
+    sampleAt(from, 0, 0);
+  }
+
+  int last = -1;
+  for (int k = 0; k < 3000; k++)
+  {
+    if (fabs(sampleAt(to, 0, 0) - to) > fraction * fabs(to - from))
+    {
+      last = k;
+    }
+  }
+  return last + 1;
+}
+
+/// @brief Noise on the filtered output once settled (mV rms)
+static double noiseFloor(double level, double noise, double spikeRate, double *peak = nullptr)
+{
+  double sum2 = 0, worst = 0;
+  int n = 0;
+  for (int k = 0; k < 20000; k++)
+  {
+    double error = (sampleAt(level, noise, spikeRate) - level) * MV_PER_COUNT;
+    if (k >= 1000)
+    {
+      sum2 += error * error;
+      worst = fmax(worst, fabs(error));
+      n++;
+    }
+  }
+  if (peak)
+  {
+    *peak = worst;
+  }
+  return sqrt(sum2 / n);
+}
+
+void setUp(void)
+{
+  memset(AnalogueIns, 0, sizeof(AnalogueIns));
+  memset((void *)anaBuffer, 0, sizeof(anaBuffer));
+}
+
+void tearDown(void) {}
+
+void test_decimation_resolution(void)
+{
+  configure(ANA_FILTER_IIR, 1, 0);
+
+  // Slow ramp with 1 LSB of noise as dither. Error of each decimated sample against the true 14-bit level.
+  double sum2 = 0;
+  int n = 0;
+  for (double c = 100; c < ANA_DECIMATED_MAX - 100; c += 0.37)
+  {
+    double error = sampleAt(c, 1.0, 0) - c;
+    sum2 += error * error;
+    n++;
+  }
+  double rms = sqrt(sum2 / n);
+  double bits = log2(ANA_DECIMATED_MAX / (rms * sqrt(12.0)));
+
+  char line[120];
+  snprintf(line, sizeof(line), "Decimated: rms error %.2f counts (%.2f mV), %.1f effective bits of %d", rms, rms * MV_PER_COUNT, bits,
+           (int)round(log2(ANA_DECIMATED_MAX)));
+  TEST_MESSAGE(line);
+
+  // The noise on one 12-bit conversion is 1 LSB, 4 decimated counts. 16 of them average to 1.
+  TEST_ASSERT_LESS_THAN_FLOAT(1.3f, rms);
+  TEST_ASSERT_GREATER_OR_EQUAL_FLOAT(11.8f, bits);
+}
+
+void test_decimated_codes_monotonic(void)
+{
+  configure(ANA_FILTER_IIR, 1, 0);
+
+  // Every 14-bit code in a span is resolved, on average, with dither on the 12-bit conversions
+  double previous = -1;
+  for (int c = 8000; c < 8064; c++)
+  {
+    double sum = 0;
+    for (int k = 0; k < 400; k++)
+    {
+      sum += sampleAt(c, 0.7, 0);
+    }
+    double mean = sum / 400;
+    TEST_ASSERT_FLOAT_WITHIN(0.75, c, mean);
+    TEST_ASSERT_GREATER_THAN_FLOAT(previous, mean);
+    previous = mean;
+  }
+}
+
+void test_iir_settling(void)
+{
+  const uint16_t times[] = {10, 50, 200};
+  const double lo = 1000 / MV_PER_COUNT, hi = 4000 / MV_PER_COUNT;
+  for (uint16_t t : times)
+  {
+    configure(ANA_FILTER_IIR, 1, t);
+
+    // Each sample closes alpha of the gap
+    double alpha = AnalogueFilterAlpha(t) / 65536.0;
+    uint32_t expected1 = ceil(log(0.01) / log(1 - alpha));
+    uint32_t expected01 = ceil(log(0.001) / log(1 - alpha));
+    uint32_t settle1 = settlingSamples(lo, hi, 0.01);
+    uint32_t settle01 = settlingSamples(lo, hi, 0.001);
+
+    char line[120];
+    snprintf(line, sizeof(line), "IIR %d ms: settles to 1%% in %.1f ms, 0.1%% in %.1f ms", t, settle1 * ANA_SAMPLE_PERIOD / 1000.0,
+             settle01 * ANA_SAMPLE_PERIOD / 1000.0);
+    TEST_MESSAGE(line);
+
+    // The output is rounded to whole counts and alpha to Q16, so the last count or two of the gap takes a little longer
+    TEST_ASSERT_UINT32_WITHIN(expected1 / 100 + 1, expected1, settle1);
+    TEST_ASSERT_UINT32_WITHIN(expected01 / 100 + 1, expected01, settle01);
+  }
+
+  // 63.2% of a step one time constant later, give or take half a sample
+  configure(ANA_FILTER_IIR, 1, 100);
+  sampleAt(0, 0, 0);
+  int k = 0;
+  while (sampleAt(10000, 0, 0) < 6320)
+  {
+    k++;
+  }
+  TEST_ASSERT_FLOAT_WITHIN(ANA_SAMPLE_PERIOD * 1.5 / 1000.0, 100.0, k * ANA_SAMPLE_PERIOD / 1000.0);
+}
+
+void test_median_settling(void)
+{
+  const double lo = 1000 / MV_PER_COUNT, hi = 4000 / MV_PER_COUNT;
+  for (uint8_t length = 1; length <= ANA_MEDIAN_MAX; length += 2)
+  {
+    configure(ANA_FILTER_MEDIAN, length, 0);
+
+    // The step is through once it's over half the window
+    TEST_ASSERT_EQUAL_UINT32(length / 2, settlingSamples(lo, hi, 0.001));
+  }
+}
+
+void test_median_matches_sort(void)
+{
+  // Small range, so there are plenty of ties. Includes the window filling from empty.
+  std::uniform_int_distribution<int> level(0, 20);
+  for (uint8_t length = 1; length <= ANA_MEDIAN_MAX; length += 2)
+  {
+    AnalogueFilterState state = {};
+    std::vector<uint16_t> history;
+    for (int k = 0; k < 5000; k++)
+    {
+      uint16_t x = level(rng);
+      history.push_back(x);
+      std::vector<uint16_t> window(history.end() - std::min<size_t>(history.size(), length), history.end());
+      std::sort(window.begin(), window.end());
+      TEST_ASSERT_EQUAL_UINT16(window[window.size() / 2], AnalogueFilterSample(state, x, ANA_FILTER_MEDIAN, length, 0));
+    }
+  }
+}
+
+void test_iir_noise_floor(void)
+{
+  // Gaussian noise only. A first order filter passes sqrt(alpha / (2 - alpha)) of white noise.
+  const double mid = 2500 / MV_PER_COUNT;
+  configure(ANA_FILTER_IIR, 1, 0);
+  double unfiltered = noiseFloor(mid, 32, 0);
+
+  const uint16_t times[] = {10, 50, 200};
+  for (uint16_t t : times)
+  {
+    configure(ANA_FILTER_IIR, 1, t);
+    double alpha = AnalogueFilterAlpha(t) / 65536.0;
+    double filtered = noiseFloor(mid, 32, 0);
+
+    char line[120];
+    snprintf(line, sizeof(line), "IIR %d ms: noise %.2f mV rms from %.2f mV", t, filtered, unfiltered);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_FLOAT_WITHIN(0.15 * filtered, unfiltered * sqrt(alpha / (2 - alpha)), filtered);
+  }
+}
+
+void test_median_rejects_spikes(void)
+{
+  // 8 LSB of noise and 1% of conversions spiking 1500 LSB. About 15% of decimated samples hold a spike.
+  const double mid = 2500 / MV_PER_COUNT;
+  double peaks[ANA_MEDIAN_MAX + 1];
+  double floors[ANA_MEDIAN_MAX + 1];
+  for (uint8_t length = 1; length <= ANA_MEDIAN_MAX; length += 2)
+  {
+    configure(ANA_FILTER_MEDIAN, length, 0);
+    floors[length] = noiseFloor(mid, 8, 0.01, &peaks[length]);
+
+    char line[120];
+    snprintf(line, sizeof(line), "Median %d: noise %.2f mV rms, peak %.1f mV", length, floors[length], peaks[length]);
+    TEST_MESSAGE(line);
+  }
+
+  // A spike moves a decimated sample about 114 mV. Unfiltered, samples holding several spikes get through.
+  // The medians pass no more than one spike's worth, and the noise falls with each step in length.
+  TEST_ASSERT_GREATER_THAN_FLOAT(300.0f, peaks[1]);
+  for (uint8_t length = 3; length <= ANA_MEDIAN_MAX; length += 2)
+  {
+    TEST_ASSERT_LESS_THAN_FLOAT(floors[length - 2], floors[length]);
+    TEST_ASSERT_LESS_THAN_FLOAT(150.0f, peaks[length]);
+  }
+  TEST_ASSERT_LESS_THAN_FLOAT(floors[1] / 4, floors[ANA_MEDIAN_MAX]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_decimation_resolution);
+  RUN_TEST(test_decimated_codes_monotonic);
+  RUN_TEST(test_iir_settling);
+  RUN_TEST(test_median_settling);
+  RUN_TEST(test_median_matches_sort);
+  RUN_TEST(test_iir_noise_floor);
+  RUN_TEST(test_median_rejects_spikes);
+  return UNITY_END();
+}
@@ -0,0 +1,322 @@
+/*  test_main.cpp Output channel state machine transitions, retry backoff and timer wraparound.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ChannelFSM.cpp"
+
+// Control updates are 1 ms apart
+static const uint32_t TICK = 1000;
+
+static ChannelFSMInputs in;
+static uint8_t errorFlags;
+static uint32_t now;
+
+static uint8_t step()
+{
+  uint8_t state = ChannelFSMStep(0, in, now, errorFlags);
+  now += TICK;
+  return state;
+}
+
+// Step until the state changes, or give up after a time (microseconds)
+// @return Time spent in the old state (microseconds), UINT32_MAX if it didn't change
+static uint32_t runUntilChange(uint32_t timeout)
+{
+  uint8_t from = ChannelStates.State[0];
+  uint32_t entered = ChannelStates.Entered[0];
+  uint32_t start = now;
+  while ((uint32_t)(now - start) <= timeout)
+  {
+    uint32_t at = now;
+    if (step() != from)
+    {
+      return at - entered;
+    }
+  }
+  return UINT32_MAX;
+}
+
+void setUp(void)
+{
+  now = 0;
+  ResetChannelFSM();
+  errorFlags = 0;
+  in = {};
+  in.Enabled = false;
+  in.Milliamps = 5000;
+  in.HighMilliamps = 10000;
+  in.LowMilliamps = 1000;
+  in.InrushTime = 50000;
+  in.CooldownTime = (uint32_t)RETRY_COOLDOWN_DEFAULT * 1000;
+  in.RetryCount = 3;
+}
+
+void tearDown(void) {}
+
+void test_starts_off(void)
+{
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_OFF, step());
+  TEST_ASSERT_FALSE(channelStateInfo[CHANNEL_OFF].OutputOn);
+  TEST_ASSERT_FALSE(ChannelMonitoring(0));
+}
+
+void test_inrush_then_monitor(void)
+{
+  in.Enabled = true;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_INRUSH, step());
+  TEST_ASSERT_TRUE(channelStateInfo[CHANNEL_INRUSH].OutputOn);
+
+  // Inrush current above the threshold doesn't count
+  in.Milliamps = 40000;
+  TEST_ASSERT_EQUAL_UINT32(in.InrushTime, runUntilChange(1000000));
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+  TEST_ASSERT_TRUE(ChannelMonitoring(0));
+  TEST_ASSERT_EQUAL_UINT8(0, errorFlags);
+}
+
+void test_soft_start_extends_inrush(void)
+{
+  in.Enabled = true;
+  in.Settling = true;
+  step();
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, runUntilChange(500000));
+
+  in.Settling = false;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, step());
+}
+
+void test_trip_during_inrush_faults(void)
+{
+  in.Enabled = true;
+  step();
+  in.Trip = CHN_OVERCURRENT;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, step());
+  TEST_ASSERT_EQUAL_UINT8(CHN_OVERCURRENT, errorFlags);
+  TEST_ASSERT_FALSE(channelStateInfo[CHANNEL_FAULT_COOLDOWN].OutputOn);
+}
+
+void test_overcurrent_averaged_over_window(void)
+{
+  in.Enabled = true;
+  step();
+  runUntilChange(1000000);
+
+  // A short spike averages out
+  uint32_t windowStart = now;
+  while ((uint32_t)(now - windowStart) <= CHANNEL_MONITOR_WINDOW)
+  {
+    in.Milliamps = (uint32_t)(now - windowStart) < 10000 ? 20000 : 5000;
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, step());
+  }
+
+  // A sustained overload doesn't, once a window has passed
+  in.Milliamps = 12000;
+  uint32_t overloadStart = now;
+  runUntilChange(1000000);
+  TEST_ASSERT_LESS_OR_EQUAL(CHANNEL_MONITOR_WINDOW + TICK, now - TICK - overloadStart);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT8(CHN_OVERCURRENT, errorFlags);
+}
+
+void test_undercurrent(void)
+{
+  in.Enabled = true;
+  step();
+  runUntilChange(1000000);
+  in.Milliamps = 200;
+  runUntilChange(1000000);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT8(CHN_UNDERCURRENT, errorFlags);
+}
+
+void test_settling_restarts_window(void)
+{
+  in.Enabled = true;
+  step();
+  runUntilChange(1000000);
+
+  // An overload while ramping isn't averaged in
+  in.Milliamps = 50000;
+  in.Settling = true;
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, runUntilChange(CHANNEL_MONITOR_WINDOW * 3));
+  in.Milliamps = 5000;
+  in.Settling = false;
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, runUntilChange(CHANNEL_MONITOR_WINDOW * 3));
+}
+
+void test_retry_backoff_then_lockout(void)
+{
+  in.Enabled = true;
+  in.Milliamps = 30000;
+  step();
+  TEST_ASSERT_EQUAL_UINT32(in.InrushTime, runUntilChange(1000000));
+
+  // Each fault doubles the cooldown. Retries are held off for the inrush time like the first turn on.
+  for (uint8_t retry = 1; retry <= in.RetryCount; retry++)
+  {
+    runUntilChange(1000000);
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+    TEST_ASSERT_EQUAL_UINT8(retry, ChannelStates.Retries[0]);
+
+    uint32_t cooldown = in.CooldownTime << (retry - 1);
+    TEST_ASSERT_EQUAL_UINT32(cooldown, ChannelStates.Cooldown[0]);
+    TEST_ASSERT_EQUAL_UINT32(cooldown, runUntilChange(100000000));
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_RETRY, ChannelStates.State[0]);
+    TEST_ASSERT_EQUAL_UINT8(CHN_OVERCURRENT, errorFlags);
+
+    TEST_ASSERT_EQUAL_UINT32(in.InrushTime, runUntilChange(1000000));
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+  }
+
+  // Out of retries
+  runUntilChange(1000000);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_LOCKED, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT8(CHN_OVERCURRENT | RETRY_LOCKOUT, errorFlags);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, runUntilChange(100000000));
+
+  // Only disabling clears it
+  in.Enabled = false;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_OFF, step());
+  TEST_ASSERT_EQUAL_UINT8(0, errorFlags);
+  TEST_ASSERT_EQUAL_UINT8(0, ChannelStates.Retries[0]);
+  in.Enabled = true;
+  in.Milliamps = 5000;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_INRUSH, step());
+}
+
+void test_backoff_capped(void)
+{
+  in.Enabled = true;
+  in.RetryCount = 20;
+  in.Trip = CHN_OVERCURRENT;
+  step();
+
+  for (int retry = 1; retry <= 12; retry++)
+  {
+    step();
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+    uint32_t expected = min((uint64_t)in.CooldownTime << (retry - 1), (uint64_t)RETRY_COOLDOWN_MAX * 1000);
+    TEST_ASSERT_EQUAL_UINT32(expected, ChannelStates.Cooldown[0]);
+
+    // Straight into the next fault on retry
+    now += ChannelStates.Cooldown[0];
+    TEST_ASSERT_EQUAL_UINT8(CHANNEL_RETRY, step());
+  }
+}
+
+void test_held_trip_extends_cooldown(void)
+{
+  in.Enabled = true;
+  step();
+  in.Trip = CHN_OVERCURRENT;
+  in.TripHeld = true;
+  step();
+  in.Trip = 0;
+
+  // Wire still hot
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, runUntilChange(in.CooldownTime * 5));
+  in.TripHeld = false;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_RETRY, step());
+}
+
+void test_healthy_window_clears_flags(void)
+{
+  in.Enabled = true;
+  in.Trip = CHN_OVERCURRENT;
+  step();
+  step();
+  in.Trip = 0;
+  runUntilChange(1000000);
+  runUntilChange(1000000);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT8(CHN_OVERCURRENT, errorFlags);
+
+  // Retries aren't refunded, but the flags clear after one healthy window
+  runUntilChange(CHANNEL_MONITOR_WINDOW + TICK);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT8(0, errorFlags);
+  TEST_ASSERT_EQUAL_UINT8(1, ChannelStates.Retries[0]);
+}
+
+void test_timers_across_micros_wrap(void)
+{
+  // Each timed state starts just before micros() wraps and ends after it. Inrush first.
+  in.Enabled = true;
+  now = UINT32_MAX - 20000 + 1;
+  step();
+  TEST_ASSERT_EQUAL_UINT32(in.InrushTime, runUntilChange(1000000));
+  TEST_ASSERT_LESS_THAN(UINT32_MAX / 2, now);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+
+  // Cooldown and retry
+  now = UINT32_MAX - in.CooldownTime / 2 + 1;
+  in.Trip = CHN_OVERCURRENT;
+  step();
+  in.Trip = 0;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT32(in.CooldownTime, runUntilChange(100000000));
+
+  // Retry inrush
+  now = UINT32_MAX - in.InrushTime / 2 + 1;
+  ChannelStates.Entered[0] = now;
+  TEST_ASSERT_EQUAL_UINT32(in.InrushTime, runUntilChange(1000000));
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, ChannelStates.State[0]);
+
+  // Monitor window
+  now = UINT32_MAX - CHANNEL_MONITOR_WINDOW / 2 + 1;
+  ChannelStates.WindowStart[0] = now;
+  in.Milliamps = 20000;
+  uint32_t windowStart = now;
+  runUntilChange(1000000);
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_FAULT_COOLDOWN, ChannelStates.State[0]);
+  TEST_ASSERT_EQUAL_UINT32(CHANNEL_MONITOR_WINDOW, now - TICK - windowStart);
+}
+
+void test_steps_far_apart(void)
+{
+  // Updates held off for over half the micros() range still see the time that passed
+  in.Enabled = true;
+  step();
+  now += 0x90000000;
+  TEST_ASSERT_EQUAL_UINT8(CHANNEL_MONITOR, step());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_starts_off);
+  RUN_TEST(test_inrush_then_monitor);
+  RUN_TEST(test_soft_start_extends_inrush);
+  RUN_TEST(test_trip_during_inrush_faults);
+  RUN_TEST(test_overcurrent_averaged_over_window);
+  RUN_TEST(test_undercurrent);
+  RUN_TEST(test_settling_restarts_window);
+  RUN_TEST(test_retry_backoff_then_lockout);
+  RUN_TEST(test_backoff_capped);
+  RUN_TEST(test_held_trip_extends_cooldown);
+  RUN_TEST(test_healthy_window_clears_flags);
+  RUN_TEST(test_timers_across_micros_wrap);
+  RUN_TEST(test_steps_far_apart);
+  return UNITY_END();
+}
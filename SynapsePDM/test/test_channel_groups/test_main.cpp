@@ -0,0 +1,262 @@
+/*  test_main.cpp Ganged output membership, totals and protection.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ChannelGroups.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+uint16_t ADCResults[ADC_RESULT_CHANNELS];
+uint16_t ADCOnResults[NUM_CHANNELS];
+
+// Outputs forced off, and the duty last requested for each
+static uint16_t forcedOff;
+static uint16_t duty[NUM_CHANNELS];
+
+void forceOutputOff(uint8_t pinIndex)
+{
+  forcedOff |= 1 << pinIndex;
+}
+
+void updatePWMDutyCycle(uint8_t pinIndex, uint16_t dutyCycle)
+{
+  duty[pinIndex] = dutyCycle;
+}
+
+// 10mA a count, so the totals are easy to follow
+uint32_t senseToMilliamps(uint8_t pinIndex, uint16_t raw)
+{
+  return raw * 10;
+}
+
+static void gang(uint8_t channel, uint8_t group)
+{
+  Channels[channel].MultiChannel = 1;
+  Channels[channel].GroupNumber = group;
+}
+
+void setUp(void)
+{
+  memset(Channels, 0, sizeof(Channels));
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    Channels[i].ChanType = DIG;
+    Channels[i].Enabled = 1;
+    ADCResults[i] = 0;
+    ADCOnResults[i] = 0;
+    duty[i] = 0;
+  }
+  forcedOff = 0;
+  ConfigureGroups();
+}
+
+void tearDown(void) {}
+
+void test_ungrouped_channels_lead_themselves(void)
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(i, GroupLeader[i]);
+    TEST_ASSERT_EQUAL_HEX16(1 << i, GroupMembers[i]);
+    TEST_ASSERT_FALSE(GroupFollower(i));
+  }
+  TEST_ASSERT_EQUAL_HEX16(0, GroupRejects);
+}
+
+void test_lowest_channel_leads(void)
+{
+  gang(5, 1);
+  gang(2, 1);
+  gang(4, 1);
+  gang(9, 2);
+  gang(12, 2);
+  ConfigureGroups();
+
+  TEST_ASSERT_EQUAL_UINT8(2, GroupLeader[4]);
+  TEST_ASSERT_EQUAL_UINT8(2, GroupLeader[5]);
+  TEST_ASSERT_EQUAL_HEX16(0x0034, GroupMembers[2]);
+  TEST_ASSERT_EQUAL_HEX16(0, GroupMembers[4]);
+  TEST_ASSERT_EQUAL_UINT8(9, GroupLeader[12]);
+  TEST_ASSERT_EQUAL_HEX16(0x1200, GroupMembers[9]);
+  TEST_ASSERT_TRUE(GroupFollower(5));
+  TEST_ASSERT_FALSE(GroupFollower(2));
+  TEST_ASSERT_EQUAL_HEX16(0, GroupRejects);
+}
+
+void test_group_spanning_banks_is_split(void)
+{
+  // Channel 6 is the last on bank G, 7 the first on bank F
+  gang(5, 3);
+  gang(6, 3);
+  gang(7, 3);
+  gang(8, 3);
+  ConfigureGroups();
+
+  TEST_ASSERT_EQUAL_HEX16(0x0060, GroupMembers[5]);
+  TEST_ASSERT_EQUAL_UINT8(7, GroupLeader[7]);
+  TEST_ASSERT_EQUAL_UINT8(8, GroupLeader[8]);
+  TEST_ASSERT_EQUAL_HEX16(0x0180, GroupRejects);
+
+  // A trip on the leader's side doesn't reach the rejected channels
+  ForceGroupOff(6);
+  TEST_ASSERT_EQUAL_HEX16(0x0060, forcedOff);
+}
+
+void test_inconsistent_members_are_rejected(void)
+{
+  gang(0, 1);
+  gang(1, 1);
+  gang(2, 1);
+  gang(3, 1);
+  Channels[2].ChanType = CAN_PWM;
+  Channels[3].Enabled = 0;
+  ConfigureGroups();
+
+  TEST_ASSERT_EQUAL_HEX16(0x0003, GroupMembers[0]);
+  TEST_ASSERT_EQUAL_HEX16(0x0004, GroupMembers[2]);
+  TEST_ASSERT_EQUAL_HEX16(0x0008, GroupMembers[3]);
+  TEST_ASSERT_EQUAL_HEX16(0x000C, GroupRejects);
+
+  // Fixed up, they join again
+  Channels[2].ChanType = DIG;
+  Channels[3].Enabled = 1;
+  ConfigureGroups();
+  TEST_ASSERT_EQUAL_HEX16(0x000F, GroupMembers[0]);
+  TEST_ASSERT_EQUAL_HEX16(0, GroupRejects);
+}
+
+void test_member_trip_turns_the_group_off(void)
+{
+  gang(8, 4);
+  gang(10, 4);
+  gang(11, 4);
+  ConfigureGroups();
+
+  // Tripped on a follower. The whole group goes, nothing else.
+  ForceGroupOff(11);
+  TEST_ASSERT_EQUAL_HEX16(0x0D00, forcedOff);
+
+  forcedOff = 0;
+  ForceGroupOff(8);
+  TEST_ASSERT_EQUAL_HEX16(0x0D00, forcedOff);
+
+  forcedOff = 0;
+  ForceGroupOff(9);
+  TEST_ASSERT_EQUAL_HEX16(0x0200, forcedOff);
+}
+
+void test_duty_drives_every_member(void)
+{
+  gang(1, 2);
+  gang(3, 2);
+  ConfigureGroups();
+
+  updateGroupDutyCycle(3, 400);
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT16((i == 1 || i == 3) ? 400 : 0, duty[i]);
+  }
+}
+
+void test_group_totals(void)
+{
+  gang(0, 1);
+  gang(1, 1);
+  gang(2, 1);
+  ConfigureGroups();
+
+  const uint16_t on[] = {100, 120, 80};
+  const uint16_t mean[] = {50, 60, 40};
+  for (int i = 0; i < 3; i++)
+  {
+    ADCOnResults[i] = on[i];
+    ADCResults[i] = mean[i];
+  }
+  ADCOnResults[5] = 70;
+  ADCResults[5] = 35;
+  UpdateGroups();
+
+  TEST_ASSERT_EQUAL_UINT8(3, Groups[0].Count);
+  TEST_ASSERT_EQUAL_UINT32(3000, Groups[0].OnMilliamps);
+  TEST_ASSERT_EQUAL_UINT32(1500, Groups[0].Milliamps);
+  TEST_ASSERT_EQUAL_UINT16(120, Groups[0].MaxOnRaw);
+  TEST_ASSERT_EQUAL_UINT8(0, Groups[1].Count);
+
+  TEST_ASSERT_EQUAL_UINT8(1, Groups[5].Count);
+  TEST_ASSERT_EQUAL_UINT32(700, Groups[5].OnMilliamps);
+}
+
+void test_imbalance(void)
+{
+  gang(7, 1);
+  gang(8, 1);
+  gang(9, 1);
+  gang(10, 1);
+  ConfigureGroups();
+
+  // Mean 1A. One member carrying half of it has likely lost its connection, another is carrying it instead.
+  const uint16_t on[] = {100, 100, 50, 150};
+  for (int i = 0; i < 4; i++)
+  {
+    ADCOnResults[7 + i] = on[i];
+  }
+  ADCOnResults[0] = 200;
+  UpdateGroups();
+
+  TEST_ASSERT_EQUAL_INT8(0, GroupImbalance[7]);
+  TEST_ASSERT_EQUAL_INT8(0, GroupImbalance[8]);
+  TEST_ASSERT_EQUAL_INT8(-50, GroupImbalance[9]);
+  TEST_ASSERT_EQUAL_INT8(50, GroupImbalance[10]);
+
+  // Channels on their own have nothing to be out of balance with
+  TEST_ASSERT_EQUAL_INT8(0, GroupImbalance[0]);
+
+  // A member carrying it all clamps rather than wrapping
+  for (int i = 0; i < 4; i++)
+  {
+    ADCOnResults[7 + i] = 0;
+  }
+  ADCOnResults[8] = 4000;
+  UpdateGroups();
+  TEST_ASSERT_EQUAL_INT8(-100, GroupImbalance[7]);
+  TEST_ASSERT_EQUAL_INT8(INT8_MAX, GroupImbalance[8]);
+
+  // Off groups are balanced
+  ADCOnResults[8] = 0;
+  UpdateGroups();
+  TEST_ASSERT_EQUAL_INT8(0, GroupImbalance[7]);
+  TEST_ASSERT_EQUAL_INT8(0, GroupImbalance[8]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ungrouped_channels_lead_themselves);
+  RUN_TEST(test_lowest_channel_leads);
+  RUN_TEST(test_group_spanning_banks_is_split);
+  RUN_TEST(test_inconsistent_members_are_rejected);
+  RUN_TEST(test_member_trip_turns_the_group_off);
+  RUN_TEST(test_duty_drives_every_member);
+  RUN_TEST(test_group_totals);
+  RUN_TEST(test_imbalance);
+  return UNITY_END();
+}
@@ -0,0 +1,268 @@
+/*  test_main.cpp Current sense accumulation and conversion against plain references.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ADCHandler.cpp"
+#include "OutputHandler.cpp"
+#include "CurrentCalibration.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static std::mt19937 rng(7);
+static uint16_t __attribute__((aligned(4))) block[ADC_SCAN_DEPTH * ADC_SCAN_CHANNELS];
+
+// One add per sample, as the code did before __UADD16
+static void plainAccumulate(const uint16_t *samples, uint16_t scans, uint32_t *sums)
+{
+  for (int scan = 0; scan < scans; scan++)
+  {
+    for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+    {
+      sums[i] += samples[scan * ADC_SCAN_CHANNELS + i];
+    }
+  }
+}
+
+// The floating point conversion senseToMilliamps() replaced
+static float plainMilliamps(uint16_t raw)
+{
+  float volts = (raw / (float)ADCres) * V_REF;
+  return k_ILIS * (volts / R_IS) * 1000.0f;
+}
+
+static void fillBlock(int low, int high)
+{
+  std::uniform_int_distribution<int> sample(low, high);
+  for (auto &s : block)
+  {
+    s = sample(rng);
+  }
+}
+
+static double nanosecondsPer(std::chrono::steady_clock::time_point start, uint32_t count)
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+void setUp(void)
+{
+  memset(Channels, 0, sizeof(Channels));
+  memset(CalibrationCurves, 0, sizeof(CalibrationCurves));
+}
+
+void tearDown(void) {}
+
+void test_accumulate_matches_plain_sums(void)
+{
+  // Whole DMA blocks, and scan counts that aren't a multiple of ADC_PACKED_SCANS
+  const uint16_t scanCounts[] = {ADC_SCAN_DEPTH / 2, ADC_SCAN_DEPTH, 1, ADC_PACKED_SCANS - 1, ADC_PACKED_SCANS + 1, 37};
+  for (uint16_t scans : scanCounts)
+  {
+    volatile uint32_t sums[ADC_SCAN_CHANNELS] = {0};
+    volatile uint32_t count = 0;
+    uint32_t expected[ADC_SCAN_CHANNELS] = {0};
+
+    for (int n = 0; n < 20; n++)
+    {
+      fillBlock(0, ADCres);
+      ADCAccumulate(block, scans, sums, &count);
+      plainAccumulate(block, scans, expected);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, (const uint32_t *)sums, ADC_SCAN_CHANNELS);
+    TEST_ASSERT_EQUAL_UINT32(20 * scans, count);
+  }
+}
+
+void test_accumulate_full_scale_doesnt_carry(void)
+{
+  // ADC_PACKED_SCANS full scale samples is the most a packed halfword holds
+  for (auto &s : block)
+  {
+    s = ADCres;
+  }
+
+  volatile uint32_t sums[ADC_SCAN_CHANNELS] = {0};
+  volatile uint32_t count = 0;
+  ADCAccumulate(block, ADC_SCAN_DEPTH, sums, &count);
+
+  for (int i = 0; i < ADC_SCAN_CHANNELS; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(ADCres * ADC_SCAN_DEPTH, sums[i]);
+  }
+}
+
+void test_accumulate_restarts_at_limit(void)
+{
+  fillBlock(0, ADCres);
+  volatile uint32_t sums[ADC_SCAN_CHANNELS];
+  volatile uint32_t count = ADC_ACCUMULATE_LIMIT;
+  for (auto &s : sums)
+  {
+    s = 0xFFFFFFF0;
+  }
+
+  uint32_t expected[ADC_SCAN_CHANNELS] = {0};
+  ADCAccumulate(block, ADC_SCAN_DEPTH / 2, sums, &count);
+  plainAccumulate(block, ADC_SCAN_DEPTH / 2, expected);
+
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, (const uint32_t *)sums, ADC_SCAN_CHANNELS);
+  TEST_ASSERT_EQUAL_UINT32(ADC_SCAN_DEPTH / 2, count);
+}
+
+void test_nominal_gain_matches_float(void)
+{
+  int maxError = 0;
+  for (uint16_t raw = 0; raw <= ADCres; raw++)
+  {
+    uint32_t milliamps = senseToMilliamps(0, raw);
+    if (raw < CURRENT_NOISE_FLOOR)
+    {
+      TEST_ASSERT_EQUAL_UINT32(0, milliamps);
+      continue;
+    }
+
+    int error = abs((int)milliamps - (int)lroundf(plainMilliamps(raw)));
+    maxError = max(maxError, error);
+  }
+
+  // The gain is rounded to Q16, worth well under 1 mA at full scale
+  TEST_ASSERT_LESS_OR_EQUAL(1, maxError);
+}
+
+void test_offset_and_gain_are_exact(void)
+{
+  std::uniform_int_distribution<int> gain(1, 4000000), offset(-200, 200), sample(0, ADCres);
+  for (int n = 0; n < 100000; n++)
+  {
+    ChannelConfig &channel = Channels[3];
+    channel.CurrentGain = gain(rng);
+    channel.CurrentOffset = offset(rng);
+    uint16_t raw = sample(rng);
+
+    int32_t counts = (int32_t)raw - channel.CurrentOffset;
+    uint32_t expected = (raw < CURRENT_NOISE_FLOOR || counts <= 0) ? 0 : (uint32_t)floor((double)counts * channel.CurrentGain / 65536.0 + 0.5);
+    TEST_ASSERT_EQUAL_UINT32(expected, senseToMilliamps(3, raw));
+  }
+}
+
+void test_calibrated_curve_matches_float(void)
+{
+  // Points out of order, as they're entered
+  CalibrationTable &table = CalibrationConfigData.data[5][CAL_DIGITAL];
+  const CalibrationPoint points[] = {{2000, 30000}, {100, 1200}, {800, 11500}, {3500, 54000}};
+  table.Count = 4;
+  memcpy(table.Points, points, sizeof(points));
+  ApplyCalibration(5);
+
+  const CalibrationPoint sorted[] = {{100, 1200}, {800, 11500}, {2000, 30000}, {3500, 54000}};
+  for (uint16_t raw = CURRENT_NOISE_FLOOR; raw <= ADCres; raw++)
+  {
+    // Readings outside the points extend the end segments
+    int k = 0;
+    while (k + 2 < 4 && raw >= sorted[k + 1].Raw)
+    {
+      k++;
+    }
+    double slope = (double)(sorted[k + 1].Milliamps - sorted[k].Milliamps) / (sorted[k + 1].Raw - sorted[k].Raw);
+    double expected = max(0.0, sorted[k].Milliamps + (raw - (int)sorted[k].Raw) * slope);
+
+    TEST_ASSERT_UINT32_WITHIN(1, lround(expected), senseToMilliamps(5, raw));
+  }
+}
+
+// Host timings are only a guide. The host compiler vectorises the plain loop, which the Cortex-M4 can't, so the buffer
+// loads per block are reported as well.
+void test_benchmark(void)
+{
+  const int blocks = 20000;
+  fillBlock(0, ADCres);
+  volatile uint32_t sums[ADC_SCAN_CHANNELS] = {0};
+  volatile uint32_t count = 0;
+  uint32_t plainSums[ADC_SCAN_CHANNELS] = {0};
+
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < blocks; n++)
+  {
+    count = 0;
+    ADCAccumulate(block, ADC_SCAN_DEPTH / 2, sums, &count);
+  }
+  double packed = nanosecondsPer(start, blocks);
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < blocks; n++)
+  {
+    plainAccumulate(block, ADC_SCAN_DEPTH / 2, plainSums);
+    __asm__ volatile("" : : "r"(plainSums) : "memory");
+  }
+  double plain = nanosecondsPer(start, blocks);
+
+  char line[160];
+  snprintf(line, sizeof(line), "ADCAccumulate: %.0f ns per block, plain sums %.0f ns per block", packed, plain);
+  TEST_MESSAGE(line);
+
+  // Loads and adds of DMA buffer data: one per word packed, one per sample plain
+  const int scans = ADC_SCAN_DEPTH / 2;
+  snprintf(line, sizeof(line), "ADCAccumulate: %d buffer loads and adds per block, plain sums %d", scans * ADC_SCAN_CHANNELS / 2,
+           scans * ADC_SCAN_CHANNELS);
+  TEST_MESSAGE(line);
+
+  const int conversions = 1000000;
+  volatile uint32_t fixedSink = 0;
+  volatile float floatSink = 0;
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < conversions; n++)
+  {
+    fixedSink = senseToMilliamps(0, block[n % (sizeof(block) / 2)]);
+  }
+  double fixed = nanosecondsPer(start, conversions);
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < conversions; n++)
+  {
+    floatSink = plainMilliamps(block[n % (sizeof(block) / 2)]);
+  }
+  double floating = nanosecondsPer(start, conversions);
+
+  snprintf(line, sizeof(line), "senseToMilliamps: %.1f ns per reading, float %.1f ns per reading", fixed, floating);
+  TEST_MESSAGE(line);
+  (void)fixedSink;
+  (void)floatSink;
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_accumulate_matches_plain_sums);
+  RUN_TEST(test_accumulate_full_scale_doesnt_carry);
+  RUN_TEST(test_accumulate_restarts_at_limit);
+  RUN_TEST(test_nominal_gain_matches_float);
+  RUN_TEST(test_offset_and_gain_are_exact);
+  RUN_TEST(test_calibrated_curve_matches_float);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
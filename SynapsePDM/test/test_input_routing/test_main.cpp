@@ -0,0 +1,377 @@
+/*  test_main.cpp Compiled input routing against the per-tick pin search it replaced.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "InputHandler.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+AnalogueInputs AnalogueIns[NUM_ANA_CHANNELS];
+bool AnalogueActive[NUM_ANA_CHANNELS];
+uint16_t AnalogueDuty[NUM_ANA_CHANNELS];
+bool CANChannelEnableFlags[NUM_CHANNELS];
+bool enabledFlags[NUM_CHANNELS];
+unsigned long enabledTimers[NUM_CHANNELS];
+bool LogicResult[NUM_CHANNELS];
+
+static bool logicActive[NUM_CHANNELS];
+bool LogicActive(uint8_t channel) { return logicActive[channel]; }
+void EvaluateLogic() {}
+void UpdateInputCapture() {}
+void UpdateAnalogueInputs() {}
+void ConfigureAnalogueFilters() {}
+void ConfigureDebounce() {}
+void ConfigureInputEdges() {}
+uint32_t DebounceCount() { return 0; }
+uint32_t InputEdgeCount() { return 0; }
+void UpdateInputEdges(uint32_t) {}
+
+// No debounce time, so the debounced port is the port
+uint32_t DebouncedPort(uint8_t port) { return inputPorts[port]->IDR; }
+
+static std::mt19937 rng(18);
+
+// HandleInputs() before the routing table: a pin search, digitalRead() and the pull resistors on every tick
+static void legacyHandleInputs()
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    int inputPin = -1;
+    bool inputIsDigital = false;
+
+    for (int j = 0; j < NUM_DI_CHANNELS; j++)
+    {
+      if (Channels[i].InputControlPin == DIchannelInputPins[j])
+      {
+        inputPin = j;
+        inputIsDigital = true;
+        break;
+      }
+    }
+
+    if (inputPin == -1)
+    {
+      for (int j = 0; j < NUM_ANA_CHANNELS; j++)
+      {
+        if (Channels[i].InputControlPin == ANAchannelInputPins[j])
+        {
+          inputPin = j;
+          inputIsDigital = false;
+          break;
+        }
+      }
+    }
+
+    switch (Channels[i].ChanType)
+    {
+    case DIG:
+    case DIG_PWM:
+      if (ChannelRuntime[i].Override)
+      {
+        Channels[i].Enabled = true;
+      }
+      else if (inputIsDigital)
+      {
+        Channels[i].Enabled = digitalRead(Channels[i].InputControlPin);
+      }
+      else if (AnalogueIns[inputPin].IsDigital)
+      {
+        Channels[i].Enabled = AnalogueIns[inputPin].PullUpEnable ? !digitalRead(AnalogueIns[inputPin].InputPin) : digitalRead(AnalogueIns[inputPin].InputPin);
+      }
+      break;
+
+    case ANA:
+    case ANA_PWM:
+      if (inputPin >= 0 && !inputIsDigital)
+      {
+        bool active = AnalogueActive[inputPin];
+        if (Channels[i].ChanType == ANA_PWM)
+        {
+          ChannelRuntime[i].InputDuty = AnalogueDuty[inputPin];
+          active = AnalogueIns[inputPin].IsThreshold ? active : AnalogueDuty[inputPin] > 0;
+        }
+        Channels[i].Enabled = ChannelRuntime[i].Override || active;
+      }
+      else
+      {
+        ChannelRuntime[i].InputDuty = 0;
+        Channels[i].Enabled = ChannelRuntime[i].Override;
+      }
+      break;
+
+    case CAN_DIGITAL:
+    case CAN_PWM:
+      Channels[i].Enabled = ChannelRuntime[i].Override || CANChannelEnableFlags[i];
+      break;
+
+    default:
+      break;
+    }
+
+    if (enabledFlags[i] != Channels[i].Enabled)
+    {
+      enabledFlags[i] = Channels[i].Enabled;
+      if (Channels[i].Enabled)
+      {
+        enabledTimers[i] = millis();
+      }
+    }
+
+    if (!Channels[i].Enabled)
+    {
+      ChannelRuntime[i].ErrorFlags &= OFF_DIAG_FLAGS;
+    }
+  }
+
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    digitalWrite(AnalogueIns[i].PullDownPin, AnalogueIns[i].PullDownEnable);
+    digitalWrite(AnalogueIns[i].PullUpPin, AnalogueIns[i].PullUpEnable);
+  }
+}
+
+// A random config. Input pins are always one of the DI or analogue pins, as the old code indexed AnalogueIns[-1] otherwise.
+static void randomConfig()
+{
+  std::uniform_int_distribution<int> type(DIG, CAN_PWM), pin(0, NUM_DI_CHANNELS + NUM_ANA_CHANNELS - 1), coin(0, 1);
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    int p = pin(rng);
+    Channels[i].ChanType = (ChannelType)type(rng);
+    Channels[i].InputControlPin = p < NUM_DI_CHANNELS ? DIchannelInputPins[p] : ANAchannelInputPins[p - NUM_DI_CHANNELS];
+  }
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    AnalogueIns[i].InputPin = ANAchannelInputPins[i];
+    AnalogueIns[i].PullUpPin = ANAchannelInputPullUps[i];
+    AnalogueIns[i].PullDownPin = ANAchannelInputPullDowns[i];
+    AnalogueIns[i].IsDigital = coin(rng);
+    AnalogueIns[i].PullUpEnable = coin(rng);
+    AnalogueIns[i].PullDownEnable = coin(rng);
+    AnalogueIns[i].IsThreshold = coin(rng);
+  }
+}
+
+// Random input levels, analogue results, CAN flags and overrides
+static void randomInputs()
+{
+  std::uniform_int_distribution<int> coin(0, 1), duty(0, PWM_DUTY_MAX), rare(0, 7);
+  for (int p = 0; p < NUM_DI_CHANNELS; p++)
+  {
+    stubSetPin(DIchannelInputPins[p], coin(rng));
+  }
+  for (int p = 0; p < NUM_ANA_CHANNELS; p++)
+  {
+    stubSetPin(ANAchannelInputPins[p], coin(rng));
+    AnalogueActive[p] = coin(rng);
+    AnalogueDuty[p] = coin(rng) ? duty(rng) : 0;
+  }
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    CANChannelEnableFlags[i] = coin(rng);
+    ChannelRuntime[i].Override = rare(rng) == 0;
+  }
+}
+
+struct ChannelOutputs
+{
+  bool Enabled[NUM_CHANNELS];
+  uint16_t InputDuty[NUM_CHANNELS];
+};
+
+static ChannelOutputs outputs()
+{
+  ChannelOutputs out;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    out.Enabled[i] = Channels[i].Enabled;
+    out.InputDuty[i] = ChannelRuntime[i].InputDuty;
+  }
+  return out;
+}
+
+static double nanosecondsPer(std::chrono::steady_clock::time_point start, uint32_t count)
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+void setUp(void)
+{
+  memset(Channels, 0, sizeof(Channels));
+  memset(ChannelRuntime, 0, sizeof(ChannelRuntime));
+  memset(AnalogueIns, 0, sizeof(AnalogueIns));
+  memset(logicActive, 0, sizeof(logicActive));
+  memset(appliedPullDown, -1, sizeof(appliedPullDown));
+  memset(appliedPullUp, -1, sizeof(appliedPullUp));
+  memset(appliedDigital, -1, sizeof(appliedDigital));
+}
+
+void tearDown(void) {}
+
+void test_routes_match_pin_search(void)
+{
+  for (int config = 0; config < 500; config++)
+  {
+    randomConfig();
+    CompileInputRouting();
+
+    for (int tick = 0; tick < 20; tick++)
+    {
+      randomInputs();
+
+      // Both start from the same held states
+      std::uniform_int_distribution<int> coin(0, 1);
+      bool held[NUM_CHANNELS];
+      for (int i = 0; i < NUM_CHANNELS; i++)
+      {
+        held[i] = coin(rng);
+        Channels[i].Enabled = held[i];
+        ChannelRuntime[i].InputDuty = 0;
+      }
+      legacyHandleInputs();
+      ChannelOutputs expected = outputs();
+
+      for (int i = 0; i < NUM_CHANNELS; i++)
+      {
+        Channels[i].Enabled = held[i];
+        ChannelRuntime[i].InputDuty = 0;
+      }
+      routeInputs();
+      ChannelOutputs routed = outputs();
+
+      TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.Enabled, routed.Enabled, NUM_CHANNELS);
+      TEST_ASSERT_EQUAL_UINT16_ARRAY(expected.InputDuty, routed.InputDuty, NUM_CHANNELS);
+    }
+  }
+}
+
+void test_pull_resistors_written_on_change_only(void)
+{
+  randomConfig();
+  CompileInputRouting();
+  for (int i = 0; i < NUM_ANA_CHANNELS; i++)
+  {
+    TEST_ASSERT_EQUAL_INT8(AnalogueIns[i].PullUpEnable, appliedPullUp[i]);
+    TEST_ASSERT_EQUAL_INT8(AnalogueIns[i].PullDownEnable, appliedPullDown[i]);
+  }
+
+  // Cleared by hand. Unchanged config leaves the pin alone.
+  digitalWrite(AnalogueIns[0].PullUpPin, !AnalogueIns[0].PullUpEnable);
+  CompileInputRouting();
+  TEST_ASSERT_EQUAL(!AnalogueIns[0].PullUpEnable, (digitalPinToPort(AnalogueIns[0].PullUpPin)->ODR & digitalPinToBitMask(AnalogueIns[0].PullUpPin)) != 0);
+
+  // A config change is written straight away
+  AnalogueIns[0].PullUpEnable = !AnalogueIns[0].PullUpEnable;
+  CompileInputRouting();
+  TEST_ASSERT_EQUAL(AnalogueIns[0].PullUpEnable, (digitalPinToPort(AnalogueIns[0].PullUpPin)->ODR & digitalPinToBitMask(AnalogueIns[0].PullUpPin)) != 0);
+}
+
+void test_unlisted_pin_holds(void)
+{
+  Channels[0].ChanType = DIG;
+  Channels[0].InputControlPin = PA0;
+  CompileInputRouting();
+  TEST_ASSERT_EQUAL_UINT8(ROUTE_HOLD, inputRoutes[0].Source);
+
+  Channels[0].Enabled = true;
+  routeInputs();
+  TEST_ASSERT_TRUE(Channels[0].Enabled);
+  Channels[0].Enabled = false;
+  routeInputs();
+  TEST_ASSERT_FALSE(Channels[0].Enabled);
+  ChannelRuntime[0].Override = true;
+  routeInputs();
+  TEST_ASSERT_TRUE(Channels[0].Enabled);
+}
+
+void test_logic_replaces_input(void)
+{
+  Channels[2].ChanType = ANA_PWM;
+  Channels[2].InputControlPin = ANAchannelInputPins[3];
+  Channels[3].ChanType = ANA_PWM;
+  Channels[3].InputControlPin = DIchannelInputPins[0];
+  logicActive[2] = logicActive[3] = true;
+  CompileInputRouting();
+  TEST_ASSERT_EQUAL_UINT8(ROUTE_LOGIC, inputRoutes[2].Source);
+
+  // Duty still from the channel's analogue input, or full without one
+  AnalogueDuty[3] = 420;
+  LogicResult[2] = true;
+  LogicResult[3] = false;
+  routeInputs();
+  TEST_ASSERT_TRUE(Channels[2].Enabled);
+  TEST_ASSERT_EQUAL_UINT16(420, ChannelRuntime[2].InputDuty);
+  TEST_ASSERT_FALSE(Channels[3].Enabled);
+  TEST_ASSERT_EQUAL_UINT16(PWM_DUTY_MAX, ChannelRuntime[3].InputDuty);
+}
+
+// Host timings are only a guide to the Cortex-M4. The stub digitalRead() and digitalWrite() are a mask and a store,
+// far cheaper than the core's pin map lookups, so the old code is flattered.
+void test_benchmark(void)
+{
+  randomConfig();
+  CompileInputRouting();
+  randomInputs();
+  const int ticks = 200000;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < ticks; n++)
+  {
+    routeInputs();
+    __asm__ volatile("" : : : "memory");
+  }
+  double routed = nanosecondsPer(start, ticks);
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < ticks; n++)
+  {
+    legacyHandleInputs();
+    __asm__ volatile("" : : : "memory");
+  }
+  double legacy = nanosecondsPer(start, ticks);
+
+  const int compiles = 20000;
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < compiles; n++)
+  {
+    CompileInputRouting();
+  }
+  double compile = nanosecondsPer(start, compiles);
+
+  char line[160];
+  snprintf(line, sizeof(line), "routeInputs: %.0f ns per tick, pin search %.0f ns per tick. CompileInputRouting: %.0f ns per config change", routed,
+           legacy, compile);
+  TEST_MESSAGE(line);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_routes_match_pin_search);
+  RUN_TEST(test_pull_resistors_written_on_change_only);
+  RUN_TEST(test_unlisted_pin_holds);
+  RUN_TEST(test_logic_replaces_input);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,429 @@
+/*  test_main.cpp Logic program verification, instructions, timers and latches.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include <initializer_list>
+#include "LogicEngine.cpp"
+
+uint16_t AnalogueMillivolts[NUM_ANA_CHANNELS];
+bool AnalogueActive[NUM_ANA_CHANNELS];
+uint32_t InputMillihertz[CAPTURE_INPUTS];
+uint16_t InputDutyCycle[CAPTURE_INPUTS];
+ChannelFSM ChannelStates;
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+bool CANChannelEnableFlags[NUM_CHANNELS];
+SystemRuntime SystemRuntimeParams;
+
+static uint32_t debouncedInputs;
+uint32_t DebouncedPort(uint8_t) { return debouncedInputs; }
+
+// Slot operands
+enum
+{
+  S0,
+  S1
+};
+
+static bool verify(std::initializer_list<uint8_t> code)
+{
+  std::vector<uint8_t> bytes(code);
+  return VerifyLogicProgram(bytes.data(), bytes.size());
+}
+
+// Load channel 0's program, as a config write would
+static bool load(std::initializer_list<uint8_t> code)
+{
+  LogicProgram &program = LogicConfigData.data[0];
+  memset(&program, 0, sizeof(program));
+  program.Length = code.size();
+  std::copy(code.begin(), code.end(), program.Code);
+  ApplyLogic(0);
+  return LogicActive(0);
+}
+
+static bool run(uint32_t now) { return RunLogicProgram(0, now); }
+
+// PUSH32 a PUSH32 b op PUSH32 expected EQ END. True if op gives expected.
+static bool binary(uint8_t op, int32_t a, int32_t b, int32_t expected)
+{
+  uint32_t ua = a, ub = b, ue = expected;
+  bool loaded = load({LOGIC_PUSH32, (uint8_t)ua, (uint8_t)(ua >> 8), (uint8_t)(ua >> 16), (uint8_t)(ua >> 24),
+                      LOGIC_PUSH32, (uint8_t)ub, (uint8_t)(ub >> 8), (uint8_t)(ub >> 16), (uint8_t)(ub >> 24), op,
+                      LOGIC_PUSH32, (uint8_t)ue, (uint8_t)(ue >> 8), (uint8_t)(ue >> 16), (uint8_t)(ue >> 24), LOGIC_EQ, LOGIC_END});
+  return loaded && run(0);
+}
+
+static bool unary(uint8_t op, int32_t a, int32_t expected)
+{
+  uint32_t ua = a, ue = expected;
+  bool loaded = load({LOGIC_PUSH32, (uint8_t)ua, (uint8_t)(ua >> 8), (uint8_t)(ua >> 16), (uint8_t)(ua >> 24), op,
+                      LOGIC_PUSH32, (uint8_t)ue, (uint8_t)(ue >> 8), (uint8_t)(ue >> 16), (uint8_t)(ue >> 24), LOGIC_EQ, LOGIC_END});
+  return loaded && run(0);
+}
+
+void setUp(void)
+{
+  memset(LogicRegisters, 0, sizeof(LogicRegisters));
+  InitialiseLogicData();
+  ApplyAllLogic();
+  debouncedInputs = 0;
+  stubMicros = 0;
+}
+
+void tearDown(void) {}
+
+void test_verifier_accepts(void)
+{
+  TEST_ASSERT_TRUE(verify({LOGIC_PUSH8, 1, LOGIC_END}));
+  TEST_ASSERT_TRUE(verify({LOGIC_LOAD, LOGIC_REGISTERS - 1, LOGIC_END}));
+  TEST_ASSERT_TRUE(verify({LOGIC_LOAD, 0, LOGIC_PUSH8, 5, LOGIC_ONDELAY, LOGIC_SLOTS - 1, LOGIC_END}));
+
+  // Exactly the deepest stack
+  TEST_ASSERT_TRUE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1,
+                           LOGIC_PUSH8, 1, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_END}));
+
+  // The whole code size
+  uint8_t code[LOGIC_CODE_SIZE];
+  memset(code, LOGIC_NOT, sizeof(code));
+  code[0] = LOGIC_PUSH8;
+  code[1] = 1;
+  code[LOGIC_CODE_SIZE - 1] = LOGIC_END;
+  TEST_ASSERT_TRUE(VerifyLogicProgram(code, LOGIC_CODE_SIZE));
+}
+
+void test_verifier_rejects(void)
+{
+  uint8_t code[LOGIC_CODE_SIZE + 1] = {LOGIC_PUSH8, 1, LOGIC_END};
+  TEST_ASSERT_FALSE(VerifyLogicProgram(code, 0));
+  TEST_ASSERT_FALSE(VerifyLogicProgram(code, LOGIC_CODE_SIZE + 1));
+
+  // Opcodes past the table
+  TEST_ASSERT_FALSE(verify({LOGIC_OPCODES, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, 0xFF}));
+
+  // Operands past the end
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH32, 0, 0, 0}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_TOGGLE}));
+
+  // Stack underflow, at the start and part way
+  TEST_ASSERT_FALSE(verify({LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_NOT, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_ADD, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_SEL, LOGIC_END}));
+
+  // One past the deepest stack
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_PUSH8, 1,
+                            LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD, LOGIC_ADD,
+                            LOGIC_ADD, LOGIC_END}));
+
+  // Registers and slots out of range
+  TEST_ASSERT_FALSE(verify({LOGIC_LOAD, LOGIC_REGISTERS, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_TOGGLE, LOGIC_SLOTS, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_LATCH, LOGIC_SLOTS, LOGIC_END}));
+
+  // Not exactly one result, or not ending at LOGIC_END
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_END, LOGIC_END}));
+  TEST_ASSERT_FALSE(verify({LOGIC_PUSH8, 1, LOGIC_END, LOGIC_PUSH8, 1}));
+}
+
+void test_rejected_program_not_run(void)
+{
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 1, LOGIC_END}));
+  EvaluateLogic();
+  TEST_ASSERT_TRUE(LogicResult[0]);
+
+  // Replacing it with a bad program drops the old result
+  TEST_ASSERT_FALSE(load({LOGIC_PUSH8, 1, LOGIC_PUSH8, 1, LOGIC_END}));
+  EvaluateLogic();
+  TEST_ASSERT_FALSE(LogicResult[0]);
+  TEST_ASSERT_EQUAL_UINT32(0, LogicStats[0].MaxCycles);
+
+  // An empty program is no program
+  TEST_ASSERT_FALSE(load({}));
+}
+
+void test_push(void)
+{
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 0x80, LOGIC_PUSH16, 0x80, 0xFF, LOGIC_EQ, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH16, 0x00, 0x80, LOGIC_PUSH32, 0x00, 0x80, 0xFF, 0xFF, LOGIC_EQ, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 0, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(0));
+
+  // Any non-zero result is true
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH32, 0, 0, 0, 0x80, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+}
+
+void test_load(void)
+{
+  LogicRegisters[LOGIC_REG_VBATT] = 13800;
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_VBATT, LOGIC_PUSH16, 0xE8, 0x35, LOGIC_EQ, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+  LogicRegisters[LOGIC_REG_VBATT] = 13801;
+  TEST_ASSERT_FALSE(run(0));
+}
+
+void test_arithmetic(void)
+{
+  TEST_ASSERT_TRUE(binary(LOGIC_ADD, 2, 3, 5));
+  TEST_ASSERT_TRUE(binary(LOGIC_ADD, INT32_MAX, 1, INT32_MIN));
+  TEST_ASSERT_TRUE(binary(LOGIC_SUB, 2, 3, -1));
+  TEST_ASSERT_TRUE(binary(LOGIC_SUB, INT32_MIN, 1, INT32_MAX));
+  TEST_ASSERT_TRUE(binary(LOGIC_MUL, -4, 5, -20));
+  TEST_ASSERT_TRUE(binary(LOGIC_MUL, 0x10000, 0x10000, 0));
+
+  // Division truncates, and nothing traps
+  TEST_ASSERT_TRUE(binary(LOGIC_DIV, 7, 2, 3));
+  TEST_ASSERT_TRUE(binary(LOGIC_DIV, -7, 2, -3));
+  TEST_ASSERT_TRUE(binary(LOGIC_DIV, 7, 0, 0));
+  TEST_ASSERT_TRUE(binary(LOGIC_DIV, INT32_MIN, -1, INT32_MIN));
+  TEST_ASSERT_TRUE(binary(LOGIC_MOD, 7, 3, 1));
+  TEST_ASSERT_TRUE(binary(LOGIC_MOD, -7, 2, -1));
+  TEST_ASSERT_TRUE(binary(LOGIC_MOD, 7, 0, 0));
+  TEST_ASSERT_TRUE(binary(LOGIC_MOD, INT32_MIN, -1, 0));
+
+  TEST_ASSERT_TRUE(unary(LOGIC_NEG, 5, -5));
+  TEST_ASSERT_TRUE(unary(LOGIC_NEG, INT32_MIN, INT32_MIN));
+  TEST_ASSERT_TRUE(binary(LOGIC_MIN, -3, 2, -3));
+  TEST_ASSERT_TRUE(binary(LOGIC_MIN, 2, -3, -3));
+  TEST_ASSERT_TRUE(binary(LOGIC_MAX, -3, 2, 2));
+  TEST_ASSERT_TRUE(binary(LOGIC_MAX, 2, -3, 2));
+}
+
+void test_comparisons(void)
+{
+  const int32_t pairs[][2] = {{1, 2}, {2, 2}, {2, 1}, {-1, 1}, {INT32_MIN, INT32_MAX}};
+  for (auto &p : pairs)
+  {
+    int32_t a = p[0], b = p[1];
+    TEST_ASSERT_TRUE(binary(LOGIC_LT, a, b, a < b));
+    TEST_ASSERT_TRUE(binary(LOGIC_LE, a, b, a <= b));
+    TEST_ASSERT_TRUE(binary(LOGIC_GT, a, b, a > b));
+    TEST_ASSERT_TRUE(binary(LOGIC_GE, a, b, a >= b));
+    TEST_ASSERT_TRUE(binary(LOGIC_EQ, a, b, a == b));
+    TEST_ASSERT_TRUE(binary(LOGIC_NE, a, b, a != b));
+  }
+}
+
+void test_boolean(void)
+{
+  // Non-zero values are true, results are 0 or 1
+  TEST_ASSERT_TRUE(binary(LOGIC_AND, 5, -2, 1));
+  TEST_ASSERT_TRUE(binary(LOGIC_AND, 5, 0, 0));
+  TEST_ASSERT_TRUE(binary(LOGIC_OR, 0, 256, 1));
+  TEST_ASSERT_TRUE(binary(LOGIC_OR, 0, 0, 0));
+  TEST_ASSERT_TRUE(unary(LOGIC_NOT, 7, 0));
+  TEST_ASSERT_TRUE(unary(LOGIC_NOT, 0, 1));
+
+  // c a b
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 2, LOGIC_PUSH8, 10, LOGIC_PUSH8, 20, LOGIC_SEL, LOGIC_PUSH8, 10, LOGIC_EQ, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 0, LOGIC_PUSH8, 10, LOGIC_PUSH8, 20, LOGIC_SEL, LOGIC_PUSH8, 20, LOGIC_EQ, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+}
+
+void test_ondelay(void)
+{
+  // din1 true for 100 ms
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_PUSH8, 100, LOGIC_ONDELAY, S0, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(0));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_FALSE(run(10));
+  TEST_ASSERT_FALSE(run(109));
+  TEST_ASSERT_TRUE(run(110));
+  TEST_ASSERT_TRUE(run(5000));
+
+  // Starts again from the beginning
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_FALSE(run(5001));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_FALSE(run(5002));
+  TEST_ASSERT_FALSE(run(5101));
+  TEST_ASSERT_TRUE(run(5102));
+
+  // A delay of 0 or less has always passed
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 1, LOGIC_PUSH8, 0xFF, LOGIC_ONDELAY, S0, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+}
+
+void test_offdelay(void)
+{
+  // din1 true, or within the last 1 s
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_PUSH16, 0xE8, 0x03, LOGIC_OFFDELAY, S0, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(0));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(10));
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_TRUE(run(20));
+  TEST_ASSERT_TRUE(run(1019));
+  TEST_ASSERT_FALSE(run(1020));
+
+  // Timed from the last time it went off
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(2000));
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_TRUE(run(2010));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(2500));
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_TRUE(run(2600));
+  TEST_ASSERT_TRUE(run(3599));
+  TEST_ASSERT_FALSE(run(3600));
+}
+
+void test_latch(void)
+{
+  // din1 sets, din2 resets
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_LOAD, LOGIC_REG_DIN + 1, LOGIC_LATCH, S0, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(0));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(1));
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_TRUE(run(2));
+
+  // Reset wins over set
+  LogicRegisters[LOGIC_REG_DIN + 1] = 1;
+  TEST_ASSERT_FALSE(run(3));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_FALSE(run(4));
+  LogicRegisters[LOGIC_REG_DIN + 1] = 0;
+  TEST_ASSERT_TRUE(run(5));
+}
+
+void test_toggle(void)
+{
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_TOGGLE, S0, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(0));
+
+  // Flips on rising edges only
+  const int levels[] = {1, 1, 0, 0, 1, 0, 1};
+  const bool expected[] = {true, true, true, true, false, false, true};
+  for (int i = 0; i < 7; i++)
+  {
+    LogicRegisters[LOGIC_REG_DIN] = levels[i];
+    TEST_ASSERT_EQUAL(expected[i], run(i + 1));
+  }
+}
+
+void test_slots_independent(void)
+{
+  // Two toggles on the same input, in different slots, flip together. The same slot twice would flip once then see no edge.
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_TOGGLE, S0, LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_TOGGLE, S1, LOGIC_AND, LOGIC_END}));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(0));
+
+  // Reloading clears every slot
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_TOGGLE, S0, LOGIC_END}));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(1));
+}
+
+void test_flash(void)
+{
+  // 300 ms on, 700 ms off
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH16, 0x2C, 0x01, LOGIC_PUSH16, 0xBC, 0x02, LOGIC_FLASH, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(0));
+  TEST_ASSERT_TRUE(run(299));
+  TEST_ASSERT_FALSE(run(300));
+  TEST_ASSERT_FALSE(run(999));
+  TEST_ASSERT_TRUE(run(1000));
+
+  // No period is off, negative times count as 0
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 0, LOGIC_PUSH8, 0, LOGIC_FLASH, LOGIC_END}));
+  TEST_ASSERT_FALSE(run(5));
+  TEST_ASSERT_TRUE(load({LOGIC_PUSH8, 10, LOGIC_PUSH8, 0xF0, LOGIC_FLASH, LOGIC_END}));
+  TEST_ASSERT_TRUE(run(12345));
+}
+
+void test_timers_across_millis_wrap(void)
+{
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_PUSH8, 100, LOGIC_ONDELAY, S0, LOGIC_END}));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_FALSE(run(0xFFFFFFF0));
+  TEST_ASSERT_FALSE(run(0x50));
+  TEST_ASSERT_TRUE(run(0x54));
+
+  // Stays on once done, however long it's held
+  TEST_ASSERT_TRUE(run(0x80000000));
+  TEST_ASSERT_TRUE(run(0xFFFFFFF0));
+  TEST_ASSERT_TRUE(run(0x10));
+
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN, LOGIC_PUSH8, 100, LOGIC_OFFDELAY, S0, LOGIC_END}));
+  LogicRegisters[LOGIC_REG_DIN] = 1;
+  TEST_ASSERT_TRUE(run(0xFFFFFFD0));
+  LogicRegisters[LOGIC_REG_DIN] = 0;
+  TEST_ASSERT_TRUE(run(0xFFFFFFE0));
+  TEST_ASSERT_TRUE(run(0x43));
+  TEST_ASSERT_FALSE(run(0x44));
+}
+
+void test_registers_filled(void)
+{
+  debouncedInputs = digitalPinToBitMask(DIchannelInputPins[2]);
+  AnalogueMillivolts[1] = 4321;
+  AnalogueActive[1] = true;
+  InputMillihertz[0] = UINT32_MAX;
+  ChannelRuntime[3].CurrentMilliamps = 7500;
+  CANChannelEnableFlags[4] = true;
+  SystemRuntimeParams.VBatt = 12.5f;
+  stubMicros = 42000;
+
+  // Every register is one the program can see
+  TEST_ASSERT_TRUE(load({LOGIC_LOAD, LOGIC_REG_DIN + 2, LOGIC_LOAD, LOGIC_REG_ANA_ACTIVE + 1, LOGIC_AND, LOGIC_LOAD, LOGIC_REG_CAN + 4, LOGIC_AND,
+                         LOGIC_LOAD, LOGIC_REG_TIME, LOGIC_PUSH8, 42, LOGIC_EQ, LOGIC_AND, LOGIC_END}));
+  EvaluateLogic();
+  TEST_ASSERT_TRUE(LogicResult[0]);
+  TEST_ASSERT_EQUAL_INT32(0, LogicRegisters[LOGIC_REG_DIN + 1]);
+  TEST_ASSERT_EQUAL_INT32(4321, LogicRegisters[LOGIC_REG_ANA_MV + 1]);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, LogicRegisters[LOGIC_REG_HZ]);
+  TEST_ASSERT_EQUAL_INT32(7500, LogicRegisters[LOGIC_REG_CH_MA + 3]);
+  TEST_ASSERT_EQUAL_INT32(12500, LogicRegisters[LOGIC_REG_VBATT]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_verifier_accepts);
+  RUN_TEST(test_verifier_rejects);
+  RUN_TEST(test_rejected_program_not_run);
+  RUN_TEST(test_push);
+  RUN_TEST(test_load);
+  RUN_TEST(test_arithmetic);
+  RUN_TEST(test_comparisons);
+  RUN_TEST(test_boolean);
+  RUN_TEST(test_ondelay);
+  RUN_TEST(test_offdelay);
+  RUN_TEST(test_latch);
+  RUN_TEST(test_toggle);
+  RUN_TEST(test_slots_independent);
+  RUN_TEST(test_flash);
+  RUN_TEST(test_timers_across_millis_wrap);
+  RUN_TEST(test_registers_filled);
+  return UNITY_END();
+}
@@ -0,0 +1,255 @@
+/*  test_main.cpp Off-state probe timing against PWM period and ADC block latency.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "OffDiagnostics.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+ChannelFSM ChannelStates;
+volatile uint8_t PowerState = RUN;
+uint16_t ADCResults[ADC_RESULT_CHANNELS];
+uint16_t ADCOnResults[NUM_CHANNELS];
+uint32_t ADCOnSamplesAveraged[NUM_CHANNELS];
+
+bool OutputRamping(uint8_t) { return false; }
+bool GroupFollower(uint8_t) { return false; }
+uint32_t senseToMilliamps(uint8_t, uint16_t raw) { return raw > CURRENT_NOISE_FLOOR ? raw * 5 : 0; }
+
+// 200 Hz PWM and 32 scans of 100 us per ADC block, as on the board
+static const uint32_t PERIOD = 5000;
+static const uint32_t SCAN = 100;
+static const uint32_t BLOCK = 32 * SCAN;
+static const uint32_t TICK = 1000;
+
+// A probe pulse is on for this long, and sampled once settled
+static const uint32_t PULSE = 300;
+static const uint32_t SETTLE = 100;
+
+uint32_t PWMPeriodMicros(uint8_t) { return PERIOD; }
+uint32_t ADCBlockMicros() { return BLOCK; }
+
+// Probe requests, taken up at the end of each PWM period as the DMA interrupt does
+static bool probeRequested[NUM_CHANNELS];
+static bool pulseArmed[NUM_CHANNELS];
+static uint32_t probeOns, probeOffs, pulses;
+static uint32_t lastOn, shortestProbe = UINT32_MAX;
+void probeOutput(uint8_t pinIndex, bool on)
+{
+  if (on && !probeRequested[pinIndex])
+  {
+    probeOns++;
+    lastOn = stubMicros;
+  }
+  if (!on && probeRequested[pinIndex])
+  {
+    probeOffs++;
+    shortestProbe = min(shortestProbe, stubMicros - lastOn);
+  }
+  probeRequested[pinIndex] = on;
+}
+
+// Sense reading of each output while it's on
+static uint16_t loadRaw[NUM_CHANNELS];
+
+// On-sample sums of the block being filled and of completed blocks, as the DMA interrupt keeps them
+static uint32_t blockSums[NUM_CHANNELS], blockCounts[NUM_CHANNELS];
+static uint32_t onSums[NUM_CHANNELS], onCounts[NUM_CHANNELS];
+static uint32_t blocks;
+
+/// @brief Run the scans up to the next control update, then latch the results as ADCUpdate() does and update the diagnostics
+static void controlTick()
+{
+  for (uint32_t end = stubMicros + TICK; stubMicros != end; stubMicros += SCAN)
+  {
+    uint32_t intoPeriod = stubMicros % PERIOD;
+    if (intoPeriod == 0)
+    {
+      for (int i = 0; i < NUM_CHANNELS; i++)
+      {
+        pulseArmed[i] = probeRequested[i];
+        pulses += pulseArmed[i];
+      }
+    }
+
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      if (pulseArmed[i] && intoPeriod >= SETTLE && intoPeriod < PULSE)
+      {
+        blockSums[i] += loadRaw[i];
+        blockCounts[i]++;
+      }
+    }
+
+    if ((stubMicros + SCAN) % BLOCK == 0)
+    {
+      for (int i = 0; i < NUM_CHANNELS; i++)
+      {
+        onSums[i] += blockSums[i];
+        onCounts[i] += blockCounts[i];
+        blockSums[i] = blockCounts[i] = 0;
+      }
+      blocks++;
+    }
+  }
+
+  // No new block keeps the previous results
+  if (blocks)
+  {
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      ADCOnResults[i] = onCounts[i] ? (onSums[i] + onCounts[i] / 2) / onCounts[i] : 0;
+      ADCOnSamplesAveraged[i] = onCounts[i];
+      onSums[i] = onCounts[i] = 0;
+    }
+    blocks = 0;
+  }
+
+  UpdateOffDiagnostics(stubMicros);
+}
+
+static void runFor(uint32_t micros)
+{
+  for (uint32_t t = 0; t < micros; t += TICK)
+  {
+    controlTick();
+  }
+}
+
+void setUp(void)
+{
+  stubMicros = 0;
+  memset(Channels, 0, sizeof(Channels));
+  memset(ChannelRuntime, 0, sizeof(ChannelRuntime));
+  memset(&ChannelStates, 0, sizeof(ChannelStates));
+  memset(probeRequested, 0, sizeof(probeRequested));
+  memset(pulseArmed, 0, sizeof(pulseArmed));
+  memset(blockSums, 0, sizeof(blockSums));
+  memset(blockCounts, 0, sizeof(blockCounts));
+  memset(onSums, 0, sizeof(onSums));
+  memset(onCounts, 0, sizeof(onCounts));
+  memset(ADCOnResults, 0, sizeof(ADCOnResults));
+  memset(ADCOnSamplesAveraged, 0, sizeof(ADCOnSamplesAveraged));
+  blocks = 0;
+  probeOns = probeOffs = pulses = 0;
+  shortestProbe = UINT32_MAX;
+  ResetOffDiagnostics();
+
+  // Channel 0 probed, off since start up, with a load drawing a few amps
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    ChannelStates.State[i] = CHANNEL_OFF;
+    loadRaw[i] = 400;
+  }
+  Channels[0].OffDiagnostics = OFF_DIAG_PROBE;
+
+  // Past the settle time, so the first probe is due straight away
+  runFor(OFF_DIAG_SETTLE_TIME);
+}
+
+void tearDown(void) {}
+
+void test_probe_spans_a_pulse_and_a_block(void)
+{
+  runFor(5 * OFF_DIAG_PROBE_INTERVAL);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(5, probeOffs);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(OFF_DIAG_PROBE_PERIODS * PERIOD + BLOCK, shortestProbe);
+
+  // At least one pulse per probe, and no more than the probe's length allows
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(probeOffs, pulses);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(probeOns * (OFF_DIAG_PROBE_PERIODS + 2), pulses);
+}
+
+void test_open_load_flagged(void)
+{
+  loadRaw[0] = 2;
+  runFor((OFF_DIAG_CONFIRM - 1) * OFF_DIAG_PROBE_INTERVAL);
+  TEST_ASSERT_FALSE(ChannelRuntime[0].ErrorFlags & CHN_OPEN_LOAD);
+  runFor(OFF_DIAG_PROBE_INTERVAL);
+  TEST_ASSERT_TRUE(ChannelRuntime[0].ErrorFlags & CHN_OPEN_LOAD);
+
+  // Cleared once the load is back
+  loadRaw[0] = 400;
+  runFor(OFF_DIAG_CONFIRM * OFF_DIAG_PROBE_INTERVAL);
+  TEST_ASSERT_FALSE(ChannelRuntime[0].ErrorFlags & CHN_OPEN_LOAD);
+}
+
+void test_connected_load_not_flagged(void)
+{
+  runFor(10 * OFF_DIAG_PROBE_INTERVAL);
+  TEST_ASSERT_EQUAL_UINT8(0, ChannelRuntime[0].ErrorFlags & OFF_DIAG_FLAGS);
+}
+
+void test_turned_on_mid_probe(void)
+{
+  loadRaw[0] = 2;
+  while (!OffDiagnosticProbing(0))
+  {
+    controlTick();
+  }
+
+  // The probe ends at the next update, without a result
+  Channels[0].Enabled = true;
+  controlTick();
+  TEST_ASSERT_FALSE(OffDiagnosticProbing(0));
+  TEST_ASSERT_FALSE(probeRequested[0]);
+  TEST_ASSERT_EQUAL_UINT8(0, ChannelRuntime[0].ErrorFlags & OFF_DIAG_FLAGS);
+}
+
+void test_one_probe_at_a_time(void)
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    Channels[i].OffDiagnostics = OFF_DIAG_PROBE;
+    loadRaw[i] = i % 2 ? 2 : 400;
+  }
+
+  // Each channel gets its turn, in order
+  for (uint32_t t = 0; t < (NUM_CHANNELS * OFF_DIAG_CONFIRM + 1) * OFF_DIAG_PROBE_INTERVAL; t += TICK)
+  {
+    controlTick();
+    int probing = 0;
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+      probing += probeRequested[i];
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, probing);
+  }
+
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    TEST_ASSERT_EQUAL(i % 2 != 0, (ChannelRuntime[i].ErrorFlags & CHN_OPEN_LOAD) != 0);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_probe_spans_a_pulse_and_a_block);
+  RUN_TEST(test_open_load_flagged);
+  RUN_TEST(test_connected_load_not_flagged);
+  RUN_TEST(test_turned_on_mid_probe);
+  RUN_TEST(test_one_probe_at_a_time);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+/*  test_main.cpp Soft start and soft stop ramps, period by period.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "OutputHandler.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+volatile uint32_t VBattCompensation[VBATT_COMP_MODES] = {65536, 65536, 65536};
+
+static const uint8_t profiles[] = {RAMP_LINEAR, RAMP_SCURVE, RAMP_EXPONENTIAL};
+
+// Bank G at 200Hz, pin 0 at 0% duty
+static PWMBank &bank = PWMBanks[PWM_BANK_G];
+
+void setUp(void)
+{
+  memset(&bank, 0, sizeof(bank));
+  bank.Pins = GPIOG_PINS;
+  bank.NumPins = NUM_PINS_G;
+  bank.FirstChannel = 0;
+  setPWMBankTiming(bank, 200, 100, true);
+
+  memset(Channels, 0, sizeof(Channels));
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    GroupLeader[i] = i;
+  }
+  Channels[0].RampProfile = RAMP_LINEAR;
+  Channels[0].RampUpTime = 500;
+  Channels[0].RampDownTime = 1000;
+}
+
+void tearDown(void) {}
+
+// Periods in a ramp across change, as rampOutput() works them out
+static uint32_t rampPeriods(uint16_t rampTime, uint16_t change)
+{
+  return ((uint32_t)rampTime * bank.Frequency / 1000) * change / PWM_DUTY_MAX;
+}
+
+// Request a duty and run periods until the output reaches it, checking every step moves towards it.
+// Returns the periods taken.
+static uint32_t runRamp(uint16_t target, uint32_t limit)
+{
+  bank.TargetDuty[0] = target;
+  int direction = target > bank.RampDuty[0] ? 1 : -1;
+  uint16_t last = bank.RampDuty[0];
+
+  uint32_t periods = 0;
+  while (OutputRamping(0))
+  {
+    TEST_ASSERT_LESS_THAN_UINT32(limit, periods);
+    rampOutput(bank, 0);
+    periods++;
+
+    int moved = ((int)bank.RampDuty[0] - (int)last) * direction;
+    TEST_ASSERT_TRUE(moved >= 0);
+    TEST_ASSERT_TRUE(direction > 0 ? bank.RampDuty[0] <= target : bank.RampDuty[0] >= target);
+    last = bank.RampDuty[0];
+  }
+
+  TEST_ASSERT_EQUAL_UINT16(target, bank.RampDuty[0]);
+  TEST_ASSERT_EQUAL_UINT16(dutyToOnSlots(bank, target), bank.TargetOnSlots[0]);
+  return periods;
+}
+
+void test_ramp_up_full_scale(void)
+{
+  for (uint8_t profile : profiles)
+  {
+    setUp();
+    Channels[0].RampProfile = profile;
+
+    // 500ms at 200Hz. The curves flatten out at the end, so may round onto it a little early.
+    uint32_t periods = runRamp(PWM_DUTY_MAX, 1000);
+    TEST_ASSERT_EQUAL_UINT32(100, bank.RampSteps[0]);
+    if (profile == RAMP_LINEAR)
+    {
+      TEST_ASSERT_EQUAL_UINT32(100, periods);
+    }
+    else
+    {
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32(100, periods);
+      TEST_ASSERT_GREATER_THAN_UINT32(50, periods);
+    }
+  }
+}
+
+void test_ramp_down_part_scale(void)
+{
+  for (uint8_t profile : profiles)
+  {
+    setUp();
+    Channels[0].RampProfile = RAMP_NONE;
+    runRamp(750, 2);
+    Channels[0].RampProfile = profile;
+
+    // Half the range at the 1s full scale soft stop time
+    uint32_t periods = runRamp(250, 1000);
+    TEST_ASSERT_EQUAL_UINT32(rampPeriods(1000, 500), bank.RampSteps[0]);
+    TEST_ASSERT_EQUAL_UINT32(100, bank.RampSteps[0]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(100, periods);
+    if (profile == RAMP_LINEAR)
+    {
+      TEST_ASSERT_EQUAL_UINT32(100, periods);
+    }
+  }
+}
+
+void test_linear_ramp_is_even(void)
+{
+  // 10 duty steps a period
+  bank.TargetDuty[0] = PWM_DUTY_MAX;
+  for (uint32_t i = 1; i <= 100; i++)
+  {
+    rampOutput(bank, 0);
+    TEST_ASSERT_EQUAL_UINT16(i * 10, bank.RampDuty[0]);
+  }
+}
+
+void test_zero_ramp_time_switches_at_once(void)
+{
+  Channels[0].RampUpTime = 0;
+  Channels[0].RampDownTime = 0;
+  TEST_ASSERT_EQUAL_UINT32(1, runRamp(PWM_DUTY_MAX, 2));
+  TEST_ASSERT_EQUAL_UINT32(1, runRamp(0, 2));
+
+  // No profile ignores the times
+  Channels[0].RampProfile = RAMP_NONE;
+  Channels[0].RampUpTime = 500;
+  TEST_ASSERT_EQUAL_UINT32(1, runRamp(600, 2));
+}
+
+void test_short_change_finishes_in_a_period(void)
+{
+  // Less than a period's worth of change rounds down to no steps
+  TEST_ASSERT_EQUAL_UINT32(1, runRamp(4, 2));
+  TEST_ASSERT_EQUAL_UINT32(0, bank.RampSteps[0]);
+}
+
+void test_retarget_mid_ramp(void)
+{
+  for (uint8_t profile : profiles)
+  {
+    setUp();
+    Channels[0].RampProfile = profile;
+
+    // Half way up, turn back down. The new ramp starts from the duty being output, with no jump.
+    bank.TargetDuty[0] = PWM_DUTY_MAX;
+    for (int i = 0; i < 50; i++)
+    {
+      rampOutput(bank, 0);
+    }
+    uint16_t turned = bank.RampDuty[0];
+    TEST_ASSERT_TRUE(turned > 0 && turned < PWM_DUTY_MAX);
+
+    bank.TargetDuty[0] = 200;
+    rampOutput(bank, 0);
+    TEST_ASSERT_EQUAL_UINT16(turned, bank.RampFrom[0]);
+    TEST_ASSERT_EQUAL_UINT32(rampPeriods(1000, turned - 200), bank.RampSteps[0]);
+    TEST_ASSERT_TRUE(bank.RampDuty[0] <= turned && turned - bank.RampDuty[0] <= 30);
+
+    uint32_t steps = bank.RampSteps[0];
+    uint32_t periods = 1 + runRamp(200, 1000);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(steps, periods);
+    if (profile == RAMP_LINEAR)
+    {
+      TEST_ASSERT_EQUAL_UINT32(steps, periods);
+    }
+
+    // And a higher target part way up continues up at the soft start rate
+    bank.TargetDuty[0] = 600;
+    for (int i = 0; i < 20; i++)
+    {
+      rampOutput(bank, 0);
+    }
+    turned = bank.RampDuty[0];
+    periods = runRamp(900, 1000);
+    TEST_ASSERT_EQUAL_UINT32(rampPeriods(500, 900 - turned), bank.RampSteps[0]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(bank.RampSteps[0], periods);
+    if (profile == RAMP_LINEAR)
+    {
+      TEST_ASSERT_EQUAL_UINT32(bank.RampSteps[0], periods);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ramp_up_full_scale);
+  RUN_TEST(test_ramp_down_part_scale);
+  RUN_TEST(test_linear_ramp_is_even);
+  RUN_TEST(test_zero_ramp_time_switches_at_once);
+  RUN_TEST(test_short_change_finishes_in_a_period);
+  RUN_TEST(test_retarget_mid_ramp);
+  return UNITY_END();
+}
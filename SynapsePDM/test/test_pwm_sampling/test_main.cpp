@@ -0,0 +1,223 @@
+/*  test_main.cpp Current sense sample validity against the PWM output tables.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "ADCHandler.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+PWMBank PWMBanks[PWM_BANKS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static uint32_t offTable[PWM_MAX_SLOTS];
+
+const uint32_t *PWMActiveTable(uint8_t bank)
+{
+  return offTable;
+}
+
+void ForceGroupOff(uint8_t channel) {}
+void WireModelScan(const volatile uint16_t *scan) {}
+void CaptureBlock(const volatile uint16_t *block, uint16_t scans) {}
+void CaptureTrigger(uint8_t channel, uint8_t trigger, uint16_t tripRaw, uint16_t scanOffset) {}
+
+static const uint32_t scanPeriod = (uint32_t)ADC_SCAN_PERIOD * (PWM_TIMER_CLOCK / 1000000);
+static const uint32_t delayCycles = (uint32_t)ADC_SAMPLE_DELAY * (PWM_TIMER_CLOCK / 1000000);
+
+// Pin under test and a neighbour held off
+static const uint32_t pin = 1 << 3;
+static const uint32_t otherPin = 1 << 4;
+
+// Slot times: the fastest allowed, bank G's fits to the scan, and bank F times that don't divide it
+static const uint32_t slotCycleSet[] = {PWM_TIMER_CLOCK / PWM_MAX_SLOT_RATE, 4200, 8400, 16800, 11200, 28560, 168000};
+static const uint16_t slotSet[] = {PWM_MIN_SLOTS, 37, 100, 200, PWM_MAX_SLOTS};
+
+static uint32_t table[PWM_MAX_SLOTS];
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+// One pin on for onSlots from start, wrapping, as patchPWMTable() leaves it
+static void fillTable(uint16_t slots, uint16_t start, uint16_t onSlots)
+{
+  for (int i = 0; i < slots; i++)
+  {
+    bool on = ((i - start + slots) % slots) < onSlots;
+    table[i] = (on ? pin : pin << 16) | otherPin << 16;
+  }
+}
+
+// Update n loads slot n - 1. The outputs are off before the first update.
+static bool slotOn(uint64_t update, uint16_t slots)
+{
+  return update > 0 && (table[(update - 1) % slots] & pin);
+}
+
+// Timer clock cycles the pin has been on for at time t
+static uint64_t onTime(uint64_t t, uint32_t slotCycles, uint16_t slots)
+{
+  uint64_t update = t / slotCycles;
+  if (!slotOn(update, slots))
+  {
+    return 0;
+  }
+
+  uint64_t time = t - update * slotCycles;
+  while (slotOn(--update, slots))
+  {
+    time += slotCycles;
+  }
+  return time;
+}
+
+// Run the phase from the first scan across a few table reloads, checking it against the timer and every sample against
+// the time the pin has actually been on
+static void runScans(uint32_t slotCycles, uint16_t slots, uint16_t start, uint16_t onSlots)
+{
+  fillTable(slots, start, onSlots);
+
+  PWMSamplePhase phase;
+  PWMSamplePhaseInit(&phase, slotCycles, slots, scanPeriod);
+  uint16_t delaySlots = PWMSampleDelaySlots(slotCycles);
+
+  uint64_t period = (uint64_t)slotCycles * slots;
+  uint32_t scans = (3 * period + scanPeriod - 1) / scanPeriod + 2;
+  for (uint32_t s = 0; s < scans; s++)
+  {
+    uint64_t t = (uint64_t)(s + 1) * scanPeriod;
+    uint64_t update = t / slotCycles;
+    TEST_ASSERT_EQUAL_UINT16(update == 0 ? slots - 1 : (update - 1) % slots, phase.Slot);
+    TEST_ASSERT_EQUAL_UINT32(t % slotCycles, phase.Phase);
+
+    uint32_t valid = PWMSampleValidPins(table, &phase);
+    TEST_ASSERT_EQUAL_HEX32(0, valid & ~pin);
+
+    uint64_t on = onTime(t, slotCycles, slots);
+    if (valid)
+    {
+      // Never inside the settling time after a turn on edge
+      TEST_ASSERT_TRUE(on >= delayCycles);
+      TEST_ASSERT_TRUE(on >= (uint64_t)delaySlots * slotCycles);
+    }
+    else if (update > 0)
+    {
+      // Settled for the slots being checked plus the one in progress, so no sample is given up needlessly
+      TEST_ASSERT_TRUE(on < (uint64_t)(delaySlots + 1) * slotCycles);
+    }
+
+    PWMSamplePhaseAdvance(&phase, scanPeriod);
+  }
+}
+
+void test_delay_covers_settling_time(void)
+{
+  for (uint32_t slotCycles : slotCycleSet)
+  {
+    uint16_t delaySlots = PWMSampleDelaySlots(slotCycles);
+    TEST_ASSERT_TRUE((uint64_t)delaySlots * slotCycles >= delayCycles);
+    TEST_ASSERT_TRUE((uint64_t)(delaySlots - 1) * slotCycles < delayCycles);
+  }
+}
+
+void test_phase_tracks_the_timer_across_reloads(void)
+{
+  // Pin off throughout, so only the phase is checked
+  for (uint32_t slotCycles : slotCycleSet)
+  {
+    for (uint16_t slots : slotSet)
+    {
+      runScans(slotCycles, slots, 0, 0);
+    }
+  }
+}
+
+void test_phase_does_not_drift(void)
+{
+  // An hour of scans at a slot time that doesn't divide the scan
+  PWMSamplePhase phase;
+  const uint32_t slotCycles = 11200;
+  const uint16_t slots = 37;
+  PWMSamplePhaseInit(&phase, slotCycles, slots, scanPeriod);
+
+  const uint64_t scans = 36000000ULL;
+  uint64_t remaining = scans - 1;
+  while (remaining--)
+  {
+    PWMSamplePhaseAdvance(&phase, scanPeriod);
+  }
+
+  uint64_t t = scans * scanPeriod;
+  TEST_ASSERT_EQUAL_UINT16((t / slotCycles - 1) % slots, phase.Slot);
+  TEST_ASSERT_EQUAL_UINT32(t % slotCycles, phase.Phase);
+}
+
+void test_samples_across_duty_and_stagger(void)
+{
+  for (uint32_t slotCycles : slotCycleSet)
+  {
+    for (uint16_t slots : slotSet)
+    {
+      // Every duty from off to fully on for short tables, about 50 steps for long ones
+      uint16_t dutyStep = max(slots / 50, 1);
+      uint16_t startStep = max(slots / 7, 1);
+      for (uint16_t onSlots = 0; onSlots <= slots; onSlots += dutyStep)
+      {
+        for (uint16_t start = 0; start < slots; start += startStep)
+        {
+          runScans(slotCycles, slots, start, onSlots);
+        }
+        runScans(slotCycles, slots, slots - 1, onSlots);
+      }
+    }
+  }
+}
+
+void test_window_wrapping_the_table_end(void)
+{
+  // On across the reload: the settling time runs from the end of the table into its start
+  const uint32_t slotCycles = 8400;
+  const uint16_t slots = 100;
+  uint16_t delaySlots = PWMSampleDelaySlots(slotCycles);
+  fillTable(slots, slots - 2, 10);
+
+  PWMSamplePhase phase = {slotCycles, slots, delaySlots, 0, (uint16_t)(delaySlots + 1), 0};
+  for (uint16_t slot = 0; slot < 8; slot++)
+  {
+    phase.Slot = slot;
+    bool settled = slot + 2 >= delaySlots;
+    TEST_ASSERT_EQUAL_HEX32(settled ? pin : 0, PWMSampleValidPins(table, &phase));
+  }
+  phase.Slot = slots - 1;
+  TEST_ASSERT_EQUAL_HEX32(0, PWMSampleValidPins(table, &phase));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_delay_covers_settling_time);
+  RUN_TEST(test_phase_tracks_the_timer_across_reloads);
+  RUN_TEST(test_phase_does_not_drift);
+  RUN_TEST(test_samples_across_duty_and_stagger);
+  RUN_TEST(test_window_wrapping_the_table_end);
+  return UNITY_END();
+}
@@ -0,0 +1,293 @@
+/*  test_main.cpp Bus current with and without PWM phase staggering.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "OutputHandler.cpp"
+
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static std::mt19937 rng(5);
+
+struct BusCurrent
+{
+  float Peak;
+  float RMS;
+};
+
+// Bank current in every slot of one period, from each output's start, on slots and current
+static BusCurrent busCurrent(const PWMBank &bank)
+{
+  BusCurrent bus = {0.0f, 0.0f};
+  double sumSquares = 0.0;
+  for (int i = 0; i < bank.Slots; i++)
+  {
+    float total = 0.0f;
+    for (int p = 0; p < bank.NumPins; p++)
+    {
+      if (((i - bank.TargetStart[p] + bank.Slots) % bank.Slots) < bank.TargetOnSlots[p])
+      {
+        total += ChannelRuntime[bank.FirstChannel + p].CurrentValue;
+      }
+    }
+    bus.Peak = max(bus.Peak, total);
+    sumSquares += (double)total * total;
+  }
+  bus.RMS = sqrt(sumSquares / bank.Slots);
+  return bus;
+}
+
+// Loads one workload into bank G, every output starting at slot 0 as they did before staggering
+static PWMBank &loadBank(const uint16_t *onSlots, const float *amps)
+{
+  PWMBank &bank = PWMBanks[PWM_BANK_G];
+  memset(&bank, 0, sizeof(bank));
+  bank.Pins = GPIOG_PINS;
+  bank.NumPins = NUM_PINS_G;
+  bank.FirstChannel = 0;
+  bank.Frequency = 200;
+  bank.Slots = PWM_MAX_SLOTS;
+  for (int p = 0; p < bank.NumPins; p++)
+  {
+    bank.TargetOnSlots[p] = onSlots[p];
+    ChannelRuntime[p].CurrentValue = amps[p];
+  }
+  return bank;
+}
+
+// Peak and RMS bus current of a workload, all in phase and then staggered
+static void compare(const char *workload, const uint16_t *onSlots, const float *amps, BusCurrent &aligned, BusCurrent &staggered)
+{
+  PWMBank &bank = loadBank(onSlots, amps);
+  aligned = busCurrent(bank);
+
+  // The stagger task runs repeatedly. Later passes see every output's placement.
+  for (int n = 0; n < 3; n++)
+  {
+    StaggerOutputs();
+  }
+  staggered = busCurrent(bank);
+
+  char line[160];
+  snprintf(line, sizeof(line), "%s: peak %.1f A -> %.1f A, RMS %.2f A -> %.2f A", workload, aligned.Peak, staggered.Peak, aligned.RMS,
+           staggered.RMS);
+  TEST_MESSAGE(line);
+}
+
+void setUp(void)
+{
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    GroupLeader[i] = i;
+  }
+  memset(PWMBanks, 0, sizeof(PWMBanks));
+}
+
+void tearDown(void) {}
+
+void test_equal_loads_spread_evenly(void)
+{
+  // Seven 5 A outputs of 7 bins each fit side by side
+  uint16_t onSlots[NUM_PINS_G];
+  float amps[NUM_PINS_G];
+  for (int p = 0; p < NUM_PINS_G; p++)
+  {
+    onSlots[p] = PWM_MAX_SLOTS / PWM_STAGGER_BINS * 7;
+    amps[p] = 5.0f;
+  }
+
+  BusCurrent aligned, staggered;
+  compare("Equal 14% duty", onSlots, amps, aligned, staggered);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 5.0f * NUM_PINS_G, aligned.Peak);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 5.0f, staggered.Peak);
+  TEST_ASSERT_LESS_THAN_FLOAT(aligned.RMS * 0.5f, staggered.RMS);
+}
+
+void test_half_duty_loads_share_the_period(void)
+{
+  uint16_t onSlots[NUM_PINS_G];
+  float amps[NUM_PINS_G];
+  for (int p = 0; p < NUM_PINS_G; p++)
+  {
+    onSlots[p] = PWM_MAX_SLOTS / 2;
+    amps[p] = 4.0f;
+  }
+
+  BusCurrent aligned, staggered;
+  compare("Equal 50% duty", onSlots, amps, aligned, staggered);
+  // 3.5 outputs on on average, so at best 4 at once
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 16.0f, staggered.Peak);
+  TEST_ASSERT_LESS_THAN_FLOAT(aligned.RMS, staggered.RMS);
+}
+
+void test_mixed_loads(void)
+{
+  // A motor, lamps and small loads at assorted duties
+  const uint16_t onSlots[NUM_PINS_G] = {600, 300, 300, 250, 200, 150, 800};
+  const float amps[NUM_PINS_G] = {15.0f, 6.0f, 6.0f, 4.0f, 2.0f, 1.0f, 0.5f};
+
+  BusCurrent aligned, staggered;
+  compare("Mixed", onSlots, amps, aligned, staggered);
+  TEST_ASSERT_LESS_THAN_FLOAT(aligned.Peak * 0.6f, staggered.Peak);
+  TEST_ASSERT_LESS_THAN_FLOAT(aligned.RMS, staggered.RMS);
+}
+
+void test_random_loads_never_worse(void)
+{
+  std::uniform_int_distribution<int> duty(0, PWM_MAX_SLOTS);
+  std::uniform_real_distribution<float> current(0.5f, 20.0f);
+  float alignedPeak = 0.0f, staggeredPeak = 0.0f, alignedRMS = 0.0f, staggeredRMS = 0.0f;
+  const int runs = 200;
+
+  for (int n = 0; n < runs; n++)
+  {
+    uint16_t onSlots[NUM_PINS_G];
+    float amps[NUM_PINS_G];
+    for (int p = 0; p < NUM_PINS_G; p++)
+    {
+      onSlots[p] = duty(rng);
+      amps[p] = current(rng);
+    }
+
+    PWMBank &bank = loadBank(onSlots, amps);
+    BusCurrent aligned = busCurrent(bank);
+    for (int i = 0; i < 3; i++)
+    {
+      StaggerOutputs();
+    }
+    BusCurrent staggered = busCurrent(bank);
+
+    TEST_ASSERT_LESS_OR_EQUAL(aligned.Peak + 0.01f, staggered.Peak);
+    TEST_ASSERT_LESS_OR_EQUAL(aligned.RMS + 0.01f, staggered.RMS);
+    alignedPeak += aligned.Peak;
+    staggeredPeak += staggered.Peak;
+    alignedRMS += aligned.RMS;
+    staggeredRMS += staggered.RMS;
+  }
+
+  char line[160];
+  snprintf(line, sizeof(line), "Random (mean of %d): peak %.1f A -> %.1f A, RMS %.2f A -> %.2f A", runs, alignedPeak / runs, staggeredPeak / runs,
+           alignedRMS / runs, staggeredRMS / runs);
+  TEST_MESSAGE(line);
+}
+
+void test_ganged_follower_keeps_leader_phase(void)
+{
+  uint16_t onSlots[NUM_PINS_G] = {400, 400, 400, 0, 0, 0, 0};
+  float amps[NUM_PINS_G] = {10.0f, 10.0f, 10.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  PWMBank &bank = loadBank(onSlots, amps);
+  GroupLeader[2] = 1;
+
+  StaggerOutputs();
+  TEST_ASSERT_EQUAL_UINT16(bank.TargetStart[1], bank.TargetStart[2]);
+  TEST_ASSERT_NOT_EQUAL(bank.TargetStart[0], bank.TargetStart[1]);
+}
+
+void test_steady_outputs_stay_put(void)
+{
+  const uint16_t onSlots[NUM_PINS_G] = {500, 250, 250, 100, 0, 1000, 300};
+  const float amps[NUM_PINS_G] = {8.0f, 3.0f, 3.0f, 1.0f, 0.0f, 2.0f, 4.0f};
+  PWMBank &bank = loadBank(onSlots, amps);
+  StaggerOutputs();
+  StaggerOutputs();
+
+  uint16_t starts[NUM_PINS_G];
+  memcpy(starts, (const void *)bank.TargetStart, sizeof(starts));
+
+  // Small changes in duty or current don't move anything
+  bank.TargetOnSlots[0] += PWM_MAX_SLOTS / PWM_STAGGER_BINS / 2;
+  ChannelRuntime[1].CurrentValue *= 1.1f;
+  StaggerOutputs();
+  TEST_ASSERT_EQUAL_UINT16_ARRAY(starts, (const uint16_t *)bank.TargetStart, NUM_PINS_G);
+}
+
+// Start bin search as it was written with modulo arithmetic
+static uint8_t moduloStartBin(const float *profile, uint8_t onBins, float amps, uint8_t currentBin)
+{
+  uint8_t bestBin = currentBin;
+  float bestPeak = 0.0f;
+  float bestOverlap = 0.0f;
+  for (int n = 0; n < PWM_STAGGER_BINS; n++)
+  {
+    uint8_t start = (currentBin + n) % PWM_STAGGER_BINS;
+    float peak = 0.0f;
+    float overlap = 0.0f;
+    for (int b = 0; b < PWM_STAGGER_BINS; b++)
+    {
+      bool on = ((b - start + PWM_STAGGER_BINS) % PWM_STAGGER_BINS) < onBins;
+      float total = profile[b] + (on ? amps : 0.0f);
+      peak = max(peak, total);
+      if (on)
+      {
+        overlap += profile[b];
+      }
+    }
+    if (n == 0 || peak < bestPeak - 0.01f || (peak < bestPeak + 0.01f && overlap < bestOverlap - 0.01f))
+    {
+      bestBin = start;
+      bestPeak = peak;
+      bestOverlap = overlap;
+    }
+  }
+  return bestBin;
+}
+
+void test_start_bin_matches_modulo_search(void)
+{
+  std::uniform_int_distribution<int> bins(0, PWM_STAGGER_BINS - 1);
+  std::uniform_int_distribution<int> onBins(1, PWM_STAGGER_BINS);
+  std::uniform_real_distribution<float> current(0.0f, 10.0f);
+
+  for (int run = 0; run < 2000; run++)
+  {
+    // Steps of whole outputs, as staggerBank() builds them, so there are ties to break
+    float profile[PWM_STAGGER_BINS] = {0.0f};
+    for (int q = 0; q < 4; q++)
+    {
+      float amps = current(rng);
+      for (int b = 0, bin = bins(rng), on = onBins(rng); b < on; b++)
+      {
+        profile[(bin + b) % PWM_STAGGER_BINS] += amps;
+      }
+    }
+
+    uint8_t on = onBins(rng);
+    float amps = current(rng);
+    uint8_t currentBin = bins(rng);
+    TEST_ASSERT_EQUAL_UINT8(moduloStartBin(profile, on, amps, currentBin), choosePWMStartBin(profile, on, amps, currentBin));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_equal_loads_spread_evenly);
+  RUN_TEST(test_half_duty_loads_share_the_period);
+  RUN_TEST(test_mixed_loads);
+  RUN_TEST(test_random_loads_never_worse);
+  RUN_TEST(test_ganged_follower_keeps_leader_phase);
+  RUN_TEST(test_steady_outputs_stay_put);
+  RUN_TEST(test_start_bin_matches_modulo_search);
+  return UNITY_END();
+}
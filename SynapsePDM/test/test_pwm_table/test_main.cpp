@@ -0,0 +1,199 @@
+/*  test_main.cpp PWM table patching against a full rewrite of the table.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "OutputHandler.cpp"
+
+static std::mt19937 rng(3);
+
+// What the table should hold for every pin, written from scratch
+static void fullTable(uint32_t *table, uint16_t slots, const uint16_t *pins, const uint16_t *starts, const uint16_t *onSlots)
+{
+  for (int i = 0; i < slots; i++)
+  {
+    table[i] = 0;
+    for (int p = 0; p < PWM_BANK_MAX_PINS; p++)
+    {
+      bool on = ((i - starts[p] + slots) % slots) < onSlots[p];
+      table[i] |= on ? pins[p] : (uint32_t)pins[p] << 16;
+    }
+  }
+}
+
+// Drives one bank's table through a sequence of duty and phase requests, the way pwmTableComplete() does
+struct TableRun
+{
+  uint16_t Slots;
+  uint32_t Table[PWM_MAX_SLOTS];
+  uint16_t Start[PWM_BANK_MAX_PINS];
+  uint16_t OnSlots[PWM_BANK_MAX_PINS];
+  uint32_t Patched;   // Words written by patchPWMTable()
+  uint32_t Rewritten; // Words the old code wrote: the whole table for every request
+  uint32_t Requests;
+
+  explicit TableRun(uint16_t slots) : Slots(slots), Start{}, OnSlots{}, Patched(0), Rewritten(0), Requests(0)
+  {
+    fullTable(Table, Slots, GPIOG_PINS, Start, OnSlots);
+  }
+
+  void request(int p, uint16_t start, uint16_t onSlots)
+  {
+    Requests++;
+    Rewritten += Slots;
+    if (OnSlots[p] != onSlots || Start[p] != start)
+    {
+      Patched += patchPWMTable(Table, Slots, GPIOG_PINS[p], Start[p], OnSlots[p], start, onSlots);
+      Start[p] = start;
+      OnSlots[p] = onSlots;
+    }
+  }
+
+  void check()
+  {
+    uint32_t expected[PWM_MAX_SLOTS];
+    fullTable(expected, Slots, GPIOG_PINS, Start, OnSlots);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(expected, Table, Slots);
+  }
+
+  void report(const char *workload)
+  {
+    char line[160];
+    snprintf(line, sizeof(line), "%s: %.2f words per request patched, %u for a full rewrite (%.2f%%)", workload, (double)Patched / Requests, Slots,
+             100.0 * Patched / Rewritten);
+    TEST_MESSAGE(line);
+  }
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_patch_matches_full_rewrite(void)
+{
+  const uint16_t sizes[] = {PWM_MIN_SLOTS, 100, 333, PWM_MAX_SLOTS};
+  for (uint16_t slots : sizes)
+  {
+    TableRun run(slots);
+    std::uniform_int_distribution<int> pin(0, PWM_BANK_MAX_PINS - 1), slot(0, slots - 1), full(0, 9);
+    for (int n = 0; n < 5000; n++)
+    {
+      // Some off and fully on windows, which have no phase
+      int f = full(rng);
+      uint16_t onSlots = f == 0 ? 0 : f == 1 ? slots : slot(rng);
+      run.request(pin(rng), slot(rng), onSlots);
+      run.check();
+    }
+  }
+}
+
+void test_window_wraps_table_end(void)
+{
+  TableRun run(100);
+  run.request(0, 90, 20);
+  run.check();
+  TEST_ASSERT_EQUAL_UINT16(20, run.Patched);
+
+  // Moving across the end clears the old window and sets the new one
+  run.request(0, 95, 20);
+  run.check();
+  TEST_ASSERT_EQUAL_UINT16(60, run.Patched);
+}
+
+void test_unchanged_request_touches_nothing(void)
+{
+  TableRun run(PWM_MAX_SLOTS);
+  run.request(3, 100, 250);
+  uint32_t patched = run.Patched;
+  for (int n = 0; n < 100; n++)
+  {
+    run.request(3, 100, 250);
+  }
+  TEST_ASSERT_EQUAL_UINT32(patched, run.Patched);
+  run.check();
+}
+
+// Words written per update against the old code, which rewrote the whole table for every duty request
+void test_words_touched_benchmark(void)
+{
+  const uint16_t slots = PWM_MAX_SLOTS;
+
+  // Steady duties, requested every period as the control update does
+  TableRun steady(slots);
+  for (int n = 0; n < 1000; n++)
+  {
+    for (int p = 0; p < PWM_BANK_MAX_PINS; p++)
+    {
+      steady.request(p, p * 140, 100 + p * 50);
+    }
+  }
+  steady.check();
+  steady.report("Steady");
+  TEST_ASSERT_LESS_THAN(steady.Rewritten / 100, steady.Patched);
+
+  // Soft start ramps: one more slot each period, 0 - 100% over a second at 1000 slots
+  TableRun ramp(slots);
+  for (int n = 0; n <= slots; n++)
+  {
+    for (int p = 0; p < PWM_BANK_MAX_PINS; p++)
+    {
+      ramp.request(p, 0, n);
+    }
+  }
+  ramp.check();
+  ramp.report("Ramp");
+  TEST_ASSERT_LESS_THAN(ramp.Rewritten / 100, ramp.Patched);
+
+  // Battery compensation jitter: +/- 1% around a steady duty
+  TableRun jitter(slots);
+  std::uniform_int_distribution<int> step(-10, 10);
+  for (int n = 0; n < 1000; n++)
+  {
+    for (int p = 0; p < PWM_BANK_MAX_PINS; p++)
+    {
+      jitter.request(p, p * 140, 500 + step(rng));
+    }
+  }
+  jitter.check();
+  jitter.report("Jitter");
+  TEST_ASSERT_LESS_THAN(jitter.Rewritten / 10, jitter.Patched);
+
+  // Worst case: every request moves the window. Never more than clearing the old window and setting the new one.
+  TableRun moving(slots);
+  std::uniform_int_distribution<int> slot(0, slots - 1);
+  for (int n = 0; n < 1000; n++)
+  {
+    moving.request(n % PWM_BANK_MAX_PINS, slot(rng), slot(rng));
+  }
+  moving.check();
+  moving.report("Moving");
+  TEST_ASSERT_LESS_OR_EQUAL(moving.Rewritten * 2, moving.Patched);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_patch_matches_full_rewrite);
+  RUN_TEST(test_window_wraps_table_end);
+  RUN_TEST(test_unchanged_request_touches_nothing);
+  RUN_TEST(test_words_touched_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,97 @@
+/*  test_main.cpp PWM bank timing and its lock to the ADC scan period.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <unity.h>
+#include "OutputHandler.cpp"
+
+ChannelConfigRuntime ChannelRuntime[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+static const uint32_t scanCycles = (uint32_t)ADC_SCAN_PERIOD * (PWM_TIMER_CLOCK / 1000000);
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_default_timing_is_unchanged(void)
+{
+  PWMBank bank = {};
+  setPWMBankTiming(bank, DEFAULT_PWM_FREQUENCY, DEFAULT_PWM_SLOTS, true);
+  TEST_ASSERT_EQUAL_UINT16(DEFAULT_PWM_FREQUENCY, bank.Frequency);
+  TEST_ASSERT_EQUAL_UINT16(DEFAULT_PWM_SLOTS, bank.Slots);
+  TEST_ASSERT_EQUAL_UINT32(scanCycles / 2, bank.SlotCycles);
+}
+
+void test_slow_slots_are_shortened_to_a_scan(void)
+{
+  // 50Hz with 20 slots would be 1ms slots and 1kHz scans. Bank G gets 100µs slots and a longer table instead.
+  PWMBank bank = {};
+  setPWMBankTiming(bank, 50, 20, true);
+  TEST_ASSERT_EQUAL_UINT32(scanCycles, bank.SlotCycles);
+  TEST_ASSERT_EQUAL_UINT16(200, bank.Slots);
+  TEST_ASSERT_EQUAL_UINT16(50, bank.Frequency);
+
+  // Bank F has no scans to keep to
+  setPWMBankTiming(bank, 50, 20);
+  TEST_ASSERT_EQUAL_UINT32(PWM_TIMER_CLOCK / 1000, bank.SlotCycles);
+  TEST_ASSERT_EQUAL_UINT16(20, bank.Slots);
+}
+
+void test_every_setting_fits_the_scan_period(void)
+{
+  float worstError = 0.0f;
+  for (uint32_t frequency = PWM_MIN_FREQUENCY; frequency <= PWM_MAX_FREQUENCY; frequency += 5)
+  {
+    for (uint32_t slots = PWM_MIN_SLOTS; slots <= PWM_MAX_SLOTS; slots += 5)
+    {
+      PWMBank bank = {};
+      setPWMBankTiming(bank, frequency, slots, true);
+
+      // A whole number of slots a scan, each a whole number of timer cycles, so scans are ADC_SCAN_PERIOD apart
+      TEST_ASSERT_EQUAL_UINT32(bank.SlotCycles, (uint32_t)bank.Prescaler * bank.SlotTicks);
+      TEST_ASSERT_EQUAL_UINT32(0, scanCycles % bank.SlotCycles);
+
+      TEST_ASSERT_GREATER_OR_EQUAL(PWM_MIN_SLOTS, bank.Slots);
+      TEST_ASSERT_LESS_OR_EQUAL(PWM_MAX_SLOTS, bank.Slots);
+      TEST_ASSERT_LESS_OR_EQUAL(PWM_MAX_SLOT_RATE, PWM_TIMER_CLOCK / bank.SlotCycles);
+
+      float achieved = (float)PWM_TIMER_CLOCK / ((float)bank.SlotCycles * bank.Slots);
+      worstError = max(worstError, fabsf(achieved - frequency) / frequency);
+    }
+  }
+
+  // Rounding the table length to whole slots. Worst with short tables at high frequencies.
+  char line[80];
+  snprintf(line, sizeof(line), "Worst frequency error %.2f%%", worstError * 100.0f);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN_FLOAT(0.025f, worstError);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_default_timing_is_unchanged);
+  RUN_TEST(test_slow_slots_are_shortened_to_a_scan);
+  RUN_TEST(test_every_setting_fits_the_scan_period);
+  return UNITY_END();
+}
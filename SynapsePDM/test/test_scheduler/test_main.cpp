@@ -0,0 +1,235 @@
+/*  test_main.cpp Task scheduler ordering, guard time, catch-up after overruns and clock wraparound.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "Scheduler.cpp"
+
+enum
+{
+  MODE_RUN = 1,
+  MODE_RUN_ON = 2
+};
+
+static uint32_t testClock() { return stubMicros; }
+
+// Each task moves the clock on by its run time and records that it ran
+static uint32_t controlCost, displayCost, backgroundCost;
+static std::vector<int> order;
+static void control()
+{
+  order.push_back(0);
+  stubMicros += controlCost;
+}
+static void display()
+{
+  order.push_back(1);
+  stubMicros += displayCost;
+}
+static void background()
+{
+  order.push_back(2);
+  stubMicros += backgroundCost;
+}
+
+static SchedulerTask tasks[4];
+enum
+{
+  DISPLAY_TASK,
+  CONTROL_TASK,
+  BACKGROUND_TASK,
+  RUN_ON_TASK
+};
+
+/// @brief Run the scheduler as the main loop does for a time, moving the clock on 10 us whenever it's idle
+static void runFor(uint32_t micros, uint16_t modes = MODE_RUN)
+{
+  uint32_t start = stubMicros;
+  while (stubMicros - start < micros)
+  {
+    if (!RunScheduler(modes))
+    {
+      stubMicros += 10;
+    }
+  }
+}
+
+static void start(uint32_t at)
+{
+  stubMicros = at;
+  tasks[DISPLAY_TASK] = {display, 70000, 70000, 3, MODE_RUN};
+  tasks[CONTROL_TASK] = {control, 50000, 5000, 0, MODE_RUN};
+  tasks[BACKGROUND_TASK] = {background, 0, 0, 7, MODE_RUN};
+  tasks[RUN_ON_TASK] = {control, 50000, 5000, 0, MODE_RUN_ON};
+  InitialiseScheduler(tasks, 4, testClock);
+  controlCost = 1000;
+  displayCost = 20000;
+  backgroundCost = 100;
+  order.clear();
+}
+
+void setUp(void) { start(0); }
+
+void tearDown(void) {}
+
+void test_priority_order(void)
+{
+  // Both due at once. Control goes first, then the display, then the background task.
+  RunScheduler(MODE_RUN);
+  RunScheduler(MODE_RUN);
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL(3, order.size());
+  TEST_ASSERT_EQUAL(0, order[0]);
+  TEST_ASSERT_EQUAL(1, order[1]);
+  TEST_ASSERT_EQUAL(2, order[2]);
+}
+
+void test_guard_keeps_control_on_time(void)
+{
+  // Display slows to 45 ms after a second, leaving 5 ms between control runs. It's held back rather than making control late.
+  runFor(1000000);
+  displayCost = 45000;
+  runFor(5000000);
+
+  const SchedulerStatistics &control = SchedulerStats(CONTROL_TASK);
+  TEST_ASSERT_EQUAL_UINT32(0, control.Missed);
+  TEST_ASSERT_LESS_THAN_UINT32(tasks[CONTROL_TASK].Deadline, control.MaxLateMicros);
+  TEST_ASSERT_UINT32_WITHIN(1, 120, control.Runs);
+  TEST_ASSERT_EQUAL_UINT32(1000, control.MaxMicros);
+  TEST_ASSERT_EQUAL_UINT32(1000, control.MeanMicros);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, SchedulerStats(DISPLAY_TASK).Deferred);
+  TEST_ASSERT_GREATER_THAN_UINT32(1000, SchedulerStats(BACKGROUND_TASK).Runs);
+  TEST_ASSERT_EQUAL_UINT32(0, SchedulerStats(RUN_ON_TASK).Runs);
+}
+
+void test_mode_change_not_missed(void)
+{
+  runFor(1000000);
+
+  // Released as soon as it's in its modes, however long it's been out of them
+  RunScheduler(MODE_RUN_ON);
+  TEST_ASSERT_EQUAL_UINT32(1, SchedulerStats(RUN_ON_TASK).Runs);
+  TEST_ASSERT_EQUAL_UINT32(0, SchedulerStats(RUN_ON_TASK).Missed);
+
+  stubMicros += 3000000;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(0, SchedulerStats(CONTROL_TASK).Missed);
+}
+
+void test_just_late_release_runs(void)
+{
+  // Control overruns into its next release by 1 us. That release is due, not gone, so it runs late rather than being skipped.
+  controlCost = tasks[CONTROL_TASK].Period + 1;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(1, SchedulerStats(CONTROL_TASK).Missed);
+  TEST_ASSERT_EQUAL_UINT32(tasks[CONTROL_TASK].Period, tasks[CONTROL_TASK].Release);
+
+  controlCost = 1000;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(2, SchedulerStats(CONTROL_TASK).Runs);
+  TEST_ASSERT_EQUAL_UINT32(1, SchedulerStats(CONTROL_TASK).Missed);
+  TEST_ASSERT_EQUAL_UINT32(1, SchedulerStats(CONTROL_TASK).MaxLateMicros);
+
+  // Back on the grid
+  TEST_ASSERT_EQUAL_UINT32(2 * tasks[CONTROL_TASK].Period, tasks[CONTROL_TASK].Release);
+}
+
+void test_overrun_skips_whole_periods(void)
+{
+  // 120 ms at a 50 ms period. The first run misses, the release at 50 ms is gone and the one at 100 ms runs late.
+  controlCost = 120000;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(2, SchedulerStats(CONTROL_TASK).Missed);
+  TEST_ASSERT_EQUAL_UINT32(100000, tasks[CONTROL_TASK].Release);
+
+  controlCost = 1000;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(20000, SchedulerStats(CONTROL_TASK).MaxLateMicros);
+
+  // Finished at 121 ms, after the 105 ms deadline
+  TEST_ASSERT_EQUAL_UINT32(3, SchedulerStats(CONTROL_TASK).Missed);
+
+  // Back on the grid
+  TEST_ASSERT_EQUAL_UINT32(150000, tasks[CONTROL_TASK].Release);
+}
+
+void test_exact_period_overrun(void)
+{
+  // Ending exactly on the following release skips the one between, and the following one is due straight away
+  controlCost = 2 * tasks[CONTROL_TASK].Period;
+  RunScheduler(MODE_RUN);
+  TEST_ASSERT_EQUAL_UINT32(2, SchedulerStats(CONTROL_TASK).Missed);
+  TEST_ASSERT_EQUAL_UINT32(2 * tasks[CONTROL_TASK].Period, tasks[CONTROL_TASK].Release);
+}
+
+void test_long_background_task_still_runs(void)
+{
+  // Too long to ever fit between control runs, so it goes anyway rather than never starting
+  runFor(100000);
+  backgroundCost = 60000;
+  uint32_t runs = SchedulerStats(BACKGROUND_TASK).Runs;
+  runFor(1000000);
+  TEST_ASSERT_GREATER_THAN_UINT32(runs + 5, SchedulerStats(BACKGROUND_TASK).Runs);
+}
+
+void test_across_clock_wrap(void)
+{
+  // Three seconds before micros() wraps, then on past it
+  start(0xFFFFFFFFu - 3000000u);
+  runFor(1000000);
+  displayCost = 45000;
+  runFor(5000000);
+
+  const SchedulerStatistics &control = SchedulerStats(CONTROL_TASK);
+  TEST_ASSERT_EQUAL_UINT32(0, control.Missed);
+  TEST_ASSERT_LESS_THAN_UINT32(tasks[CONTROL_TASK].Deadline, control.MaxLateMicros);
+  TEST_ASSERT_UINT32_WITHIN(1, 120, control.Runs);
+
+  // Overrun across the wrap still skips by whole periods
+  controlCost = 120000;
+  uint32_t missed = control.Missed;
+  while (control.MaxMicros != controlCost)
+  {
+    if (!RunScheduler(MODE_RUN))
+    {
+      stubMicros += 10;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(missed + 2, control.Missed);
+  TEST_ASSERT_GREATER_THAN_INT32(-(int32_t)tasks[CONTROL_TASK].Period, elapsed(stubMicros, tasks[CONTROL_TASK].Release));
+  TEST_ASSERT_LESS_OR_EQUAL_INT32(0, elapsed(stubMicros, tasks[CONTROL_TASK].Release));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_priority_order);
+  RUN_TEST(test_guard_keeps_control_on_time);
+  RUN_TEST(test_mode_change_not_missed);
+  RUN_TEST(test_just_late_release_runs);
+  RUN_TEST(test_overrun_skips_whole_periods);
+  RUN_TEST(test_exact_period_overrun);
+  RUN_TEST(test_long_background_task_still_runs);
+  RUN_TEST(test_across_clock_wrap);
+  return UNITY_END();
+}
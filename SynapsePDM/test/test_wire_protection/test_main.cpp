@@ -0,0 +1,259 @@
+/*  test_main.cpp Wire model trip times for inrush, overload and short circuit waveforms.
+    Copyright (c) 2023 Joe Mann.  All right reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <Arduino.h>
+#include <unity.h>
+#include "WireProtection.cpp"
+#include "CurrentCalibration.cpp"
+
+ChannelConfig Channels[NUM_CHANNELS];
+PWMBank PWMBanks[PWM_BANKS];
+uint16_t ADCSlotDivider = 1;
+volatile uint16_t GroupMembers[NUM_CHANNELS];
+volatile uint8_t GroupLeader[NUM_CHANNELS];
+
+bool GroupFollower(uint8_t channel)
+{
+  return GroupLeader[channel] != channel;
+}
+
+// Samples taken when each channel was turned off. -1 while it's on.
+static int32_t forcedOffAt[NUM_CHANNELS];
+static int32_t sampleNumber;
+
+void ForceGroupOff(uint8_t channel)
+{
+  forcedOffAt[channel] = sampleNumber;
+}
+
+// 100 us scans: one 16800 cycle slot at 168 MHz
+static const uint32_t SCAN_MICROS = 100;
+
+// Configure a channel's wire rating (A) and time constant (ms)
+static void configureWire(uint8_t channel, float ratedAmps, uint16_t timeConstant)
+{
+  Channels[channel].WireRatedCurrent = lroundf(ratedAmps * 10.0f);
+  Channels[channel].WireTimeConstant = timeConstant;
+  ConfigureWireProtection();
+}
+
+// Feed a waveform to a channel's model until it trips or the time runs out
+// @return Time to trip (ms), or -1 if it didn't
+template <typename Waveform>
+static float tripTime(uint8_t channel, float seconds, Waveform milliamps)
+{
+  int32_t samples = seconds * 1000000 / SCAN_MICROS;
+  for (sampleNumber = 0; sampleNumber < samples; sampleNumber++)
+  {
+    WireModelSample(channel, milliamps(sampleNumber * SCAN_MICROS / 1000.0f));
+    if (WireTripped(channel))
+    {
+      return (sampleNumber + 1) * SCAN_MICROS / 1000.0f;
+    }
+  }
+  return -1.0f;
+}
+
+// Trip time of a step from cold (ms): -τ ln(1 - In² / I²)
+static float expectedTripTime(float ratedAmps, float amps, float timeConstant)
+{
+  return -timeConstant * logf(1.0f - (ratedAmps * ratedAmps) / (amps * amps));
+}
+
+// The same filter in double precision, as a reference for waveforms with no closed form trip time
+template <typename Waveform>
+static float referenceTripTime(float ratedAmps, float timeConstant, float seconds, Waveform milliamps)
+{
+  double heat = 0.0;
+  double tripLevel = (double)ratedAmps * 1000.0 * ratedAmps * 1000.0;
+  int32_t samples = seconds * 1000000 / SCAN_MICROS;
+  for (int32_t n = 0; n < samples; n++)
+  {
+    double amps = milliamps(n * SCAN_MICROS / 1000.0f);
+    heat += (amps * amps - heat) * (SCAN_MICROS / 1000.0) / timeConstant;
+    if (heat >= tripLevel)
+    {
+      return (n + 1) * SCAN_MICROS / 1000.0f;
+    }
+  }
+  return -1.0f;
+}
+
+static void report(const char *waveform, float tripped, float expected)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "%s: tripped after %.1f ms, expected %.1f ms", waveform, tripped, expected);
+  TEST_MESSAGE(line);
+}
+
+void setUp(void)
+{
+  memset(Channels, 0, sizeof(Channels));
+  memset(PWMBanks, 0, sizeof(PWMBanks));
+  PWMBanks[PWM_BANK_G].SlotCycles = SCAN_MICROS * (PWM_TIMER_CLOCK / 1000000);
+  ADCSlotDivider = 1;
+  for (int i = 0; i < NUM_CHANNELS; i++)
+  {
+    GroupLeader[i] = i;
+    GroupMembers[i] = 1 << i;
+    forcedOffAt[i] = -1;
+  }
+  ResetWireProtection();
+}
+
+void tearDown(void) {}
+
+void test_overload_trip_times(void)
+{
+  // 10 A wire with a 1 s time constant at 1.5, 2 and 5 times its rating
+  const float overloads[] = {15.0f, 20.0f, 50.0f};
+  for (float amps : overloads)
+  {
+    ResetWireProtection();
+    configureWire(0, 10.0f, 1000);
+    float tripped = tripTime(0, 10.0f, [&](float) { return (uint32_t)(amps * 1000); });
+    float expected = expectedTripTime(10.0f, amps, 1000.0f);
+
+    char name[40];
+    snprintf(name, sizeof(name), "%.0f A on a 10 A wire", amps);
+    report(name, tripped, expected);
+    TEST_ASSERT_FLOAT_WITHIN(expected * 0.01f + SCAN_MICROS / 1000.0f, expected, tripped);
+    TEST_ASSERT_EQUAL_INT32(sampleNumber, forcedOffAt[0]);
+  }
+}
+
+void test_rated_current_never_trips(void)
+{
+  configureWire(0, 10.0f, 1000);
+  TEST_ASSERT_LESS_THAN_FLOAT(0.0f, tripTime(0, 20.0f, [](float) { return 9900u; }));
+  TEST_ASSERT_GREATER_OR_EQUAL(98, WireHeatPercent(0));
+}
+
+void test_lamp_inrush_doesnt_trip(void)
+{
+  // Filament lamp: 10 times its 4 A running current when cold, falling with a 15 ms time constant, on a 5 A wire
+  configureWire(0, 5.0f, 1000);
+  float tripped = tripTime(0, 5.0f, [](float ms) { return (uint32_t)(4000.0f + 36000.0f * expf(-ms / 15.0f)); });
+  TEST_ASSERT_LESS_THAN_FLOAT(0.0f, tripped);
+  TEST_ASSERT_LESS_THAN(80, WireHeatPercent(0));
+}
+
+void test_motor_stall_trips(void)
+{
+  // Motor inrush settling to 8 A, then stalled at 30 A after a second, on a 10 A wire with a 2 s time constant
+  auto motor = [](float ms) { return ms < 1000.0f ? (uint32_t)(8000.0f + 22000.0f * expf(-ms / 50.0f)) : 30000u; };
+  configureWire(0, 10.0f, 2000);
+  float tripped = tripTime(0, 10.0f, motor);
+  float expected = referenceTripTime(10.0f, 2000.0f, 10.0f, motor);
+  report("Motor stall after 1 s", tripped, expected);
+  TEST_ASSERT_GREATER_THAN_FLOAT(1000.0f, tripped);
+  TEST_ASSERT_FLOAT_WITHIN(expected * 0.01f, expected, tripped);
+}
+
+void test_short_circuit_trips_fast(void)
+{
+  // 300 A into a short on a 10 A wire
+  configureWire(0, 10.0f, 1000);
+  float tripped = tripTime(0, 1.0f, [](float) { return 300000u; });
+  float expected = expectedTripTime(10.0f, 300.0f, 1000.0f);
+  report("300 A short on a 10 A wire", tripped, expected);
+  TEST_ASSERT_FLOAT_WITHIN(SCAN_MICROS / 1000.0f, expected, tripped);
+}
+
+void test_ganged_group_above_65_amps(void)
+{
+  // Three outputs ganged onto an 80 A wire, 50 A each. Modelled on the leader with the total current.
+  for (int i = 0; i < 3; i++)
+  {
+    GroupLeader[i] = 0;
+    Channels[i].CurrentGain = 20 << 16; // 20 mA per count
+  }
+  GroupMembers[0] = 0b111;
+  GroupMembers[1] = GroupMembers[2] = 0;
+  configureWire(0, 80.0f, 1000);
+  TEST_ASSERT_TRUE(WireModelEnabled(0));
+  TEST_ASSERT_FALSE(WireModelEnabled(1));
+
+  uint16_t scan[NUM_CHANNELS] = {2500, 2500, 2500};
+  int32_t samples = 0;
+  for (sampleNumber = 0; sampleNumber < 20000 && !WireTripped(0); sampleNumber++)
+  {
+    WireModelScan(scan);
+    samples++;
+  }
+
+  float tripped = samples * SCAN_MICROS / 1000.0f;
+  float expected = expectedTripTime(80.0f, 150.0f, 1000.0f);
+  report("150 A on an 80 A ganged wire", tripped, expected);
+  TEST_ASSERT_TRUE(WireTripped(0));
+  TEST_ASSERT_FLOAT_WITHIN(expected * 0.01f + SCAN_MICROS / 1000.0f, expected, tripped);
+}
+
+void test_current_beyond_model_limit(void)
+{
+  // Limited to WIRE_MAX_MILLIAMPS without overflowing. Trips as fast as a WIRE_MAX_MILLIAMPS load.
+  configureWire(0, 10.0f, WIRE_MIN_TIME_CONSTANT);
+  float tripped = tripTime(0, 1.0f, [](float) { return UINT32_MAX; });
+  float expected = expectedTripTime(10.0f, WIRE_MAX_MILLIAMPS / 1000.0f, WIRE_MIN_TIME_CONSTANT);
+  TEST_ASSERT_FLOAT_WITHIN(SCAN_MICROS / 1000.0f, expected, tripped);
+  TEST_ASSERT_GREATER_THAN(0, WireModels[0].Heat);
+
+  // The largest rating is limited the same way
+  configureWire(1, 6000.0f, 1000);
+  TEST_ASSERT_EQUAL_UINT64((uint64_t)WIRE_MAX_MILLIAMPS * WIRE_MAX_MILLIAMPS, WireModels[1].TripLevel);
+}
+
+void test_cools_before_retry(void)
+{
+  configureWire(0, 10.0f, 1000);
+  tripTime(0, 1.0f, [](float) { return 40000u; });
+  TEST_ASSERT_TRUE(WireTripped(0));
+  TEST_ASSERT_FALSE(WireCooled(0));
+
+  // Off, the heat decays to WIRE_RESET_PERCENT of the trip level in τ ln(100 / WIRE_RESET_PERCENT)
+  int32_t samples = 0;
+  while (!WireCooled(0) && samples < 100000)
+  {
+    WireModelSample(0, 0);
+    samples++;
+  }
+  float expected = 1000.0f * logf(100.0f / WIRE_RESET_PERCENT);
+  TEST_ASSERT_FLOAT_WITHIN(expected * 0.01f, expected, samples * SCAN_MICROS / 1000.0f);
+
+  ResetWireTrip(0);
+  TEST_ASSERT_FALSE(WireTripped(0));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_overload_trip_times);
+  RUN_TEST(test_rated_current_never_trips);
+  RUN_TEST(test_lamp_inrush_doesnt_trip);
+  RUN_TEST(test_motor_stall_trips);
+  RUN_TEST(test_short_circuit_trips_fast);
+  RUN_TEST(test_ganged_group_above_65_amps);
+  RUN_TEST(test_current_beyond_model_limit);
+  RUN_TEST(test_cools_before_retry);
+  return UNITY_END();
+}
@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+"""calibrate.py Current sense calibration for SynapsePDM output channels.
+
+Captures current sense readings at known loads over USB, fits a piecewise-linear
+table of up to 8 points and uploads it to the PDM.
+
+    calibrate.py capture -p /dev/ttyACM0 -c 3 ch3.csv    Measure loads, appending to ch3.csv
+    calibrate.py fit ch3.csv                             Show the fitted table and its error
+    calibrate.py upload -p /dev/ttyACM0 -c 3 ch3.csv -s  Fit, upload and save to EEPROM
+    calibrate.py clear -p /dev/ttyACM0 -c 3 -s           Go back to the channel's gain and offset
+
+Digital and PWM outputs have separate tables (--mode). PWM readings are the mean while the
+output is on, so calibrate PWM channels at any duty with the output running.
+
+Requires pyserial.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import time
+
+SERIAL_HEADER = 0x1984
+SERIAL_TRAILER = 0x2024
+
+COMMAND_ID_CONFIRM = b'c'
+COMMAND_ID_NEWCONFIG = b'n'
+COMMAND_ID_SAVECHANGES = b'S'
+COMMAND_ID_CAL_CAPTURE = b'a'
+
+CONFIG_DATA_CALIBRATION = 4
+
+CAL_POINTS = 8
+CAL_MODES = {'digital': 0, 'pwm': 1}
+NUM_CHANNELS = 14
+
+# Header, command, channel, type, raw (uint16), current (uint32, mA), trailer, checksum
+CAPTURE_FORMAT = '<HBBBHIHI'
+CAPTURE_SIZE = struct.calcsize(CAPTURE_FORMAT)
+
+
+def open_port(port):
+    import serial
+    return serial.Serial(port, 921600, timeout=1)
+
+
+def capture(link, channel):
+    """One reading of a channel. Returns (raw, mA with the calibration in use)."""
+    link.reset_input_buffer()
+    link.write(COMMAND_ID_CAL_CAPTURE + bytes([channel]))
+    packet = link.read(CAPTURE_SIZE)
+    if len(packet) != CAPTURE_SIZE:
+        raise IOError('No reply from channel %d' % channel)
+
+    header, command, chan, _, raw, milliamps, trailer, checksum = struct.unpack(CAPTURE_FORMAT, packet)
+    if header != SERIAL_HEADER or trailer != SERIAL_TRAILER or command != COMMAND_ID_CAL_CAPTURE[0] or chan != channel:
+        raise IOError('Bad capture packet')
+    if checksum != sum(packet[:-4]):
+        raise IOError('Capture checksum failed')
+
+    return raw, milliamps
+
+
+def send_table(link, channel, mode, points):
+    data = bytes([len(points)]) + b''.join(struct.pack('<HH', raw, ma) for raw, ma in points)
+    packet = struct.pack('<HBBB', SERIAL_HEADER, CONFIG_DATA_CALIBRATION, mode, channel) + data
+    packet += struct.pack('<H', SERIAL_TRAILER)
+    packet += struct.pack('<I', sum(packet))
+
+    link.reset_input_buffer()
+    link.write(COMMAND_ID_NEWCONFIG + packet)
+    if link.read(1) != COMMAND_ID_CONFIRM:
+        raise IOError('Table rejected')
+
+
+def save(link):
+    link.write(COMMAND_ID_SAVECHANGES)
+    link.timeout = 5  # Writing the EEPROM takes a while
+    if link.read(1) != COMMAND_ID_CONFIRM:
+        raise IOError('Save failed')
+
+
+def load_measurements(path):
+    with open(path, newline='') as f:
+        return [(float(row['raw']), float(row['milliamps'])) for row in csv.DictReader(f)]
+
+
+def solve(a, b):
+    """Gaussian elimination with partial pivoting."""
+    n = len(b)
+    m = [row[:] + [b[i]] for i, row in enumerate(a)]
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(m[r][col]))
+        m[col], m[pivot] = m[pivot], m[col]
+        if abs(m[col][col]) < 1e-12:
+            raise ValueError('Measurements don\'t cover the knots. Take more points across the range.')
+        for r in range(col + 1, n):
+            f = m[r][col] / m[col][col]
+            for c in range(col, n + 1):
+                m[r][c] -= f * m[col][c]
+    x = [0.0] * n
+    for r in reversed(range(n)):
+        x[r] = (m[r][n] - sum(m[r][c] * x[c] for c in range(r + 1, n))) / m[r][r]
+    return x
+
+
+def interpolate(points, raw):
+    """Current at a reading, the way the firmware works it out."""
+    if len(points) == 1:
+        r0, m0 = points[0]
+        return m0 * raw / r0 if r0 else m0
+    k = 0
+    while k + 2 < len(points) and raw >= points[k + 1][0]:
+        k += 1
+    (r0, m0), (r1, m1) = points[k], points[k + 1]
+    return max(0.0, m0 + (raw - r0) * (m1 - m0) / (r1 - r0))
+
+
+def fit(measurements, count=CAL_POINTS):
+    """Least squares piecewise-linear fit with knots spread over the measured readings."""
+    merged = {}
+    for raw, ma in measurements:
+        merged.setdefault(round(raw), []).append(ma)
+    readings = sorted((raw, sum(ma) / len(ma)) for raw, ma in merged.items())
+
+    if len(readings) <= count:
+        points = readings
+    else:
+        # Knots at quantiles of the readings, so each segment has measurements to fit
+        knots = sorted({readings[round(i * (len(readings) - 1) / (count - 1))][0] for i in range(count)})
+
+        def basis(raw):
+            w = [0.0] * len(knots)
+            k = 0
+            while k + 2 < len(knots) and raw >= knots[k + 1]:
+                k += 1
+            t = (raw - knots[k]) / (knots[k + 1] - knots[k])
+            w[k], w[k + 1] = 1 - t, t
+            return w
+
+        n = len(knots)
+        ata = [[0.0] * n for _ in range(n)]
+        atb = [0.0] * n
+        for raw, ma in measurements:
+            w = basis(raw)
+            for i in range(n):
+                atb[i] += w[i] * ma
+                for j in range(n):
+                    ata[i][j] += w[i] * w[j]
+        points = list(zip(knots, solve(ata, atb)))
+
+    return [(int(round(raw)), int(min(max(round(ma), 0), 0xFFFF))) for raw, ma in points]
+
+
+def report(points, measurements):
+    print('Point  Raw   mA')
+    for i, (raw, ma) in enumerate(points):
+        print('%5d %5d %6d' % (i, raw, ma))
+
+    worst = 0.0
+    print('\nMeasured mA  Fitted mA  Error mA')
+    for raw, ma in sorted(measurements):
+        fitted = interpolate(points, raw)
+        worst = max(worst, abs(fitted - ma))
+        print('%11.0f %10.0f %9.0f' % (ma, fitted, fitted - ma))
+    print('\nWorst error %.0f mA' % worst)
+
+
+def cmd_capture(args):
+    link = open_port(args.port)
+    new = not os.path.exists(args.csv)
+    with open(args.csv, 'a', newline='') as f:
+        out = csv.writer(f)
+        if new:
+            out.writerow(['raw', 'milliamps'])
+
+        while True:
+            entry = input('Load current in amps (blank to finish): ').strip()
+            if not entry:
+                break
+
+            raws = []
+            for _ in range(args.samples):
+                raws.append(capture(link, args.channel)[0])
+                time.sleep(args.interval)
+
+            raw = sum(raws) / len(raws)
+            milliamps = float(entry) * 1000
+            out.writerow(['%.1f' % raw, '%.0f' % milliamps])
+            f.flush()
+            print('  raw %.1f (%d - %d) at %.0f mA' % (raw, min(raws), max(raws), milliamps))
+
+
+def cmd_fit(args):
+    measurements = load_measurements(args.csv)
+    report(fit(measurements), measurements)
+
+
+def cmd_upload(args):
+    measurements = load_measurements(args.csv)
+    points = fit(measurements)
+    report(points, measurements)
+
+    link = open_port(args.port)
+    send_table(link, args.channel, CAL_MODES[args.mode], points)
+    if args.save:
+        save(link)
+    print('\nUploaded %d points to channel %d (%s)%s' % (len(points), args.channel, args.mode, ', saved' if args.save else ''))
+
+
+def cmd_clear(args):
+    link = open_port(args.port)
+    send_table(link, args.channel, CAL_MODES[args.mode], [])
+    if args.save:
+        save(link)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    def link_args(p):
+        p.add_argument('-p', '--port', required=True, help='PDM serial port, e.g. /dev/ttyACM0')
+        p.add_argument('-c', '--channel', type=int, required=True, choices=range(NUM_CHANNELS), metavar='0-13')
+
+    p = commands.add_parser('capture', help='measure readings at known loads')
+    link_args(p)
+    p.add_argument('csv')
+    p.add_argument('-n', '--samples', type=int, default=20, help='readings averaged per load')
+    p.add_argument('-i', '--interval', type=float, default=0.05, help='seconds between readings')
+    p.set_defaults(func=cmd_capture)
+
+    p = commands.add_parser('fit', help='show the table fitted to a capture')
+    p.add_argument('csv')
+    p.set_defaults(func=cmd_fit)
+
+    p = commands.add_parser('upload', help='fit a capture and send it to the PDM')
+    link_args(p)
+    p.add_argument('csv')
+    p.add_argument('-m', '--mode', choices=CAL_MODES, default='digital')
+    p.add_argument('-s', '--save', action='store_true', help='save to EEPROM')
+    p.set_defaults(func=cmd_upload)
+
+    p = commands.add_parser('clear', help='remove a channel\'s table')
+    link_args(p)
+    p.add_argument('-m', '--mode', choices=CAL_MODES, default='digital')
+    p.add_argument('-s', '--save', action='store_true', help='save to EEPROM')
+    p.set_defaults(func=cmd_clear)
+
+    args = parser.parse_args()
+    try:
+        args.func(args)
+    except (IOError, ValueError) as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
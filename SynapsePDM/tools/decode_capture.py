@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""decode_capture.py Convert SynapsePDM fault captures to CSV.
+
+Each output fault freezes the current sense readings around it and writes them to the SD card
+as FAULT_<date>_<time>_CHnn.bin. This turns them into CSV with time relative to the trigger.
+
+    decode_capture.py FAULT_2026-03-01_12-00-00_CH03.bin           Writes FAULT_..._CH03.csv
+    decode_capture.py -o - FAULT_2026-03-01_12-00-00_CH03.bin      CSV to stdout
+    decode_capture.py -i FAULT_*.bin                               Just show the headers
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+CAPTURE_MAGIC = b'SPFC'
+CAPTURE_VERSION = 1
+CAL_POINTS = 8
+
+# Matches CaptureHeader in FaultCapture.h
+HEADER_FORMAT = '<4sBBBBIIHHHHIIhB%dH%dI%di' % (CAL_POINTS, CAL_POINTS, CAL_POINTS)
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+
+TRIGGERS = ['watchdog', 'overcurrent', 'is fault']
+CHANNEL_TYPES = ['DIG', 'DIG_PWM', 'ANA', 'ANA_PWM', 'CAN_DIGITAL', 'CAN_PWM']
+
+# Raw reading below which the firmware reports no current (CURRENT_NOISE_FLOOR)
+CURRENT_NOISE_FLOOR = 5
+
+
+class Capture:
+    def __init__(self, data):
+        if len(data) < HEADER_SIZE + 4:
+            raise ValueError('Too short for a capture')
+
+        fields = struct.unpack_from(HEADER_FORMAT, data)
+        (self.magic, self.version, self.channel, self.trigger, self.chan_type, self.epoch, self.sample_period,
+         self.samples, self.pre_samples, self.trip_raw, self.fault_raw, self.vbatt_mv, self.gain, self.offset,
+         self.curve_count) = fields[:15]
+        self.curve_raw = fields[15:15 + CAL_POINTS]
+        self.curve_ma = fields[15 + CAL_POINTS:15 + 2 * CAL_POINTS]
+        self.curve_slope = fields[15 + 2 * CAL_POINTS:]
+
+        if self.magic != CAPTURE_MAGIC:
+            raise ValueError('Not a capture file')
+        if self.version != CAPTURE_VERSION:
+            raise ValueError('Unsupported capture version %d' % self.version)
+
+        end = HEADER_SIZE + self.samples * 2
+        self.complete = len(data) >= end + 4 and struct.unpack_from('<I', data, end)[0] == zlib.crc32(data[:end])
+        count = min(self.samples, (len(data) - HEADER_SIZE) // 2)
+        self.raw = struct.unpack_from('<%dH' % count, data, HEADER_SIZE)
+
+    def milliamps(self, raw):
+        """Current at a reading, the way the firmware works it out (senseToMilliamps)."""
+        if raw < CURRENT_NOISE_FLOOR:
+            return 0
+
+        if self.curve_count:
+            k = 0
+            while k + 1 < self.curve_count and raw >= self.curve_raw[k + 1]:
+                k += 1
+            ma = self.curve_ma[k] + (((raw - self.curve_raw[k]) * self.curve_slope[k] + 0x8000) >> 16)
+            return max(ma, 0)
+
+        counts = raw - self.offset
+        return (counts * self.gain + 0x8000) >> 16 if counts > 0 else 0
+
+    def describe(self):
+        trigger = TRIGGERS[self.trigger] if self.trigger < len(TRIGGERS) else str(self.trigger)
+        chan_type = CHANNEL_TYPES[self.chan_type] if self.chan_type < len(CHANNEL_TYPES) else str(self.chan_type)
+        lines = [
+            'Channel %d (%s), %s trigger, written %s' % (self.channel + 1, chan_type, trigger,
+                                                   time.strftime('%Y-%m-%d %H:%M:%S', time.gmtime(self.epoch))),
+            '%d samples, %d before the trigger, every %.1f us' % (len(self.raw), self.pre_samples, self.sample_period / 1000),
+            'Battery %.2f V' % (self.vbatt_mv / 1000),
+        ]
+        if self.trip_raw:
+            lines.append('Watchdog tripped at raw %d (%d mA)' % (self.trip_raw, self.milliamps(self.trip_raw)))
+        if not self.complete:
+            lines.append('Incomplete: the capture was cut short or is corrupt')
+        return '\n'.join(lines)
+
+    def write_csv(self, out):
+        out.write('time_us,raw,milliamps,fault\n')
+        for n, raw in enumerate(self.raw):
+            t = (n - self.pre_samples) * self.sample_period / 1000
+            out.write('%.1f,%d,%d,%d\n' % (t, raw, self.milliamps(raw), raw > self.fault_raw))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('captures', nargs='+')
+    parser.add_argument('-o', '--output', help='CSV file, or - for stdout. Default is the capture name with .csv')
+    parser.add_argument('-i', '--info', action='store_true', help='show the headers only')
+    args = parser.parse_args()
+
+    if args.output and args.output != '-' and len(args.captures) > 1:
+        sys.exit('-o takes one capture at a time')
+
+    failed = False
+    for path in args.captures:
+        try:
+            with open(path, 'rb') as f:
+                capture = Capture(f.read())
+        except (IOError, ValueError, struct.error) as e:
+            print('%s: %s' % (path, e), file=sys.stderr)
+            failed = True
+            continue
+
+        print('%s\n%s\n' % (path, capture.describe()), file=sys.stderr)
+        if args.info:
+            continue
+
+        if args.output == '-':
+            capture.write_csv(sys.stdout)
+        else:
+            name = args.output or (path.rsplit('.', 1)[0] + '.csv')
+            with open(name, 'w', newline='') as out:
+                capture.write_csv(out)
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,422 @@
+#!/usr/bin/env python3
+"""logic_compile.py Compile output channel conditions for SynapsePDM.
+
+A channel with a condition switches on its result instead of its input. Conditions are compiled
+to bytecode here, checked, and run by the PDM once per control tick.
+
+    logic_compile.py compile "din1 and vbatt > 12.5V"                Show the bytecode
+    logic_compile.py upload -p /dev/ttyACM0 -c 3 "ondelay(din2, 2s)" -s   Upload to channel 3 and save
+    logic_compile.py clear -p /dev/ttyACM0 -c 3 -s                   Back to the channel's input
+
+Conditions are expressions over these values, numbered from 1:
+
+    din1-din8      Digital input (0 or 1)             ana1-ana8      Analogue input (mV)
+    ana1.active    Analogue input past its thresholds din1.hz ana1.hz Input frequency (mHz)
+    din1.duty      Input duty (0.1%)                  ch1.on         Output driven (0 or 1)
+    ch1.amps       Output current (mA)                ch1.fault      Output error flags
+    can1           CAN enable flag of a channel       ign            Ignition (0 or 1)
+    vbatt          Battery voltage (mV)               temp           Board temperature (C)
+    time           Milliseconds since start up
+
+Numbers take a unit, converted to the units above: V mV A mA Hz s ms %.
+Operators are  or  and  not  < <= > >= == !=  + -  * / %  and unary minus, lowest first.
+Functions are ondelay(x, t), offdelay(x, t), latch(set, reset), toggle(x), flash(on, off),
+flash(x, on, off), if(c, a, b), min(a, b) and max(a, b). Every part of a condition is
+worked out every tick, so timers inside if() keep running.
+
+Requires pyserial to upload.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SERIAL_HEADER = 0x1984
+SERIAL_TRAILER = 0x2024
+
+COMMAND_ID_CONFIRM = b'c'
+COMMAND_ID_NEWCONFIG = b'n'
+COMMAND_ID_SAVECHANGES = b'S'
+
+CONFIG_DATA_LOGIC = 5
+
+NUM_CHANNELS = 14
+NUM_DI_CHANNELS = 8
+NUM_ANA_CHANNELS = 8
+
+# Match LogicEngine.h
+LOGIC_CODE_SIZE = 48
+LOGIC_STACK_DEPTH = 8
+LOGIC_SLOTS = 8
+
+OPCODES = ['END', 'PUSH8', 'PUSH16', 'PUSH32', 'LOAD', 'ADD', 'SUB', 'MUL', 'DIV', 'MOD', 'NEG', 'MIN', 'MAX',
+           'LT', 'LE', 'GT', 'GE', 'EQ', 'NE', 'AND', 'OR', 'NOT', 'SEL', 'ONDELAY', 'OFFDELAY', 'LATCH', 'TOGGLE',
+           'FLASH']
+OP = {name: code for code, name in enumerate(OPCODES)}
+
+# Operand bytes, values popped and pushed by each opcode
+OP_INFO = {
+    'END': (0, 1, 0), 'PUSH8': (1, 0, 1), 'PUSH16': (2, 0, 1), 'PUSH32': (4, 0, 1), 'LOAD': (1, 0, 1),
+    'NEG': (0, 1, 1), 'NOT': (0, 1, 1), 'SEL': (0, 3, 1), 'ONDELAY': (1, 2, 1), 'OFFDELAY': (1, 2, 1),
+    'LATCH': (1, 2, 1), 'TOGGLE': (1, 1, 1),
+}
+SLOT_OPS = {'ONDELAY', 'OFFDELAY', 'LATCH', 'TOGGLE'}
+
+# Register file
+REG_DIN = 0
+REG_ANA_MV = REG_DIN + NUM_DI_CHANNELS
+REG_ANA_ACTIVE = REG_ANA_MV + NUM_ANA_CHANNELS
+REG_HZ = REG_ANA_ACTIVE + NUM_ANA_CHANNELS
+REG_DUTY = REG_HZ + NUM_DI_CHANNELS + NUM_ANA_CHANNELS
+REG_CH_ON = REG_DUTY + NUM_DI_CHANNELS + NUM_ANA_CHANNELS
+REG_CH_MA = REG_CH_ON + NUM_CHANNELS
+REG_CH_FAULT = REG_CH_MA + NUM_CHANNELS
+REG_CAN = REG_CH_FAULT + NUM_CHANNELS
+REG_IGN = REG_CAN + NUM_CHANNELS
+REG_VBATT = REG_IGN + 1
+REG_TEMP = REG_IGN + 2
+REG_TIME = REG_IGN + 3
+LOGIC_REGISTERS = REG_IGN + 4
+
+UNITS = {'v': 1000, 'mv': 1, 'a': 1000, 'ma': 1, 'hz': 1000, 's': 1000, 'ms': 1, '%': 10}
+
+BINARY = {'or': 'OR', 'and': 'AND', '<': 'LT', '<=': 'LE', '>': 'GT', '>=': 'GE', '==': 'EQ', '!=': 'NE',
+          '+': 'ADD', '-': 'SUB', '*': 'MUL', '/': 'DIV', '%': 'MOD'}
+
+# Binary operators by precedence, lowest first
+LEVELS = [('or',), ('and',), None, ('<', '<=', '>', '>=', '==', '!='), ('+', '-'), ('*', '/', '%')]
+
+# Function name: (opcode, arguments)
+FUNCTIONS = {'ondelay': ('ONDELAY', 2), 'offdelay': ('OFFDELAY', 2), 'latch': ('LATCH', 2), 'toggle': ('TOGGLE', 1),
+             'min': ('MIN', 2), 'max': ('MAX', 2), 'if': ('SEL', 3)}
+
+TOKEN = re.compile(r'\s*(?:(\d+(?:\.\d+)?)([a-z]+|%)?|([a-z_]\w*(?:\.[a-z_]\w*)?)|(<=|>=|==|!=|&&|\|\||[-+*/%()<>!,]))',
+                   re.IGNORECASE)
+
+# Follows a % that's modulo rather than percent
+OPERAND = re.compile(r'\s*(?:[\d(]|(?!(?:and|or)\b)[a-z_])', re.IGNORECASE)
+
+
+class CompileError(ValueError):
+    pass
+
+
+def register(name):
+    """Register index of a value name."""
+    fixed = {'ign': REG_IGN, 'vbatt': REG_VBATT, 'temp': REG_TEMP, 'time': REG_TIME}
+    if name in fixed:
+        return fixed[name]
+
+    m = re.fullmatch(r'(din|ana|ch|can)(\d+)(?:\.(\w+))?', name)
+    if m:
+        kind, number, field = m.group(1), int(m.group(2)), m.group(3)
+        inputs = {'din': (NUM_DI_CHANNELS, 0), 'ana': (NUM_ANA_CHANNELS, NUM_DI_CHANNELS)}
+        count = inputs[kind][0] if kind in inputs else NUM_CHANNELS
+        if not 1 <= number <= count:
+            raise CompileError('%s: %s goes from 1 to %d' % (name, kind, count))
+        i = number - 1
+
+        if kind in inputs:
+            capture = inputs[kind][1] + i
+            fields = {'hz': REG_HZ + capture, 'duty': REG_DUTY + capture}
+            if kind == 'din':
+                fields[None] = REG_DIN + i
+            else:
+                fields[None] = REG_ANA_MV + i
+                fields['active'] = REG_ANA_ACTIVE + i
+        elif kind == 'ch':
+            fields = {'on': REG_CH_ON + i, 'amps': REG_CH_MA + i, 'fault': REG_CH_FAULT + i}
+        else:
+            fields = {None: REG_CAN + i}
+
+        if field in fields:
+            return fields[field]
+
+    raise CompileError('Unknown value %s' % name)
+
+
+def tokenise(text):
+    tokens = []
+    pos = 0
+    text = text.strip()
+    while pos < len(text):
+        m = TOKEN.match(text, pos)
+        if not m or m.end() == pos:
+            raise CompileError('Can\'t read "%s"' % text[pos:].strip())
+        number, unit, name, symbol = m.groups()
+        if number is not None:
+            if unit == '%' and OPERAND.match(text, m.end()):
+                # 10%3 is 10 modulo 3
+                unit = None
+                m = re.compile(r'\s*\d+(?:\.\d+)?').match(text, pos)
+            if unit and unit.lower() not in UNITS:
+                raise CompileError('Unknown unit %s' % unit)
+            value = float(number) * UNITS[unit.lower()] if unit else float(number)
+            if value != int(value):
+                raise CompileError('%s%s isn\'t a whole number of %s' % (number, unit or '', 'm' + unit if unit else 'units'))
+            tokens.append(('num', int(value)))
+        elif name is not None:
+            name = name.lower()
+            tokens.append(('op', name) if name in ('and', 'or', 'not') else ('name', name))
+        else:
+            tokens.append(('op', {'&&': 'and', '||': 'or', '!': 'not'}.get(symbol, symbol)))
+        pos = m.end()
+    return tokens
+
+
+class Parser:
+    """Recursive descent parser. Emits instructions as it goes, as (opcode, operand) pairs."""
+
+    def __init__(self, text):
+        self.tokens = tokenise(text)
+        self.pos = 0
+        self.code = []
+        self.slots = 0
+
+    def peek(self):
+        return self.tokens[self.pos] if self.pos < len(self.tokens) else (None, None)
+
+    def take(self, kind=None, value=None):
+        token = self.peek()
+        if token[0] is None or (kind and token[0] != kind) or (value and token[1] != value):
+            raise CompileError('Expected %s' % (value or kind) if token[0] is None else 'Unexpected %s' % str(token[1]))
+        self.pos += 1
+        return token
+
+    def emit(self, op, operand=None):
+        if op in SLOT_OPS:
+            if self.slots >= LOGIC_SLOTS:
+                raise CompileError('More than %d timers, latches and toggles' % LOGIC_SLOTS)
+            operand = self.slots
+            self.slots += 1
+        self.code.append((op, operand))
+
+    def parse(self):
+        self.binary(0)
+        if self.pos != len(self.tokens):
+            raise CompileError('Unexpected %s' % str(self.peek()[1]))
+        self.emit('END')
+        return self.code
+
+    def binary(self, level):
+        if level == len(LEVELS):
+            return self.unary()
+        if LEVELS[level] is None:
+            # not sits between and and the comparisons
+            if self.peek() == ('op', 'not'):
+                self.take()
+                self.binary(level)
+                self.emit('NOT')
+            else:
+                self.binary(level + 1)
+            return
+
+        self.binary(level + 1)
+        while self.peek()[0] == 'op' and self.peek()[1] in LEVELS[level]:
+            op = self.take()[1]
+            self.binary(level + 1)
+            self.emit(BINARY[op])
+
+    def unary(self):
+        if self.peek() == ('op', '-'):
+            self.take()
+            if self.peek()[0] == 'num':
+                self.emit('PUSH', -self.take()[1])
+            else:
+                self.unary()
+                self.emit('NEG')
+        elif self.peek() == ('op', 'not'):
+            self.take()
+            self.unary()
+            self.emit('NOT')
+        else:
+            self.primary()
+
+    def arguments(self):
+        self.take('op', '(')
+        count = 0
+        if self.peek() != ('op', ')'):
+            while True:
+                self.binary(0)
+                count += 1
+                if self.peek() != ('op', ','):
+                    break
+                self.take()
+        self.take('op', ')')
+        return count
+
+    def primary(self):
+        kind, value = self.take()
+        if kind == 'num':
+            self.emit('PUSH', value)
+        elif kind == 'op' and value == '(':
+            self.binary(0)
+            self.take('op', ')')
+        elif kind == 'name' and self.peek() == ('op', '('):
+            count = self.arguments()
+            if value == 'flash' and count in (2, 3):
+                self.emit('FLASH')
+                if count == 3:
+                    self.emit('AND')
+            elif value in FUNCTIONS and count == FUNCTIONS[value][1]:
+                self.emit(FUNCTIONS[value][0])
+            elif value in FUNCTIONS or value == 'flash':
+                raise CompileError('Wrong number of arguments to %s' % value)
+            else:
+                raise CompileError('Unknown function %s' % value)
+        elif kind == 'name' and value in ('true', 'false'):
+            self.emit('PUSH', int(value == 'true'))
+        elif kind == 'name':
+            self.emit('LOAD', register(value))
+        else:
+            raise CompileError('Unexpected %s' % value)
+
+
+def assemble(instructions):
+    code = bytearray()
+    for op, operand in instructions:
+        if op == 'PUSH':
+            if -0x80 <= operand < 0x80:
+                code += bytes([OP['PUSH8']]) + struct.pack('<b', operand)
+            elif -0x8000 <= operand < 0x8000:
+                code += bytes([OP['PUSH16']]) + struct.pack('<h', operand)
+            elif -0x80000000 <= operand < 0x100000000:
+                code += bytes([OP['PUSH32']]) + struct.pack('<I', operand & 0xFFFFFFFF)
+            else:
+                raise CompileError('%d is too big' % operand)
+        elif operand is None:
+            code.append(OP[op])
+        else:
+            code += bytes([OP[op], operand])
+    return bytes(code)
+
+
+def verify(code):
+    """The same checks the PDM makes before it takes a program. Returns the deepest the stack goes."""
+    if not 0 < len(code) <= LOGIC_CODE_SIZE:
+        raise CompileError('%d bytes. Programs are 1 to %d bytes' % (len(code), LOGIC_CODE_SIZE))
+
+    depth = deepest = pc = 0
+    while pc < len(code):
+        if code[pc] >= len(OPCODES):
+            raise CompileError('Bad opcode %d at %d' % (code[pc], pc))
+        op = OPCODES[code[pc]]
+        operands, pops, pushes = OP_INFO.get(op, (0, 2, 1))
+        if pc + 1 + operands > len(code) or depth < pops:
+            raise CompileError('%s at %d runs off the end or the stack' % (op, pc))
+        if (op == 'LOAD' and code[pc + 1] >= LOGIC_REGISTERS) or (op in SLOT_OPS and code[pc + 1] >= LOGIC_SLOTS):
+            raise CompileError('%s at %d is out of range' % (op, pc))
+        if op == 'END':
+            if depth != 1 or pc + 1 != len(code):
+                raise CompileError('Program doesn\'t end with one result')
+            return deepest
+        depth += pushes - pops
+        deepest = max(deepest, depth)
+        if depth > LOGIC_STACK_DEPTH:
+            raise CompileError('Needs more than %d stack entries. Split it up or reorder it' % LOGIC_STACK_DEPTH)
+        pc += 1 + operands
+    raise CompileError('Program doesn\'t end')
+
+
+def compile_condition(text):
+    code = assemble(Parser(text).parse())
+    verify(code)
+    return code
+
+
+def disassemble(code):
+    lines = []
+    pc = 0
+    while pc < len(code):
+        op = OPCODES[code[pc]]
+        operands = OP_INFO.get(op, (0, 2, 1))[0]
+        raw = code[pc + 1:pc + 1 + operands]
+        if op in ('PUSH8', 'PUSH16', 'PUSH32'):
+            arg = ' %d' % struct.unpack({1: '<b', 2: '<h', 4: '<i'}[operands], raw)[0]
+        elif operands:
+            arg = ' %d' % raw[0]
+        else:
+            arg = ''
+        lines.append('%3d  %-9s%s' % (pc, op, arg))
+        pc += 1 + operands
+    return '\n'.join(lines)
+
+
+def open_port(port):
+    import serial
+    return serial.Serial(port, 921600, timeout=1)
+
+
+def send_program(link, channel, code):
+    packet = struct.pack('<HBBB', SERIAL_HEADER, CONFIG_DATA_LOGIC, 0, channel) + bytes([len(code)]) + code
+    packet += struct.pack('<H', SERIAL_TRAILER)
+    packet += struct.pack('<I', sum(packet))
+
+    link.reset_input_buffer()
+    link.write(COMMAND_ID_NEWCONFIG + packet)
+    if link.read(1) != COMMAND_ID_CONFIRM:
+        raise IOError('Program rejected')
+
+
+def save(link):
+    link.write(COMMAND_ID_SAVECHANGES)
+    link.timeout = 5  # Writing the EEPROM takes a while
+    if link.read(1) != COMMAND_ID_CONFIRM:
+        raise IOError('Save failed')
+
+
+def cmd_compile(args):
+    code = compile_condition(args.condition)
+    print(disassemble(code))
+    print('\n%d of %d bytes, stack depth %d' % (len(code), LOGIC_CODE_SIZE, verify(code)))
+    print(code.hex(' '))
+
+
+def cmd_upload(args):
+    code = compile_condition(args.condition)
+    link = open_port(args.port)
+    send_program(link, args.channel, code)
+    if args.save:
+        save(link)
+    print('Uploaded %d bytes to channel %d%s' % (len(code), args.channel, ', saved' if args.save else ''))
+
+
+def cmd_clear(args):
+    link = open_port(args.port)
+    send_program(link, args.channel, b'')
+    if args.save:
+        save(link)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    def link_args(p):
+        p.add_argument('-p', '--port', required=True, help='PDM serial port, e.g. /dev/ttyACM0')
+        p.add_argument('-c', '--channel', type=int, required=True, choices=range(NUM_CHANNELS), metavar='0-13')
+        p.add_argument('-s', '--save', action='store_true', help='save to EEPROM')
+
+    p = commands.add_parser('compile', help='show the bytecode for a condition')
+    p.add_argument('condition')
+    p.set_defaults(func=cmd_compile)
+
+    p = commands.add_parser('upload', help='compile a condition and send it to a channel')
+    link_args(p)
+    p.add_argument('condition')
+    p.set_defaults(func=cmd_upload)
+
+    p = commands.add_parser('clear', help='remove a channel\'s condition')
+    link_args(p)
+    p.set_defaults(func=cmd_clear)
+
+    args = parser.parse_args()
+    try:
+        args.func(args)
+    except (IOError, ValueError) as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""test_logic_compile.py Tests for logic_compile.py.
+
+Conditions are compiled and checked against bytecode worked out by hand from LogicEngine.h,
+so a change to the compiler's tables or the firmware's shows up here.
+
+    python3 -m unittest discover tools
+"""
+
+import os
+import re
+import unittest
+
+import logic_compile as lc
+
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'src', 'LogicEngine.h')
+
+
+class BytecodeTest(unittest.TestCase):
+    def check(self, condition, expected):
+        self.assertEqual(lc.compile_condition(condition).hex(' '), expected, condition)
+
+    def test_comparison_with_unit(self):
+        # LOAD din1, LOAD vbatt, PUSH16 12500, GT, AND, END
+        self.check('din1 and vbatt > 12.5V', '04 00 04 71 02 d4 30 0f 13 00')
+
+    def test_not_binds_tighter_than_or(self):
+        # LOAD din1, NOT, LOAD ch3.amps, PUSH16 2500, GE, OR, END
+        self.check('not din1 or ch3.amps >= 2.5A', '04 00 15 04 48 02 c4 09 10 14 00')
+
+    def test_timers_take_slots_in_order(self):
+        # LOAD din2, PUSH16 2000, ONDELAY 0, LOAD can1, PUSH16 500, OFFDELAY 1, AND, END
+        self.check('ondelay(din2, 2s) and offdelay(can1, 500ms)', '04 01 02 d0 07 17 00 04 62 02 f4 01 18 01 13 00')
+        # LOAD din1, LOAD din2, LATCH 0, LOAD din3, TOGGLE 1, AND, END
+        self.check('latch(din1, din2) and toggle(din3)', '04 00 04 01 19 00 04 02 1a 01 13 00')
+
+    def test_gated_flash(self):
+        # LOAD ign, PUSH16 300, PUSH16 700, FLASH, AND, END
+        self.check('flash(ign, 300ms, 700ms)', '04 70 02 2c 01 02 bc 02 1b 13 00')
+
+    def test_percent_and_modulo(self):
+        # PUSH8 10, PUSH8 3, MOD, PUSH8 1, EQ, END
+        self.check('10%3 == 1', '01 0a 01 03 09 01 01 11 00')
+        # LOAD din1.duty, PUSH16 500, GT, END
+        self.check('din1.duty > 50%', '04 28 02 f4 01 0f 00')
+
+    def test_negation(self):
+        # LOAD ana1, NEG, PUSH8 -5, LT, END
+        self.check('-ana1 < -5', '04 08 0a 01 fb 0d 00')
+
+    def test_push_widths(self):
+        # LOAD temp, PUSH16 -129, GT, END
+        self.check('temp > -129', '04 72 02 7f ff 0f 00')
+        # LOAD temp, PUSH8 -128, GT, END
+        self.check('temp > -128', '04 72 01 80 0f 00')
+        # LOAD din1, PUSH32 70000, PUSH32 -40000, SEL, END
+        self.check('if(din1, 70000, -40000)', '04 00 03 70 11 01 00 03 c0 63 ff ff 16 00')
+
+    def test_rejects(self):
+        for bad in ['din9', 'ch15.on', 'ana1.fault', 'din1 and', '(din1', 'foo(1)', 'min(1)', '1.5', '2.5mV',
+                    'din1 ^ din2', ' and '.join(['toggle(din1)'] * (lc.LOGIC_SLOTS + 1)),
+                    ' + '.join(['vbatt'] * 30), '1+(1+(1+(1+(1+(1+(1+(1+1)))))))']:
+            with self.assertRaises(lc.CompileError, msg=bad):
+                lc.compile_condition(bad)
+
+    def test_verify_matches_firmware_rules(self):
+        lc.verify(bytes([lc.OP['PUSH8'], 1, lc.OP['END']]))
+        for bad in [b'', bytes([lc.OP['END']]), bytes([lc.OP['PUSH8'], 1]), bytes([lc.OP['PUSH8'], 1, lc.OP['END'], 0]),
+                    bytes([lc.OP['LOAD'], lc.LOGIC_REGISTERS, lc.OP['END']]),
+                    bytes([lc.OP['PUSH8'], 1, lc.OP['TOGGLE'], lc.LOGIC_SLOTS, lc.OP['END']]),
+                    bytes([len(lc.OPCODES), lc.OP['END']]), bytes([lc.OP['PUSH8'], 1]) * 9 + bytes([lc.OP['END']])]:
+            with self.assertRaises(lc.CompileError, msg=bad.hex()):
+                lc.verify(bad)
+
+
+class HeaderTest(unittest.TestCase):
+    """The compiler's tables follow LogicEngine.h."""
+
+    @classmethod
+    def setUpClass(cls):
+        with open(HEADER) as f:
+            cls.header = f.read()
+
+    def enum(self, name):
+        body = re.search(r'enum %s\s*\{(.*?)\};' % name, self.header, re.S).group(1)
+        return re.findall(r'^\s*(\w+)', re.sub(r'//.*', '', body), re.M)
+
+    def test_opcodes(self):
+        names = [n[len('LOGIC_'):] for n in self.enum('LogicOpcode')]
+        self.assertEqual(names[-1], 'OPCODES')
+        self.assertEqual(names[:-1], lc.OPCODES)
+
+    def test_sizes(self):
+        for name in ('LOGIC_CODE_SIZE', 'LOGIC_STACK_DEPTH', 'LOGIC_SLOTS'):
+            value = int(re.search(r'#define %s (\d+)' % name, self.header).group(1))
+            self.assertEqual(value, getattr(lc, name), name)
+
+    def test_registers(self):
+        names = self.enum('LogicRegister')
+        self.assertEqual(names, ['LOGIC_REG_DIN', 'LOGIC_REG_ANA_MV', 'LOGIC_REG_ANA_ACTIVE', 'LOGIC_REG_HZ', 'LOGIC_REG_DUTY',
+                                 'LOGIC_REG_CH_ON', 'LOGIC_REG_CH_MA', 'LOGIC_REG_CH_FAULT', 'LOGIC_REG_CAN', 'LOGIC_REG_IGN',
+                                 'LOGIC_REG_VBATT', 'LOGIC_REG_TEMP', 'LOGIC_REG_TIME', 'LOGIC_REGISTERS'])
+        # Blocks in order, sized by channel counts
+        self.assertEqual(lc.REG_DUTY - lc.REG_HZ, lc.NUM_DI_CHANNELS + lc.NUM_ANA_CHANNELS)
+        self.assertEqual(lc.REG_IGN - lc.REG_CAN, lc.NUM_CHANNELS)
+        self.assertEqual(lc.LOGIC_REGISTERS, lc.REG_TIME + 1)
+
+
+if __name__ == '__main__':
+    unittest.main()